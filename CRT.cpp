@@ -1,35 +1,20 @@
-#include <iostream>
-#include <sstream>
-#include <string>
-#include <vector>
-#include <unordered_map>
-#include <algorithm>
-#include <fstream>
-#include <iomanip>
-#include <cctype>
-#include <regex>
+#include "CRT.h"
+
+// ---- Allocation Counters ----
+thread_local AllocationCount* allocationCounter = nullptr;
 
 // ---- Data Structures ----
-struct Column {
-    std::string name;
-    std::string type; // "INT" or "TEXT"
-};
-
-struct Row {
-    std::vector<std::string> values; // store everything as string for simplicity
-    int id; // Auto-incremented ID for each row
-};
-
-struct Table {
-    std::string name;
-    std::vector<Column> columns;
-    std::vector<Row> rows;
-    int next_id = 1; // For auto-incrementing row IDs
-};
+// Stamps tables when statements change them, so a save can tell which
+// tables changed since the last one
+std::atomic<uint64_t> changeClock(0);
 
 // ---- Database ----
 std::unordered_map<std::string, Table> database;
 
+// Shared by statements on one table, which then lock that table; exclusive
+// for statements that add or replace tables or need all of them
+SharedMutex catalogLock;
+
 // ---- Utility Functions ----
 std::string toUpper(const std::string& s) {
     std::string result = s;
@@ -51,663 +36,5977 @@ std::string trim(const std::string& s) {
     return std::string(start, end + 1);
 }
 
+// Position of `keyword` in an upper-cased statement as a whole word outside
+// quoted text, or npos
+size_t findKeyword(const std::string& upper, const std::string& keyword, size_t from) {
+    char quote = 0;
+    for (size_t i = from; i < upper.size(); i++) {
+        char c = upper[i];
+        if (quote) {
+            if (c == quote) quote = 0;
+        } else if (c == '"' || c == '\'') {
+            quote = c;
+        } else if (upper.compare(i, keyword.size(), keyword) == 0 &&
+                   (i == 0 || std::isspace(static_cast<unsigned char>(upper[i - 1]))) &&
+                   (i + keyword.size() == upper.size() ||
+                    std::isspace(static_cast<unsigned char>(upper[i + keyword.size()])))) {
+            return i;
+        }
+    }
+    return std::string::npos;
+}
+
+// Index of a column by name, or -1
+int columnIndex(const Table& table, const std::string& name) {
+    for (size_t i = 0; i < table.columns.size(); i++) {
+        if (table.columns[i].name == name) return static_cast<int>(i);
+    }
+    return -1;
+}
+
 bool isNumber(const std::string& s) {
     return !s.empty() && std::find_if(s.begin(), s.end(), 
         [](unsigned char c) { return !std::isdigit(c); }) == s.end();
 }
 
+// Parse an unsigned decimal integer; false if not a number or out of range
+bool parseNumber(const char* s, size_t length, int64_t& out) {
+    if (length == 0) return false;
+    int64_t value = 0;
+    for (size_t i = 0; i < length; i++) {
+        int digit = static_cast<unsigned char>(s[i]) - '0';
+        if (digit < 0 || digit > 9) return false;
+        if (value > (INT64_MAX - digit) / 10) return false;
+        value = value * 10 + digit;
+    }
+    out = value;
+    return true;
+}
+
+bool parseNumber(const std::string& s, int64_t& out) {
+    return parseNumber(s.data(), s.size(), out);
+}
+
 // Validate data type
 bool validateDataType(const std::string& value, const std::string& type) {
     if (type == "INT") {
-        return isNumber(value);
+        int64_t number;
+        return parseNumber(value, number);
     }
     // TEXT type accepts any string
     return true;
 }
 
-// Parse condition for WHERE clause
-bool evaluateCondition(const Row& row, const std::vector<Column>& columns, const std::string& condition) {
-    if (condition.empty()) return true;
-    
-    std::regex conditionRegex("(\\w+)\\s*([=<>!]+)\\s*([^\\s]+)");
-    std::smatch matches;
-    
-    if (std::regex_search(condition, matches, conditionRegex) && matches.size() >= 4) {
-        std::string colName = matches[1].str();
-        std::string op = matches[2].str();
-        std::string value = matches[3].str();
-        
-        // Remove quotes if present
-        if (value.front() == '"' && value.back() == '"') {
-            value = value.substr(1, value.length() - 2);
-        }
-        
-        // Find column index
-        int colIndex = -1;
-        for (size_t i = 0; i < columns.size(); i++) {
-            if (columns[i].name == colName) {
-                colIndex = i;
-                break;
-            }
-        }
-        
-        if (colIndex == -1) return false;
-        
-        std::string rowValue = row.values[colIndex];
-        
-        if (op == "=") {
-            return rowValue == value;
-        } else if (op == "!=") {
-            return rowValue != value;
-        } else if (op == ">") {
-            return isNumber(rowValue) && isNumber(value) && std::stoi(rowValue) > std::stoi(value);
-        } else if (op == "<") {
-            return isNumber(rowValue) && isNumber(value) && std::stoi(rowValue) < std::stoi(value);
-        } else if (op == ">=") {
-            return isNumber(rowValue) && isNumber(value) && std::stoi(rowValue) >= std::stoi(value);
-        } else if (op == "<=") {
-            return isNumber(rowValue) && isNumber(value) && std::stoi(rowValue) <= std::stoi(value);
-        }
-    }
-    
-    return false;
+// ---- Selection Bitmaps ----
+size_t countSelected(const Bitmap& bitmap) {
+    size_t count = 0;
+    for (uint64_t word : bitmap) count += countBits(word);
+    return count;
 }
 
-// ---- Command Handlers ----
+// ---- Result Output ----
+// Every session runs on its own thread, so the mode is kept per thread
+thread_local OutputMode outputMode = OutputMode::TABLE;
 
-// CREATE TABLE tableName (col1 TYPE, col2 TYPE, ...)
-void handleCreate(const std::string& command) {
-    try {
-        std::istringstream ss(command);
-        std::string word, tableName;
-        ss >> word; // CREATE
-        ss >> word; // TABLE
-        ss >> tableName;
+// Write one cell; `col` is -1 for the row ID
+void writeCell(ResultWriter& writer, const Table& table, int col, size_t slot) {
+    if (col < 0) {
+        writer.value(static_cast<int64_t>(table.ids[slot]));
+    } else if (table.isInt(col)) {
+        writer.value(table.data[col].ints[slot]);
+    } else {
+        const ColumnData& column = table.data[col];
+        writer.value(column.textData(slot), column.textLength(slot));
+    }
+}
 
-        if (tableName.empty()) {
-            std::cout << "Error: Table name is required.\n";
-            return;
-        }
+// Write a reply to standard output in one call
+void writeOutput(const std::string& reply) {
+#ifdef CRT_HAVE_WRITE
+    std::cout.flush();
+    const char* data = reply.data();
+    size_t size = reply.size();
+    while (size > 0) {
+        ssize_t written = write(STDOUT_FILENO, data, size);
+        if (written <= 0) return;
+        data += written;
+        size -= written;
+    }
+#else
+    std::cout << reply;
+#endif
+}
 
-        if (database.find(tableName) != database.end()) {
-            std::cout << "Error: Table '" << tableName << "' already exists.\n";
-            return;
-        }
+// ---- Parallel Tasks ----
+std::mutex poolMutex;
+std::unique_ptr<ThreadPool> pool;
 
-        Table t;
-        t.name = tableName;
+// The shared pool, sized to the hardware until SET threads changes it
+ThreadPool& threadPool() {
+    std::lock_guard<std::mutex> lock(poolMutex);
+    if (!pool) {
+        unsigned count = std::thread::hardware_concurrency();
+        pool.reset(new ThreadPool(count ? count : 1));
+    }
+    return *pool;
+}
 
-        std::string rest;
-        std::getline(ss, rest); // (id INT, name TEXT, age INT)
+// Replace the pool; no parallelFor may be running
+void setThreadCount(size_t numThreads) {
+    std::lock_guard<std::mutex> lock(poolMutex);
+    pool.reset(new ThreadPool(numThreads));
+}
 
-        // Check if parentheses are present
-        if (rest.find('(') == std::string::npos || rest.find(')') == std::string::npos) {
-            std::cout << "Error: Column definitions must be enclosed in parentheses.\n";
-            return;
-        }
+size_t workerCount() {
+    return threadPool().threads();
+}
 
-        rest.erase(std::remove(rest.begin(), rest.end(), '('), rest.end());
-        rest.erase(std::remove(rest.begin(), rest.end(), ')'), rest.end());
+// ---- Indexes ----
+// Index keys are 64-bit: INT values as-is and TEXT values hashed. Lookups only
+// produce candidate rows that are rechecked against the predicate, so hash
+// collisions cost time but never correctness.
+int64_t hashText(const char* s, size_t length) {
+    uint64_t hash = 14695981039346656037ULL; // FNV-1a
+    for (size_t i = 0; i < length; i++) {
+        hash ^= static_cast<unsigned char>(s[i]);
+        hash *= 1099511628211ULL;
+    }
+    return static_cast<int64_t>(hash);
+}
 
-        std::istringstream colStream(rest);
-        std::string colDef;
-        bool hasColumns = false;
+int64_t indexKey(const Table& table, size_t col, size_t slot) {
+    const ColumnData& column = table.data[col];
+    if (table.isInt(col)) return column.ints[slot];
+    return hashText(column.textData(slot), column.textLength(slot));
+}
 
-        while (std::getline(colStream, colDef, ',')) {
-            colDef = trim(colDef);
-            if (colDef.empty()) continue;
+void indexAdd(Index& index, int64_t key, int id) {
+    if (index.kind == IndexKind::BTREE) {
+        index.tree.insert(BPlusTree::Entry(key, id));
+        return;
+    }
+    std::vector<int>& ids = index.hash[key];
+    if (ids.empty() || ids.back() < id) {
+        ids.push_back(id);
+    } else {
+        auto pos = std::lower_bound(ids.begin(), ids.end(), id);
+        if (*pos != id) ids.insert(pos, id);
+    }
+}
 
-            std::istringstream colDefStream(colDef);
-            std::string colName, colType;
-            colDefStream >> colName >> colType;
+void indexRemove(Index& index, int64_t key, int id) {
+    if (index.kind == IndexKind::BTREE) {
+        index.tree.erase(BPlusTree::Entry(key, id));
+        return;
+    }
+    auto it = index.hash.find(key);
+    if (it == index.hash.end()) return;
+    std::vector<int>& ids = it->second;
+    auto pos = std::lower_bound(ids.begin(), ids.end(), id);
+    if (pos != ids.end() && *pos == id) ids.erase(pos);
+    if (ids.empty()) index.hash.erase(it);
+}
 
-            if (colName.empty() || colType.empty()) {
-                std::cout << "Error: Invalid column definition: '" << colDef << "'.\n";
-                return;
-            }
+void rebuildIndex(const Table& table, Index& index) {
+    index.hash.clear();
+    index.tree.clear();
+    for (size_t slot = 0; slot < table.rowCount(); slot++) {
+        if (table.isDeleted(slot) && !table.versions.count(slot)) continue;
+        indexAdd(index, indexKey(table, index.colIndex, slot), table.ids[slot]);
+    }
+}
 
-            colType = toUpper(colType);
-            if (colType != "INT" && colType != "TEXT") {
-                std::cout << "Error: Unsupported data type: '" << colType << "'. Use INT or TEXT.\n";
-                return;
+Index* findIndexByName(const std::string& name, Table** owner) {
+    for (auto& tablePair : database) {
+        for (auto& index : tablePair.second.indexes) {
+            if (index.name == name) {
+                if (owner) *owner = &tablePair.second;
+                return &index;
             }
-
-            t.columns.push_back({colName, colType});
-            hasColumns = true;
         }
+    }
+    return nullptr;
+}
 
-        if (!hasColumns) {
-            std::cout << "Error: No valid columns defined.\n";
-            return;
+// ---- Column Storage ----
+// Dictionary entry of an encoded TEXT column equal to a value, or kNoEntry
+uint32_t findEntry(const ColumnData& column, const char* text, size_t length) {
+    if (column.lookup.empty()) return kNoEntry;
+    size_t mask = column.lookup.size() - 1;
+    for (size_t i = mixKey(hashText(text, length)) & mask; column.lookup[i] != kNoEntry; i = (i + 1) & mask) {
+        uint32_t code = column.lookup[i];
+        if (column.lengths[code] == length &&
+            std::memcmp(column.bytes.data() + column.offsets[code], text, length) == 0) {
+            return code;
         }
+    }
+    return kNoEntry;
+}
 
-        database[t.name] = t;
-        std::cout << "Table '" << t.name << "' created successfully.\n";
-    } catch (const std::exception& e) {
-        std::cout << "Error creating table: " << e.what() << "\n";
+// Rebuild the lookup table of an encoded column with `size` positions, a
+// power of two more than the entries
+void rehashEntries(ColumnData& column, size_t size) {
+    column.lookup.assign(size, kNoEntry);
+    for (uint32_t code = 0; code < column.offsets.size(); code++) {
+        size_t i = mixKey(hashText(column.bytes.data() + column.offsets[code], column.lengths[code])) &
+                   (size - 1);
+        while (column.lookup[i] != kNoEntry) i = (i + 1) & (size - 1);
+        column.lookup[i] = code;
     }
 }
 
-// INSERT INTO tableName VALUES (val1, val2, val3)
-void handleInsert(const std::string& command) {
-    try {
-        std::istringstream ss(command);
-        std::string word, tableName;
-        ss >> word; // INSERT
-        ss >> word; // INTO
-        ss >> tableName;
-        ss >> word; // VALUES
+// Switch an encoded column to an offset and length per slot. The entry
+// bytes stay where they are, so no value is copied.
+void decodeText(ColumnData& column) {
+    ColumnArray<uint64_t> offsets;
+    ColumnArray<uint32_t> lengths;
+    offsets.reserve(column.codes.capacity());
+    lengths.reserve(column.codes.capacity());
+    for (uint16_t code : column.codes) {
+        offsets.push_back(column.offsets[code]);
+        lengths.push_back(column.lengths[code]);
+    }
+    column.offsets.swap(offsets);
+    column.lengths.swap(lengths);
+    ColumnArray<uint16_t>().swap(column.codes);
+    std::vector<uint32_t>().swap(column.lookup);
+    column.encoded = false;
+}
 
-        if (database.find(tableName) == database.end()) {
-            std::cout << "Error: Table '" << tableName << "' does not exist.\n";
-            return;
+// Code of a value in an encoded column, adding an entry if it is new.
+// Returns false, with the column decoded, when the dictionary is full.
+bool encodeText(ColumnData& column, const char* text, size_t length, uint16_t& code) {
+    uint32_t found = findEntry(column, text, length);
+    if (found == kNoEntry) {
+        if (column.offsets.size() == kMaxDictionaryEntries) {
+            decodeText(column);
+            return false;
         }
+        found = static_cast<uint32_t>(column.offsets.size());
+        column.offsets.push_back(column.bytes.size());
+        column.lengths.push_back(static_cast<uint32_t>(length));
+        column.bytes.append(text, length);
+        // Keep the lookup table at most half full
+        if (column.offsets.size() * 2 > column.lookup.size()) {
+            rehashEntries(column, std::max<size_t>(8, column.lookup.size() * 2));
+        } else {
+            size_t mask = column.lookup.size() - 1;
+            size_t i = mixKey(hashText(text, length)) & mask;
+            while (column.lookup[i] != kNoEntry) i = (i + 1) & mask;
+            column.lookup[i] = found;
+        }
+    }
+    code = static_cast<uint16_t>(found);
+    return true;
+}
 
-        Table& table = database[tableName];
-
-        std::string rest;
-        std::getline(ss, rest); // (1, "Alice", 20)
+void appendText(ColumnData& column, const char* text, size_t length) {
+    uint16_t code;
+    if (column.encoded && encodeText(column, text, length, code)) {
+        column.codes.push_back(code);
+        return;
+    }
+    column.offsets.push_back(column.bytes.size());
+    column.lengths.push_back(static_cast<uint32_t>(length));
+    column.bytes.append(text, length);
+}
 
-        // Check if parentheses are present
-        if (rest.find('(') == std::string::npos || rest.find(')') == std::string::npos) {
-            std::cout << "Error: Values must be enclosed in parentheses.\n";
-            return;
-        }
+void appendText(ColumnData& column, const std::string& value) {
+    appendText(column, value.data(), value.size());
+}
 
-        rest.erase(std::remove(rest.begin(), rest.end(), '('), rest.end());
-        rest.erase(std::remove(rest.begin(), rest.end(), ')'), rest.end());
+std::string getText(const ColumnData& column, size_t slot) {
+    return std::string(column.textData(slot), column.textLength(slot));
+}
 
-        Row r;
-        r.id = table.next_id++;
-        std::istringstream valStream(rest);
-        std::string value;
-        std::vector<std::string> values;
+// Cell value formatted as text
+std::string getValue(const Table& table, size_t col, size_t slot) {
+    if (table.isInt(col)) return std::to_string(table.data[col].ints[slot]);
+    return getText(table.data[col], slot);
+}
 
-        while (std::getline(valStream, value, ',')) {
-            value = trim(value);
-            
-            // Handle quoted strings
-            if (!value.empty() && value.front() == '"' && value.back() == '"') {
-                value = value.substr(1, value.length() - 2);
-            }
-            
-            values.push_back(value);
+void reserveRows(Table& table, size_t numRows) {
+    table.ids.reserve(numRows);
+    for (size_t col = 0; col < table.columns.size(); col++) {
+        if (table.isInt(col)) {
+            table.data[col].ints.reserve(numRows);
+        } else if (table.data[col].encoded) {
+            table.data[col].codes.reserve(numRows);
+        } else {
+            table.data[col].offsets.reserve(numRows);
+            table.data[col].lengths.reserve(numRows);
         }
+    }
+}
 
-        // Validate number of values
-        if (values.size() != table.columns.size()) {
-            std::cout << "Error: Expected " << table.columns.size() << " values, but got " 
-                      << values.size() << ".\n";
-            return;
+// Widen the zone bounds of an INT column to cover its values from slot
+// `first` on, adding zones as the column grows. Zones missing before
+// `first` are filled in too.
+void addToZones(ColumnData& column, size_t first) {
+    size_t numSlots = column.ints.size();
+    size_t begin = std::min(first, column.zoneMin.size() * kZoneSlots);
+    while (begin < numSlots) {
+        size_t zone = begin / kZoneSlots;
+        size_t end = std::min(numSlots, (zone + 1) * kZoneSlots);
+        auto range = std::minmax_element(column.ints.begin() + begin, column.ints.begin() + end);
+        if (zone == column.zoneMin.size()) {
+            column.zoneMin.push_back(*range.first);
+            column.zoneMax.push_back(*range.second);
+        } else {
+            column.zoneMin[zone] = std::min(column.zoneMin[zone], *range.first);
+            column.zoneMax[zone] = std::max(column.zoneMax[zone], *range.second);
         }
+        begin = end;
+    }
+}
 
-        // Validate data types
-        for (size_t i = 0; i < values.size(); i++) {
-            if (!validateDataType(values[i], table.columns[i].type)) {
-                std::cout << "Error: Value '" << values[i] << "' is not valid for column '" 
-                          << table.columns[i].name << "' of type '" << table.columns[i].type << "'.\n";
-                return;
+// Recompute the zone bounds of an INT column, narrowing them to its values
+void rebuildZones(ColumnData& column) {
+    column.zoneMin.clear();
+    column.zoneMax.clear();
+    addToZones(column, 0);
+}
+
+// Append a row of already validated values under the given row ID
+void appendRow(Table& table, const std::vector<std::string>& values, int id) {
+    for (size_t col = 0; col < table.columns.size(); col++) {
+        ColumnData& column = table.data[col];
+        if (table.isInt(col)) {
+            int64_t number;
+            if (!parseNumber(values[col], number)) {
+                throw std::runtime_error("invalid INT value '" + values[col] + "'");
             }
-            r.values.push_back(values[i]);
+            column.ints.push_back(number);
+            addToZones(column, column.ints.size() - 1);
+        } else {
+            appendText(column, values[col]);
         }
+    }
+    pushId(table, id);
 
-        table.rows.push_back(r);
-        std::cout << "Row inserted into '" << tableName << "' with ID " << r.id << ".\n";
-    } catch (const std::exception& e) {
-        std::cout << "Error inserting row: " << e.what() << "\n";
+    size_t slot = table.rowCount() - 1;
+    for (auto& index : table.indexes) {
+        indexAdd(index, indexKey(table, index.colIndex, slot), id);
     }
 }
 
-// SELECT * FROM tableName [WHERE condition]
-void handleSelect(const std::string& command) {
-    try {
-        std::istringstream ss(command);
-        std::string word, tableName, whereClause;
-        ss >> word; // SELECT
-        ss >> word; // *
-        ss >> word; // FROM
-        ss >> tableName;
-
-        // Check for WHERE clause
-        std::string condition;
-        if (ss >> word && toUpper(word) == "WHERE") {
-            std::getline(ss, condition);
-            condition = trim(condition);
+// Overwrite a cell with an already validated value. Replaced TEXT bytes, or
+// dictionary entries no slot uses any more, stay until the column is
+// compacted; so do zone bounds widened for a new INT value. A new version of
+// a row shares its row ID with the old one, so the old version's index
+// entry is kept for it.
+void setValue(Table& table, size_t col, size_t slot, const std::string& value, int64_t number,
+              bool newVersion) {
+    for (auto& index : table.indexes) {
+        if (index.colIndex == static_cast<int>(col) && !newVersion) {
+            indexRemove(index, indexKey(table, col, slot), table.ids[slot]);
         }
+    }
 
-        if (database.find(tableName) == database.end()) {
-            std::cout << "Error: Table '" << tableName << "' not found.\n";
-            return;
+    ColumnData& column = table.data[col];
+    uint16_t code;
+    if (table.isInt(col)) {
+        column.ints.set(slot, number);
+        size_t zone = slot / kZoneSlots;
+        if (zone < column.zoneMin.size()) {
+            column.zoneMin[zone] = std::min(column.zoneMin[zone], number);
+            column.zoneMax[zone] = std::max(column.zoneMax[zone], number);
         }
+    } else if (column.encoded && encodeText(column, value.data(), value.size(), code)) {
+        column.codes.set(slot, code);
+    } else {
+        column.offsets.set(slot, column.bytes.size());
+        column.lengths.set(slot, static_cast<uint32_t>(value.size()));
+        column.bytes.append(value);
+    }
 
-        auto& table = database[tableName];
-        
-        // No rows to display
-        if (table.rows.empty()) {
-            std::cout << "Table '" << tableName << "' is empty.\n";
-            return;
+    for (auto& index : table.indexes) {
+        if (index.colIndex == static_cast<int>(col)) {
+            indexAdd(index, indexKey(table, col, slot), table.ids[slot]);
         }
+    }
+}
+
+// Bytes of the values of a plain TEXT column
+size_t liveTextBytes(const ColumnData& column) {
+    size_t live = 0;
+    for (uint32_t length : column.lengths) live += length;
+    return live;
+}
 
-        // Print header with formatting
-        std::cout << "ID\t";
-        for (auto& col : table.columns) {
-            std::cout << std::setw(15) << std::left << col.name;
+// Rewrite a TEXT column keeping only the values its slots refer to. An
+// encoded column drops the entries no slot uses; a plain one is encoded
+// again, which keeps it plain only if it still has too many distinct values.
+void compactText(ColumnData& column) {
+    ColumnData compacted;
+    if (column.encoded) {
+        std::vector<uint32_t> remap(column.offsets.size(), kNoEntry);
+        for (uint16_t code : column.codes) remap[code] = 0;
+        for (size_t code = 0; code < remap.size(); code++) {
+            if (remap[code] == kNoEntry) continue;
+            uint16_t kept;
+            encodeText(compacted, column.bytes.data() + column.offsets[code], column.lengths[code], kept);
+            remap[code] = kept;
         }
-        std::cout << "\n";
-        
-        // Print separator line
-        std::cout << std::string(80, '-') << "\n";
-
-        // Print rows that match the condition
-        int rowCount = 0;
-        for (auto& row : table.rows) {
-            if (evaluateCondition(row, table.columns, condition)) {
-                std::cout << row.id << "\t";
-                for (auto& val : row.values) {
-                    std::cout << std::setw(15) << std::left << val;
-                }
-                std::cout << "\n";
-                rowCount++;
-            }
+        compacted.codes.reserve(column.codes.size());
+        for (uint16_t code : column.codes) compacted.codes.push_back(static_cast<uint16_t>(remap[code]));
+    } else {
+        compacted.codes.reserve(column.offsets.size());
+        for (size_t slot = 0; slot < column.offsets.size(); slot++) {
+            appendText(compacted, column.textData(slot), column.textLength(slot));
         }
-        
-        std::cout << rowCount << " row(s) returned.\n";
-    } catch (const std::exception& e) {
-        std::cout << "Error executing SELECT: " << e.what() << "\n";
     }
+    compacted.bytes.shrinkToFit();
+    column = std::move(compacted);
 }
 
-// DELETE FROM tableName [WHERE condition]
-void handleDelete(const std::string& command) {
-    try {
-        std::istringstream ss(command);
-        std::string word, tableName;
-        ss >> word; // DELETE
-        ss >> word; // FROM
-        ss >> tableName;
+// Mark the live slots set in `drop` deleted and unlink them from the
+// indexes. Scans skip deleted slots until compactRows removes them.
+size_t deleteRows(Table& table, const Bitmap& drop) {
+    size_t removed = countSelected(drop);
+    if (removed == 0) return 0;
+
+    // Unlink a few rows from the indexes; rebuild them after mass deletes
+    bool rebuild = removed * 4 > table.liveRows();
+    if (!rebuild) {
+        forEachSelected(drop, [&](size_t slot) {
+            for (auto& index : table.indexes) {
+                indexRemove(index, indexKey(table, index.colIndex, slot), table.ids[slot]);
+            }
+        });
+    }
+
+    if (table.deleted.size() < drop.size()) table.deleted.resize(drop.size(), 0);
+    for (size_t w = 0; w < drop.size(); w++) table.deleted[w] |= drop[w];
+    table.deletedRows += removed;
+
+    if (rebuild) {
+        for (auto& index : table.indexes) rebuildIndex(table, index);
+    }
+    return removed;
+}
+
+// Compaction pays off once a quarter of the slots are deleted or out of
+// order in the delta. It waits for the table's versions to be collected,
+// and for a background save reading the table, which would otherwise copy
+// every chunk compaction moves.
+bool needsCompaction(const Table& table) {
+    size_t deltaRows = table.hasDelta() ? table.rowCount() - table.deltaStart : 0;
+    return table.versions.empty() && !table.writer && !table.beingSaved() &&
+           (table.deletedRows + deltaRows) * 4 > table.rowCount();
+}
+
+// Remove the deleted slots, keeping the remaining rows in order. Indexes map
+// to row IDs, which do not change, so they stay valid. A delta is merged,
+// putting the rows back in row ID order. Tables with versions open
+// snapshots still tell apart, or with a writer, are left alone.
+size_t compactRows(Table& table) {
+    size_t numSlots = table.rowCount();
+    size_t removed = table.deletedRows;
+    if (!table.versions.empty() || table.writer || (removed == 0 && !table.hasDelta())) return 0;
 
-        // Check for WHERE clause
-        std::string condition;
-        if (ss >> word && toUpper(word) == "WHERE") {
-            std::getline(ss, condition);
-            condition = trim(condition);
+    std::vector<size_t> order;
+    if (table.hasDelta()) {
+        for (size_t slot = 0; slot < numSlots; slot++) {
+            if (!table.isDeleted(slot)) order.push_back(slot);
         }
+        std::sort(order.begin(), order.end(), [&](size_t a, size_t b) { return table.ids[a] < table.ids[b]; });
+    }
 
-        if (database.find(tableName) == database.end()) {
-            std::cout << "Error: Table '" << tableName << "' not found.\n";
+    // Columns are compacted independently, one task each, with the row IDs
+    // as the last task
+    parallelFor(table.columns.size() + 1, [&](size_t col) {
+        if (col == table.columns.size()) {
+            keepSlots(table, table.ids, order);
             return;
         }
 
-        auto& table = database[tableName];
-        size_t initialSize = table.rows.size();
-
-        if (condition.empty()) {
-            // Delete all rows if no condition
-            table.rows.clear();
-            std::cout << initialSize << " row(s) deleted from '" << tableName << "'.\n";
+        ColumnData& column = table.data[col];
+        if (table.isInt(col)) {
+            keepSlots(table, column.ints, order);
+            rebuildZones(column);
+        } else if (column.encoded) {
+            keepSlots(table, column.codes, order);
+            compactText(column);
         } else {
-            // Delete rows that match the condition
-            auto newEnd = std::remove_if(table.rows.begin(), table.rows.end(),
-                [&](const Row& row) { return evaluateCondition(row, table.columns, condition); });
-            
-            size_t deletedCount = std::distance(newEnd, table.rows.end());
-            table.rows.erase(newEnd, table.rows.end());
-            
-            std::cout << deletedCount << " row(s) deleted from '" << tableName << "'.\n";
+            keepSlots(table, column.offsets, order);
+            keepSlots(table, column.lengths, order);
+            compactText(column);
         }
-    } catch (const std::exception& e) {
-        std::cout << "Error executing DELETE: " << e.what() << "\n";
+    });
+
+    Bitmap().swap(table.deleted);
+    table.deletedRows = 0;
+    table.deltaStart = SIZE_MAX;
+    std::unordered_multimap<int, size_t>().swap(table.deltaSlots);
+    return removed;
+}
+
+void clearRows(Table& table) {
+    table.ids.clear();
+    table.ids.shrink_to_fit();
+    Bitmap().swap(table.deleted);
+    table.deletedRows = 0;
+    table.deltaStart = SIZE_MAX;
+    std::unordered_multimap<int, size_t>().swap(table.deltaSlots);
+    for (auto& column : table.data) {
+        column = ColumnData();
+    }
+    for (auto& index : table.indexes) {
+        std::unordered_map<int64_t, std::vector<int>>().swap(index.hash);
+        index.tree.clear();
     }
 }
 
-// UPDATE tableName SET col1=val1, col2=val2 [WHERE condition]
-void handleUpdate(const std::string& command) {
-    try {
-        std::istringstream ss(command);
-        std::string word, tableName, setClause;
-        ss >> word; // UPDATE
-        ss >> tableName;
-        ss >> word; // SET
-        
-        // Get the SET clause
-        std::string remaining;
-        std::getline(ss, remaining);
-        
-        size_t wherePos = remaining.find(" WHERE ");
-        std::string condition;
-        
-        if (wherePos != std::string::npos) {
-            setClause = remaining.substr(0, wherePos);
-            condition = trim(remaining.substr(wherePos + 7)); // 7 is length of " WHERE "
+// ---- Row Versions ----
+thread_local std::unique_ptr<Transaction> activeTransaction; // Opened by the session's BEGIN
+thread_local Transaction* writingTransaction = nullptr;      // Transaction of the running write
+
+// Whether the session sees the row version at a slot
+bool isVisible(const Table& table, size_t slot) {
+    if (activeTransaction && !table.versions.empty()) {
+        auto it = table.versions.find(slot);
+        if (it != table.versions.end()) return sees(*activeTransaction, it->second);
+    }
+    return !table.isDeleted(slot);
+}
+
+// Bit per slot of the versions the session does not see: the tombstones, or
+// `scratch` filled in from them and the stamps
+const Bitmap& hiddenSlots(const Table& table, Bitmap& scratch) {
+    if (!activeTransaction || table.versions.empty()) return table.deleted;
+    scratch = table.deleted;
+    scratch.resize(bitmapWords(table.rowCount()), 0);
+    for (const auto& entry : table.versions) {
+        uint64_t bit = uint64_t(1) << (entry.first % 64);
+        if (sees(*activeTransaction, entry.second)) {
+            scratch[entry.first / 64] &= ~bit;
         } else {
-            setClause = remaining;
-        }
-        
-        setClause = trim(setClause);
-        
-        if (database.find(tableName) == database.end()) {
-            std::cout << "Error: Table '" << tableName << "' not found.\n";
-            return;
-        }
-        
-        auto& table = database[tableName];
-        
-        // Parse SET clause to get column-value pairs
-        std::vector<std::pair<int, std::string>> updates; // column index, new value
-        std::istringstream setStream(setClause);
-        std::string assignment;
-        
-        while (std::getline(setStream, assignment, ',')) {
-            assignment = trim(assignment);
-            size_t equalsPos = assignment.find('=');
-            
-            if (equalsPos == std::string::npos) {
-                std::cout << "Error: Invalid SET clause format.\n";
-                return;
-            }
-            
-            std::string colName = trim(assignment.substr(0, equalsPos));
-            std::string newValue = trim(assignment.substr(equalsPos + 1));
-            
-            // Remove quotes if present
-            if (!newValue.empty() && newValue.front() == '"' && newValue.back() == '"') {
-                newValue = newValue.substr(1, newValue.length() - 2);
-            }
-            
-            // Find column index
-            int colIndex = -1;
-            for (size_t i = 0; i < table.columns.size(); i++) {
-                if (table.columns[i].name == colName) {
-                    colIndex = i;
-                    break;
-                }
-            }
-            
-            if (colIndex == -1) {
-                std::cout << "Error: Column '" << colName << "' not found.\n";
-                return;
-            }
-            
-            // Validate data type
-            if (!validateDataType(newValue, table.columns[colIndex].type)) {
-                std::cout << "Error: Value '" << newValue << "' is not valid for column '" 
-                          << colName << "' of type '" << table.columns[colIndex].type << "'.\n";
-                return;
-            }
-            
-            updates.push_back({colIndex, newValue});
-        }
-        
-        if (updates.empty()) {
-            std::cout << "Error: No valid column updates specified.\n";
-            return;
+            scratch[entry.first / 64] |= bit;
         }
-        
-        // Apply updates to rows that match the condition
-        int updatedCount = 0;
-        for (auto& row : table.rows) {
-            if (evaluateCondition(row, table.columns, condition)) {
-                for (const auto& update : updates) {
-                    row.values[update.first] = update.second;
-                }
-                updatedCount++;
-            }
+    }
+    return scratch;
+}
+
+// Whether the session sees any row. Live slots without stamps are seen by
+// everyone, so the stamps only need checking when there are no more of them.
+bool hasVisibleRows(const Table& table) {
+    if (!activeTransaction || table.liveRows() > table.versions.size()) return table.liveRows() > 0;
+    for (const auto& entry : table.versions) {
+        if (sees(*activeTransaction, entry.second)) return true;
+    }
+    for (size_t slot = 0; slot < table.rowCount(); slot++) {
+        if (!table.isDeleted(slot) && !table.versions.count(slot)) return true;
+    }
+    return false;
+}
+
+void markDeleted(Table& table, size_t slot, bool dead) {
+    if (table.isDeleted(slot) == dead) return;
+    if (table.deleted.size() <= slot / 64) table.deleted.resize(slot / 64 + 1, 0);
+    table.deleted[slot / 64] ^= uint64_t(1) << (slot % 64);
+    if (dead) {
+        table.deletedRows++;
+    } else {
+        table.deletedRows--;
+    }
+}
+
+// Stamp the slots from `first` on as written by the running transaction;
+// they stay deleted for everyone else until it commits
+void stampCreated(Table& table, size_t first) {
+    if (!writingTransaction) return;
+    for (size_t slot = first; slot < table.rowCount(); slot++) {
+        table.versions[slot].begin = writingTransaction->marker;
+        markDeleted(table, slot, true);
+    }
+}
+
+// Stamp the end of the row version at a slot, which stays live for everyone
+// else until the running transaction commits
+void stampEnded(Table& table, size_t slot) {
+    table.versions[slot].end = writingTransaction->marker;
+    writingTransaction->tables[table.name].ended.push_back(slot);
+}
+
+// Append a copy of the row at a slot as a new version under the same row ID;
+// returns its slot. The first such version starts the delta. Plain TEXT
+// values are shared, since updates append new bytes rather than overwrite.
+size_t appendVersion(Table& table, size_t slot) {
+    size_t version = table.rowCount();
+    if (!table.hasDelta()) table.deltaStart = version;
+    for (size_t col = 0; col < table.columns.size(); col++) {
+        ColumnData& column = table.data[col];
+        if (table.isInt(col)) {
+            column.ints.push_back(column.ints[slot]);
+            addToZones(column, version);
+        } else if (column.encoded) {
+            column.codes.push_back(column.codes[slot]);
+        } else {
+            column.offsets.push_back(column.offsets[slot]);
+            column.lengths.push_back(column.lengths[slot]);
         }
-        
-        std::cout << updatedCount << " row(s) updated in '" << tableName << "'.\n";
-    } catch (const std::exception& e) {
-        std::cout << "Error executing UPDATE: " << e.what() << "\n";
     }
+    pushId(table, table.ids[slot]);
+    return version;
 }
 
-// SAVE database to file
-void handleSave(const std::string& command) {
-    try {
+// Make the running transaction the writer of a table, or report why it
+// cannot be. A table has one writer at a time, and a transaction may not
+// change a table someone committed changes to after its snapshot.
+bool claimTable(Table& table, std::ostream& out) {
+    Transaction* txn = writingTransaction;
+    if (!txn || table.writer == txn->marker) return true;
+    if (table.writer) {
+        out << "Error: Table '" << table.name << "' is being changed by another transaction.\n";
+        return false;
+    }
+    if (table.lastCommit > txn->snapshot) {
+        out << "Error: Table '" << table.name << "' was changed after this transaction began.\n";
+        return false;
+    }
+    table.writer = txn->marker;
+    Transaction::Writes& writes = txn->tables[table.name];
+    writes.firstSlot = table.rowCount();
+    writes.firstId = table.next_id;
+    return true;
+}
+
+// Remove the index entries of a slot that is going away, except those
+// another version of the row still needs
+void unlinkVersion(Table& table, size_t slot) {
+    int id = table.ids[slot];
+    for (auto& index : table.indexes) {
+        int64_t key = indexKey(table, index.colIndex, slot);
+        bool shared = false;
+        forEachSlotOf(table, id, [&](size_t other) {
+            shared = shared || (other != slot && (!table.isDeleted(other) || table.versions.count(other)) &&
+                                indexKey(table, index.colIndex, other) == key);
+        });
+        if (!shared) indexRemove(index, key, id);
+    }
+}
+
+// Move the version of a row at a delta slot, which every snapshot sees, to
+// the row's first slot once the version there is gone for all of them. The
+// row is then where an UPDATE in place, and so replaying the log, leaves
+// it, rather than at the end of the table.
+void settleVersion(Table& table, size_t slot) {
+    int id = table.ids[slot];
+    size_t home = slot;
+    forEachSlotOf(table, id, [&](size_t other) { home = std::min(home, other); });
+    if (home == slot || !table.isDeleted(home) || table.versions.count(home)) return;
+
+    for (size_t col = 0; col < table.columns.size(); col++) {
+        ColumnData& column = table.data[col];
+        if (table.isInt(col)) {
+            int64_t number = column.ints[slot];
+            column.ints.set(home, number);
+            size_t zone = home / kZoneSlots;
+            if (zone < column.zoneMin.size()) {
+                column.zoneMin[zone] = std::min(column.zoneMin[zone], number);
+                column.zoneMax[zone] = std::max(column.zoneMax[zone], number);
+            }
+        } else if (column.encoded) {
+            column.codes.set(home, column.codes[slot]);
+        } else {
+            column.offsets.set(home, column.offsets[slot]);
+            column.lengths.set(home, column.lengths[slot]);
+        }
+    }
+    markDeleted(table, home, false);
+    markDeleted(table, slot, true);
+    auto range = table.deltaSlots.equal_range(id);
+    for (auto it = range.first; it != range.second; ++it) {
+        if (it->second == slot) {
+            table.deltaSlots.erase(it);
+            break;
+        }
+    }
+}
+
+// Drop the stamps every snapshot from `oldest` on agrees about: versions
+// that ended before it are gone for all of them, and versions that began
+// before it and have not ended are seen by all of them. Settled versions in
+// the delta then go back to their rows' first slots.
+void collectVersions(Table& table, uint64_t oldest) {
+    if (table.versions.empty() || oldest <= table.collectedAt) return;
+    table.collectedAt = oldest;
+    std::vector<size_t> settledDelta;
+    for (auto it = table.versions.begin(); it != table.versions.end();) {
+        const RowVersion& version = it->second;
+        bool gone = isCommitted(version.end) && version.end <= oldest;
+        bool settled = isCommitted(version.begin) && version.begin <= oldest && version.end == kForever;
+        if (!gone && !settled) {
+            ++it;
+            continue;
+        }
+        size_t slot = it->first;
+        it = table.versions.erase(it);
+        if (gone) unlinkVersion(table, slot);
+        if (settled && slot >= table.deltaStart && !table.isDeleted(slot)) settledDelta.push_back(slot);
+    }
+    for (size_t slot : settledDelta) settleVersion(table, slot);
+}
+
+// Whether a transaction changed anything in a table it claimed
+bool hasWrites(const Table& table, const Transaction::Writes& writes) {
+    return writes.firstSlot < table.rowCount() || !writes.ended.empty();
+}
+
+// Give a committed transaction's writes to a table their commit stamp
+void commitWrites(Table& table, const Transaction::Writes& writes, uint64_t stamp) {
+    table.writer = 0;
+    if (!hasWrites(table, writes)) return;
+    for (size_t slot = writes.firstSlot; slot < table.rowCount(); slot++) {
+        RowVersion& version = table.versions[slot];
+        version.begin = stamp;
+        if (version.end == kForever) markDeleted(table, slot, false);
+    }
+    for (size_t slot : writes.ended) {
+        table.versions[slot].end = stamp;
+        markDeleted(table, slot, true);
+    }
+    table.lastCommit = stamp;
+}
+
+// Undo a transaction's writes to a table. The rows it appended are the last
+// slots, so they are cut off and their row IDs handed out again.
+void rollbackWrites(Table& table, const Transaction::Writes& writes) {
+    for (size_t slot : writes.ended) {
+        auto it = table.versions.find(slot);
+        if (it == table.versions.end()) continue;
+        it->second.end = kForever;
+        if (it->second.begin == 0) table.versions.erase(it);
+    }
+
+    size_t numSlots = table.rowCount();
+    for (size_t slot = writes.firstSlot; slot < numSlots; slot++) table.versions.erase(slot);
+    for (size_t slot = numSlots; slot-- > writes.firstSlot;) {
+        unlinkVersion(table, slot);
+        markDeleted(table, slot, false);
+        auto range = table.deltaSlots.equal_range(table.ids[slot]);
+        for (auto it = range.first; it != range.second; ++it) {
+            if (it->second == slot) {
+                table.deltaSlots.erase(it);
+                break;
+            }
+        }
+        table.ids.pop_back();
+    }
+    for (size_t col = 0; col < table.columns.size(); col++) {
+        ColumnData& column = table.data[col];
+        if (table.isInt(col)) {
+            // Bounds of the last zone kept may stay wider than its values
+            size_t numZones = (writes.firstSlot + kZoneSlots - 1) / kZoneSlots;
+            column.ints.resize(writes.firstSlot);
+            column.zoneMin.resize(std::min(column.zoneMin.size(), numZones));
+            column.zoneMax.resize(std::min(column.zoneMax.size(), numZones));
+        } else if (column.encoded) {
+            column.codes.resize(writes.firstSlot);
+        } else {
+            column.offsets.resize(writes.firstSlot);
+            column.lengths.resize(writes.firstSlot);
+        }
+    }
+    if (table.deltaStart >= writes.firstSlot) table.deltaStart = SIZE_MAX;
+    table.deleted.resize(std::min(table.deleted.size(), bitmapWords(writes.firstSlot)));
+    table.next_id = writes.firstId;
+    table.writer = 0;
+    table.collectedAt = 0; // Versions it ended may be settled now
+}
+
+// ---- Bulk Loading ----
+// Whether a value in `format` may be quoted with `c`: CSV quotes with ",
+// and tuples with either quote, as WHERE literals are
+bool isQuote(RowFormat format, char c) {
+    return c == '"' || (c == '\'' && format == RowFormat::TUPLES);
+}
+
+// Read one field up to a ',' or the end of its row outside quotes, leaving
+// `p` on the delimiter. Quoted fields lose their quotes (a doubled quote
+// stands for the quote); unquoted fields are trimmed.
+void scanField(const char*& p, const char* end, RowFormat format, std::string& field) {
+    char stop = format == RowFormat::CSV ? '\n' : ')';
+    field.clear();
+    while (p < end && (*p == ' ' || *p == '\t')) p++;
+
+    if (p < end && isQuote(format, *p)) {
+        char q = *p++;
+        while (p < end) {
+            const char* quote = static_cast<const char*>(std::memchr(p, q, end - p));
+            if (!quote) quote = end;
+            field.append(p, quote);
+            p = quote;
+            if (p == end) break;
+            if (p + 1 < end && p[1] == q) {
+                field += q;
+                p += 2;
+            } else {
+                p++;
+                break;
+            }
+        }
+        while (p < end && *p != ',' && *p != stop) p++;
+        return;
+    }
+
+    const char* start = p;
+    while (p < end && *p != ',' && *p != stop) p++;
+    const char* last = p;
+    while (last > start && std::isspace(static_cast<unsigned char>(last[-1]))) last--;
+    field.assign(start, last);
+}
+
+// Parse the rows in [p, end) into `batch`, stopping at the first invalid one
+void parseRows(const Table& table, const char* p, const char* end, RowFormat format, RowBatch& batch) {
+    size_t numColumns = table.columns.size();
+    batch.data.assign(numColumns, ColumnData());
+    for (size_t col = 0; col < numColumns; col++) batch.data[col].encoded = table.data[col].encoded;
+    char stop = format == RowFormat::CSV ? '\n' : ')';
+    std::string field;
+
+    while (p < end) {
+        // Skip to the start of the next row
+        if (format == RowFormat::CSV) {
+            const char* lineEnd = static_cast<const char*>(std::memchr(p, '\n', end - p));
+            if (!lineEnd) lineEnd = end;
+            const char* q = p;
+            while (q < lineEnd && std::isspace(static_cast<unsigned char>(*q))) q++;
+            if (q == lineEnd) {
+                p = lineEnd + (lineEnd < end);
+                continue;
+            }
+        } else {
+            while (p < end && (*p == ',' || std::isspace(static_cast<unsigned char>(*p)))) p++;
+            if (p == end) break;
+            if (*p != '(') {
+                batch.error = "Values must be enclosed in parentheses.";
+                return;
+            }
+            p++;
+        }
+
+        // A wrong value count is reported ahead of a bad value
+        size_t numFields = 0;
+        std::string badValue;
+        bool rowEnded = false;
+        while (!rowEnded) {
+            scanField(p, end, format, field);
+            if (p == end) {
+                if (format == RowFormat::TUPLES) {
+                    batch.error = "Values must be enclosed in parentheses.";
+                    return;
+                }
+                rowEnded = true;
+            } else {
+                rowEnded = *p++ == stop;
+            }
+
+            if (numFields < numColumns && badValue.empty()) {
+                ColumnData& column = batch.data[numFields];
+                int64_t number;
+                if (!table.isInt(numFields)) {
+                    appendText(column, field);
+                } else if (parseNumber(field, number)) {
+                    column.ints.push_back(number);
+                } else {
+                    badValue = "Value '" + field + "' is not valid for column '" +
+                               table.columns[numFields].name + "' of type 'INT'.";
+                }
+            }
+            numFields++;
+        }
+
+        if (numFields != numColumns) {
+            batch.error = "Expected " + std::to_string(numColumns) + " values, but got " +
+                          std::to_string(numFields) + ".";
+            return;
+        }
+        if (!badValue.empty()) {
+            batch.error = badValue;
+            return;
+        }
+        batch.rows++;
+    }
+}
+
+// Split [begin, end) into up to `parts` ranges that each start at a row. CSV
+// rows never span lines; tuples are found by a scan that skips quoted text.
+// A doubled quote closes and reopens the text, so it needs no case of its own.
+std::vector<const char*> splitRows(const char* begin, const char* end, RowFormat format, size_t parts) {
+    std::vector<const char*> bounds(1, begin);
+    size_t size = end - begin;
+
+    if (format == RowFormat::CSV) {
+        for (size_t i = 1; i < parts; i++) {
+            const char* p = std::max(bounds.back(), begin + size / parts * i);
+            const char* lineEnd = static_cast<const char*>(std::memchr(p, '\n', end - p));
+            if (!lineEnd) break;
+            if (lineEnd + 1 > bounds.back()) bounds.push_back(lineEnd + 1);
+        }
+    } else {
+        const char* target = begin + size / parts;
+        char quote = 0;
+        int depth = 0;
+        for (const char* p = begin; p < end; p++) {
+            if (quote) {
+                if (*p == quote) quote = 0;
+            } else if (isQuote(format, *p)) {
+                quote = *p;
+            } else if (*p == '(') {
+                if (depth++ == 0 && p >= target && p > bounds.back()) {
+                    bounds.push_back(p);
+                    target = p + size / parts;
+                }
+            } else if (*p == ')' && depth > 0) {
+                depth--;
+            }
+        }
+    }
+
+    bounds.push_back(end);
+    return bounds;
+}
+
+// Parse rows in parallel; on error `error` holds the message for the first
+// invalid row, numbered from 1
+std::vector<RowBatch> parseBulk(const Table& table, const char* begin, const char* end,
+                                RowFormat format, std::string& error) {
+    static const size_t kMinChunkBytes = 256 * 1024;
+    size_t parts = std::max<size_t>(1, std::min(workerCount() * 4, (end - begin) / kMinChunkBytes));
+    std::vector<const char*> bounds = splitRows(begin, end, format, parts);
+
+    std::vector<RowBatch> batches(bounds.size() - 1);
+    parallelFor(batches.size(), [&](size_t i) {
+        parseRows(table, bounds[i], bounds[i + 1], format, batches[i]);
+    });
+
+    size_t row = 0;
+    for (const auto& batch : batches) {
+        if (!batch.error.empty()) {
+            error = row + batch.rows == 0 ? batch.error
+                  : "Row " + std::to_string(row + batch.rows + 1) + ": " + batch.error;
+            break;
+        }
+        row += batch.rows;
+    }
+    return batches;
+}
+
+// Append the codes of an encoded batch to an encoded column, translating
+// each of the batch's entries once. Returns false, with the column decoded
+// and nothing appended, when the entries do not fit its dictionary.
+bool appendCodes(ColumnData& column, const ColumnData& parsed) {
+    std::vector<uint16_t> codes(parsed.offsets.size());
+    for (size_t entry = 0; entry < codes.size(); entry++) {
+        if (!encodeText(column, parsed.bytes.data() + parsed.offsets[entry], parsed.lengths[entry],
+                        codes[entry])) {
+            return false;
+        }
+    }
+    for (uint16_t code : parsed.codes) column.codes.push_back(codes[code]);
+    return true;
+}
+
+// Append parsed batches under consecutive new row IDs, consuming them;
+// returns the row count. An empty table takes over a single batch's columns
+// without copying them.
+size_t appendBatches(Table& table, std::vector<RowBatch>&& batches) {
+    size_t numRows = 0;
+    for (const auto& batch : batches) numRows += batch.rows;
+    size_t first = table.rowCount();
+    if (first == 0 && batches.size() == 1) {
+        table.data = std::move(batches[0].data);
+        table.ids.reserve(numRows);
+        for (size_t i = 0; i < numRows; i++) pushId(table, table.next_id++);
+        batches.clear();
+    } else if (table.ids.capacity() < first + numRows) {
+        // Grow geometrically so row-at-a-time inserts stay amortized O(1)
+        reserveRows(table, std::max(first + numRows, 2 * table.ids.capacity()));
+    }
+
+    // Each plain TEXT arena grows at most once for the whole statement
+    for (size_t col = 0; col < table.columns.size() && !batches.empty(); col++) {
+        if (table.isInt(col) || table.data[col].encoded) continue;
+        TextArena& bytes = table.data[col].bytes;
+        size_t needed = bytes.size();
+        for (const auto& batch : batches) needed += batch.data[col].bytes.size();
+        if (needed > bytes.capacity()) bytes.reserve(std::max(needed, 2 * bytes.capacity()));
+    }
+
+    for (const auto& batch : batches) {
+        for (size_t col = 0; col < table.columns.size(); col++) {
+            ColumnData& column = table.data[col];
+            const ColumnData& parsed = batch.data[col];
+            if (table.isInt(col)) {
+                column.ints.append(parsed.ints.data(), parsed.ints.size());
+                continue;
+            }
+            if (column.encoded && parsed.encoded && appendCodes(column, parsed)) continue;
+            if (column.encoded || parsed.encoded) {
+                for (size_t i = 0; i < batch.rows; i++) appendText(column, parsed.textData(i), parsed.textLength(i));
+                continue;
+            }
+            uint64_t base = column.bytes.size();
+            for (uint64_t offset : parsed.offsets) column.offsets.push_back(base + offset);
+            column.lengths.append(parsed.lengths.data(), parsed.lengths.size());
+            column.bytes.append(parsed.bytes.data(), parsed.bytes.size());
+        }
+        for (size_t i = 0; i < batch.rows; i++) pushId(table, table.next_id++);
+    }
+    for (size_t col = 0; col < table.columns.size(); col++) {
+        if (table.isInt(col)) addToZones(table.data[col], first);
+    }
+
+    for (size_t slot = first; slot < table.rowCount(); slot++) {
+        for (auto& index : table.indexes) {
+            indexAdd(index, indexKey(table, index.colIndex, slot), table.ids[slot]);
+        }
+    }
+    if (numRows) table.markChanged();
+    return numRows;
+}
+
+// ---- WHERE Conditions ----
+CompareOp parseCompareOp(const std::string& op) {
+    if (op == "=") return CompareOp::EQ;
+    if (op == "!=" || op == "<>") return CompareOp::NE;
+    if (op == ">") return CompareOp::GT;
+    if (op == "<") return CompareOp::LT;
+    if (op == ">=") return CompareOp::GE;
+    if (op == "<=") return CompareOp::LE;
+    return CompareOp::INVALID;
+}
+
+std::string unquote(const std::string& literal) {
+    if (literal.size() >= 2 && (literal.front() == '"' || literal.front() == '\'') &&
+        literal.back() == literal.front()) {
+        return literal.substr(1, literal.length() - 2);
+    }
+    return literal;
+}
+
+// Set the literals of a comparison, as written, deciding whether it can match.
+// Given the table, values compared with an encoded column become codes.
+void bindPredicate(Predicate& pred, const std::vector<std::string>& literals, const Table* table) {
+    pred.matchAll = false;
+    pred.matchNone = true;
+    pred.codesBound = false;
+    pred.codes.clear();
+
+    if (pred.op == CompareOp::IN) {
+        // Equal to any of the values; like =, a non-number never equals an INT
+        pred.numbers.clear();
+        pred.texts.clear();
+        for (const auto& literal : literals) {
+            int64_t number;
+            pred.texts.push_back(unquote(literal));
+            if (parseNumber(pred.texts.back(), number)) pred.numbers.push_back(number);
+        }
+        std::sort(pred.numbers.begin(), pred.numbers.end());
+        pred.numbers.erase(std::unique(pred.numbers.begin(), pred.numbers.end()), pred.numbers.end());
+        pred.matchNone = pred.intColumn ? pred.numbers.empty() : pred.texts.empty();
+        if (table) bindCodes(*table, pred);
+        return;
+    }
+
+    if (pred.op == CompareOp::BETWEEN && !parseNumber(literals[1], pred.upper)) return;
+
+    // Remove quotes if present
+    pred.literal = unquote(literals[0]);
+    pred.literalIsNumber = parseNumber(pred.literal, pred.number);
+
+    if (pred.op == CompareOp::INVALID) return;
+    if (pred.op == CompareOp::BETWEEN && (!pred.literalIsNumber || pred.number > pred.upper)) {
+        return;
+    }
+
+    if (!pred.literalIsNumber && pred.op != CompareOp::LIKE) {
+        // Ordering comparisons never match a non-numeric literal, and neither
+        // does equality against an INT column
+        if (pred.op == CompareOp::NE && pred.intColumn) {
+            pred.matchAll = true;
+        } else if (pred.op != CompareOp::EQ && pred.op != CompareOp::NE) {
+            return;
+        } else if (pred.intColumn) {
+            return;
+        }
+    }
+
+    pred.matchNone = false;
+    if (table) bindCodes(*table, pred);
+}
+
+// SQL LIKE: % matches any run of characters and _ any one character. On a
+// mismatch after a %, the match resumes one character further on from it.
+bool matchLike(const char* text, size_t length, const std::string& pattern) {
+    size_t t = 0, p = 0, starP = std::string::npos, starT = 0;
+    while (t < length) {
+        if (p < pattern.size() && (pattern[p] == '_' || pattern[p] == text[t])) {
+            t++;
+            p++;
+        } else if (p < pattern.size() && pattern[p] == '%') {
+            starP = p++;
+            starT = t;
+        } else if (starP != std::string::npos) {
+            p = starP + 1;
+            t = ++starT;
+        } else {
+            return false;
+        }
+    }
+    while (p < pattern.size() && pattern[p] == '%') p++;
+    return p == pattern.size();
+}
+
+bool evaluateCondition(const Table& table, size_t slot, const Predicate& pred) {
+    if (pred.matchAll) return true;
+    if (pred.matchNone) return false;
+
+    int64_t value;
+
+    if (pred.rowId) {
+        value = table.ids[slot];
+    } else if (pred.intColumn) {
+        value = table.data[pred.colIndex].ints[slot];
+    } else {
+        const ColumnData& column = table.data[pred.colIndex];
+        if (pred.codesBound && column.encoded) {
+            uint16_t code = column.codes[slot];
+            bool found = std::find(pred.codes.begin(), pred.codes.end(), code) != pred.codes.end();
+            return pred.op == CompareOp::NE ? !found : found;
+        }
+        const char* text = column.textData(slot);
+        size_t length = column.textLength(slot);
+        if (pred.op == CompareOp::LIKE) return matchLike(text, length, pred.literal);
+        if (pred.op == CompareOp::IN) {
+            for (const auto& value : pred.texts) {
+                if (value.size() == length && std::memcmp(text, value.data(), length) == 0) return true;
+            }
+            return false;
+        }
+
+        bool equal = length == pred.literal.size() &&
+                     std::memcmp(text, pred.literal.data(), length) == 0;
+
+        if (pred.op == CompareOp::EQ) return equal;
+        if (pred.op == CompareOp::NE) return !equal;
+        if (!parseNumber(text, length, value)) return false;
+    }
+
+    switch (pred.op) {
+        case CompareOp::EQ: return value == pred.number;
+        case CompareOp::NE: return value != pred.number;
+        case CompareOp::GT: return value > pred.number;
+        case CompareOp::LT: return value < pred.number;
+        case CompareOp::GE: return value >= pred.number;
+        case CompareOp::LE: return value <= pred.number;
+        case CompareOp::BETWEEN: return value >= pred.number && value <= pred.upper;
+        case CompareOp::IN:
+            return std::binary_search(pred.numbers.begin(), pred.numbers.end(), value);
+        case CompareOp::LIKE: {
+            char digits[24];
+            int length = std::snprintf(digits, sizeof(digits), "%lld", static_cast<long long>(value));
+            return matchLike(digits, length, pred.literal);
+        }
+        default: return false;
+    }
+}
+
+// A condition whose comparisons scans all run through filter kernels
+bool isVectorized(const Condition& cond) {
+    if (cond.kind == ConditionKind::COMPARE) {
+        const Predicate& pred = cond.pred;
+        return pred.intColumn && !pred.rowId && pred.op != CompareOp::IN && pred.op != CompareOp::LIKE;
+    }
+    for (const auto& child : cond.children) {
+        if (!isVectorized(child)) return false;
+    }
+    return true;
+}
+
+// Parse a WHERE condition, leaving its literals unbound. A condition that
+// does not parse, or names an unknown column, matches no rows.
+Condition parseCondition(const std::vector<Column>& columns, const std::string& text,
+                         const std::string& tableName) {
+    Condition cond;
+    if (trim(text).empty()) return cond;
+    ConditionParser parser(columns, text, tableName);
+    if (!parser.parse(cond)) {
+        cond = Condition();
+        cond.kind = ConditionKind::NONE;
+    }
+    return cond;
+}
+
+Condition compileCondition(const std::vector<Column>& columns, const std::string& text,
+                           const std::string& tableName) {
+    Condition cond = parseCondition(columns, text, tableName);
+    bindCondition(cond, [](const std::string& literal) { return literal; });
+    return cond;
+}
+
+// Compiled against the table itself, so its TEXT values are bound to codes
+Condition compileCondition(const Table& table, const std::string& text) {
+    Condition cond = parseCondition(table.columns, text, table.name);
+    bindCondition(cond, [](const std::string& literal) { return literal; }, &table);
+    return cond;
+}
+
+// Per-row evaluation, stopping at the first operand that decides
+bool evaluateCondition(const Table& table, size_t slot, const Condition& cond) {
+    switch (cond.kind) {
+        case ConditionKind::ALL: return true;
+        case ConditionKind::NONE: return false;
+        case ConditionKind::COMPARE: return evaluateCondition(table, slot, cond.pred);
+        case ConditionKind::NOT: return !evaluateCondition(table, slot, cond.children[0]);
+        case ConditionKind::AND:
+            for (const auto& child : cond.children) {
+                if (!evaluateCondition(table, slot, child)) return false;
+            }
+            return true;
+        case ConditionKind::OR:
+            for (const auto& child : cond.children) {
+                if (evaluateCondition(table, slot, child)) return true;
+            }
+            return false;
+    }
+    return false;
+}
+
+// ---- Filter Kernels ----
+// Bits for the slots from `start` to `count` that do not fill a whole word
+void filterIntTail(const int64_t* values, size_t start, size_t count, CompareOp op,
+                   int64_t literal, uint64_t* bitmap) {
+    if (start == count) return;
+    uint64_t bits = 0;
+    for (size_t i = start; i < count; i++) {
+        bits |= static_cast<uint64_t>(compareInt(values[i], op, literal)) << (i - start);
+    }
+    bitmap[start / 64] = bits;
+}
+
+void filterIntScalar(const int64_t* values, size_t count, CompareOp op, int64_t literal,
+                     uint64_t* bitmap) {
+    switch (op) {
+        case CompareOp::EQ: filterIntScalarOp<CompareOp::EQ>(values, count, literal, bitmap); break;
+        case CompareOp::NE: filterIntScalarOp<CompareOp::NE>(values, count, literal, bitmap); break;
+        case CompareOp::GT: filterIntScalarOp<CompareOp::GT>(values, count, literal, bitmap); break;
+        case CompareOp::LT: filterIntScalarOp<CompareOp::LT>(values, count, literal, bitmap); break;
+        case CompareOp::GE: filterIntScalarOp<CompareOp::GE>(values, count, literal, bitmap); break;
+        case CompareOp::LE: filterIntScalarOp<CompareOp::LE>(values, count, literal, bitmap); break;
+        default: std::fill(bitmap, bitmap + bitmapWords(count), 0); break;
+    }
+}
+
+#ifdef CRT_X86_KERNELS
+
+__attribute__((target("avx2")))
+void filterIntAvx2(const int64_t* values, size_t count, CompareOp op, int64_t literal,
+                   uint64_t* bitmap) {
+    const __m256i lit = _mm256_set1_epi64x(literal);
+    const bool invert = invertsCompare(op);
+    const bool equal = op == CompareOp::EQ || op == CompareOp::NE;
+    const bool swap = op == CompareOp::LT || op == CompareOp::GE;
+    size_t words = count / 64;
+
+    for (size_t w = 0; w < words; w++) {
+        const int64_t* v = values + w * 64;
+        uint64_t bits = 0;
+        for (size_t j = 0; j < 64; j += 4) {
+            __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(v + j));
+            __m256i mask = equal ? _mm256_cmpeq_epi64(x, lit)
+                         : swap  ? _mm256_cmpgt_epi64(lit, x)
+                                 : _mm256_cmpgt_epi64(x, lit);
+            bits |= static_cast<uint64_t>(_mm256_movemask_pd(_mm256_castsi256_pd(mask))) << j;
+        }
+        bitmap[w] = invert ? ~bits : bits;
+    }
+    filterIntTail(values, words * 64, count, op, literal, bitmap);
+}
+
+__attribute__((target("sse4.2")))
+void filterIntSse42(const int64_t* values, size_t count, CompareOp op, int64_t literal,
+                    uint64_t* bitmap) {
+    const __m128i lit = _mm_set1_epi64x(literal);
+    const bool invert = invertsCompare(op);
+    const bool equal = op == CompareOp::EQ || op == CompareOp::NE;
+    const bool swap = op == CompareOp::LT || op == CompareOp::GE;
+    size_t words = count / 64;
+
+    for (size_t w = 0; w < words; w++) {
+        const int64_t* v = values + w * 64;
+        uint64_t bits = 0;
+        for (size_t j = 0; j < 64; j += 2) {
+            __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(v + j));
+            __m128i mask = equal ? _mm_cmpeq_epi64(x, lit)
+                         : swap  ? _mm_cmpgt_epi64(lit, x)
+                                 : _mm_cmpgt_epi64(x, lit);
+            bits |= static_cast<uint64_t>(_mm_movemask_pd(_mm_castsi128_pd(mask))) << j;
+        }
+        bitmap[w] = invert ? ~bits : bits;
+    }
+    filterIntTail(values, words * 64, count, op, literal, bitmap);
+}
+#endif
+
+FilterKernelInfo selectFilterKernel() {
+#ifdef CRT_X86_KERNELS
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) return {filterIntAvx2, "avx2"};
+    if (__builtin_cpu_supports("sse4.2")) return {filterIntSse42, "sse4.2"};
+#endif
+    return {filterIntScalar, "scalar"};
+}
+
+const FilterKernelInfo filterKernel = selectFilterKernel();
+
+// An equality, inequality or IN on an encoded TEXT column, which scans
+// evaluate on entry codes
+bool comparesCodes(const Table& table, const Predicate& pred) {
+    return !pred.intColumn && !pred.rowId && !pred.matchAll && !pred.matchNone &&
+           (pred.op == CompareOp::EQ || pred.op == CompareOp::NE || pred.op == CompareOp::IN) &&
+           table.data[pred.colIndex].encoded;
+}
+
+// Codes of the values a comparison on an encoded column wants; values
+// missing from the dictionary match no slot and have none
+void lookupCodes(const ColumnData& column, const Predicate& pred, std::vector<uint16_t>& codes) {
+    codes.clear();
+    auto want = [&](const std::string& text) {
+        uint32_t code = findEntry(column, text.data(), text.size());
+        if (code != kNoEntry) codes.push_back(static_cast<uint16_t>(code));
+    };
+    if (pred.op == CompareOp::IN) {
+        for (const auto& text : pred.texts) want(text);
+    } else {
+        want(pred.literal);
+    }
+}
+
+// Look a comparison's values up once, for a statement that holds the
+// table's lock: entries are only added meanwhile, so the codes stay valid
+void bindCodes(const Table& table, Predicate& pred) {
+    pred.codesBound = comparesCodes(table, pred);
+    if (pred.codesBound) lookupCodes(table.data[pred.colIndex], pred, pred.codes);
+}
+
+// A condition whose comparisons scans of this table all evaluate a morsel
+// at a time, through filter kernels or on codes
+bool isVectorized(const Table& table, const Condition& cond) {
+    if (cond.kind == ConditionKind::COMPARE) return isVectorized(cond) || comparesCodes(table, cond.pred);
+    for (const auto& child : cond.children) {
+        if (!isVectorized(table, child)) return false;
+    }
+    return true;
+}
+
+// Match of slots [begin, end), within one zone, to a predicate: bounded by
+// the zone's INT column bounds, or by the row IDs at either end since they
+// ascend with the slots. Other comparisons are undecided.
+ZoneMatch zoneMatch(const Table& table, const Predicate& pred, size_t begin, size_t end) {
+    if (pred.matchAll) return ZoneMatch::ALL;
+    if (pred.matchNone) return ZoneMatch::NONE;
+
+    int64_t lo, hi;
+    size_t zone = begin / kZoneSlots;
+    if (pred.rowId) {
+        if (end > table.deltaStart) return ZoneMatch::SOME;  // Row IDs out of order
+        lo = table.ids[begin];
+        hi = table.ids[end - 1];
+    } else if (pred.intColumn && zone < table.data[pred.colIndex].zoneMin.size()) {
+        lo = table.data[pred.colIndex].zoneMin[zone];
+        hi = table.data[pred.colIndex].zoneMax[zone];
+    } else {
+        return ZoneMatch::SOME;
+    }
+
+    int64_t n = pred.number;
+    switch (pred.op) {
+        case CompareOp::EQ: return decideZone(n < lo || n > hi, lo == n && hi == n);
+        case CompareOp::NE: return decideZone(lo == n && hi == n, n < lo || n > hi);
+        case CompareOp::GT: return decideZone(hi <= n, lo > n);
+        case CompareOp::LT: return decideZone(lo >= n, hi < n);
+        case CompareOp::GE: return decideZone(hi < n, lo >= n);
+        case CompareOp::LE: return decideZone(lo > n, hi <= n);
+        case CompareOp::BETWEEN: return decideZone(hi < n || lo > pred.upper, lo >= n && hi <= pred.upper);
+        case CompareOp::IN: {
+            auto it = std::lower_bound(pred.numbers.begin(), pred.numbers.end(), lo);
+            bool none = it == pred.numbers.end() || *it > hi;
+            return decideZone(none, !none && lo == hi);
+        }
+        default: return ZoneMatch::SOME;
+    }
+}
+
+// Match of slots [begin, end) to a condition. An AND matches nothing once
+// an operand does, and everything only if every operand does; an OR the
+// reverse.
+ZoneMatch zoneMatch(const Table& table, const Condition& cond, size_t begin, size_t end) {
+    switch (cond.kind) {
+        case ConditionKind::ALL: return ZoneMatch::ALL;
+        case ConditionKind::NONE: return ZoneMatch::NONE;
+        case ConditionKind::COMPARE: return zoneMatch(table, cond.pred, begin, end);
+        case ConditionKind::NOT: {
+            ZoneMatch match = zoneMatch(table, cond.children[0], begin, end);
+            return decideZone(match == ZoneMatch::ALL, match == ZoneMatch::NONE);
+        }
+        case ConditionKind::AND:
+        case ConditionKind::OR:
+            break;
+    }
+    ZoneMatch decided = cond.kind == ConditionKind::OR ? ZoneMatch::ALL : ZoneMatch::NONE;
+    ZoneMatch match = cond.kind == ConditionKind::OR ? ZoneMatch::NONE : ZoneMatch::ALL;
+    for (const auto& child : cond.children) {
+        ZoneMatch childMatch = zoneMatch(table, child, begin, end);
+        if (childMatch == decided) return decided;
+        if (childMatch == ZoneMatch::SOME) match = ZoneMatch::SOME;
+    }
+    return match;
+}
+
+// Bits of the codes in `codes[0, count)` equal to any of `wanted`, or to
+// none of them when `invert` is set
+void filterCodes(const uint16_t* codes, size_t count, const std::vector<uint16_t>& wanted, bool invert,
+                 uint64_t* bitmap) {
+    for (size_t w = 0; w < bitmapWords(count); w++) {
+        const uint16_t* c = codes + w * 64;
+        size_t n = std::min<size_t>(64, count - w * 64);
+        uint64_t bits = 0;
+        for (uint16_t code : wanted) {
+            if (n == 64) {
+                for (size_t j = 0; j < 64; j++) bits |= static_cast<uint64_t>(c[j] == code) << j;
+            } else {
+                for (size_t j = 0; j < n; j++) bits |= static_cast<uint64_t>(c[j] == code) << j;
+            }
+        }
+        if (invert) bits = ~bits;
+        bitmap[w] = n == 64 ? bits : bits & ((uint64_t(1) << n) - 1);
+    }
+}
+
+// Bits of slots [begin, end) matching a predicate, written to `words` from
+// the word holding `begin`
+void scanMorsel(const Table& table, const Predicate& pred, size_t begin, size_t end, uint64_t* words) {
+    size_t count = end - begin;
+
+    if (comparesCodes(table, pred)) {
+        const ColumnData& column = table.data[pred.colIndex];
+        std::vector<uint16_t> looked;
+        if (!pred.codesBound) lookupCodes(column, pred, looked);
+        const std::vector<uint16_t>& wanted = pred.codesBound ? pred.codes : looked;
+        filterCodes(column.codes.data() + begin, count, wanted, pred.op == CompareOp::NE, words);
+        return;
+    }
+
+    if (pred.intColumn && !pred.rowId && pred.op != CompareOp::IN && pred.op != CompareOp::LIKE) {
+        const int64_t* values = table.data[pred.colIndex].ints.data() + begin;
+        if (pred.op != CompareOp::BETWEEN) {
+            filterKernel.kernel(values, count, pred.op, pred.number, words);
+            return;
+        }
+        // BETWEEN is the intersection of a GE and an LE pass
+        Bitmap upper(bitmapWords(count), 0);
+        filterKernel.kernel(values, count, CompareOp::GE, pred.number, words);
+        filterKernel.kernel(values, count, CompareOp::LE, pred.upper, upper.data());
+        for (size_t w = 0; w < upper.size(); w++) words[w] &= upper[w];
+        return;
+    }
+
+    for (size_t slot = begin; slot < end; slot++) {
+        if (evaluateCondition(table, slot, pred)) {
+            words[(slot - begin) / 64] |= uint64_t(1) << (slot % 64);
+        }
+    }
+}
+
+// Bits of slots [begin, end) matching a condition, written to `words` as by
+// scanMorsel. A morsel its zone bounds decide is filled without reading it.
+// AND and OR combine their operands word by word and stop once the morsel is
+// decided. Operands that are not vectorized, or have few rows left to
+// decide, are evaluated for just those rows.
+void scanConditionMorsel(const Table& table, const Condition& cond, size_t begin, size_t end,
+                         uint64_t* words) {
+    size_t count = end - begin;
+    size_t numWords = bitmapWords(count);
+    uint64_t tailMask = count % 64 ? (uint64_t(1) << (count % 64)) - 1 : ~uint64_t(0);
+
+    ZoneMatch match = zoneMatch(table, cond, begin, end);
+    if (match != ZoneMatch::SOME) {
+        std::fill(words, words + numWords, match == ZoneMatch::ALL ? ~uint64_t(0) : 0);
+        words[numWords - 1] &= tailMask;
+        return;
+    }
+
+    switch (cond.kind) {
+        case ConditionKind::COMPARE:
+            std::fill(words, words + numWords, 0);
+            scanMorsel(table, cond.pred, begin, end, words);
+            return;
+        case ConditionKind::NOT:
+            scanConditionMorsel(table, cond.children[0], begin, end, words);
+            for (size_t w = 0; w < numWords; w++) words[w] = ~words[w];
+            words[numWords - 1] &= tailMask;
+            return;
+        case ConditionKind::ALL:   // decided by the zone match above
+        case ConditionKind::NONE:
+        case ConditionKind::AND:
+        case ConditionKind::OR:
+            break;
+    }
+
+    // An AND looks at the rows still set, an OR at the rows still clear
+    bool isOr = cond.kind == ConditionKind::OR;
+    auto undecidedBits = [&](size_t w) {
+        return isOr ? ~words[w] & (w + 1 < numWords ? ~uint64_t(0) : tailMask) : words[w];
+    };
+    uint64_t other[kMorselSlots / 64];
+    scanConditionMorsel(table, cond.children[0], begin, end, words);
+    for (size_t i = 1; i < cond.children.size(); i++) {
+        const Condition& child = cond.children[i];
+        size_t undecided = 0;
+        for (size_t w = 0; w < numWords; w++) undecided += countBits(undecidedBits(w));
+        if (undecided == 0) return;
+
+        if (!isVectorized(table, child) || undecided * 16 < count) {
+            for (size_t w = 0; w < numWords; w++) {
+                uint64_t word = undecidedBits(w);
+                while (word) {
+                    size_t bit = lowestBit(word);
+                    word &= word - 1;
+                    if (evaluateCondition(table, begin + w * 64 + bit, child) == isOr) {
+                        words[w] ^= uint64_t(1) << bit;
+                    }
+                }
+            }
+            continue;
+        }
+
+        scanConditionMorsel(table, child, begin, end, other);
+        for (size_t w = 0; w < numWords; w++) {
+            words[w] = isOr ? words[w] | other[w] : words[w] & other[w];
+        }
+    }
+}
+
+// Clear the bits of hidden slots in the words of a bitmap starting at word
+// `first`
+void dropHidden(const Bitmap& hidden, size_t first, uint64_t* words, size_t numWords) {
+    size_t end = std::min(hidden.size(), first + numWords);
+    for (size_t w = first; w < end; w++) words[w - first] &= ~hidden[w];
+}
+
+// Selection bitmap of the visible slots matching a condition, by a full scan
+Bitmap scanRows(const Table& table, const Condition& cond) {
+    size_t numSlots = table.rowCount();
+    Bitmap bitmap(bitmapWords(numSlots), 0);
+
+    if (cond.kind == ConditionKind::NONE || numSlots == 0) return bitmap;
+
+    Bitmap scratch;
+    const Bitmap& hidden = hiddenSlots(table, scratch);
+    if (cond.kind == ConditionKind::ALL) {
+        std::fill(bitmap.begin(), bitmap.end(), ~uint64_t(0));
+        if (numSlots % 64) bitmap.back() = (uint64_t(1) << (numSlots % 64)) - 1;
+        dropHidden(hidden, 0, bitmap.data(), bitmap.size());
+        return bitmap;
+    }
+
+    parallelFor(morselCount(numSlots), [&](size_t morsel) {
+        size_t begin = morsel * kMorselSlots;
+        size_t end = std::min(numSlots, begin + kMorselSlots);
+        if (zoneMatch(table, cond, begin, end) == ZoneMatch::SOME) bufferPool.touch(table, morsel);
+        scanConditionMorsel(table, cond, begin, end, bitmap.data() + begin / 64);
+        dropHidden(hidden, begin / 64, bitmap.data() + begin / 64, bitmapWords(end - begin));
+    });
+    return bitmap;
+}
+
+// Morsels among the first `numSlots` slots that scans fill from their zone
+// bounds; `slots` is set to the slots in them
+size_t skippedMorsels(const Table& table, const Condition& cond, size_t numSlots, size_t& slots) {
+    size_t morsels = 0;
+    slots = 0;
+    if (cond.kind == ConditionKind::ALL || cond.kind == ConditionKind::NONE) return 0;
+    for (size_t begin = 0; begin < numSlots; begin += kMorselSlots) {
+        size_t end = std::min(numSlots, begin + kMorselSlots);
+        if (zoneMatch(table, cond, begin, end) != ZoneMatch::SOME) {
+            morsels++;
+            slots += end - begin;
+        }
+    }
+    return morsels;
+}
+
+// Slots of the first `limit` visible rows matching a condition, in slot order.
+// Morsels are scanned a wave of one per worker at a time, stopping after the
+// wave that reaches the limit. `scanned` is set to the slots looked at.
+SlotList scanFirstRows(const Table& table, const Condition& cond, size_t limit, size_t* scanned) {
+    SlotList slots;
+    size_t numSlots = table.rowCount();
+    size_t slot = 0;
+    if (scanned) *scanned = 0;
+    if (cond.kind == ConditionKind::NONE || limit == 0) return slots;
+    Bitmap scratch;
+    const Bitmap& hidden = hiddenSlots(table, scratch);
+    if (cond.kind == ConditionKind::ALL) {
+        for (; slot < numSlots && slots.size() < limit; slot++) {
+            if (!isHidden(hidden, slot)) slots.push_back(slot);
+        }
+        if (scanned) *scanned = slot;
+        return slots;
+    }
+
+    size_t numMorsels = morselCount(numSlots);
+    size_t wave = workerCount();
+    Bitmap bitmap(wave * kMorselSlots / 64);
+    for (size_t first = 0; first < numMorsels && slots.size() < limit; first += wave) {
+        size_t count = std::min(wave, numMorsels - first);
+        std::fill(bitmap.begin(), bitmap.end(), 0);
+        parallelFor(count, [&](size_t i) {
+            size_t begin = (first + i) * kMorselSlots;
+            size_t end = std::min(numSlots, begin + kMorselSlots);
+            uint64_t* words = bitmap.data() + i * kMorselSlots / 64;
+            if (zoneMatch(table, cond, begin, end) == ZoneMatch::SOME) bufferPool.touch(table, first + i);
+            scanConditionMorsel(table, cond, begin, end, words);
+            dropHidden(hidden, begin / 64, words, bitmapWords(end - begin));
+        });
+        for (size_t w = 0; w < bitmap.size() && slots.size() < limit; w++) {
+            uint64_t word = bitmap[w];
+            while (word && slots.size() < limit) {
+                slots.push_back(first * kMorselSlots + w * 64 + lowestBit(word));
+                word &= word - 1;
+            }
+        }
+        slot = std::min(numSlots, (first + count) * kMorselSlots);
+    }
+    if (scanned) *scanned = slot;
+    return slots;
+}
+
+// ---- Statement Profiling ----
+thread_local Profile* activeProfile = nullptr;
+
+// Bytes per row of a column as operators read it: the value, or a TEXT
+// value's code or offset and length plus its bytes averaged over the rows.
+// -1 is the row ID.
+uint64_t columnWidth(const Table& table, int col) {
+    if (col < 0) return sizeof(int);
+    if (table.isInt(col)) return sizeof(int64_t);
+    size_t numSlots = table.rowCount();
+    const ColumnData& column = table.data[col];
+    return (column.encoded ? sizeof(uint16_t) : sizeof(uint64_t) + sizeof(uint32_t)) +
+           (numSlots ? column.bytes.size() / numSlots : 0);
+}
+
+void conditionColumns(const Condition& cond, std::vector<int>& cols) {
+    if (cond.kind == ConditionKind::COMPARE) cols.push_back(cond.pred.rowId ? -1 : cond.pred.colIndex);
+    for (const auto& child : cond.children) conditionColumns(child, cols);
+}
+
+// Bytes per row a condition reads, each column counted once
+uint64_t conditionWidth(const Table& table, const Condition& cond) {
+    std::vector<int> cols;
+    conditionColumns(cond, cols);
+    std::sort(cols.begin(), cols.end());
+    cols.erase(std::unique(cols.begin(), cols.end()), cols.end());
+    uint64_t width = 0;
+    for (int col : cols) width += columnWidth(table, col);
+    return width;
+}
+
+const char* compareOpText(CompareOp op) {
+    static const char* names[] = {"=", "!=", ">", "<", ">=", "<=", "BETWEEN", "IN", "LIKE", "?"};
+    return names[static_cast<int>(op)];
+}
+
+// A bound comparison as it could be written
+std::string predicateText(const Table& table, const Predicate& pred) {
+    bool number = pred.rowId || pred.intColumn;
+    auto literal = [&](const std::string& value) { return number ? value : "\"" + value + "\""; };
+    std::string text = pred.rowId ? "id" : table.columns[pred.colIndex].name;
+    text += std::string(" ") + compareOpText(pred.op) + " ";
+    if (pred.op == CompareOp::IN) {
+        text += "(";
+        for (size_t i = 0; i < pred.texts.size(); i++) text += (i ? ", " : "") + literal(pred.texts[i]);
+        return text + ")";
+    }
+    if (pred.op == CompareOp::BETWEEN) {
+        return text + std::to_string(pred.number) + " AND " + std::to_string(pred.upper);
+    }
+    return text + literal(pred.literal);
+}
+
+// A bound condition as it could be written; nested AND and OR are
+// parenthesized
+std::string conditionText(const Table& table, const Condition& cond, bool nested) {
+    switch (cond.kind) {
+        case ConditionKind::ALL: return "true";
+        case ConditionKind::NONE: return "false";
+        case ConditionKind::COMPARE: return predicateText(table, cond.pred);
+        case ConditionKind::NOT: return "NOT " + conditionText(table, cond.children[0], true);
+        default: break;
+    }
+    std::string text;
+    for (size_t i = 0; i < cond.children.size(); i++) {
+        if (i) text += cond.kind == ConditionKind::AND ? " AND " : " OR ";
+        text += conditionText(table, cond.children[i], true);
+    }
+    return nested ? "(" + text + ")" : text;
+}
+
+void countComparisons(const Table& table, const Condition& cond, size_t& total, size_t& vectorized) {
+    if (cond.kind == ConditionKind::COMPARE) {
+        total++;
+        if (isVectorized(table, cond)) vectorized++;
+    }
+    for (const auto& child : cond.children) countComparisons(table, child, total, vectorized);
+}
+
+// WHERE text with how scans evaluate it: through filter kernels, row by
+// row, or some of each
+std::string filterText(const Table& table, const Condition& cond) {
+    size_t total = 0, vectorized = 0;
+    countComparisons(table, cond, total, vectorized);
+    std::string form = vectorized == total ? "vectorized"
+                       : vectorized == 0   ? "per row"
+                                           : std::to_string(vectorized) + " of " + std::to_string(total) +
+                                                 " comparisons vectorized";
+    return "WHERE " + conditionText(table, cond) + " (" + form + ")";
+}
+
+std::string outputDetail(size_t numColumns, OutputMode mode) {
+    static const char* names[] = {"table", "csv", "tsv", "binary"};
+    return std::to_string(numColumns) + " column(s) as " + names[static_cast<int>(mode)];
+}
+
+// ---- Access Paths ----
+size_t countSelected(const Selection& selection) {
+    return selection.sparse ? selection.slots.size() : countSelected(selection.bitmap);
+}
+
+// Number of morsels a selection splits into: slot ranges for a bitmap,
+// runs of slots for a sparse selection
+size_t morselCount(const Selection& selection) {
+    if (selection.sparse) return morselCount(selection.slots.size());
+    return morselCount(selection.bitmap.size() * 64);
+}
+
+Bitmap toBitmap(const Selection& selection, size_t numSlots) {
+    if (!selection.sparse) return selection.bitmap;
+    Bitmap bitmap(bitmapWords(numSlots), 0);
+    for (size_t slot : selection.slots) bitmap[slot / 64] |= uint64_t(1) << (slot % 64);
+    return bitmap;
+}
+
+// Set the bits of slots [begin, end)
+void setBitRange(Bitmap& bitmap, size_t begin, size_t end) {
+    for (size_t slot = begin; slot < end && slot % 64; slot++) {
+        bitmap[slot / 64] |= uint64_t(1) << (slot % 64);
+    }
+    size_t word = (begin + 63) / 64;
+    for (; (word + 1) * 64 <= end; word++) bitmap[word] = ~uint64_t(0);
+    for (size_t slot = std::max(begin, word * 64); slot < end; slot++) {
+        bitmap[slot / 64] |= uint64_t(1) << (slot % 64);
+    }
+}
+
+// Delta slots holding a row ID in [lo, hi], ascending
+std::vector<size_t> deltaSlotsIn(const Table& table, int64_t lo, int64_t hi) {
+    std::vector<size_t> slots;
+    if (!table.hasDelta()) return slots;
+    if (lo == hi && lo >= INT_MIN && lo <= INT_MAX) {
+        auto range = table.deltaSlots.equal_range(static_cast<int>(lo));
+        for (auto it = range.first; it != range.second; ++it) slots.push_back(it->second);
+        std::sort(slots.begin(), slots.end());
+        return slots;
+    }
+    for (size_t slot = table.deltaStart; slot < table.rowCount(); slot++) {
+        if (table.ids[slot] >= lo && table.ids[slot] <= hi) slots.push_back(slot);
+    }
+    return slots;
+}
+
+// Inclusive bounds of the values a comparison seeks; an NE seeks the value
+// it excludes. Literals are unsigned, so only GT can step past the end of
+// the range, and then nothing matches and false is returned.
+bool seekBounds(const Predicate& pred, int64_t& lo, int64_t& hi) {
+    lo = INT64_MIN;
+    hi = INT64_MAX;
+    switch (pred.op) {
+        case CompareOp::EQ:
+        case CompareOp::NE: lo = hi = pred.number; break;
+        case CompareOp::GT:
+            if (pred.number == INT64_MAX) return false;
+            lo = pred.number + 1;
+            break;
+        case CompareOp::GE: lo = pred.number; break;
+        case CompareOp::LT: hi = pred.number - 1; break;
+        case CompareOp::LE: hi = pred.number; break;
+        case CompareOp::BETWEEN: lo = pred.number; hi = pred.upper; break;
+        default: break;
+    }
+    return true;
+}
+
+// Slots holding the row IDs a predicate seeks: a run of the sorted slots,
+// found by binary search, and the delta slots in its range
+RowIdRange rowIdRange(const Table& table, const Predicate& pred) {
+    RowIdRange range;
+    int64_t lo, hi;
+    if (!seekBounds(pred, lo, hi)) return range;
+    auto sorted = table.ids.begin() + std::min(table.deltaStart, table.rowCount());
+    range.begin = std::lower_bound(table.ids.begin(), sorted, lo) - table.ids.begin();
+    range.end = std::upper_bound(table.ids.begin(), sorted, hi) - table.ids.begin();
+    range.delta = deltaSlotsIn(table, lo, hi);
+    return range;
+}
+
+// Whether lookupRowIds returns the slots of a range rather than a bitmap
+bool sparseRowIds(const Table& table, const Predicate& pred, const RowIdRange& range) {
+    return pred.op != CompareOp::NE && (range.end - range.begin + range.delta.size()) * 16 <= table.rowCount();
+}
+
+// Rows matching a predicate on the row ID. IDs are kept ascending in slot
+// order through inserts and deletes, so every comparison resolves to one
+// contiguous run of slots, less the hidden ones. Versions in the delta are
+// looked up by hash or checked one by one.
+Selection lookupRowIds(const Table& table, const Predicate& pred) {
+    size_t numSlots = table.rowCount();
+    Selection selection;
+    RowIdRange range = rowIdRange(table, pred);
+    size_t begin = range.begin, end = range.end;
+    const std::vector<size_t>& delta = range.delta;
+
+    if (pred.op == CompareOp::NE) {
+        selection.bitmap.assign(bitmapWords(numSlots), 0);
+        setBitRange(selection.bitmap, 0, begin);
+        setBitRange(selection.bitmap, end, numSlots);
+        for (size_t slot : delta) selection.bitmap[slot / 64] &= ~(uint64_t(1) << (slot % 64));
+    } else if (sparseRowIds(table, pred, range)) {
+        selection.sparse = true;
+        for (size_t slot = begin; slot < end; slot++) {
+            if (isVisible(table, slot)) selection.slots.push_back(slot);
+        }
+        for (size_t slot : delta) {
+            if (isVisible(table, slot)) selection.slots.push_back(slot);
+        }
+        return selection;
+    } else {
+        selection.bitmap.assign(bitmapWords(numSlots), 0);
+        setBitRange(selection.bitmap, begin, end);
+        for (size_t slot : delta) selection.bitmap[slot / 64] |= uint64_t(1) << (slot % 64);
+    }
+    Bitmap scratch;
+    dropHidden(hiddenSlots(table, scratch), 0, selection.bitmap.data(), selection.bitmap.size());
+    return selection;
+}
+
+// Index able to serve a predicate, or nullptr. Equality prefers a hash index;
+// ranges need an ordered index on an INT column.
+const Index* chooseIndex(const Table& table, const Predicate& pred) {
+    if (pred.matchAll || pred.matchNone || pred.op == CompareOp::NE) return nullptr;
+
+    const Index* best = nullptr;
+    for (const auto& index : table.indexes) {
+        if (index.colIndex != pred.colIndex) continue;
+        if (pred.op == CompareOp::EQ) {
+            if (index.kind == IndexKind::HASH) return &index;
+            best = &index;
+        } else if (pred.intColumn && index.kind == IndexKind::BTREE) {
+            best = &index;
+        }
+    }
+    return best;
+}
+
+// Row IDs in the range of a B+-tree range predicate, added to `ids` when
+// given. Gives up, returning false, once they would cover a sixteenth of
+// the table, since the vectorized scan is faster there.
+bool indexRange(const Table& table, const Index& index, const Predicate& pred, std::vector<int>* ids) {
+    int64_t lo, hi;
+    if (!seekBounds(pred, lo, hi)) return true;
+    size_t limit = table.rowCount() / 16, count = 0;
+    bool complete = true;
+    index.tree.scan(lo, hi, [&](int id) {
+        if (count++ >= limit) {
+            complete = false;
+            return false;
+        }
+        if (ids) ids->push_back(id);
+        return true;
+    });
+    return complete;
+}
+
+// Candidate rows for a predicate from an index, rechecked against it; false
+// when a range gives up for a scan
+bool lookupIndex(const Table& table, const Index& index, const Predicate& pred, Selection& selection) {
+    std::vector<int> ids;
+
+    if (pred.op == CompareOp::EQ) {
+        int64_t key = pred.intColumn ? pred.number : hashText(pred.literal.data(), pred.literal.size());
+        if (index.kind == IndexKind::HASH) {
+            auto it = index.hash.find(key);
+            if (it != index.hash.end()) ids = it->second;
+        } else {
+            index.tree.scan(key, key, [&](int id) { ids.push_back(id); return true; });
+        }
+    } else if (!indexRange(table, index, pred, &ids)) {
+        return false;
+    }
+
+    selection.sparse = true;
+    for (int id : ids) {
+        forEachSlotOf(table, id, [&](size_t slot) {
+            if (isVisible(table, slot) && evaluateCondition(table, slot, pred)) selection.slots.push_back(slot);
+        });
+    }
+    if (!std::is_sorted(selection.slots.begin(), selection.slots.end())) {
+        std::sort(selection.slots.begin(), selection.slots.end());
+    }
+    return true;
+}
+
+// Rows matching a comparison through the row IDs or an index; false when
+// neither applies, or on a snapshot view, which is only scanned
+bool seekRows(const Table& table, const Predicate& pred, Selection& selection) {
+    if (table.view || pred.op == CompareOp::IN || pred.op == CompareOp::LIKE) return false;
+    if (pred.rowId) {
+        selection = lookupRowIds(table, pred);
+        return true;
+    }
+    const Index* index = chooseIndex(table, pred);
+    return index && lookupIndex(table, *index, pred, selection);
+}
+
+void setSeekPath(const Table& table, const Predicate& pred, AccessPath& path) {
+    path.kind = pred.rowId ? AccessKind::ROW_ID_LOOKUP : AccessKind::INDEX_LOOKUP;
+    path.seek = &pred;
+    path.index = pred.rowId ? nullptr : chooseIndex(table, pred);
+}
+
+// Whether seekRows finds a comparison's rows, and, for an AND's `sparse`
+// child, as slots. Counts what a lookup would, without collecting rows.
+bool seeks(const Table& table, const Condition& cond, bool sparse) {
+    const Predicate& pred = cond.pred;
+    if (table.view || cond.kind != ConditionKind::COMPARE || pred.op == CompareOp::IN ||
+        pred.op == CompareOp::LIKE) {
+        return false;
+    }
+    if (pred.rowId) return !sparse || sparseRowIds(table, pred, rowIdRange(table, pred));
+    const Index* index = chooseIndex(table, pred);
+    return index && (pred.op == CompareOp::EQ || indexRange(table, *index, pred, nullptr));
+}
+
+// The path selectRows takes
+AccessPath planAccess(const Table& table, const Condition& cond, size_t limit) {
+    AccessPath path;
+    if (seeks(table, cond, false)) {
+        setSeekPath(table, cond.pred, path);
+        return path;
+    }
+    if (cond.kind == ConditionKind::AND) {
+        for (const auto& child : cond.children) {
+            if (!seeks(table, child, true)) continue;
+            setSeekPath(table, child.pred, path);
+            path.recheck = true;
+            return path;
+        }
+    }
+    if (limit < table.rowCount()) {
+        path.kind = AccessKind::LIMITED_SCAN;
+        path.limit = limit;
+    } else {
+        size_t slots;
+        path.skipped = skippedMorsels(table, cond, table.rowCount(), slots);
+    }
+    return path;
+}
+
+const char* accessName(AccessKind kind) {
+    static const char* names[] = {"Full Scan", "Limited Scan", "Row ID Lookup", "Index Lookup"};
+    return names[static_cast<int>(kind)];
+}
+
+std::string describeAccess(const Table& table, const Condition& cond, const AccessPath& path) {
+    std::string detail = table.name;
+    switch (path.kind) {
+        case AccessKind::FULL_SCAN:
+            detail += ", " + std::to_string(morselCount(table.rowCount())) + " morsel(s) on " +
+                      std::to_string(workerCount()) + " thread(s)";
+            break;
+        case AccessKind::LIMITED_SCAN:
+            detail += ", first " + std::to_string(path.limit) + " row(s) in waves of " +
+                      std::to_string(workerCount()) + " morsel(s)";
+            break;
+        case AccessKind::ROW_ID_LOOKUP:
+            detail += ", binary search for " + predicateText(table, *path.seek);
+            break;
+        case AccessKind::INDEX_LOOKUP:
+            detail += ", " + path.index->name;
+            detail += path.index->kind == IndexKind::HASH ? " (HASH)" : " (BTREE)";
+            detail += " for " + predicateText(table, *path.seek);
+            break;
+    }
+    bool scan = path.kind == AccessKind::FULL_SCAN || path.kind == AccessKind::LIMITED_SCAN;
+    if ((scan && cond.kind != ConditionKind::ALL) || path.recheck) detail += ", " + filterText(table, cond);
+    if (path.skipped > 0) detail += ", " + std::to_string(path.skipped) + " morsel(s) skipped by zone maps";
+    return detail;
+}
+
+// Rows matching a condition, through an index when one applies. An AND
+// seeks through the first comparison that can, and checks the rest on just
+// those rows. With a limit, a scan stops early and may return only the
+// first `limit` rows. `path` is set to the way the rows were found.
+Selection selectRows(const Table& table, const Condition& cond, size_t limit, AccessPath& path) {
+    Selection selection;
+    path = AccessPath();
+    if (cond.kind == ConditionKind::COMPARE && seekRows(table, cond.pred, selection)) {
+        setSeekPath(table, cond.pred, path);
+        path.examined = countSelected(selection);
+        return selection;
+    }
+
+    if (cond.kind == ConditionKind::AND) {
+        for (const auto& child : cond.children) {
+            Selection candidates;
+            if (child.kind != ConditionKind::COMPARE || !seekRows(table, child.pred, candidates) ||
+                !candidates.sparse) {
+                continue;
+            }
+            setSeekPath(table, child.pred, path);
+            path.recheck = true;
+            path.examined = candidates.slots.size();
+            selection.sparse = true;
+            for (size_t slot : candidates.slots) {
+                if (evaluateCondition(table, slot, cond)) selection.slots.push_back(slot);
+            }
+            return selection;
+        }
+    }
+
+    if (limit < table.rowCount()) {
+        path.kind = AccessKind::LIMITED_SCAN;
+        path.limit = limit;
+        selection.sparse = true;
+        selection.slots = scanFirstRows(table, cond, limit, &path.examined);
+    } else {
+        selection.sparse = false;
+        selection.slots.clear();
+        selection.bitmap = scanRows(table, cond);
+        path.examined = cond.kind == ConditionKind::NONE ? 0 : table.rowCount();
+    }
+    size_t skippedSlots;
+    path.skipped = skippedMorsels(table, cond, path.examined, skippedSlots);
+    path.examined -= skippedSlots;
+    return selection;
+}
+
+Selection selectRows(const Table& table, const Condition& cond, size_t limit) {
+    StepTimer timer;
+    AccessPath path;
+    Selection selection = selectRows(table, cond, limit, path);
+    if (activeProfile) {
+        timer.record(accessName(path.kind), describeAccess(table, cond, path), path.examined,
+                     countSelected(selection), path.examined * conditionWidth(table, cond), true);
+    }
+    return selection;
+}
+
+// ---- Aggregation ----
+// Parse a select list of aggregates plus, when grouping, the group column
+bool parseAggregates(const Table& table, const std::string& list, int groupCol,
+                     std::vector<Aggregate>& aggregates, std::string& error) {
+    static const std::regex callRegex("(\\w+)\\s*\\(\\s*(\\*|\\w+)\\s*\\)");
+    std::istringstream items(list);
+    std::string item;
+    while (std::getline(items, item, ',')) {
+        Aggregate agg;
+        agg.label = trim(item);
+        std::smatch matches;
+        if (!std::regex_match(agg.label, matches, callRegex)) {
+            agg.op = AggregateOp::KEY;
+            agg.colIndex = columnIndex(table, agg.label);
+            if (groupCol < 0 || agg.colIndex != groupCol) {
+                error = "'" + agg.label + "' is neither an aggregate nor the GROUP BY column";
+                return false;
+            }
+            aggregates.push_back(agg);
+            continue;
+        }
+
+        std::string name = toUpper(matches[1].str());
+        std::string arg = matches[2].str();
+        if (name == "COUNT") agg.op = AggregateOp::COUNT;
+        else if (name == "SUM") agg.op = AggregateOp::SUM;
+        else if (name == "MIN") agg.op = AggregateOp::MIN;
+        else if (name == "MAX") agg.op = AggregateOp::MAX;
+        else if (name == "AVG") agg.op = AggregateOp::AVG;
+        else {
+            error = "Unknown aggregate '" + matches[1].str() + "'";
+            return false;
+        }
+
+        if (arg != "*") {
+            agg.colIndex = columnIndex(table, arg);
+            if (agg.colIndex == -1) {
+                error = "Column '" + arg + "' not found";
+                return false;
+            }
+        }
+        if (agg.op != AggregateOp::COUNT && (agg.colIndex == -1 || !table.isInt(agg.colIndex))) {
+            error = name + " needs an INT column";
+            return false;
+        }
+        aggregates.push_back(agg);
+    }
+    if (aggregates.empty()) {
+        error = "Empty select list";
+        return false;
+    }
+    return true;
+}
+
+void mergeAccumulator(Accumulator& into, const Accumulator& from) {
+    into.count += from.count;
+    into.sum += from.sum;
+    into.min = std::min(into.min, from.min);
+    into.max = std::max(into.max, from.max);
+}
+
+// Accumulate a batch of slots. `groups` holds each slot's group, or is null
+// when every slot is in group 0; the ungrouped loops keep their running
+// values in registers.
+void accumulateBatch(const Table& table, const std::vector<Aggregate>& aggregates,
+                     const size_t* slots, const uint32_t* groups, size_t n,
+                     Accumulator* accumulators) {
+    size_t width = aggregates.size();
+    for (size_t a = 0; a < width; a++) {
+        const Aggregate& agg = aggregates[a];
+        Accumulator* acc = accumulators + a;
+        if (agg.op == AggregateOp::KEY) continue;
+        if (agg.op == AggregateOp::COUNT) {
+            if (!groups) {
+                acc->count += n;
+                continue;
+            }
+            for (size_t i = 0; i < n; i++) acc[groups[i] * width].count++;
+            continue;
+        }
+
+        const int64_t* ints = table.data[agg.colIndex].ints.data();
+        if (!groups) {
+            Accumulator batch;
+            batch.count = n;
+            for (size_t i = 0; i < n; i++) {
+                int64_t value = ints[slots[i]];
+                batch.sum += value;
+                batch.min = std::min(batch.min, value);
+                batch.max = std::max(batch.max, value);
+            }
+            mergeAccumulator(*acc, batch);
+            continue;
+        }
+        for (size_t i = 0; i < n; i++) {
+            Accumulator& state = acc[groups[i] * width];
+            int64_t value = ints[slots[i]];
+            state.count++;
+            state.sum += value;
+            state.min = std::min(state.min, value);
+            state.max = std::max(state.max, value);
+        }
+    }
+}
+
+// Aggregate the selected rows of morsels [begin, end) into `groups` and
+// `accumulators`
+void aggregateMorsels(const Table& table, const Selection& selection, size_t begin, size_t end,
+                      const std::vector<Aggregate>& aggregates, GroupTable& groups,
+                      std::vector<Accumulator>& accumulators) {
+    size_t slots[kAggregateBatch];
+    uint32_t groupOf[kAggregateBatch];
+    size_t n = 0;
+    auto flush = [&]() {
+        if (groups.grouped()) {
+            for (size_t i = 0; i < n; i++) groupOf[i] = groups.find(slots[i]);
+        } else {
+            groups.find(slots[0]);
+        }
+        accumulators.resize(groups.size() * aggregates.size());
+        accumulateBatch(table, aggregates, slots, groups.grouped() ? groupOf : nullptr, n,
+                        accumulators.data());
+        n = 0;
+    };
+    for (size_t morsel = begin; morsel < end; morsel++) {
+        if (!selection.sparse) bufferPool.touch(table, morsel);
+        forEachSelectedIn(selection, morsel, [&](size_t slot) {
+            slots[n++] = slot;
+            if (n == kAggregateBatch) flush();
+        });
+    }
+    if (n > 0) flush();
+}
+
+void writeAggregate(ResultWriter& writer, const Table& table, const Aggregate& agg,
+                    size_t firstSlot, const Accumulator& acc) {
+    if (agg.op == AggregateOp::KEY) {
+        writeCell(writer, table, agg.colIndex, firstSlot);
+    } else if (agg.op == AggregateOp::COUNT) {
+        writer.value(acc.count);
+    } else if (acc.count == 0) {
+        writer.null();
+    } else if (agg.op == AggregateOp::SUM) {
+        writer.value(acc.sum);
+    } else if (agg.op == AggregateOp::MIN) {
+        writer.value(acc.min);
+    } else if (agg.op == AggregateOp::MAX) {
+        writer.value(acc.max);
+    } else {
+        char avg[32];
+        int length = std::snprintf(avg, sizeof(avg), "%.2f",
+                                   static_cast<double>(acc.sum) / static_cast<double>(acc.count));
+        writer.value(avg, length);
+    }
+}
+
+std::string aggregateDetail(const Table& table, const std::vector<Aggregate>& aggregates, int groupCol) {
+    std::string detail;
+    for (const auto& agg : aggregates) {
+        if (agg.op != AggregateOp::KEY) detail += (detail.empty() ? "" : ", ") + agg.label;
+    }
+    if (groupCol >= 0) detail += " GROUP BY " + table.columns[groupCol].name;
+    return detail;
+}
+
+// Aggregate the selected rows and print one row per group. An ungrouped
+// query always prints one row, even over no rows.
+void runAggregates(const Table& table, const Selection& selection,
+                   const std::vector<Aggregate>& aggregates, int groupCol, std::ostream& out) {
+    StepTimer timer;
+    size_t numMorsels = morselCount(selection);
+    size_t numRuns = std::min(numMorsels, workerCount() * 4);
+    std::vector<GroupTable> partialGroups(numRuns, GroupTable(table, groupCol));
+    std::vector<std::vector<Accumulator>> partials(numRuns);
+    parallelFor(numRuns, [&](size_t run) {
+        aggregateMorsels(table, selection, run * numMorsels / numRuns,
+                         (run + 1) * numMorsels / numRuns, aggregates, partialGroups[run],
+                         partials[run]);
+    });
+
+    size_t width = aggregates.size();
+    GroupTable groups(table, groupCol);
+    std::vector<Accumulator> accumulators(groupCol < 0 ? width : 0);
+    for (size_t m = 0; m < numRuns; m++) {
+        for (uint32_t g = 0; g < partialGroups[m].size(); g++) {
+            uint32_t group = groups.find(partialGroups[m].firstSlot(g));
+            accumulators.resize(std::max(accumulators.size(), (group + 1) * width));
+            for (size_t a = 0; a < width; a++) {
+                mergeAccumulator(accumulators[group * width + a], partials[m][g * width + a]);
+            }
+        }
+    }
+    size_t numRows = accumulators.size() / width;
+    if (activeProfile) {
+        std::vector<int> cols(1, groupCol);
+        for (const auto& agg : aggregates) cols.push_back(agg.colIndex);
+        std::sort(cols.begin(), cols.end());
+        cols.erase(std::unique(cols.begin(), cols.end()), cols.end());
+        uint64_t rowWidth = 0;
+        for (int col : cols) rowWidth += col < 0 ? 0 : columnWidth(table, col);
+        size_t numSelected = countSelected(selection);
+        std::string detail = aggregateDetail(table, aggregates, groupCol);
+        detail += ", " + std::to_string(numRuns) + " run(s)";
+        timer.record("Aggregate", detail, numSelected, numRows, numSelected * rowWidth);
+    }
+    StepTimer outputTimer;
+
+    std::vector<ResultColumn> columns;
+    for (const auto& agg : aggregates) {
+        bool isInt = agg.op == AggregateOp::KEY ? table.isInt(agg.colIndex) : agg.op != AggregateOp::AVG;
+        columns.push_back(ResultColumn{agg.label, isInt, false});
+    }
+    ResultWriter result(outputMode, columns);
+    result.header();
+    for (size_t g = 0; g < numRows; g++) {
+        size_t firstSlot = g < groups.size() ? groups.firstSlot(static_cast<uint32_t>(g)) : 0;
+        for (size_t a = 0; a < width; a++) {
+            writeAggregate(result, table, aggregates[a], firstSlot, accumulators[g * width + a]);
+        }
+        result.endRow();
+    }
+    result.finish(numRows, out);
+    if (activeProfile) {
+        outputTimer.record("Output", outputDetail(columns.size(), outputMode), numRows, numRows, 0);
+    }
+}
+
+// ---- Sorting ----
+// Selected slots in ORDER BY order, at most order.needed() of them
+std::string orderDetail(const Table& table, const RowOrder& order) {
+    std::string detail = "ORDER BY ";
+    detail += order.colIndex < 0 ? "id" : table.columns[order.colIndex].name;
+    if (order.descending) detail += " DESC";
+    if (order.needed() != SIZE_MAX) detail += ", top " + std::to_string(order.needed());
+    return detail;
+}
+
+std::string limitDetail(const RowOrder& order) {
+    return "LIMIT " + std::to_string(order.limit) + " OFFSET " + std::to_string(order.offset);
+}
+
+SlotList orderRows(const Table& table, const Selection& selection, const RowOrder& order) {
+    SlotOrder less{&table, order.colIndex, order.descending};
+    size_t k = order.needed();
+    SlotList slots;
+
+    if (k >= countSelected(selection)) {
+        forEachSelected(selection, [&](size_t slot) { slots.push_back(slot); });
+        std::sort(slots.begin(), slots.end(), less);
+        return slots;
+    }
+
+    // Top-k per run: a max-heap whose top is the worst row kept so far
+    size_t numMorsels = morselCount(selection);
+    size_t numRuns = std::min(numMorsels, workerCount() * 4);
+    std::vector<SlotList> heaps(numRuns);
+    parallelFor(numRuns, [&](size_t run) {
+        SlotList& heap = heaps[run];
+        for (size_t morsel = run * numMorsels / numRuns; morsel < (run + 1) * numMorsels / numRuns;
+             morsel++) {
+            forEachSelectedIn(selection, morsel, [&](size_t slot) {
+                if (heap.size() < k) {
+                    heap.push_back(slot);
+                    std::push_heap(heap.begin(), heap.end(), less);
+                } else if (less(slot, heap.front())) {
+                    std::pop_heap(heap.begin(), heap.end(), less);
+                    heap.back() = slot;
+                    std::push_heap(heap.begin(), heap.end(), less);
+                }
+            });
+        }
+    });
+
+    for (const auto& heap : heaps) slots.insert(slots.end(), heap.begin(), heap.end());
+    size_t keep = std::min(k, slots.size());
+    std::partial_sort(slots.begin(), slots.begin() + keep, slots.end(), less);
+    slots.resize(keep);
+    return slots;
+}
+
+// ---- Joins ----
+int64_t joinKey(const Table& table, int col, size_t slot) {
+    return col < 0 ? table.ids[slot] : indexKey(table, col, slot);
+}
+
+// Same key value in two tables; only TEXT keys can differ with equal hashes
+bool sameJoinKey(const JoinSide& a, size_t slotA, const JoinSide& b, size_t slotB) {
+    if (a.keyCol < 0 || a.table->isInt(a.keyCol)) return true;
+    const ColumnData& columnA = a.table->data[a.keyCol];
+    const ColumnData& columnB = b.table->data[b.keyCol];
+    return columnA.textLength(slotA) == columnB.textLength(slotB) &&
+           std::memcmp(columnA.textData(slotA), columnB.textData(slotB), columnA.textLength(slotA)) == 0;
+}
+
+// Matching slot pairs, one vector per morsel of the probe side, in probe
+// order and then build slot order
+std::vector<JoinMatches> hashJoin(const JoinSide sides[2]) {
+    int build = countSelected(sides[0].selection) <= countSelected(sides[1].selection) ? 0 : 1;
+    const JoinSide& buildSide = sides[build];
+    const JoinSide& probeSide = sides[1 - build];
+    JoinTable hash(buildSide);
+
+    std::vector<JoinMatches> matches(morselCount(probeSide.selection));
+    parallelFor(matches.size(), [&](size_t morsel) {
+        forEachSelectedIn(probeSide.selection, morsel, [&](size_t probeSlot) {
+            int64_t key = joinKey(*probeSide.table, probeSide.keyCol, probeSlot);
+            hash.forEachMatch(key, [&](size_t buildSlot) {
+                if (!sameJoinKey(probeSide, probeSlot, buildSide, buildSlot)) return;
+                matches[morsel].push_back(build == 0 ? JoinMatch(buildSlot, probeSlot)
+                                                     : JoinMatch(probeSlot, buildSlot));
+            });
+        });
+    });
+    return matches;
+}
+
+// ---- Query Plans ----
+PlanLiteral planLiteral(const std::string& text) {
+    PlanLiteral literal;
+    literal.text = text;
+    int64_t number;
+    if (text.size() > 1 && text.size() < 10 && text[0] == '?' && parseNumber(text.substr(1), number)) {
+        literal.param = static_cast<int>(number);
+    }
+    return literal;
+}
+
+// Statement text with each ?N replaced by literal N
+std::string bindStatement(const std::string& key, const std::vector<std::string>& literals) {
+    std::string text;
+    for (size_t i = 0; i < key.size(); i++) {
+        if (key[i] != '?' || i + 1 == key.size() || !std::isdigit(static_cast<unsigned char>(key[i + 1]))) {
+            text += key[i];
+            continue;
+        }
+        size_t number = 0;
+        while (i + 1 < key.size() && std::isdigit(static_cast<unsigned char>(key[i + 1]))) {
+            number = number * 10 + (key[++i] - '0');
+        }
+        if (number < literals.size()) text += literals[number];
+    }
+    return text;
+}
+
+// A literal's text for one execution. Without arguments, as for a statement
+// planned from its own text, a literal stands for itself.
+std::string bindLiteral(const PlanLiteral& literal, const std::vector<std::string>& args) {
+    if (args.empty()) return literal.text;
+    if (literal.param >= 0 && static_cast<size_t>(literal.param) < args.size()) return args[literal.param];
+    if (literal.text.find('?') != std::string::npos) return bindStatement(literal.text, args);
+    return literal.text;
+}
+
+// WHERE condition with its literals bound for one execution on `table`
+Condition bindWhere(const Condition& where, const std::vector<std::string>& args, const Table& table) {
+    Condition bound = where;
+    bindCondition(bound, [&](const std::string& literal) { return bindLiteral(planLiteral(literal), args); },
+                  &table);
+    return bound;
+}
+
+// Bumped when a table is created or the catalog replaced, which happens
+// under the exclusive catalog lock; plans from an older catalog are replanned
+std::atomic<uint64_t> catalogVersion(0);
+
+// Replace each number and quoted string with ?N, numbered from 0, and
+// collapse whitespace; the literals go to `literals` as written. A ? of the
+// statement's own is a parameter: its position goes to `parameters` and its
+// literal is empty. Without `parameters`, a ? makes the statement fail to
+// normalize.
+bool normalizeStatement(const std::string& text, std::string& key, std::vector<std::string>& literals,
+                        std::vector<size_t>* parameters) {
+    auto isWord = [](char c) { return std::isalnum(static_cast<unsigned char>(c)) || c == '_'; };
+    auto addLiteral = [&](const std::string& literal) {
+        key += '?';
+        key += std::to_string(literals.size());
+        literals.push_back(literal);
+    };
+
+    key.clear();
+    literals.clear();
+    size_t i = 0, n = text.size();
+    while (i < n) {
+        char c = text[i];
+        if (std::isspace(static_cast<unsigned char>(c))) {
+            while (i < n && std::isspace(static_cast<unsigned char>(text[i]))) i++;
+            if (!key.empty() && i < n) key += ' ';
+        } else if ((c == '"' || c == '\'') && (key.empty() || !isWord(key.back()))) {
+            // A doubled quote inside stands for the quote
+            size_t start = i++;
+            while (i < n && (text[i] != c || (i + 1 < n && text[i + 1] == c && ++i))) i++;
+            i = std::min(n, i + 1);
+            addLiteral(text.substr(start, i - start));
+        } else if (std::isdigit(static_cast<unsigned char>(c)) && (i == 0 || (!isWord(text[i - 1]) && text[i - 1] != '.'))) {
+            size_t start = i;
+            while (i < n && std::isdigit(static_cast<unsigned char>(text[i]))) i++;
+            if (i < n && (isWord(text[i]) || text[i] == '.')) {
+                key.append(text, start, i - start); // Part of a word
+            } else {
+                addLiteral(text.substr(start, i - start));
+            }
+        } else if (c == '?') {
+            if (!parameters) return false;
+            parameters->push_back(literals.size());
+            addLiteral("");
+            i++;
+        } else {
+            key += c;
+            i++;
+        }
+    }
+    return true;
+}
+
+PlanCache planCache(1024);
+
+// Plan of a statement, reused from the cache when its normalized text was
+// planned against the current catalog; `args` gets the literals to bind.
+// Planning errors are reported for the statement as written and not cached.
+PlanPtr statementPlan(const Statement& stmt, Planner planner, std::vector<std::string>& args,
+                      std::ostream& out) {
+    std::string key = stmt.key;
+    args = stmt.literals;
+    if (key.empty() && (stmt.text.size() > kMaxPlanText || !normalizeStatement(stmt.text, key, args))) {
+        args.clear();
+        return planner(stmt.text, out);
+    }
+
+    uint64_t version = catalogVersion.load();
+    PlanPtr cached = planCache.find(key);
+    if (cached && cached->catalogVersion == version) return cached;
+
+    std::ostringstream errors;
+    std::shared_ptr<Plan> plan = planner(key, errors);
+    if (!plan) {
+        args.clear();
+        return planner(stmt.text, out);
+    }
+    plan->catalogVersion = version;
+    planCache.insert(key, plan);
+    return plan;
+}
+
+// Prepared statements belong to the session, which has its own thread
+thread_local std::unordered_map<std::string, PreparedStatement> preparedStatements;
+
+// ---- Snapshot Files ----
+// Directory encoding: fixed-width integers and length-prefixed strings
+void putU64(std::string& out, uint64_t value) {
+    out.append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+void putString(std::string& out, const std::string& value) {
+    putU64(out, value.size());
+    out.append(value);
+}
+
+// Write one array as its own section; returns its offset
+uint64_t writeSection(SnapshotWriter& writer, const void* data, size_t size) {
+    if (size) writer.align();
+    uint64_t offset = writer.offset();
+    writer.write(data, size);
+    return offset;
+}
+
+// Register the arrays of a table with a capture, in the order writeTable
+// reads them: the row IDs, then per INT column its values, and per TEXT
+// column its codes or offsets, its lengths and its bytes
+void addArrays(const Table& table, ChunkCapture& capture) {
+    capture.add(table.ids.data(), table.ids.size(), sizeof(int));
+    for (size_t col = 0; col < table.columns.size(); col++) {
+        const ColumnData& column = table.data[col];
+        if (table.isInt(col)) {
+            capture.add(column.ints.data(), column.ints.size(), sizeof(int64_t));
+            continue;
+        }
+        if (column.encoded) {
+            capture.add(column.codes.data(), column.codes.size(), sizeof(uint16_t));
+        } else {
+            capture.add(column.offsets.data(), column.offsets.size(), sizeof(uint64_t));
+        }
+        capture.add(column.lengths.data(), column.lengths.size(), sizeof(uint32_t));
+        capture.add(column.bytes.data(), column.bytes.size(), 1);
+    }
+}
+
+// Write the sections of a TEXT column, whose arrays are captured from `id`
+// on, and describe them in the directory. Offsets are rebuilt from the
+// lengths on load, so bytes are written in order: in slot order for a
+// plain column, in entry order for an encoded one, whose entries are
+// always contiguous.
+void writeTextColumn(SnapshotWriter& writer, std::string& directory, ChunkCapture& capture, size_t id,
+                     bool encoded) {
+    size_t lengthsId = id + 1;
+    size_t bytesId = id + 2;
+    size_t numRows = capture.size(id);
+    if (!encoded) {
+        // The lengths are read again with the offsets to gather the bytes
+        putU64(directory, static_cast<uint64_t>(TextEncoding::PLAIN));
+        if (numRows) writer.align();
+        putU64(directory, writer.offset());
+        std::vector<uint32_t> lengths;
+        size_t liveBytes = 0;
+        for (size_t first = 0; first < numRows; first += ChunkCapture::kChunk) {
+            readCaptured(capture, lengthsId, first, std::min(numRows, first + ChunkCapture::kChunk), lengths,
+                         true);
+            for (uint32_t length : lengths) liveBytes += length;
+            writer.write(lengths.data(), lengths.size() * sizeof(uint32_t));
+        }
+        if (liveBytes) writer.align();
+        putU64(directory, writer.offset());
+        putU64(directory, liveBytes);
+        std::vector<uint64_t> offsets;
+        std::string bytes;
+        for (size_t first = 0; first < numRows; first += ChunkCapture::kChunk) {
+            size_t last = std::min(numRows, first + ChunkCapture::kChunk);
+            offsets.resize(last - first);
+            lengths.resize(last - first);
+            {
+                std::lock_guard<std::mutex> lock(capture.mutex);
+                capture.read(id, first, last, offsets.data());
+                capture.read(lengthsId, first, last, lengths.data());
+                size_t chunkBytes = 0;
+                for (uint32_t length : lengths) chunkBytes += length;
+                bytes.resize(chunkBytes);
+                char* to = &bytes[0];
+                for (size_t i = 0; i < offsets.size(); i++) {
+                    capture.read(bytesId, offsets[i], offsets[i] + lengths[i], to, true);
+                    to += lengths[i];
+                }
+            }
+            writer.write(bytes.data(), bytes.size());
+        }
+        capture.done(bytesId);
+        return;
+    }
+
+    // Codes are stored as runs when that takes at most half the space
+    std::vector<uint16_t> runCodes;
+    std::vector<uint32_t> runLengths;
+    std::vector<uint16_t> codes;
+    for (size_t first = 0; first < numRows; first += ChunkCapture::kChunk) {
+        readCaptured(capture, id, first, std::min(numRows, first + ChunkCapture::kChunk), codes, true);
+        size_t slot = first;
+        for (uint16_t code : codes) {
+            if (slot++ > 0 && code == runCodes.back()) {
+                runLengths.back()++;
+                continue;
+            }
+            if ((runCodes.size() + 1) * (sizeof(uint16_t) + sizeof(uint32_t)) * 2 > numRows * sizeof(uint16_t)) {
+                runCodes.clear();
+                break;
+            }
+            runCodes.push_back(code);
+            runLengths.push_back(1);
+        }
+        if (runCodes.empty()) break;
+    }
+    bool runs = !runCodes.empty();
+
+    putU64(directory, static_cast<uint64_t>(runs ? TextEncoding::DICTIONARY_RUNS : TextEncoding::DICTIONARY));
+    putU64(directory, capture.size(lengthsId));
+    putU64(directory, writeCaptured<uint32_t>(writer, capture, lengthsId));
+    putU64(directory, writeCaptured<char>(writer, capture, bytesId));
+    putU64(directory, capture.size(bytesId));
+    if (runs) {
+        capture.done(id);
+        putU64(directory, runCodes.size());
+        putU64(directory, writeSection(writer, runCodes.data(), runCodes.size() * sizeof(uint16_t)));
+        putU64(directory, writeSection(writer, runLengths.data(), runLengths.size() * sizeof(uint32_t)));
+    } else {
+        putU64(directory, writeCaptured<uint16_t>(writer, capture, id));
+    }
+}
+
+// Snapshots hold live rows only, so tables are compacted before a save
+void compactTables(TableMap& tables) {
+    for (auto& tablePair : tables) compactRows(tablePair.second);
+}
+
+// Write the sections of a table; returns its directory entry. The arrays
+// are read a chunk at a time through `capture`, a background save's, when
+// one is given, and `table` then only gives the definitions. Zone bounds
+// are computed from the values written, so they are as narrow as can be.
+std::string writeTable(SnapshotWriter& writer, const Table& table, ChunkCapture* capture) {
+    ChunkCapture direct;
+    if (!capture) {
+        addArrays(table, direct);
+        capture = &direct;
+    }
+    std::string entry;
+    size_t numRows = capture->size(0);
+    putString(entry, table.name);
+    putU64(entry, static_cast<uint32_t>(table.next_id));
+    putU64(entry, numRows);
+    putU64(entry, writeCaptured<int>(writer, *capture, 0));
+
+    putU64(entry, table.columns.size());
+    size_t id = 1;
+    for (size_t col = 0; col < table.columns.size(); col++) {
+        putString(entry, table.columns[col].name);
+        putString(entry, table.columns[col].type);
+        if (!table.isInt(col)) {
+            writeTextColumn(writer, entry, *capture, id, table.data[col].encoded);
+            id += 3;
+            continue;
+        }
+
+        if (numRows) writer.align();
+        putU64(entry, writer.offset());
+        std::vector<int64_t> values, zoneMin, zoneMax;
+        for (size_t first = 0; first < numRows; first += ChunkCapture::kChunk) {
+            readCaptured(*capture, id, first, std::min(numRows, first + ChunkCapture::kChunk), values);
+            for (size_t begin = 0; begin < values.size();) {
+                size_t slot = first + begin;
+                size_t end = std::min(values.size(), begin + kZoneSlots - slot % kZoneSlots);
+                auto range = std::minmax_element(values.begin() + begin, values.begin() + end);
+                if (slot / kZoneSlots == zoneMin.size()) {
+                    zoneMin.push_back(*range.first);
+                    zoneMax.push_back(*range.second);
+                } else {
+                    zoneMin.back() = std::min(zoneMin.back(), *range.first);
+                    zoneMax.back() = std::max(zoneMax.back(), *range.second);
+                }
+                begin = end;
+            }
+            writer.write(values.data(), values.size() * sizeof(int64_t));
+        }
+        putU64(entry, zoneMin.size());
+        putU64(entry, writeSection(writer, zoneMin.data(), zoneMin.size() * sizeof(int64_t)));
+        putU64(entry, writeSection(writer, zoneMax.data(), zoneMax.size() * sizeof(int64_t)));
+        id++;
+    }
+
+    // Index definitions; LOAD rebuilds the indexes from the rows
+    putU64(entry, table.indexes.size());
+    for (const auto& index : table.indexes) {
+        putString(entry, index.name);
+        putU64(entry, index.colIndex);
+        putU64(entry, index.kind == IndexKind::HASH ? 0 : 1);
+    }
+    return entry;
+}
+
+// Write the directory of `numTables` entries after the sections and flush;
+// returns the header that locates it
+SnapshotHeader writeDirectory(SnapshotWriter& writer, uint64_t numTables, const std::string& entries,
+                              uint64_t logSequence) {
+    std::string directory;
+    putU64(directory, numTables);
+    directory += entries;
+
+    SnapshotHeader header = {};
+    header.directoryOffset = writeSection(writer, directory.data(), directory.size());
+    header.directorySize = directory.size();
+    header.fileSize = writer.offset();
+    writer.flush();
+
+    std::memcpy(header.magic, kSnapshotMagic, sizeof(header.magic));
+    header.version = kSnapshotVersion;
+    header.align = kSnapshotAlign;
+    header.logSequence = logSequence;
+    return header;
+}
+
+void writeHeader(std::ostream& file, const SnapshotHeader& header) {
+    file.seekp(0);
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+}
+
+void saveSnapshot(const TableMap& tables, const std::string& filename, uint64_t logSequence) {
+    std::ofstream file(filename, std::ios::binary);
+    if (!file) throw std::runtime_error("could not open file '" + filename + "' for writing");
+
+    // The header page is rewritten once the directory location is known
+    SnapshotWriter writer(file);
+    SnapshotHeader header = {};
+    writer.write(&header, sizeof(header));
+
+    std::string entries;
+    for (const auto& tablePair : tables) entries += writeTable(writer, tablePair.second);
+    writeHeader(file, writeDirectory(writer, tables.size(), entries, logSequence));
+    file.close();
+    if (!file) throw std::runtime_error("could not write file '" + filename + "'");
+}
+
+// Start of a section of `count` elements of `width` bytes, bounds-checked
+const char* sectionAt(const MappedFile& file, uint64_t offset, uint64_t count, size_t width) {
+    if (offset > file.size() || count > (file.size() - offset) / width) {
+        throw std::runtime_error("snapshot section out of bounds");
+    }
+    return file.data() + offset;
+}
+
+bool isSnapshot(const MappedFile& file) {
+    return file.size() >= sizeof(SnapshotHeader) &&
+           std::memcmp(file.data(), kSnapshotMagic, sizeof(kSnapshotMagic)) == 0;
+}
+
+// Read a TEXT column written by writeTextColumn. A column from a version 1
+// file is plain, and is encoded if its values fit a dictionary.
+void readTextColumn(const MappedFile& file, DirectoryReader& dir, ColumnData& data, size_t numRows,
+                    uint32_t version) {
+    uint64_t encodingId = version < 2 ? 0 : dir.u64();
+    if (encodingId > static_cast<uint64_t>(TextEncoding::DICTIONARY_RUNS)) {
+        throw std::runtime_error("unknown TEXT encoding");
+    }
+    TextEncoding encoding = static_cast<TextEncoding>(encodingId);
+    size_t numEntries = numRows;
+    if (encoding != TextEncoding::PLAIN) {
+        numEntries = dir.u64();
+        if (numEntries > kMaxDictionaryEntries) throw std::runtime_error("corrupt TEXT dictionary");
+    }
+
+    readSection(file, dir.u64(), numEntries, data.lengths);
+    uint64_t bytesOffset = dir.u64();
+    uint64_t bytesSize = dir.u64();
+    const char* bytes = sectionAt(file, bytesOffset, bytesSize, 1);
+    if (!bytesSize || !data.bytes.map(file.descriptor(), bytesOffset, bytesSize)) {
+        data.bytes.assign(bytes, bytesSize);
+    }
+    data.offsets.clear();
+    data.offsets.reserve(numEntries);
+    data.lengths.willNeed(0, numEntries); // Paged lengths are all read here
+    uint64_t offset = 0;
+    for (size_t entry = 0; entry < numEntries; entry++) {
+        data.offsets.push_back(offset);
+        offset += data.lengths[entry];
+    }
+    if (offset != data.bytes.size()) throw std::runtime_error("corrupt TEXT column");
+
+    if (encoding == TextEncoding::PLAIN) {
+        data.encoded = false;
+        if (version < 2) compactText(data);
+        return;
+    }
+
+    if (encoding == TextEncoding::DICTIONARY_RUNS) {
+        size_t numRuns = dir.u64();
+        std::vector<uint16_t> runCodes;
+        std::vector<uint32_t> runLengths;
+        readSection(file, dir.u64(), numRuns, runCodes);
+        readSection(file, dir.u64(), numRuns, runLengths);
+        data.codes.reserve(numRows);
+        for (size_t run = 0; run < numRuns; run++) {
+            if (runLengths[run] > numRows - data.codes.size()) throw std::runtime_error("corrupt TEXT runs");
+            data.codes.append(runLengths[run], runCodes[run]);
+        }
+        if (data.codes.size() != numRows) throw std::runtime_error("corrupt TEXT runs");
+    } else {
+        readSection(file, dir.u64(), numRows, data.codes);
+        data.codes.willNeed(0, numRows);
+    }
+    for (uint16_t code : data.codes) {
+        if (code >= numEntries) throw std::runtime_error("corrupt TEXT codes");
+    }
+    size_t size = 8;
+    while (size < numEntries * 2) size *= 2;
+    rehashEntries(data, size);
+}
+
+// Step over the directory fields of a TEXT column written by writeTextColumn
+void skipTextColumn(DirectoryReader& dir, uint32_t version) {
+    uint64_t encodingId = version < 2 ? 0 : dir.u64();
+    if (encodingId > static_cast<uint64_t>(TextEncoding::DICTIONARY_RUNS)) {
+        throw std::runtime_error("unknown TEXT encoding");
+    }
+    TextEncoding encoding = static_cast<TextEncoding>(encodingId);
+    if (encoding != TextEncoding::PLAIN) dir.u64(); // Entries
+    dir.u64();                                      // Lengths
+    dir.u64();                                      // Bytes and their size
+    dir.u64();
+    if (encoding == TextEncoding::DICTIONARY_RUNS) {
+        dir.u64(); // Runs, their codes and their lengths
+        dir.u64();
+        dir.u64();
+    } else if (encoding == TextEncoding::DICTIONARY) {
+        dir.u64(); // Codes
+    }
+}
+
+// Read a table's directory entry, with its rows unless `rows` is false.
+// Index definitions are read, but the indexes are left to be rebuilt.
+Table readTable(const MappedFile& file, DirectoryReader& dir, uint32_t version, bool rows) {
+    Table table;
+    table.name = dir.str();
+    table.next_id = static_cast<int>(dir.u64());
+    size_t numRows = dir.u64();
+    uint64_t idsOffset = dir.u64();
+    if (rows) readSection(file, idsOffset, numRows, table.ids);
+
+    uint64_t numColumns = dir.u64();
+    table.data.resize(numColumns);
+    for (uint64_t col = 0; col < numColumns; col++) {
+        Column column;
+        column.name = dir.str();
+        column.type = dir.str();
+        table.columns.push_back(column);
+
+        ColumnData& data = table.data[col];
+        if (table.isInt(col)) {
+            uint64_t valuesOffset = dir.u64();
+            if (rows) readSection(file, valuesOffset, numRows, data.ints);
+            if (version < 3) {
+                if (rows) rebuildZones(data);
+                continue;
+            }
+            size_t numZones = dir.u64();
+            if (numZones != (numRows + kZoneSlots - 1) / kZoneSlots) {
+                throw std::runtime_error("corrupt zone bounds");
+            }
+            uint64_t minOffset = dir.u64();
+            uint64_t maxOffset = dir.u64();
+            if (rows) {
+                readSection(file, minOffset, numZones, data.zoneMin);
+                readSection(file, maxOffset, numZones, data.zoneMax);
+            }
+            continue;
+        }
+
+        if (rows) {
+            readTextColumn(file, dir, data, numRows, version);
+        } else {
+            skipTextColumn(dir, version);
+        }
+    }
+
+    uint64_t numIndexes = dir.u64();
+    for (uint64_t j = 0; j < numIndexes; j++) {
+        Index index;
+        index.name = dir.str();
+        index.colIndex = static_cast<int>(dir.u64());
+        index.kind = dir.u64() == 0 ? IndexKind::HASH : IndexKind::BTREE;
+        if (index.colIndex < 0 || index.colIndex >= static_cast<int>(numColumns)) {
+            throw std::runtime_error("corrupt index definition");
+        }
+        table.indexes.push_back(std::move(index));
+    }
+    return table;
+}
+
+// Header of a snapshot, checked against the file's size
+SnapshotHeader readHeader(const MappedFile& file) {
+    SnapshotHeader header;
+    std::memcpy(&header, file.data(), sizeof(header));
+    if (header.version == 0 || header.version > kSnapshotVersion) {
+        throw std::runtime_error("unsupported snapshot version " + std::to_string(header.version));
+    }
+    // Bytes past the recorded size are from a save that did not finish
+    if (header.fileSize > file.size() || header.directoryOffset > file.size() ||
+        header.directorySize > file.size() - header.directoryOffset) {
+        throw std::runtime_error("truncated snapshot");
+    }
+    return header;
+}
+
+// Returns the log sequence stored in the header
+uint64_t loadSnapshot(const MappedFile& file, TableMap& tables) {
+    SnapshotHeader header = readHeader(file);
+    DirectoryReader dir(file.data() + header.directoryOffset, header.directorySize);
+    uint64_t numTables = dir.u64();
+    for (uint64_t i = 0; i < numTables; i++) {
+        Table table = readTable(file, dir, header.version);
+        for (auto& index : table.indexes) rebuildIndex(table, index);
+        std::string tableName = table.name;
+        tables[tableName] = std::move(table);
+    }
+    return header.logSequence;
+}
+
+// ---- Write-Ahead Log ----
+// Flush stdio buffers and force the file to stable storage
+void syncFile(std::FILE* file) {
+    std::fflush(file);
+#ifdef CRT_HAVE_FSYNC
+    fsync(fileno(file));
+#endif
+}
+
+// Force an already written file to stable storage
+void syncPath(const std::string& path) {
+#ifdef CRT_HAVE_FSYNC
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) return;
+    fsync(fd);
+    ::close(fd);
+#else
+    (void)path;
+#endif
+}
+
+uint32_t logChecksum(const std::string& payload) {
+    return static_cast<uint32_t>(hashText(payload.data(), payload.size()));
+}
+
+// Last record this thread appended to the log, to wait for under GROUP
+thread_local uint64_t appendedRecord = 0;
+
+WriteAheadLog wal;
+std::string walSnapshotPath; // Snapshot the log is replayed over
+
+// ---- Saved Files ----
+// Write the tables `changed` to the file of `base`, appending to it when
+// `append` is set, and a directory that also points at the sections of the
+// tables `kept` from `base`; returns what the file then holds. For a
+// background save, `captures` has the rows of each changed table, which
+// are read through it and no longer kept once written. The tables `reread`
+// are read back from their sections in `source` one at a time and written
+// too. An append is synced before the header points at it; a new file is
+// written aside and renamed over the old one, so arrays paged from the old
+// one still read it.
+SavedFile writeSavedFile(const SavedFile& base, const std::vector<std::string>& kept,
+                         const std::vector<const Table*>& changed,
+                         const std::vector<std::shared_ptr<ChunkCapture>>& captures,
+                         const std::vector<SavedTable>& reread, const MappedFile* source, bool append,
+                         std::atomic<uint64_t>* progress, std::atomic<size_t>* tablesWritten) {
+    SavedFile saved;
+    saved.filename = base.filename;
+    std::fstream file;
+    uint64_t start = 0;
+    std::string path = append ? base.filename : base.filename + ".tmp";
+    if (append) {
+        start = base.fileSize;
+        file.open(path, std::ios::binary | std::ios::in | std::ios::out);
+        file.seekp(start);
+    } else {
+        file.open(path, std::ios::binary | std::ios::out | std::ios::trunc);
+    }
+    if (!file) throw std::runtime_error("could not open file '" + path + "' for writing");
+
+    // A new file's header page is written once the directory location is known
+    SnapshotWriter writer(file, start, progress);
+    if (!append) {
+        SnapshotHeader header = {};
+        writer.write(&header, sizeof(header));
+    }
+    std::string entries;
+    for (const auto& name : kept) {
+        saved.tables[name] = base.tables.at(name);
+        entries += saved.tables[name].entry;
+    }
+    auto write = [&](const Table& table, ChunkCapture* capture) {
+        SavedTable& entry = saved.tables[table.name];
+        entry.changedAt = table.changedAt;
+        entry.offset = writer.offset();
+        entry.entry = writeTable(writer, table, capture);
+        entry.bytes = writer.offset() - entry.offset;
+        entries += entry.entry;
+        if (tablesWritten) (*tablesWritten)++;
+    };
+    for (size_t i = 0; i < changed.size(); i++) {
+        ChunkCapture* capture = i < captures.size() ? captures[i].get() : nullptr;
+        write(*changed[i], capture);
+        if (capture) capture->close();
+    }
+    for (const auto& entry : reread) {
+        source->willNeed(entry.offset, entry.bytes);
+        DirectoryReader dir(entry.entry.data(), entry.entry.size());
+        Table table = readTable(*source, dir, kSnapshotVersion);
+        table.changedAt = entry.changedAt;
+        write(table, nullptr);
+    }
+
+    SnapshotHeader header = writeDirectory(writer, saved.tables.size(), entries, 0);
+    if (append) {
+        file.flush();
+        syncPath(base.filename);
+    }
+    writeHeader(file, header);
+    file.close();
+    if (!file) throw std::runtime_error("could not write file '" + path + "'");
+    if (!append) {
+#ifndef CRT_HAVE_FSYNC
+        std::remove(base.filename.c_str()); // rename does not replace files here
+#endif
+        if (std::rename(path.c_str(), base.filename.c_str()) != 0) {
+            throw std::runtime_error("could not replace '" + base.filename + "'");
+        }
+    }
+    saved.fileSize = header.fileSize;
+    saved.directoryOffset = header.directoryOffset;
+    return saved;
+}
+
+// ---- Buffer Pool ----
+// LOAD name PAGED reads only the directory of a snapshot. Its tables stay in
+// the file, their data file, and are read in when a statement pins them:
+// their sections are mapped as the arrays' pages, privately, so operators
+// still read contiguous arrays, and only the indexes are built in memory.
+// Scans touch a morsel before reading it, which counts the pages its rows
+// are on against the pool's budget and reads the next morsel ahead. Once
+// the pool is over budget it gives back the pages of the morsels read
+// longest ago, so a scan streams through a table larger than the budget,
+// and then evicts tables no statement has pinned, going round them like a
+// clock and passing over any pinned since its last pass. A table changed
+// since it was read in is first written back to the data file, as an
+// incremental save would. Reading in and writing back happen outside the
+// pool's lock.
+
+// Pages of the paged arrays that rows [first, last) of a column are on, or
+// of the row IDs for column -1; returns their bytes, or for DROP the bytes
+// given back. A TEXT column's bytes are taken to lie between the starts of
+// its first and last rows' values, so no page is read to find them.
+size_t columnPages(const Table& table, int col, size_t first, size_t last, PageAction action) {
+    if (col < 0) return arrayPages(table.ids, first, last, sizeof(int), action);
+    const ColumnData& column = table.data[col];
+    if (table.isInt(col)) return arrayPages(column.ints, first, last, sizeof(int64_t), action);
+    if (column.encoded) return arrayPages(column.codes, first, last, sizeof(uint16_t), action);
+    last = std::min(last, column.offsets.size());
+    if (first >= last) return 0;
+    uint64_t begin = std::min(column.offsets[first], column.offsets[last - 1]);
+    uint64_t end = std::max(column.offsets[first], column.offsets[last - 1]) + 1;
+    return arrayPages(column.bytes, begin, end, 1, action) +
+           arrayPages(column.lengths, first, last, sizeof(uint32_t), action);
+}
+
+// Pages of the paged arrays of every column that a morsel's rows are on
+size_t morselPages(const Table& table, size_t morsel, PageAction action) {
+    size_t first = morsel * kMorselSlots;
+    size_t last = std::min(table.rowCount(), first + kMorselSlots);
+    if (first >= last) return 0;
+    size_t bytes = 0;
+    for (int col = -1; col < static_cast<int>(table.data.size()); col++) {
+        bytes += columnPages(table, col, first, last, action);
+    }
+    return bytes;
+}
+
+// Bytes a table holds that the pool cannot give back by the page, from the
+// sizes of its arrays and indexes: paged arrays count only the chunks
+// written since they were mapped
+size_t heldBytes(const Table& table) {
+    size_t bytes = table.ids.heldBytes() + table.deleted.capacity() * sizeof(uint64_t);
+    for (const auto& column : table.data) {
+        bytes += column.ints.heldBytes() + column.offsets.heldBytes() + column.lengths.heldBytes() +
+                 column.codes.heldBytes() + column.bytes.heldBytes() +
+                 (column.zoneMin.capacity() + column.zoneMax.capacity()) * sizeof(int64_t) +
+                 column.lookup.capacity() * sizeof(uint32_t);
+    }
+    for (const auto& index : table.indexes) {
+        bytes += index.hash.bucket_count() * sizeof(void*) + index.tree.memoryBytes();
+        if (!index.hash.empty()) {
+            bytes += index.hash.size() * (sizeof(*index.hash.begin()) + 2 * sizeof(void*)) +
+                     table.rowCount() * sizeof(int);
+        }
+    }
+    return bytes;
+}
+
+// Where a table's sections start: its row ID section comes first
+uint64_t sectionsStart(const std::string& entry) {
+    DirectoryReader dir(entry.data(), entry.size());
+    dir.str(); // Name
+    dir.u64(); // next_id
+    dir.u64(); // Rows
+    return dir.u64();
+}
+
+// Read the definitions of the tables of a snapshot into `tables`, marked
+// paged; returns where their sections are
+SavedFile readPagedTables(const MappedFile& file, const std::string& filename, TableMap& tables) {
+    SnapshotHeader header = readHeader(file);
+    if (header.version != kSnapshotVersion) {
+        throw std::runtime_error("'" + filename + "' is from an earlier version; LOAD and SAVE it first");
+    }
+    SavedFile saved;
+    saved.filename = filename;
+    saved.fileSize = header.fileSize;
+    saved.directoryOffset = header.directoryOffset;
+
+    DirectoryReader dir(file.data() + header.directoryOffset, header.directorySize);
+    uint64_t numTables = dir.u64();
+    std::vector<SavedTable*> bySection;
+    for (uint64_t i = 0; i < numTables; i++) {
+        size_t start = dir.position();
+        Table table = readTable(file, dir, header.version, false);
+        table.paged = true;
+        SavedTable& entry = saved.tables[table.name];
+        entry.changedAt = table.changedAt;
+        entry.entry.assign(file.data() + header.directoryOffset + start, dir.position() - start);
+        entry.offset = sectionsStart(entry.entry);
+        bySection.push_back(&entry);
+        std::string tableName = table.name;
+        tables[tableName] = std::move(table);
+    }
+
+    // A table's sections are written together, so they run up to the next
+    // table's or the directory. Older sections in between are read ahead too.
+    std::sort(bySection.begin(), bySection.end(),
+              [](const SavedTable* a, const SavedTable* b) { return a->offset < b->offset; });
+    for (size_t i = 0; i < bySection.size(); i++) {
+        uint64_t end = i + 1 < bySection.size() ? bySection[i + 1]->offset : header.directoryOffset;
+        bySection[i]->bytes = end > bySection[i]->offset ? end - bySection[i]->offset : 0;
+    }
+    return saved;
+}
+
+BufferPool bufferPool;
+
+// ---- Background Compaction ----
+Compactor compactor;
+
+// ---- Background Saves ----
+// Column and index definitions of a table, for a background save to write
+// with the rows it captured
+std::unique_ptr<Table> copyDefinitions(const Table& table) {
+    std::unique_ptr<Table> copy(new Table());
+    copy->name = table.name;
+    copy->columns = table.columns;
+    copy->data.resize(table.data.size());
+    for (size_t col = 0; col < table.data.size(); col++) copy->data[col].encoded = table.data[col].encoded;
+    copy->next_id = table.next_id;
+    copy->changedAt = table.changedAt;
+    for (const auto& index : table.indexes) {
+        Index definition;
+        definition.name = index.name;
+        definition.colIndex = index.colIndex;
+        definition.kind = index.kind;
+        copy->indexes.push_back(std::move(definition));
+    }
+    return copy;
+}
+
+// Have a background save read the arrays of a table through a new capture,
+// registered in the order addArrays gives. Copies nothing until the table
+// changes.
+std::shared_ptr<ChunkCapture> captureTable(Table& table) {
+    std::shared_ptr<ChunkCapture> capture = std::make_shared<ChunkCapture>();
+    table.ids.capture(capture);
+    for (size_t col = 0; col < table.columns.size(); col++) {
+        ColumnData& column = table.data[col];
+        if (table.isInt(col)) {
+            column.ints.capture(capture);
+            continue;
+        }
+        if (column.encoded) {
+            column.codes.capture(capture);
+        } else {
+            column.offsets.capture(capture);
+        }
+        column.lengths.capture(capture);
+        column.bytes.capture(capture);
+    }
+    table.capture = capture;
+    return capture;
+}
+
+Saver saver;
+
+// ---- Transactions ----
+// BEGIN opens a transaction on the session, with a snapshot of the commits
+// made so far. Its writes are stamped with its marker and logged when it
+// commits, as one record, so recovery replays all of them or none. While
+// transactions are open, writes outside them run as transactions of their
+// own, committed as they finish. Statements still take their table locks as
+// usual, except that a scan in a snapshot holds its lock only while it
+// captures the view it reads (see captureView), so writes, and commits,
+// run during it.
+std::mutex transactionMutex;           // Guards the stamps and open snapshots
+uint64_t lastCommitStamp = 0;
+uint64_t transactionCount = 0;
+std::vector<uint64_t> openSnapshots;   // Of transactions opened by BEGIN; ascending, as stamps only grow
+
+// Give a transaction its marker and a snapshot of the commits so far
+void startTransaction(Transaction& txn, bool explicitBegin) {
+    std::lock_guard<std::mutex> lock(transactionMutex);
+    txn.marker = kUncommitted | ++transactionCount;
+    txn.snapshot = lastCommitStamp;
+    if (explicitBegin) openSnapshots.push_back(txn.snapshot);
+}
+
+// Close a transaction, setting `stamp` to a new commit stamp if given one;
+// returns the oldest snapshot still open
+uint64_t finishTransaction(const Transaction& txn, bool explicitBegin, uint64_t* stamp) {
+    std::lock_guard<std::mutex> lock(transactionMutex);
+    if (stamp) *stamp = ++lastCommitStamp;
+    if (explicitBegin) openSnapshots.erase(std::find(openSnapshots.begin(), openSnapshots.end(), txn.snapshot));
+    return openSnapshots.empty() ? lastCommitStamp : openSnapshots.front();
+}
+
+bool transactionsOpen() {
+    std::lock_guard<std::mutex> lock(transactionMutex);
+    return !openSnapshots.empty();
+}
+
+uint64_t oldestSnapshot() {
+    std::lock_guard<std::mutex> lock(transactionMutex);
+    return openSnapshots.empty() ? lastCommitStamp : openSnapshots.front();
+}
+
+// Drop the versions a table no longer needs, and queue it for compaction
+// once it can be
+void collectTable(Table& table, uint64_t oldest) {
+    collectVersions(table, oldest);
+    if (needsCompaction(table)) compactor.schedule(table.name);
+}
+
+// Stamp or undo the writes of a transaction that is finishing
+void finishWrites(const Transaction& txn, bool commit, uint64_t stamp) {
+    for (const auto& written : txn.tables) {
+        auto it = database.find(written.first);
+        if (it == database.end()) continue;
+        if (commit) {
+            commitWrites(it->second, written.second, stamp);
+        } else {
+            rollbackWrites(it->second, written.second);
+        }
+    }
+}
+
+// Tables the session's transaction wrote, in name order
+std::vector<std::string> writtenTables() {
+    std::vector<std::string> names;
+    if (!activeTransaction) return names;
+    for (const auto& written : activeTransaction->tables) names.push_back(written.first);
+    std::sort(names.begin(), names.end());
+    return names;
+}
+
+// End the session's transaction, committed or rolled back. Runs under the
+// locks of the tables it wrote, which are collected on the way out; the
+// others are left to collectOthers.
+void endSessionTransaction(bool commit) {
+    std::unique_ptr<Transaction> txn = std::move(activeTransaction);
+    bool changed = false;
+    for (const auto& written : txn->tables) {
+        auto it = database.find(written.first);
+        changed = changed || (it != database.end() && hasWrites(it->second, written.second));
+    }
+    uint64_t stamp = 0;
+    uint64_t oldest = finishTransaction(*txn, true, commit && changed ? &stamp : nullptr);
+    finishWrites(*txn, commit, stamp);
+    for (const auto& written : txn->tables) {
+        auto it = database.find(written.first);
+        if (it != database.end()) collectTable(it->second, oldest);
+    }
+}
+
+// Collect the tables a finished transaction did not write, locking one at a
+// time, since the snapshot it closed may have held their versions back
+void collectOthers(const std::vector<std::string>& written) {
+    uint64_t oldest = oldestSnapshot();
+    for (auto& tablePair : database) {
+        if (std::binary_search(written.begin(), written.end(), tablePair.first)) continue;
+        std::lock_guard<SharedMutex> lock(*tablePair.second.lock);
+        collectTable(tablePair.second, oldest);
+    }
+}
+
+// BEGIN [TRANSACTION]
+void handleBegin(std::ostream& out) {
+    if (activeTransaction) {
+        out << "Error: A transaction is already open.\n";
+        return;
+    }
+    activeTransaction.reset(new Transaction());
+    startTransaction(*activeTransaction, true);
+    out << "Transaction started.\n";
+}
+
+// COMMIT: the statements are logged before the writes are stamped, so a
+// commit that could not be logged is rolled back instead
+void handleCommit(std::ostream& out) {
+    if (!activeTransaction) {
+        out << "Error: No transaction is open.\n";
+        return;
+    }
+    const std::vector<std::string>& log = activeTransaction->log;
+    if (!log.empty()) {
+        // Statements are one line each, so a NUL byte can separate them
+        std::string record = log[0];
+        for (size_t i = 1; i < log.size(); i++) record += '\0' + log[i];
+        try {
+            wal.append(record);
+        } catch (const std::exception& e) {
+            endSessionTransaction(false);
+            out << "Error: " << e.what() << "; transaction rolled back.\n";
+            return;
+        }
+    }
+    endSessionTransaction(true);
+    out << "Transaction committed.\n";
+}
+
+void handleRollback(std::ostream& out) {
+    if (!activeTransaction) {
+        out << "Error: No transaction is open.\n";
+        return;
+    }
+    endSessionTransaction(false);
+    out << "Transaction rolled back.\n";
+}
+
+// ---- Snapshot Reads ----
+std::mutex viewMutex; // Readers sharing a table's lock capture views of it one at a time
+thread_local ReadLock* ReadLock::innermost = nullptr;
+
+// A table whose arrays read those of `table` as they are now, holding the
+// slots the session sees as its live ones. Call under the table's lock.
+// Zone bounds and the dictionary lookup are copied, since they change in
+// place; the view has no indexes, so it is only scanned.
+std::unique_ptr<Table> captureView(Table& table) {
+    std::unique_ptr<Table> view(new Table());
+    view->name = table.name;
+    view->columns = table.columns;
+    view->next_id = table.next_id;
+    view->deltaStart = table.deltaStart;
+    view->view = true;
+    Bitmap scratch;
+    const Bitmap& hidden = hiddenSlots(table, scratch);
+    view->deleted = &hidden == &scratch ? std::move(scratch) : hidden;
+    view->deletedRows = countSelected(view->deleted);
+
+    std::lock_guard<std::mutex> lock(viewMutex);
+    std::shared_ptr<ViewBuffers> buffers = table.views.lock();
+    if (!buffers) {
+        buffers = std::make_shared<ViewBuffers>();
+        table.views = buffers;
+    }
+    view->viewed = buffers;
+    view->ids = table.ids.view(buffers);
+    view->data.resize(table.data.size());
+    for (size_t col = 0; col < table.data.size(); col++) {
+        ColumnData& column = table.data[col];
+        ColumnData& copy = view->data[col];
+        copy.ints = column.ints.view(buffers);
+        copy.zoneMin = column.zoneMin;
+        copy.zoneMax = column.zoneMax;
+        copy.offsets = column.offsets.view(buffers);
+        copy.lengths = column.lengths.view(buffers);
+        copy.bytes = column.bytes.view(buffers);
+        copy.encoded = column.encoded;
+        copy.codes = column.codes.view(buffers);
+        copy.lookup = column.lookup;
+    }
+    return view;
+}
+
+// The table a SELECT reads the rows of `cond` from. In a snapshot, rows
+// found by a scan are read from a view of the table, which releases its
+// lock; a lookup is quick, and keeps the lock.
+const Table& readTable(const Table& table, const Condition& cond, size_t limit) {
+    ReadLock* lock = ReadLock::held(table);
+    if (!lock || !activeTransaction) return table;
+    if (!lock->viewed()) {
+        AccessKind kind = planAccess(table, cond, limit).kind;
+        if (kind == AccessKind::ROW_ID_LOOKUP || kind == AccessKind::INDEX_LOOKUP) return table;
+    }
+    return lock->view();
+}
+
+// ---- Command Handlers ----
+// Handlers that change the database return true when they did, so the
+// statement can be written to the log.
+
+// CREATE TABLE tableName (col1 TYPE, col2 TYPE, ...)
+bool handleCreate(const std::string& command, std::ostream& out) {
+    try {
+        std::istringstream ss(command);
+        std::string word, tableName;
+        ss >> word; // CREATE
+        ss >> word; // TABLE
+        ss >> tableName;
+
+        if (tableName.empty()) {
+            out << "Error: Table name is required.\n";
+            return false;
+        }
+
+        if (database.find(tableName) != database.end()) {
+            out << "Error: Table '" << tableName << "' already exists.\n";
+            return false;
+        }
+
+        Table t;
+        t.name = tableName;
+
+        std::string rest;
+        std::getline(ss, rest); // (id INT, name TEXT, age INT)
+
+        // Check if parentheses are present
+        if (rest.find('(') == std::string::npos || rest.find(')') == std::string::npos) {
+            out << "Error: Column definitions must be enclosed in parentheses.\n";
+            return false;
+        }
+
+        rest.erase(std::remove(rest.begin(), rest.end(), '('), rest.end());
+        rest.erase(std::remove(rest.begin(), rest.end(), ')'), rest.end());
+
+        std::istringstream colStream(rest);
+        std::string colDef;
+        bool hasColumns = false;
+
+        while (std::getline(colStream, colDef, ',')) {
+            colDef = trim(colDef);
+            if (colDef.empty()) continue;
+
+            std::istringstream colDefStream(colDef);
+            std::string colName, colType;
+            colDefStream >> colName >> colType;
+
+            if (colName.empty() || colType.empty()) {
+                out << "Error: Invalid column definition: '" << colDef << "'.\n";
+                return false;
+            }
+
+            colType = toUpper(colType);
+            if (colType != "INT" && colType != "TEXT") {
+                out << "Error: Unsupported data type: '" << colType << "'. Use INT or TEXT.\n";
+                return false;
+            }
+
+            t.columns.push_back({colName, colType});
+            hasColumns = true;
+        }
+
+        if (!hasColumns) {
+            out << "Error: No valid columns defined.\n";
+            return false;
+        }
+
+        t.data.resize(t.columns.size());
+        database[t.name] = std::move(t);
+        catalogVersion++;
+        out << "Table '" << tableName << "' created successfully.\n";
+        return true;
+    } catch (const std::exception& e) {
+        out << "Error creating table: " << e.what() << "\n";
+        return false;
+    }
+}
+
+// CREATE INDEX indexName ON tableName(column) [USING HASH|BTREE]
+bool handleCreateIndex(const std::string& command, std::ostream& out) {
+    try {
+        std::istringstream ss(command);
+        std::string word, indexName;
+        ss >> word; // CREATE
+        ss >> word; // INDEX
+        ss >> indexName;
+        ss >> word; // ON
+
+        if (indexName.empty() || toUpper(word) != "ON") {
+            out << "Error: Expected CREATE INDEX indexName ON tableName(column).\n";
+            return false;
+        }
+
+        std::string rest;
+        std::getline(ss, rest); // users(age) USING BTREE
+
+        size_t open = rest.find('(');
+        size_t close = rest.find(')');
+        if (open == std::string::npos || close == std::string::npos || close < open) {
+            out << "Error: Indexed column must be enclosed in parentheses.\n";
+            return false;
+        }
+
+        std::string tableName = trim(rest.substr(0, open));
+        std::string colName = trim(rest.substr(open + 1, close - open - 1));
+
+        IndexKind kind = IndexKind::BTREE;
+        std::istringstream usingStream(rest.substr(close + 1));
+        std::string kindName;
+        if (usingStream >> word) {
+            usingStream >> kindName;
+            kindName = toUpper(kindName);
+            if (toUpper(word) != "USING" || (kindName != "HASH" && kindName != "BTREE")) {
+                out << "Error: Index type must be USING HASH or USING BTREE.\n";
+                return false;
+            }
+            kind = kindName == "HASH" ? IndexKind::HASH : IndexKind::BTREE;
+        }
+
+        if (database.find(tableName) == database.end()) {
+            out << "Error: Table '" << tableName << "' does not exist.\n";
+            return false;
+        }
+
+        if (findIndexByName(indexName, nullptr)) {
+            out << "Error: Index '" << indexName << "' already exists.\n";
+            return false;
+        }
+
+        Table& table = database[tableName];
+        PinGuard pin(table);
+
+        // Find column index
+        int colIndex = -1;
+        for (size_t i = 0; i < table.columns.size(); i++) {
+            if (table.columns[i].name == colName) {
+                colIndex = i;
+                break;
+            }
+        }
+
+        if (colIndex == -1) {
+            out << "Error: Column '" << colName << "' not found.\n";
+            return false;
+        }
+
+        Index index;
+        index.name = indexName;
+        index.colIndex = colIndex;
+        index.kind = kind;
+        rebuildIndex(table, index);
+        table.indexes.push_back(std::move(index));
+        table.markChanged();
+
+        out << "Index '" << indexName << "' created on '" << tableName << "(" << colName << ")'.\n";
+        return true;
+    } catch (const std::exception& e) {
+        out << "Error creating index: " << e.what() << "\n";
+        return false;
+    }
+}
+
+// DROP INDEX indexName
+bool handleDropIndex(const std::string& command, std::ostream& out) {
+    try {
+        std::istringstream ss(command);
+        std::string word, indexName;
+        ss >> word; // DROP
+        ss >> word; // INDEX
+        ss >> indexName;
+
+        Table* table = nullptr;
+        Index* index = findIndexByName(indexName, &table);
+        if (!index) {
+            out << "Error: Index '" << indexName << "' not found.\n";
+            return false;
+        }
+
+        PinGuard pin(*table); // A paged table is written back whole once changed
+        table->indexes.erase(table->indexes.begin() + (index - table->indexes.data()));
+        table->markChanged();
+        out << "Index '" << indexName << "' dropped.\n";
+        return true;
+    } catch (const std::exception& e) {
+        out << "Error dropping index: " << e.what() << "\n";
+        return false;
+    }
+}
+
+// INSERT INTO tableName VALUES (val1, val2, val3)
+std::shared_ptr<Plan> planInsert(const std::string& text, std::ostream& out) {
+    std::istringstream ss(text);
+    std::string word, tableName;
+    ss >> word; // INSERT
+    ss >> word; // INTO
+    ss >> tableName;
+    ss >> word; // VALUES
+
+    if (database.find(tableName) == database.end()) {
+        out << "Error: Table '" << tableName << "' does not exist.\n";
+        return nullptr;
+    }
+
+    const Table& table = database.find(tableName)->second;
+
+    std::string rest;
+    std::getline(ss, rest); // (1, "Alice", 20), (2, "Bob", 25)
+
+    // Check if parentheses are present
+    if (rest.find('(') == std::string::npos || rest.find(')') == std::string::npos) {
+        out << "Error: Values must be enclosed in parentheses.\n";
+        return nullptr;
+    }
+
+    // Values as written, row by row; they are checked against their column
+    // types once bound
+    auto plan = std::make_shared<Plan>();
+    plan->kind = PlanKind::INSERT;
+    plan->tableName = tableName;
+    const char* p = rest.data();
+    const char* end = p + rest.size();
+    while (true) {
+        while (p < end && (*p == ',' || std::isspace(static_cast<unsigned char>(*p)))) p++;
+        if (p == end) break;
+        if (*p != '(') {
+            out << "Error: Values must be enclosed in parentheses.\n";
+            return nullptr;
+        }
+        p++;
+
+        size_t numFields = 0;
+        bool rowEnded = false;
+        while (!rowEnded) {
+            const char* start = p;
+            char quote = 0;
+            for (; p < end && (quote || (*p != ',' && *p != ')')); p++) {
+                if (quote) {
+                    if (*p == quote) quote = 0;
+                } else if (isQuote(RowFormat::TUPLES, *p)) {
+                    quote = *p;
+                }
+            }
+            if (p == end) {
+                out << "Error: Values must be enclosed in parentheses.\n";
+                return nullptr;
+            }
+            plan->values.push_back(planLiteral(trim(std::string(start, p))));
+            numFields++;
+            rowEnded = *p++ == ')';
+        }
+
+        if (numFields != table.columns.size()) {
+            if (plan->numRows > 0) out << "Error: Row " << plan->numRows + 1 << ": ";
+            else out << "Error: ";
+            out << "Expected " << table.columns.size() << " values, but got " << numFields << ".\n";
+            return nullptr;
+        }
+        plan->numRows++;
+    }
+    return plan;
+}
+
+// Append the plan's rows with their values bound, as one batch
+bool runInsert(const Plan& plan, const std::vector<std::string>& args, std::ostream& out) {
+    Table& table = database.find(plan.tableName)->second;
+    if (!claimTable(table, out)) return false;
+    size_t numColumns = table.columns.size();
+    std::vector<RowBatch> batches(1);
+    RowBatch& batch = batches[0];
+    batch.data.assign(numColumns, ColumnData());
+    for (size_t col = 0; col < numColumns; col++) batch.data[col].encoded = table.data[col].encoded;
+    std::string value, field;
+
+    for (size_t row = 0; row < plan.numRows; row++) {
+        for (size_t col = 0; col < numColumns; col++) {
+            value = bindLiteral(plan.values[row * numColumns + col], args);
+            const char* p = value.data();
+            scanField(p, p + value.size(), RowFormat::TUPLES, field);
+
+            int64_t number;
+            if (!table.isInt(col)) {
+                appendText(batch.data[col], field);
+            } else if (parseNumber(field, number)) {
+                batch.data[col].ints.push_back(number);
+            } else {
+                out << "Error: ";
+                if (row > 0) out << "Row " << row + 1 << ": ";
+                out << "Value '" << field << "' is not valid for column '" << table.columns[col].name
+                    << "' of type 'INT'.\n";
+                return false;
+            }
+        }
+        batch.rows++;
+    }
+
+    size_t first = table.rowCount();
+    size_t numRows = appendBatches(table, std::move(batches));
+    stampCreated(table, first);
+    if (numRows == 1) {
+        out << "Row inserted into '" << plan.tableName << "' with ID " << table.ids.back() << ".\n";
+    } else {
+        out << numRows << " row(s) inserted into '" << plan.tableName << "'.\n";
+    }
+    return numRows > 0;
+}
+
+// Rows parsed in parallel straight from the statement, for bulk INSERTs too
+// long to plan
+bool insertBulk(const std::string& command, std::ostream& out) {
+    std::istringstream ss(command);
+    std::string word, tableName;
+    ss >> word >> word >> tableName >> word; // INSERT INTO tableName VALUES
+
+    if (database.find(tableName) == database.end()) {
+        out << "Error: Table '" << tableName << "' does not exist.\n";
+        return false;
+    }
+
+    Table& table = database.find(tableName)->second;
+    if (!claimTable(table, out)) return false;
+
+    std::string rest;
+    std::getline(ss, rest);
+    if (rest.find('(') == std::string::npos || rest.find(')') == std::string::npos) {
+        out << "Error: Values must be enclosed in parentheses.\n";
+        return false;
+    }
+
+    std::string error;
+    std::vector<RowBatch> batches = parseBulk(table, rest.data(), rest.data() + rest.size(),
+                                              RowFormat::TUPLES, error);
+    if (!error.empty()) {
+        out << "Error: " << error << "\n";
+        return false;
+    }
+
+    size_t first = table.rowCount();
+    size_t numRows = appendBatches(table, std::move(batches));
+    stampCreated(table, first);
+    if (numRows == 1) {
+        out << "Row inserted into '" << tableName << "' with ID " << table.ids.back() << ".\n";
+    } else {
+        out << numRows << " row(s) inserted into '" << tableName << "'.\n";
+    }
+    return numRows > 0;
+}
+
+bool handleInsert(const Statement& stmt, std::ostream& out) {
+    try {
+        if (stmt.key.empty() && stmt.text.size() > kMaxPlanText) return insertBulk(stmt.text, out);
+
+        std::vector<std::string> args;
+        PlanPtr plan = statementPlan(stmt, planInsert, args, out);
+        return plan && runInsert(*plan, args, out);
+    } catch (const std::exception& e) {
+        out << "Error inserting row: " << e.what() << "\n";
+        return false;
+    }
+}
+
+// COPY tableName FROM 'file.csv' [HEADER]
+bool handleCopy(const std::string& command, std::ostream& out) {
+    try {
+        std::istringstream ss(command);
+        std::string word, tableName;
+        ss >> word; // COPY
+        ss >> tableName;
+        ss >> word; // FROM
+
+        if (toUpper(word) != "FROM") {
+            out << "Error: Expected COPY tableName FROM 'file.csv'.\n";
+            return false;
+        }
+
+        std::string rest;
+        std::getline(ss, rest); // 'users.csv' HEADER
+        rest = trim(rest);
+
+        // The file name may be quoted to allow spaces
+        std::string filename, options;
+        if (!rest.empty() && (rest[0] == '\'' || rest[0] == '"')) {
+            size_t close = rest.find(rest[0], 1);
+            if (close == std::string::npos) {
+                out << "Error: Unterminated file name.\n";
+                return false;
+            }
+            filename = rest.substr(1, close - 1);
+            options = rest.substr(close + 1);
+        } else {
+            std::istringstream restStream(rest);
+            restStream >> filename;
+            std::getline(restStream, options);
+        }
+
+        options = toUpper(trim(options));
+        if (filename.empty() || (!options.empty() && options != "HEADER")) {
+            out << "Error: Expected COPY tableName FROM 'file.csv' [HEADER].\n";
+            return false;
+        }
+
+        if (database.find(tableName) == database.end()) {
+            out << "Error: Table '" << tableName << "' does not exist.\n";
+            return false;
+        }
+
+        Table& table = database.find(tableName)->second;
+
+        MappedFile file;
+        if (!file.open(filename)) {
+            out << "Error: Could not open file '" << filename << "' for reading.\n";
+            return false;
+        }
+
+        const char* begin = file.data();
+        const char* end = begin + file.size();
+        if (options == "HEADER" && begin < end) {
+            const char* lineEnd = static_cast<const char*>(std::memchr(begin, '\n', end - begin));
+            begin = lineEnd ? lineEnd + 1 : end;
+        }
+
+        std::string error;
+        std::vector<RowBatch> batches = parseBulk(table, begin, end, RowFormat::CSV, error);
+        if (!error.empty()) {
+            out << "Error: " << error << " Nothing was copied.\n";
+            return false;
+        }
+
+        size_t numRows = appendBatches(table, std::move(batches));
+        out << numRows << " row(s) copied into '" << tableName << "'.\n";
+        return numRows > 0;
+    } catch (const std::exception& e) {
+        out << "Error executing COPY: " << e.what() << "\n";
+        return false;
+    }
+}
+
+// Column named in a select list or ORDER BY: -1 for the row ID, which `id`
+// names unless the table has an `id` column; -2 if there is no such column
+int selectColumn(const Table& table, const std::string& name) {
+    int col = columnIndex(table, name);
+    if (col == -1 && toUpper(name) != "ID") return -2;
+    return col;
+}
+
+bool resolveJoinColumn(const JoinSide sides[2], const std::string& name, JoinColumn& ref,
+                       std::string& error) {
+    size_t dot = name.find('.');
+    for (int side = 0; side < 2; side++) {
+        std::string colName = name;
+        if (dot != std::string::npos) {
+            if (name.substr(0, dot) != sides[side].table->name) continue;
+            colName = name.substr(dot + 1);
+        }
+        int col = selectColumn(*sides[side].table, colName);
+        if (col == -2) continue;
+        if (dot == std::string::npos && side == 0 &&
+            selectColumn(*sides[1].table, colName) != -2) {
+            error = "Column '" + name + "' is ambiguous";
+            return false;
+        }
+        ref.side = side;
+        ref.col = col;
+        return true;
+    }
+    error = "Column '" + name + "' not found";
+    return false;
+}
+
+// The ON clause, and when the sides are selected, which one is built
+std::string joinDetail(const JoinQuery& query, bool selected) {
+    std::string detail;
+    for (int side = 0; side < 2; side++) {
+        const JoinSide& s = query.sides[side];
+        detail += (side ? " = " : "") + s.table->name + "." +
+                  (s.keyCol < 0 ? std::string("ID") : s.table->columns[s.keyCol].name);
+    }
+    if (!selected) return detail + ", building the side with fewer rows";
+    int build = countSelected(query.sides[0].selection) <= countSelected(query.sides[1].selection) ? 0 : 1;
+    return detail + ", built on " + query.sides[build].table->name + ", probed in " +
+           std::to_string(morselCount(query.sides[1 - build].selection)) + " morsel(s)";
+}
+
+// SELECT *|col, ... FROM a [INNER] JOIN b ON a.x = b.y [WHERE condition]. The
+// WHERE condition filters the table of the first column it names before the
+// join, so its columns all belong to that table.
+bool parseJoin(const std::string& selectList, const std::string& source, JoinQuery& query,
+               std::ostream& out) {
+    static const std::regex joinRegex(
+        "\\s*(\\w+)\\s+(?:INNER\\s+)?JOIN\\s+(\\w+)\\s+ON\\s+([\\w.]+)\\s*=\\s*([\\w.]+)\\s*(.*)",
+        std::regex::icase);
+    std::smatch matches;
+    if (!std::regex_match(source, matches, joinRegex)) {
+        out << "Error: Invalid JOIN syntax. Expected: SELECT ... FROM a JOIN b ON a.x = b.y\n";
+        return false;
+    }
+
+    JoinSide* sides = query.sides;
+    for (int side = 0; side < 2; side++) {
+        auto it = database.find(matches[side + 1].str());
+        if (it == database.end()) {
+            out << "Error: Table '" << matches[side + 1].str() << "' not found.\n";
+            return false;
+        }
+        sides[side].table = &it->second;
+    }
+
+    // Join keys, one from each table, of the same type
+    std::string error;
+    JoinColumn keys[2];
+    if (!resolveJoinColumn(sides, matches[3].str(), keys[0], error) ||
+        !resolveJoinColumn(sides, matches[4].str(), keys[1], error)) {
+        out << "Error: " << error << ".\n";
+        return false;
+    }
+    if (keys[0].side == keys[1].side) {
+        out << "Error: ON must compare a column of each table.\n";
+        return false;
+    }
+    if (keys[0].side == 1) std::swap(keys[0], keys[1]);
+    for (int side = 0; side < 2; side++) sides[side].keyCol = keys[side].col;
+    auto isInt = [&](const JoinColumn& ref) {
+        return ref.col < 0 || sides[ref.side].table->isInt(ref.col);
+    };
+    if (isInt(keys[0]) != isInt(keys[1])) {
+        out << "Error: Join keys must have the same type.\n";
+        return false;
+    }
+
+    // WHERE applies to the table of its column; the other table is read whole
+    std::string whereText = trim(matches[5].str());
+    std::string conditions[2];
+    if (!whereText.empty()) {
+        Lexer lexer(whereText.data(), whereText.data() + whereText.size());
+        Token token = lexer.next();
+        if (!token.is("WHERE")) {
+            out << "Error: Invalid JOIN syntax. Expected: ... ON a.x = b.y [WHERE condition]\n";
+            return false;
+        }
+        std::string condition(token.text + token.length, whereText.data() + whereText.size());
+        do {
+            token = lexer.next();
+        } while (token.kind != TokenKind::END && (token.kind != TokenKind::WORD || token.is("NOT")));
+
+        JoinColumn ref;
+        if (token.kind == TokenKind::END) {
+            out << "Error: Invalid JOIN syntax. Expected: ... ON a.x = b.y [WHERE condition]\n";
+            return false;
+        }
+        if (!resolveJoinColumn(sides, token.str(), ref, error)) {
+            out << "Error: " << error << ".\n";
+            return false;
+        }
+        conditions[ref.side] = condition;
+    }
+
+    // Projected columns
+    std::vector<JoinColumn>& projection = query.projection;
+    if (selectList == "*") {
+        for (int side = 0; side < 2; side++) {
+            for (size_t col = 0; col < sides[side].table->columns.size(); col++) {
+                JoinColumn ref;
+                ref.side = side;
+                ref.col = static_cast<int>(col);
+                projection.push_back(ref);
+            }
+        }
+    } else {
+        std::istringstream items(selectList);
+        std::string item;
+        while (std::getline(items, item, ',')) {
+            JoinColumn ref;
+            if (!resolveJoinColumn(sides, trim(item), ref, error)) {
+                out << "Error: " << error << ".\n";
+                return false;
+            }
+            projection.push_back(ref);
+        }
+    }
+
+    for (int side = 0; side < 2; side++) {
+        const Table& table = *sides[side].table;
+        query.where[side] = compileCondition(table, conditions[side]);
+    }
+    return true;
+}
+
+void handleJoin(const std::string& selectList, const std::string& source, std::ostream& out) {
+    JoinQuery query;
+    if (!parseJoin(selectList, source, query, out)) return;
+    JoinSide* sides = query.sides;
+    const std::vector<JoinColumn>& projection = query.projection;
+
+    // A table joined with itself is read through the view of either side
+    // that takes one
+    const Table* stored[2] = {sides[0].table, sides[1].table};
+    for (int side = 0; side < 2; side++) sides[side].table = &readTable(*stored[side], query.where[side]);
+    if (stored[0] == stored[1]) sides[0].table = &readTable(*stored[0], query.where[0]);
+    for (int side = 0; side < 2; side++) {
+        sides[side].selection = selectRows(*sides[side].table, query.where[side]);
+    }
+    StepTimer timer;
+    std::vector<JoinMatches> joined = hashJoin(sides);
+    size_t numRows = 0;
+    for (const auto& matches : joined) numRows += matches.size();
+    if (activeProfile) {
+        size_t numSelected[2];
+        uint64_t bytesRead = 0;
+        for (int side = 0; side < 2; side++) {
+            numSelected[side] = countSelected(sides[side].selection);
+            bytesRead += numSelected[side] * columnWidth(*sides[side].table, sides[side].keyCol);
+        }
+        timer.record("Hash Join", joinDetail(query, true), numSelected[0] + numSelected[1], numRows,
+                     bytesRead);
+    }
+
+    StepTimer outputTimer;
+    std::vector<ResultColumn> columns;
+    for (const JoinColumn& ref : projection) {
+        const Table& table = *sides[ref.side].table;
+        bool rowId = ref.col < 0;
+        columns.push_back(ResultColumn{table.name + "." + (rowId ? "ID" : table.columns[ref.col].name),
+                                       rowId || table.isInt(ref.col), false});
+    }
+    OutputMode mode = outputMode;
+    ResultWriter result(mode, columns);
+    result.header();
+
+    // Matches are formatted in parallel, one part per probe morsel
+    std::vector<ResultWriter> parts(joined.size(), ResultWriter(mode, columns));
+    parallelFor(parts.size(), [&](size_t morsel) {
+        for (const JoinMatch& match : joined[morsel]) {
+            for (const JoinColumn& ref : projection) {
+                writeCell(parts[morsel], *sides[ref.side].table, ref.col,
+                          ref.side == 0 ? match.first : match.second);
+            }
+            parts[morsel].endRow();
+        }
+    });
+    result.finish(parts, numRows, out);
+    if (activeProfile) {
+        uint64_t rowWidth = 0;
+        for (const JoinColumn& ref : projection) rowWidth += columnWidth(*sides[ref.side].table, ref.col);
+        outputTimer.record("Output", outputDetail(columns.size(), mode), numRows, numRows,
+                           numRows * rowWidth);
+    }
+}
+
+// SELECT *|col, ...|aggregate, ... FROM tableName [WHERE condition]
+//     [GROUP BY col] [ORDER BY col [ASC|DESC]] [LIMIT n [OFFSET m]]
+std::shared_ptr<Plan> planSelect(const std::string& text, std::ostream& out) {
+    std::string upperCmd = toUpper(text);
+    size_t fromPos = findKeyword(upperCmd, "FROM");
+    if (fromPos == std::string::npos) {
+        out << "Error: Invalid SELECT syntax. Expected: SELECT ... FROM tableName\n";
+        return nullptr;
+    }
+    auto plan = std::make_shared<Plan>();
+    plan->kind = PlanKind::SELECT;
+    if (findKeyword(upperCmd, "JOIN", fromPos) != std::string::npos) {
+        plan->join = true;
+        return plan;
+    }
+    std::string selectList = trim(text.substr(6, fromPos - 6));
+
+    std::istringstream ss(text.substr(fromPos + 4));
+    std::string word, tableName, rest, extra;
+    ss >> tableName;
+    std::getline(ss, rest);
+
+    // Clauses after WHERE, parsed from the end of the statement. LIMIT and
+    // OFFSET are bound when the plan runs.
+    RowOrder& order = plan->order;
+    size_t limitPos = findKeyword(toUpper(rest), "LIMIT");
+    if (limitPos != std::string::npos) {
+        std::istringstream limit(rest.substr(limitPos + 5));
+        std::string count, keyword, offset;
+        int64_t number = 0;
+        limit >> count >> keyword >> offset;
+        plan->limit = planLiteral(count);
+        plan->offset = planLiteral(offset.empty() ? "0" : offset);
+        bool valid = !count.empty() && (plan->limit.param >= 0 || parseNumber(count, number));
+        if (valid && !keyword.empty()) {
+            valid = toUpper(keyword) == "OFFSET" && !offset.empty() &&
+                    (plan->offset.param >= 0 || parseNumber(offset, number)) && !(limit >> extra);
+        }
+        if (!valid) {
+            out << "Error: Invalid LIMIT clause. Expected: LIMIT n [OFFSET m]\n";
+            return nullptr;
+        }
+        plan->limited = true;
+        rest = rest.substr(0, limitPos);
+    }
+
+    std::string orderName;
+    size_t orderPos = findKeyword(toUpper(rest), "ORDER");
+    if (orderPos != std::string::npos) {
+        std::istringstream orderBy(rest.substr(orderPos + 5));
+        std::string direction;
+        orderBy >> word >> orderName >> direction;
+        direction = toUpper(direction);
+        if (toUpper(word) != "BY" || orderName.empty() ||
+            (!direction.empty() && direction != "ASC" && direction != "DESC") ||
+            orderBy >> extra) {
+            out << "Error: Invalid ORDER BY clause. Expected: ORDER BY column [ASC|DESC]\n";
+            return nullptr;
+        }
+        order.ordered = true;
+        order.descending = direction == "DESC";
+        rest = rest.substr(0, orderPos);
+    }
+
+    std::string groupName;
+    size_t groupPos = findKeyword(toUpper(rest), "GROUP");
+    if (groupPos != std::string::npos) {
+        std::istringstream group(rest.substr(groupPos + 5));
+        group >> word >> groupName;
+        if (toUpper(word) != "BY" || groupName.empty() || group >> extra) {
+            out << "Error: Invalid GROUP BY clause. Expected: GROUP BY column\n";
+            return nullptr;
+        }
+        rest = rest.substr(0, groupPos);
+    }
+
+    // Check for WHERE clause
+    std::string condition;
+    std::istringstream where(rest);
+    if (where >> word && toUpper(word) == "WHERE") {
+        std::getline(where, condition);
+        condition = trim(condition);
+    }
+
+    if (database.find(tableName) == database.end()) {
+        out << "Error: Table '" << tableName << "' not found.\n";
+        return nullptr;
+    }
+
+    const auto& table = database.find(tableName)->second;
+    plan->tableName = tableName;
+    plan->where = parseCondition(table.columns, condition);
+
+    if (selectList.find('(') != std::string::npos || !groupName.empty()) {
+        if (!groupName.empty()) {
+            plan->groupCol = columnIndex(table, groupName);
+            if (plan->groupCol == -1) {
+                out << "Error: Column '" << groupName << "' not found.\n";
+                return nullptr;
+            }
+        }
+        std::string error;
+        if (selectList == "*") error = "GROUP BY needs aggregates in the select list";
+        if (order.ordered || plan->limited) {
+            error = "ORDER BY and LIMIT are not supported with aggregates";
+        }
+        if (!error.empty() ||
+            !parseAggregates(table, selectList, plan->groupCol, plan->aggregates, error)) {
+            out << "Error: " << error << ".\n";
+            return nullptr;
+        }
+        return plan;
+    }
+
+    // Projected columns, -1 for the row ID
+    std::vector<int>& projection = plan->projection;
+    bool allColumns = selectList == "*";
+    if (!allColumns) {
+        std::istringstream items(selectList);
+        std::string item;
+        while (std::getline(items, item, ',')) {
+            item = trim(item);
+            int col = selectColumn(table, item);
+            if (col == -2) {
+                out << "Error: Column '" << item << "' not found.\n";
+                return nullptr;
+            }
+            projection.push_back(col);
+        }
+    }
+    if (order.ordered) {
+        order.colIndex = selectColumn(table, orderName);
+        if (order.colIndex == -2) {
+            out << "Error: Column '" << orderName << "' not found.\n";
+            return nullptr;
+        }
+    }
+
+    // SELECT * lists the row ID, tab-separated in a table, then every column
+    std::vector<ResultColumn>& columns = plan->columns;
+    if (allColumns) {
+        columns.push_back(ResultColumn{"ID", true, true});
+        for (size_t col = 0; col < table.columns.size(); col++) {
+            projection.push_back(static_cast<int>(col));
+            columns.push_back(ResultColumn{table.columns[col].name, table.isInt(col), false});
+        }
+        projection.insert(projection.begin(), -1);
+    } else {
+        for (int col : projection) {
+            columns.push_back(ResultColumn{col < 0 ? "ID" : table.columns[col].name,
+                                           col < 0 || table.isInt(col), false});
+        }
+    }
+    return plan;
+}
+
+// ORDER BY and LIMIT of a SELECT plan, with LIMIT and OFFSET bound
+bool bindOrder(const Plan& plan, const std::vector<std::string>& args, RowOrder& order) {
+    order = plan.order;
+    if (!plan.limited) return true;
+    int64_t limit = 0, offset = 0;
+    if (!parseNumber(bindLiteral(plan.limit, args), limit) ||
+        !parseNumber(bindLiteral(plan.offset, args), offset)) {
+        return false;
+    }
+    order.limit = static_cast<size_t>(limit);
+    order.offset = static_cast<size_t>(offset);
+    return true;
+}
+
+void runSelect(const Plan& plan, const std::vector<std::string>& args, std::ostream& out) {
+    const auto& stored = database.find(plan.tableName)->second;
+    Condition where = bindWhere(plan.where, args, stored);
+    RowOrder order;
+    if (!bindOrder(plan, args, order)) {
+        out << "Error: Invalid LIMIT clause. Expected: LIMIT n [OFFSET m]\n";
+        return;
+    }
+    const Table& table = readTable(stored, where, plan.limited && !order.ordered ? order.needed() : SIZE_MAX);
+    if (!plan.aggregates.empty()) {
+        runAggregates(table, selectRows(table, where), plan.aggregates, plan.groupCol, out);
+        return;
+    }
+
+    // No rows to display
+    OutputMode mode = outputMode;
+    if (mode == OutputMode::TABLE && !hasVisibleRows(table)) {
+        out << "Table '" << plan.tableName << "' is empty.\n";
+        return;
+    }
+    ResultWriter result(mode, plan.columns);
+    result.header();
+
+    // Rows that match the condition, in output order. LIMIT without ORDER
+    // BY lets the scan stop once it has enough rows.
+    Selection selection;
+    if (order.ordered) {
+        selection = selectRows(table, where);
+        StepTimer timer;
+        size_t numSelected = activeProfile ? countSelected(selection) : 0;
+        selection.slots = orderRows(table, selection, order);
+        selection.sparse = true;
+        if (activeProfile) {
+            timer.record("Sort", orderDetail(table, order), numSelected, selection.slots.size(),
+                         numSelected * columnWidth(table, order.colIndex));
+        }
+    } else if (plan.limited) {
+        selection = selectRows(table, where, order.needed());
+        if (!selection.sparse) {
+            forEachSelected(selection, [&](size_t slot) { selection.slots.push_back(slot); });
+            selection.sparse = true;
+        }
+    } else {
+        selection = selectRows(table, where);
+    }
+    if (selection.sparse) {
+        SlotList& slots = selection.slots;
+        slots.erase(slots.begin(), slots.begin() + std::min(order.offset, slots.size()));
+        if (slots.size() > order.limit) slots.resize(order.limit);
+    }
+
+    // Only projected columns are read. Morsels are formatted in parallel
+    // and written in order.
+    StepTimer timer;
+    std::vector<ResultWriter> parts(morselCount(selection), ResultWriter(mode, plan.columns));
+    parallelFor(parts.size(), [&](size_t morsel) {
+        if (!selection.sparse) bufferPool.touch(table, morsel);
+        forEachSelectedIn(selection, morsel, [&](size_t slot) {
+            for (int col : plan.projection) writeCell(parts[morsel], table, col, slot);
+            parts[morsel].endRow();
+        });
+    });
+    size_t numRows = countSelected(selection);
+    result.finish(parts, numRows, out);
+    if (activeProfile) {
+        uint64_t rowWidth = 0;
+        for (int col : plan.projection) rowWidth += columnWidth(table, col);
+        std::string detail = outputDetail(plan.columns.size(), mode);
+        if (plan.limited) detail += ", " + limitDetail(order);
+        timer.record("Output", detail, numRows, numRows, numRows * rowWidth);
+    }
+}
+
+void handleSelect(const Statement& stmt, std::ostream& out) {
+    try {
+        std::vector<std::string> args;
+        PlanPtr plan = statementPlan(stmt, planSelect, args, out);
+        if (!plan) return;
+        if (plan->join) {
+            size_t fromPos = findKeyword(toUpper(stmt.text), "FROM");
+            handleJoin(trim(stmt.text.substr(6, fromPos - 6)), stmt.text.substr(fromPos + 4), out);
+            return;
+        }
+        runSelect(*plan, args, out);
+    } catch (const std::exception& e) {
+        out << "Error executing SELECT: " << e.what() << "\n";
+    }
+}
+
+// DELETE FROM tableName [WHERE condition]
+std::shared_ptr<Plan> planDelete(const std::string& text, std::ostream& out) {
+    std::istringstream ss(text);
+    std::string word, tableName;
+    ss >> word; // DELETE
+    ss >> word; // FROM
+    ss >> tableName;
+
+    // Check for WHERE clause
+    std::string condition;
+    if (ss >> word && toUpper(word) == "WHERE") {
+        std::getline(ss, condition);
+        condition = trim(condition);
+    }
+
+    if (database.find(tableName) == database.end()) {
+        out << "Error: Table '" << tableName << "' not found.\n";
+        return nullptr;
+    }
+
+    auto plan = std::make_shared<Plan>();
+    plan->kind = PlanKind::DELETE;
+    plan->tableName = tableName;
+    plan->where = parseCondition(database.find(tableName)->second.columns, condition);
+    return plan;
+}
+
+// Matching rows are marked deleted; the table is compacted in the background
+// once enough of it is
+bool runDelete(const Plan& plan, const std::vector<std::string>& args, std::ostream& out) {
+    auto& table = database.find(plan.tableName)->second;
+    if (!claimTable(table, out)) return false;
+    size_t initialSize = table.liveRows();
+
+    Condition where = bindWhere(plan.where, args, table);
+    if (where.kind == ConditionKind::ALL && !writingTransaction) {
+        // Delete all rows if no condition
+        StepTimer timer;
+        clearRows(table);
+        table.markChanged();
+        if (activeProfile) {
+            timer.record("Delete", "every row, freeing the table", initialSize, initialSize, 0);
+        }
+        out << initialSize << " row(s) deleted from '" << plan.tableName << "'.\n";
+        return initialSize > 0;
+    }
+
+    // Delete rows that match the condition. In a transaction they are only
+    // stamped, and stay for other snapshots until it commits.
+    Selection selection = selectRows(table, where);
+    StepTimer timer;
+    if (writingTransaction) {
+        forEachSelected(selection, [&](size_t slot) { stampEnded(table, slot); });
+        size_t deletedCount = countSelected(selection);
+        if (deletedCount) table.markChanged();
+        if (activeProfile) timer.record("Delete", "stamped as deleted", deletedCount, deletedCount, 0);
+        out << deletedCount << " row(s) deleted from '" << plan.tableName << "'.\n";
+        return deletedCount > 0;
+    }
+    size_t deletedCount = deleteRows(table, toBitmap(selection, table.rowCount()));
+    if (deletedCount) table.markChanged();
+    bool compact = needsCompaction(table);
+    if (compact) compactor.schedule(table.name);
+    if (activeProfile) {
+        timer.record("Delete", compact ? "marked deleted, compaction queued" : "marked deleted", deletedCount,
+                     deletedCount, 0);
+    }
+    out << deletedCount << " row(s) deleted from '" << plan.tableName << "'.\n";
+    return deletedCount > 0;
+}
+
+bool handleDelete(const Statement& stmt, std::ostream& out) {
+    try {
+        std::vector<std::string> args;
+        PlanPtr plan = statementPlan(stmt, planDelete, args, out);
+        return plan && runDelete(*plan, args, out);
+    } catch (const std::exception& e) {
+        out << "Error executing DELETE: " << e.what() << "\n";
+        return false;
+    }
+}
+
+// UPDATE tableName SET col1=val1, col2=val2 [WHERE condition]
+std::shared_ptr<Plan> planUpdate(const std::string& text, std::ostream& out) {
+    std::istringstream ss(text);
+    std::string word, tableName;
+    ss >> word; // UPDATE
+    ss >> tableName;
+    ss >> word; // SET
+
+    // Get the SET clause
+    std::string remaining;
+    std::getline(ss, remaining);
+
+    if (database.find(tableName) == database.end()) {
+        out << "Error: Table '" << tableName << "' not found.\n";
+        return nullptr;
+    }
+
+    const auto& table = database.find(tableName)->second;
+    auto plan = std::make_shared<Plan>();
+    plan->kind = PlanKind::UPDATE;
+    plan->tableName = tableName;
+
+    // col = value, ... up to WHERE; values are checked against their column
+    // types once bound
+    const char* end = remaining.data() + remaining.size();
+    Lexer lexer(remaining.data(), end);
+    Token token = lexer.next();
+    while (token.kind != TokenKind::END && !token.is("WHERE")) {
+        Token column = token;
+        Token equals = lexer.next();
+        Token value = lexer.next();
+        token = lexer.next();
+        if (column.kind != TokenKind::WORD || !equals.isOp("=") ||
+            (value.kind != TokenKind::WORD && value.kind != TokenKind::STRING) ||
+            (token.kind != TokenKind::COMMA && token.kind != TokenKind::END && !token.is("WHERE"))) {
+            out << "Error: Invalid SET clause format.\n";
+            return nullptr;
+        }
+        if (token.kind == TokenKind::COMMA) token = lexer.next();
+
+        int colIndex = columnIndex(table, column.str());
+        if (colIndex == -1) {
+            out << "Error: Column '" << column.str() << "' not found.\n";
+            return nullptr;
+        }
+        plan->assignments.emplace_back(colIndex, planLiteral(value.str()));
+    }
+
+    if (plan->assignments.empty()) {
+        out << "Error: No valid column updates specified.\n";
+        return nullptr;
+    }
+
+    std::string condition;
+    if (token.is("WHERE")) condition.assign(token.text + token.length, end);
+    plan->where = parseCondition(table.columns, condition);
+    return plan;
+}
+
+std::string updateDetail(const Table& table, const Plan& plan) {
+    std::string detail = "SET";
+    for (size_t i = 0; i < plan.assignments.size(); i++) {
+        detail += (i ? ", " : " ") + table.columns[plan.assignments[i].first].name;
+    }
+    return detail;
+}
+
+bool runUpdate(const Plan& plan, const std::vector<std::string>& args, std::ostream& out) {
+    auto& table = database.find(plan.tableName)->second;
+
+    struct Assignment {
+        int colIndex;
+        std::string value;
+        int64_t number; // parsed value for INT columns
+    };
+    std::vector<Assignment> updates;
+    for (const auto& assignment : plan.assignments) {
+        int colIndex = assignment.first;
+        std::string newValue = bindLiteral(assignment.second, args);
+
+        // Remove quotes if present
+        newValue = unquote(newValue);
+
+        // Validate data type
+        if (!validateDataType(newValue, table.columns[colIndex].type)) {
+            out << "Error: Value '" << newValue << "' is not valid for column '"
+                << table.columns[colIndex].name << "' of type '" << table.columns[colIndex].type << "'.\n";
+            return false;
+        }
+
+        int64_t number = 0;
+        parseNumber(newValue, number);
+        updates.push_back({colIndex, newValue, number});
+    }
+
+    // Apply updates to rows that match the condition. In a transaction each
+    // row gets a new version, and the old one stays for other snapshots.
+    if (!claimTable(table, out)) return false;
+    Condition where = bindWhere(plan.where, args, table);
+    Selection selection = selectRows(table, where);
+    StepTimer timer;
+    int updatedCount = 0;
+    size_t firstVersion = table.rowCount();
+    forEachSelected(selection, [&](size_t slot) {
+        size_t target = slot;
+        if (writingTransaction) {
+            target = appendVersion(table, slot);
+            stampEnded(table, slot);
+        }
+        for (const auto& update : updates) {
+            setValue(table, update.colIndex, target, update.value, update.number, target != slot);
+        }
+        updatedCount++;
+    });
+    stampCreated(table, firstVersion);
+    if (updatedCount) table.markChanged();
+
+    // Reclaim TEXT bytes once replaced values outweigh live ones. Unused
+    // dictionary entries are bounded by the dictionary size, so encoded
+    // columns keep theirs until the table is compacted.
+    for (const auto& update : updates) {
+        ColumnData& column = table.data[update.colIndex];
+        if (!table.isInt(update.colIndex) && !column.encoded &&
+            column.bytes.size() > 2 * liveTextBytes(column)) {
+            compactText(column);
+        }
+    }
+    if (activeProfile) timer.record("Update", updateDetail(table, plan), updatedCount, updatedCount, 0);
+
+    out << updatedCount << " row(s) updated in '" << plan.tableName << "'.\n";
+    return updatedCount > 0;
+}
+
+bool handleUpdate(const Statement& stmt, std::ostream& out) {
+    try {
+        std::vector<std::string> args;
+        PlanPtr plan = statementPlan(stmt, planUpdate, args, out);
+        return plan && runUpdate(*plan, args, out);
+    } catch (const std::exception& e) {
+        out << "Error executing UPDATE: " << e.what() << "\n";
+        return false;
+    }
+}
+
+// SAVE [ASYNC] filename. A background save must finish before another
+// save starts. Saving to the file the paged tables come from appends to it.
+void handleSave(const std::string& command, std::ostream& out) {
+    try {
         std::istringstream ss(command);
         std::string word, filename;
         ss >> word; // SAVE
         ss >> filename;
+        bool background = toUpper(filename) == "ASYNC";
+        if (background) {
+            filename.clear();
+            ss >> filename;
+        }
+        
+        if (filename.empty()) {
+            out << "Error: Filename is required.\n";
+            return;
+        }
+        
+        // Add .db extension if not present
+        if (filename.find('.') == std::string::npos) {
+            filename += ".db";
+        }
+        
+        if (background && saver.running()) {
+            out << "Error: A save is already running. See SHOW SAVE STATUS.\n";
+            return;
+        }
+        if (background && bufferPool.isDataFile(filename)) {
+            out << "Error: '" << filename << "' holds the paged tables; use SAVE.\n";
+            return;
+        }
+        saver.wait();
+        SaveJob job = saver.plan(filename, background);
+        if (background) {
+            out << "Saving database to '" << filename << "' in the background: "
+                << job.changed.size() + job.reread.size() << " table(s) to write, " << job.kept.size()
+                << " unchanged.\n";
+            saver.start(std::move(job));
+            return;
+        }
+        SavedFile saved = saver.save(job);
+        if (bufferPool.isDataFile(filename)) bufferPool.attach(saved); // Tables created since are paged too
+        out << "Database saved to '" << filename << "' successfully.\n";
+    } catch (const std::exception& e) {
+        out << "Error saving database: " << e.what() << "\n";
+    }
+}
+
+// Read a database file in the format used before snapshots: a stream of
+// length-prefixed values, row by row, followed by index definitions
+void loadLegacy(std::istream& file, const std::string& filename, TableMap& tables) {
+    // Read number of tables
+    size_t numTables = 0;
+    file.read(reinterpret_cast<char*>(&numTables), sizeof(numTables));
+    if (!file) throw std::runtime_error("corrupt header in '" + filename + "'");
+    
+    // Read each table
+    for (size_t i = 0; i < numTables; i++) {
+        Table table;
+        
+        // Read table name
+        size_t nameLength;
+        file.read(reinterpret_cast<char*>(&nameLength), sizeof(nameLength));
+        table.name.resize(nameLength);
+        file.read(&table.name[0], nameLength);
+        
+        // Read next_id
+        file.read(reinterpret_cast<char*>(&table.next_id), sizeof(table.next_id));
+        
+        // Read columns
+        size_t numColumns;
+        file.read(reinterpret_cast<char*>(&numColumns), sizeof(numColumns));
+        
+        for (size_t j = 0; j < numColumns; j++) {
+            Column column;
+            
+            // Read column name
+            size_t nameLength;
+            file.read(reinterpret_cast<char*>(&nameLength), sizeof(nameLength));
+            column.name.resize(nameLength);
+            file.read(&column.name[0], nameLength);
+            
+            // Read column type
+            size_t typeLength;
+            file.read(reinterpret_cast<char*>(&typeLength), sizeof(typeLength));
+            column.type.resize(typeLength);
+            file.read(&column.type[0], typeLength);
+            
+            table.columns.push_back(column);
+        }
+        
+        // Read rows
+        size_t numRows;
+        file.read(reinterpret_cast<char*>(&numRows), sizeof(numRows));
+        table.data.resize(numColumns);
+        reserveRows(table, numRows);
+        
+        std::vector<std::string> values;
+        for (size_t j = 0; j < numRows; j++) {
+            // Read row ID
+            int id;
+            file.read(reinterpret_cast<char*>(&id), sizeof(id));
+            
+            // Read values
+            size_t numValues;
+            file.read(reinterpret_cast<char*>(&numValues), sizeof(numValues));
+            if (!file || numValues != numColumns) {
+                throw std::runtime_error("corrupt row data in '" + filename + "'");
+            }
+            
+            values.clear();
+            for (size_t k = 0; k < numValues; k++) {
+                size_t valueLength;
+                file.read(reinterpret_cast<char*>(&valueLength), sizeof(valueLength));
+                
+                std::string value;
+                value.resize(valueLength);
+                file.read(&value[0], valueLength);
+                
+                values.push_back(value);
+            }
+            
+            appendRow(table, values, id);
+        }
+        
+        std::string tableName = table.name;
+        tables[tableName] = std::move(table);
+    }
+    
+    // Read index definitions, absent in files saved before indexes existed
+    size_t numIndexes = 0;
+    if (file.peek() != std::char_traits<char>::eof()) {
+        file.read(reinterpret_cast<char*>(&numIndexes), sizeof(numIndexes));
+    }
+
+    for (size_t i = 0; i < numIndexes; i++) {
+        std::string def[4]; // index name, table name, column name, kind
+        for (auto& field : def) {
+            size_t fieldLength;
+            file.read(reinterpret_cast<char*>(&fieldLength), sizeof(fieldLength));
+            if (!file) throw std::runtime_error("corrupt index data in '" + filename + "'");
+            field.resize(fieldLength);
+            file.read(&field[0], fieldLength);
+        }
+
+        auto tableIt = tables.find(def[1]);
+        if (tableIt == tables.end()) continue;
+        Table& table = tableIt->second;
+
+        Index index;
+        index.name = def[0];
+        index.colIndex = -1;
+        index.kind = def[3] == "HASH" ? IndexKind::HASH : IndexKind::BTREE;
+        for (size_t col = 0; col < table.columns.size(); col++) {
+            if (table.columns[col].name == def[2]) index.colIndex = col;
+        }
+        if (index.colIndex == -1) continue;
+
+        rebuildIndex(table, index);
+        table.indexes.push_back(std::move(index));
+    }
+}
+
+// Read a snapshot or legacy file into `tables`; false if it cannot be opened.
+// `logSequence` is 0 for files not written by a checkpoint.
+bool loadDatabaseFile(const std::string& filename, TableMap& tables, uint64_t& logSequence) {
+    MappedFile file;
+    if (!file.open(filename)) return false;
+
+    logSequence = 0;
+    if (isSnapshot(file)) {
+        logSequence = loadSnapshot(file, tables);
+    } else {
+        MemoryBuffer buffer(file.data(), file.size());
+        std::istream legacy(&buffer);
+        loadLegacy(legacy, filename, tables);
+    }
+    return true;
+}
+
+// LOAD filename [PAGED]. A paged load reads only the table definitions and
+// leaves the rows to the buffer pool.
+bool handleLoad(const std::string& command, std::ostream& out) {
+    try {
+        std::istringstream ss(command);
+        std::string word, filename, paged;
+        ss >> word; // LOAD
+        ss >> filename;
+        ss >> paged;
         
         if (filename.empty()) {
-            std::cout << "Error: Filename is required.\n";
+            out << "Error: Filename is required.\n";
+            return false;
+        }
+        if (!paged.empty() && toUpper(paged) != "PAGED") {
+            out << "Error: Expected LOAD filename [PAGED].\n";
+            return false;
+        }
+        if (!paged.empty() && wal.isOpen()) {
+            out << "Error: Paged tables cannot be used with a write-ahead log.\n";
+            return false;
+        }
+        
+        // Add .db extension if not present
+        if (filename.find('.') == std::string::npos) {
+            filename += ".db";
+        }
+        
+        // Load into a fresh map so a corrupt file leaves the database intact
+        saver.wait();
+        TableMap tables;
+        if (!paged.empty()) {
+            std::shared_ptr<MappedFile> file(new MappedFile());
+            if (!file->open(filename, true)) {
+                out << "Error: Could not open file '" << filename << "' for reading.\n";
+                return false;
+            }
+            if (!isSnapshot(*file)) {
+                out << "Error: '" << filename << "' is from an earlier version; LOAD and SAVE it first.\n";
+                return false;
+            }
+            SavedFile saved = readPagedTables(*file, filename, tables);
+            database.swap(tables);
+            bufferPool.detach();
+            bufferPool.attach(saved, file);
+            catalogVersion++;
+
+            out << "Database loaded from '" << filename << "' successfully.\n";
+            out << database.size() << " table(s) loaded, paged in from '" << filename << "' as they are used.\n";
+            return true;
+        }
+
+        uint64_t logSequence;
+        if (!loadDatabaseFile(filename, tables, logSequence)) {
+            out << "Error: Could not open file '" << filename << "' for reading.\n";
+            return false;
+        }
+        database.swap(tables);
+        bufferPool.detach();
+        catalogVersion++;
+        
+        out << "Database loaded from '" << filename << "' successfully.\n";
+        out << database.size() << " table(s) loaded.\n";
+        return true;
+    } catch (const std::exception& e) {
+        out << "Error loading database: " << e.what() << "\n";
+        return false;
+    }
+}
+
+// Run a statement that may change the database; false if it is not one of
+// those. `changed` reports whether the database changed.
+bool executeWrite(const Statement& stmt, const std::string& upperCmd, bool& changed,
+                  std::ostream& out) {
+    const std::string& command = stmt.text;
+    if (upperCmd.find("CREATE TABLE") == 0) {
+        changed = handleCreate(command, out);
+    } else if (upperCmd.find("CREATE INDEX") == 0) {
+        changed = handleCreateIndex(command, out);
+    } else if (upperCmd.find("DROP INDEX") == 0) {
+        changed = handleDropIndex(command, out);
+    } else if (upperCmd.find("INSERT INTO") == 0) {
+        changed = handleInsert(stmt, out);
+    } else if (upperCmd.find("UPDATE") == 0) {
+        changed = handleUpdate(stmt, out);
+    } else if (upperCmd.find("DELETE FROM") == 0) {
+        changed = handleDelete(stmt, out);
+    } else {
+        return false;
+    }
+    return true;
+}
+
+// Snapshot the database over the log's snapshot and start a new log
+// sequence. The snapshot is written aside and renamed into place, so a crash
+// leaves either the old snapshot and its log, or the new snapshot, which the
+// old log is recognised as already included in.
+void checkpoint() {
+    uint64_t sequence = wal.sequence() + 1;
+    std::string tempPath = walSnapshotPath + ".tmp";
+    compactTables(database);
+    saveSnapshot(database, tempPath, sequence);
+    syncPath(tempPath);
+#ifndef CRT_HAVE_FSYNC
+    std::remove(walSnapshotPath.c_str()); // rename does not replace files here
+#endif
+    if (std::rename(tempPath.c_str(), walSnapshotPath.c_str()) != 0) {
+        throw std::runtime_error("could not replace '" + walSnapshotPath + "'");
+    }
+    wal.reset(sequence);
+}
+
+// CHECKPOINT
+void handleCheckpoint(std::ostream& out) {
+    try {
+        if (!wal.isOpen()) {
+            out << "Error: No write-ahead log is open. Start with --wal name.\n";
             return;
         }
-        
-        // Add .db extension if not present
-        if (filename.find('.') == std::string::npos) {
-            filename += ".db";
+        checkpoint();
+        out << "Checkpoint written to '" << walSnapshotPath << "'; log '" << wal.path()
+            << "' truncated.\n";
+    } catch (const std::exception& e) {
+        out << "Error writing checkpoint: " << e.what() << "\n";
+    }
+}
+
+TableMemory tableMemory(const Table& table) {
+    TableMemory memory;
+    memory.columns = table.ids.heldBytes() + table.deleted.capacity() * sizeof(uint64_t);
+    for (const auto& column : table.data) {
+        memory.columns += column.ints.heldBytes() +
+                          (column.zoneMin.capacity() + column.zoneMax.capacity()) * sizeof(int64_t) +
+                          column.offsets.heldBytes() + column.lengths.heldBytes() + column.codes.heldBytes() +
+                          column.lookup.capacity() * sizeof(uint32_t);
+        memory.text += column.bytes.heldBytes();
+    }
+    memory.columns += (table.versions.bucket_count() + table.deltaSlots.bucket_count()) * sizeof(void*) +
+                      table.versions.size() * (sizeof(size_t) + sizeof(RowVersion) + 2 * sizeof(void*)) +
+                      table.deltaSlots.size() * (sizeof(int) + sizeof(size_t) + 2 * sizeof(void*));
+    for (size_t col = 0; col < table.columns.size(); col++) {
+        if (table.isInt(col)) continue;
+        for (size_t slot = 0; slot < table.rowCount(); slot++) {
+            if (!table.isDeleted(slot)) memory.liveText += table.data[col].textLength(slot);
+        }
+    }
+    for (const auto& index : table.indexes) {
+        memory.indexes += index.hash.bucket_count() * sizeof(void*) + index.tree.memoryBytes();
+        for (const auto& entry : index.hash) {
+            memory.indexes += sizeof(entry) + 2 * sizeof(void*) + entry.second.capacity() * sizeof(int);
+        }
+    }
+    return memory;
+}
+
+// SHOW MEMORY: heap bytes per table
+void handleShowMemory(std::ostream& out) {
+    std::vector<const Table*> tables;
+    for (const auto& entry : database) tables.push_back(&entry.second);
+    std::sort(tables.begin(), tables.end(),
+              [](const Table* a, const Table* b) { return a->name < b->name; });
+
+    std::vector<ResultColumn> columns = {
+        {"table", false, false}, {"rows", true, false},      {"deleted", true, false},
+        {"columns", true, false}, {"text", true, false},     {"live_text", true, false},
+        {"indexes", true, false}, {"total", true, false}};
+    ResultWriter result(outputMode, columns);
+    result.header();
+    for (const Table* table : tables) {
+        TableMemory memory = tableMemory(*table);
+        result.value(table->name);
+        result.value(static_cast<int64_t>(table->liveRows()));
+        result.value(static_cast<int64_t>(table->deletedRows));
+        result.value(static_cast<int64_t>(memory.columns));
+        result.value(static_cast<int64_t>(memory.text));
+        result.value(static_cast<int64_t>(memory.liveText));
+        result.value(static_cast<int64_t>(memory.indexes));
+        result.value(static_cast<int64_t>(memory.columns + memory.text + memory.indexes));
+        result.endRow();
+    }
+    result.finish(tables.size(), out);
+}
+
+// SHOW SAVE STATUS: progress of the running save, or how the last one went
+void handleShowSaveStatus(std::ostream& out) {
+    SaveStatus status = saver.status();
+    std::vector<ResultColumn> columns = {
+        {"file", false, false},    {"state", false, false},  {"kind", false, false},
+        {"written", true, false},  {"to_write", true, false}, {"unchanged", true, false},
+        {"bytes", true, false},    {"copied", true, false},   {"time_ms", false, false},
+        {"error", false, false}};
+    ResultWriter result(outputMode, columns);
+    result.header();
+    if (!status.state.empty()) {
+        char ms[32];
+        int length = std::snprintf(ms, sizeof(ms), "%.3f", status.ms);
+        result.value(status.filename);
+        result.value(status.state);
+        result.value(status.incremental ? "incremental" : "full");
+        result.value(static_cast<int64_t>(status.tablesWritten));
+        result.value(static_cast<int64_t>(status.tablesToWrite));
+        result.value(static_cast<int64_t>(status.tablesKept));
+        result.value(static_cast<int64_t>(status.bytesWritten));
+        result.value(static_cast<int64_t>(status.bytesCopied));
+        result.value(ms, length);
+        result.value(status.error);
+        result.endRow();
+    }
+    result.finish(status.state.empty() ? 0 : 1, out);
+}
+
+// SHOW BUFFER POOL: the paged tables, and whether each is in memory
+void handleShowBufferPool(std::ostream& out) {
+    std::vector<Frame> frames = bufferPool.frameList();
+    std::sort(frames.begin(), frames.end(),
+              [](const Frame& a, const Frame& b) { return a.table->name < b.table->name; });
+
+    std::vector<ResultColumn> columns = {
+        {"table", false, false},     {"resident", false, false},     {"dirty", false, false},
+        {"pins", true, false},       {"bytes", true, false},         {"morsels", true, false},
+        {"loads", true, false},      {"evictions", true, false},     {"morsel_reads", true, false},
+        {"morsel_drops", true, false}};
+    ResultWriter result(outputMode, columns);
+    result.header();
+    for (const Frame& frame : frames) {
+        size_t morsels = 0;
+        for (size_t bytes : frame.morselBytes) morsels += bytes > 0;
+        result.value(frame.table->name);
+        result.value(frame.resident ? "yes" : "no");
+        result.value(bufferPool.isDirty(*frame.table) ? "yes" : "no");
+        result.value(static_cast<int64_t>(frame.pins));
+        result.value(static_cast<int64_t>(frame.bytes + frame.pagedBytes));
+        result.value(static_cast<int64_t>(morsels));
+        result.value(static_cast<int64_t>(frame.loads));
+        result.value(static_cast<int64_t>(frame.evictions));
+        result.value(static_cast<int64_t>(frame.morselReads));
+        result.value(static_cast<int64_t>(frame.morselDrops));
+        result.endRow();
+    }
+    result.finish(frames.size(), out);
+}
+
+// VACUUM [tableName]: compact one table, or all of them, however few of its
+// rows are deleted. Row IDs do not change, so it is not logged.
+void handleVacuum(const std::string& command, std::ostream& out) {
+    std::istringstream ss(command);
+    std::string word, tableName;
+    ss >> word; // VACUUM
+    ss >> tableName;
+
+    if (tableName.empty()) {
+        size_t removed = 0;
+        for (auto& tablePair : database) removed += compactRows(tablePair.second);
+        out << database.size() << " table(s) vacuumed, " << removed << " deleted row(s) removed.\n";
+        return;
+    }
+
+    auto it = database.find(tableName);
+    if (it == database.end()) {
+        out << "Error: Table '" << tableName << "' does not exist.\n";
+        return;
+    }
+    size_t removed = compactRows(it->second);
+    out << "Table '" << tableName << "' vacuumed, " << removed << " deleted row(s) removed.\n";
+}
+
+// Rows of an EXPLAIN: each step and its detail. EXPLAIN ANALYZE adds the
+// row counts, time and bytes read of each, then `total`. The detail comes
+// last, since it is often wider than a column.
+void writeSteps(const std::vector<ProfileStep>& steps, const ProfileStep* total, std::ostream& out) {
+    std::vector<ResultColumn> columns = {{"step", false, false}};
+    if (total) {
+        columns.push_back({"rows_in", true, false});
+        columns.push_back({"rows_out", true, false});
+        columns.push_back({"time_ms", false, false});
+        columns.push_back({"bytes_read", true, false});
+    }
+    columns.push_back({"detail", false, false});
+    ResultWriter result(outputMode, columns);
+    result.header();
+    auto write = [&](const ProfileStep& step) {
+        result.value(step.name);
+        if (total) {
+            char ms[32];
+            int length = std::snprintf(ms, sizeof(ms), "%.3f", step.ms);
+            result.value(static_cast<int64_t>(step.rowsIn));
+            result.value(static_cast<int64_t>(step.rowsOut));
+            result.value(ms, length);
+            result.value(static_cast<int64_t>(step.bytesRead));
+        }
+        result.value(step.detail);
+        result.endRow();
+    };
+    for (const auto& step : steps) write(step);
+    if (total) write(*total);
+    result.finish(steps.size() + (total ? 1 : 0), out);
+}
+
+// EXPLAIN statement: the steps a SELECT, UPDATE or DELETE would run, without
+// running it
+void handleExplain(const std::string& command, std::ostream& out) {
+    try {
+        Statement stmt(trim(command.substr(7)));
+        std::string upperCmd = toUpper(stmt.text);
+        Planner planner = upperCmd.find("SELECT") == 0   ? planSelect
+                          : upperCmd.find("UPDATE") == 0 ? planUpdate
+                          : upperCmd.find("DELETE") == 0 ? planDelete
+                                                         : nullptr;
+        if (!planner) {
+            out << "Error: Only SELECT, UPDATE and DELETE statements can be explained.\n";
+            return;
         }
-        
-        std::ofstream file(filename, std::ios::binary);
-        if (!file) {
-            std::cout << "Error: Could not open file '" << filename << "' for writing.\n";
+        std::vector<std::string> args;
+        PlanPtr plan = statementPlan(stmt, planner, args, out);
+        if (!plan) return;
+
+        std::vector<ProfileStep> steps;
+        auto add = [&](const std::string& name, const std::string& detail) {
+            ProfileStep step;
+            step.name = name;
+            step.detail = detail;
+            steps.push_back(step);
+        };
+        auto access = [&](const Table& table, const Condition& where, size_t limit) {
+            PinGuard pin(database.at(table.name)); // Paths depend on the rows and zone bounds
+            AccessPath path = planAccess(table, where, limit);
+            add(accessName(path.kind), describeAccess(table, where, path));
+        };
+
+        if (plan->join) {
+            size_t fromPos = findKeyword(upperCmd, "FROM");
+            JoinQuery query;
+            std::string selectList = trim(stmt.text.substr(6, fromPos - 6));
+            if (!parseJoin(selectList, stmt.text.substr(fromPos + 4), query, out)) return;
+            for (int side = 0; side < 2; side++) {
+                access(*query.sides[side].table, query.where[side], SIZE_MAX);
+            }
+            add("Hash Join", joinDetail(query, false));
+            add("Output", outputDetail(query.projection.size(), outputMode));
+            writeSteps(steps, nullptr, out);
             return;
         }
-        
-        // Write number of tables
-        size_t numTables = database.size();
-        file.write(reinterpret_cast<const char*>(&numTables), sizeof(numTables));
-        
-        // Write each table
-        for (const auto& tablePair : database) {
-            const Table& table = tablePair.second;
-            
-            // Write table name
-            size_t nameLength = table.name.length();
-            file.write(reinterpret_cast<const char*>(&nameLength), sizeof(nameLength));
-            file.write(table.name.c_str(), nameLength);
-            
-            // Write next_id
-            file.write(reinterpret_cast<const char*>(&table.next_id), sizeof(table.next_id));
-            
-            // Write columns
-            size_t numColumns = table.columns.size();
-            file.write(reinterpret_cast<const char*>(&numColumns), sizeof(numColumns));
-            
-            for (const auto& column : table.columns) {
-                // Write column name
-                nameLength = column.name.length();
-                file.write(reinterpret_cast<const char*>(&nameLength), sizeof(nameLength));
-                file.write(column.name.c_str(), nameLength);
-                
-                // Write column type
-                size_t typeLength = column.type.length();
-                file.write(reinterpret_cast<const char*>(&typeLength), sizeof(typeLength));
-                file.write(column.type.c_str(), typeLength);
+
+        const Table& table = database.find(plan->tableName)->second;
+        Condition where = bindWhere(plan->where, args, table);
+        if (plan->kind == PlanKind::DELETE) {
+            if (where.kind == ConditionKind::ALL) {
+                add("Delete", "every row, freeing the table");
+            } else {
+                access(table, where, SIZE_MAX);
+                add("Delete", "marked deleted");
             }
-            
-            // Write rows
-            size_t numRows = table.rows.size();
-            file.write(reinterpret_cast<const char*>(&numRows), sizeof(numRows));
-            
-            for (const auto& row : table.rows) {
-                // Write row ID
-                file.write(reinterpret_cast<const char*>(&row.id), sizeof(row.id));
-                
-                // Write values
-                size_t numValues = row.values.size();
-                file.write(reinterpret_cast<const char*>(&numValues), sizeof(numValues));
-                
-                for (const auto& value : row.values) {
-                    size_t valueLength = value.length();
-                    file.write(reinterpret_cast<const char*>(&valueLength), sizeof(valueLength));
-                    file.write(value.c_str(), valueLength);
-                }
+        } else if (plan->kind == PlanKind::UPDATE) {
+            access(table, where, SIZE_MAX);
+            add("Update", updateDetail(table, *plan));
+        } else if (!plan->aggregates.empty()) {
+            access(table, where, SIZE_MAX);
+            add("Aggregate", aggregateDetail(table, plan->aggregates, plan->groupCol));
+            add("Output", outputDetail(plan->aggregates.size(), outputMode));
+        } else {
+            RowOrder order;
+            if (!bindOrder(*plan, args, order)) {
+                out << "Error: Invalid LIMIT clause. Expected: LIMIT n [OFFSET m]\n";
+                return;
             }
+            access(table, where, order.ordered || !plan->limited ? SIZE_MAX : order.needed());
+            if (order.ordered) add("Sort", orderDetail(table, order));
+            add("Output", outputDetail(plan->columns.size(), outputMode) +
+                              (plan->limited ? ", " + limitDetail(order) : ""));
         }
-        
-        file.close();
-        std::cout << "Database saved to '" << filename << "' successfully.\n";
+        writeSteps(steps, nullptr, out);
     } catch (const std::exception& e) {
-        std::cout << "Error saving database: " << e.what() << "\n";
+        out << "Error executing EXPLAIN: " << e.what() << "\n";
+    }
+}
+
+// Restore `name`.db and replay `name`.wal over it, then keep logging there
+void recoverDatabase(const std::string& name, SyncPolicy policy, int groupMs, std::ostream& out) {
+    walSnapshotPath = name + ".db";
+    TableMap tables;
+    uint64_t sequence = 0;
+    loadDatabaseFile(walSnapshotPath, tables, sequence); // a missing snapshot is an empty database
+    database.swap(tables);
+    catalogVersion++;
+
+    std::vector<std::string> statements = wal.open(name + ".wal", sequence, policy, groupMs);
+
+    // Replay quietly: the statements were acknowledged when first run. The
+    // catalog is held so background compaction waits for the replay.
+    // A committed transaction is one record of statements separated by NUL
+    // bytes.
+    std::ostream quiet(nullptr);
+    bool changed;
+    size_t replayed = 0;
+    std::lock_guard<SharedMutex> catalog(catalogLock);
+    for (const auto& record : statements) {
+        size_t start = 0;
+        while (start <= record.size()) {
+            size_t end = std::min(record.find('\0', start), record.size());
+            std::string statement = record.substr(start, end - start);
+            executeWrite(statement, toUpper(statement), changed, quiet);
+            replayed++;
+            start = end + 1;
+        }
     }
+
+    out << "Recovered '" << name << "': " << database.size() << " table(s), "
+        << replayed << " statement(s) replayed from '" << wal.path() << "'.\n";
 }
 
-// LOAD database from file
-void handleLoad(const std::string& command) {
+// SET threads = N | SET plan_cache = N
+void handleSet(const std::string& command, std::ostream& out) {
     try {
-        std::istringstream ss(command);
-        std::string word, filename;
-        ss >> word; // LOAD
-        ss >> filename;
-        
-        if (filename.empty()) {
-            std::cout << "Error: Filename is required.\n";
+        std::string rest = trim(command.substr(3)); // threads = 8
+        size_t equalsPos = rest.find('=');
+        if (equalsPos == std::string::npos) {
+            out << "Error: Expected SET name = value.\n";
             return;
         }
-        
-        // Add .db extension if not present
-        if (filename.find('.') == std::string::npos) {
-            filename += ".db";
-        }
-        
-        std::ifstream file(filename, std::ios::binary);
-        if (!file) {
-            std::cout << "Error: Could not open file '" << filename << "' for reading.\n";
+
+        std::string name = toUpper(trim(rest.substr(0, equalsPos)));
+        std::string value = trim(rest.substr(equalsPos + 1));
+
+        if (name == "PLAN_CACHE") {
+            int64_t entries;
+            if (!parseNumber(value, entries) || entries > 1000000) {
+                out << "Error: plan_cache must be a number from 0 to 1000000.\n";
+                return;
+            }
+            planCache.setCapacity(entries);
+            out << "Caching up to " << entries << " statement plan(s).\n";
             return;
         }
-        
-        // Clear existing database
-        database.clear();
-        
-        // Read number of tables
-        size_t numTables;
-        file.read(reinterpret_cast<char*>(&numTables), sizeof(numTables));
-        
-        // Read each table
-        for (size_t i = 0; i < numTables; i++) {
-            Table table;
-            
-            // Read table name
-            size_t nameLength;
-            file.read(reinterpret_cast<char*>(&nameLength), sizeof(nameLength));
-            table.name.resize(nameLength);
-            file.read(&table.name[0], nameLength);
-            
-            // Read next_id
-            file.read(reinterpret_cast<char*>(&table.next_id), sizeof(table.next_id));
-            
-            // Read columns
-            size_t numColumns;
-            file.read(reinterpret_cast<char*>(&numColumns), sizeof(numColumns));
-            
-            for (size_t j = 0; j < numColumns; j++) {
-                Column column;
-                
-                // Read column name
-                size_t nameLength;
-                file.read(reinterpret_cast<char*>(&nameLength), sizeof(nameLength));
-                column.name.resize(nameLength);
-                file.read(&column.name[0], nameLength);
-                
-                // Read column type
-                size_t typeLength;
-                file.read(reinterpret_cast<char*>(&typeLength), sizeof(typeLength));
-                column.type.resize(typeLength);
-                file.read(&column.type[0], typeLength);
-                
-                table.columns.push_back(column);
-            }
-            
-            // Read rows
-            size_t numRows;
-            file.read(reinterpret_cast<char*>(&numRows), sizeof(numRows));
-            
-            for (size_t j = 0; j < numRows; j++) {
-                Row row;
-                
-                // Read row ID
-                file.read(reinterpret_cast<char*>(&row.id), sizeof(row.id));
-                
-                // Read values
-                size_t numValues;
-                file.read(reinterpret_cast<char*>(&numValues), sizeof(numValues));
-                
-                for (size_t k = 0; k < numValues; k++) {
-                    size_t valueLength;
-                    file.read(reinterpret_cast<char*>(&valueLength), sizeof(valueLength));
-                    
-                    std::string value;
-                    value.resize(valueLength);
-                    file.read(&value[0], valueLength);
-                    
-                    row.values.push_back(value);
-                }
-                
-                table.rows.push_back(row);
+
+        if (name == "BUFFER_POOL") {
+            int64_t megabytes;
+            if (!parseNumber(value, megabytes) || megabytes < 1 || megabytes > 1048576) {
+                out << "Error: buffer_pool must be a number of MB from 1 to 1048576.\n";
+                return;
             }
-            
-            database[table.name] = table;
+            bufferPool.setBudget(static_cast<size_t>(megabytes) << 20);
+            out << "Keeping up to " << megabytes << " MB of paged tables in memory.\n";
+            return;
         }
-        
-        file.close();
-        std::cout << "Database loaded from '" << filename << "' successfully.\n";
-        std::cout << numTables << " table(s) loaded.\n";
+
+        if (name != "THREADS") {
+            out << "Error: Unknown setting '" << trim(rest.substr(0, equalsPos)) << "'.\n";
+            return;
+        }
+
+        int64_t numThreads;
+        if (!parseNumber(value, numThreads) || numThreads < 1 || numThreads > 1024) {
+            out << "Error: threads must be a number from 1 to 1024.\n";
+            return;
+        }
+
+        setThreadCount(numThreads);
+        out << "Using " << numThreads << " thread(s) for scans and bulk loads.\n";
     } catch (const std::exception& e) {
-        std::cout << "Error loading database: " << e.what() << "\n";
+        out << "Error executing SET: " << e.what() << "\n";
+    }
+}
+
+// .mode [table|csv|tsv|binary]: set or show the output mode of this session
+void handleMode(const std::string& command, std::ostream& out) {
+    static const char* names[] = {"table", "csv", "tsv", "binary"};
+    std::istringstream ss(command);
+    std::string word, mode;
+    ss >> word >> mode;
+    if (mode.empty()) {
+        out << "Output mode: " << names[static_cast<int>(outputMode)] << "\n";
+        return;
+    }
+    for (int i = 0; i < 4; i++) {
+        if (toUpper(mode) == toUpper(names[i])) {
+            outputMode = static_cast<OutputMode>(i);
+            out << "Output mode set to " << names[i] << ".\n";
+            return;
+        }
     }
+    out << "Error: Unknown output mode '" << mode << "'. Expected: table, csv, tsv or binary\n";
 }
 
 // Display help information
-void handleHelp() {
-    std::cout << "\nMini Database Engine - Available Commands:\n";
-    std::cout << std::string(40, '=') << "\n";
-    std::cout << "CREATE TABLE tableName (col1 TYPE, col2 TYPE, ...)\n";
-    std::cout << "INSERT INTO tableName VALUES (val1, val2, ...)\n";
-    std::cout << "SELECT * FROM tableName [WHERE condition]\n";
-    std::cout << "UPDATE tableName SET col1=val1, col2=val2 [WHERE condition]\n";
-    std::cout << "DELETE FROM tableName [WHERE condition]\n";
-    std::cout << "SAVE filename\n";
-    std::cout << "LOAD filename\n";
-    std::cout << "HELP\n";
-    std::cout << "EXIT\n";
-    std::cout << std::string(40, '=') << "\n";
-    std::cout << "Supported data types: INT, TEXT\n";
-    std::cout << "Supported operators in WHERE clause: =, !=, >, <, >=, <=\n";
-    std::cout << "Example: SELECT * FROM users WHERE age > 30\n\n";
+void handleHelp(std::ostream& out) {
+    out << "\nMini Database Engine - Available Commands:\n";
+    out << std::string(40, '=') << "\n";
+    out << "CREATE TABLE tableName (col1 TYPE, col2 TYPE, ...)\n";
+    out << "CREATE INDEX indexName ON tableName(column) [USING HASH|BTREE]\n";
+    out << "DROP INDEX indexName\n";
+    out << "INSERT INTO tableName VALUES (val1, val2, ...)[, (...), ...]\n";
+    out << "COPY tableName FROM 'file.csv' [HEADER]\n";
+    out << "SELECT *|col1, col2, ... FROM tableName [WHERE condition]\n";
+    out << "    [ORDER BY col [ASC|DESC]] [LIMIT n [OFFSET m]]\n";
+    out << "SELECT aggregate, ... FROM tableName [WHERE condition] [GROUP BY column]\n";
+    out << "SELECT *|cols FROM table1 JOIN table2 ON table1.col = table2.col [WHERE condition]\n";
+    out << "UPDATE tableName SET col1=val1, col2=val2 [WHERE condition]\n";
+    out << "DELETE FROM tableName [WHERE condition]\n";
+    out << "BEGIN [TRANSACTION], COMMIT, ROLLBACK\n";
+    out << "SAVE [ASYNC] filename\n";
+    out << "LOAD filename [PAGED]\n";
+    out << "CHECKPOINT\n";
+    out << "SHOW MEMORY\n";
+    out << "SHOW SAVE STATUS\n";
+    out << "SHOW BUFFER POOL\n";
+    out << "SHOW STATS\n";
+    out << "EXPLAIN [ANALYZE] SELECT|UPDATE|DELETE ...\n";
+    out << "VACUUM [tableName]\n";
+    out << "PREPARE name AS statement    (? marks a parameter)\n";
+    out << "EXECUTE name(arg, ...)\n";
+    out << "DEALLOCATE name\n";
+    out << "SET threads = N\n";
+    out << "SET plan_cache = N\n";
+    out << "SET buffer_pool = N    (MB)\n";
+    out << ".mode [table|csv|tsv|binary]\n";
+    out << ".timer [on|off]\n";
+    out << "HELP\n";
+    out << "EXIT\n";
+    out << std::string(40, '=') << "\n";
+    out << "Supported data types: INT, TEXT\n";
+    out << "Supported operators in WHERE clause: =, !=, <>, >, <, >=, <=, BETWEEN a AND b,\n";
+    out << "    IN (a, b, ...), LIKE pattern; combined with AND, OR, NOT and parentheses\n";
+    out << "Aggregates: COUNT(*), COUNT(col), SUM(col), MIN(col), MAX(col), AVG(col)\n";
+    out << "WHERE id ... matches the row ID unless the table has an 'id' column\n";
+    out << "Example: SELECT * FROM users WHERE age > 30\n\n";
+}
+
+// ---- Statement Statistics ----
+StatementStats statementStats[kNumStatementKinds];  // Zeroed before main
+
+thread_local bool statementTimer = false;  // .timer on
+
+void recordStatement(const std::string& upperCmd, double ms) {
+    size_t kind = 0;
+    while (kind + 1 < kNumStatementKinds && upperCmd.compare(0, std::strlen(kStatementKinds[kind]),
+                                                              kStatementKinds[kind]) != 0) {
+        kind++;
+    }
+    double micros = ms * 1000.0;
+    size_t bucket = 0;
+    for (double limit = 10; bucket + 1 < kNumLatencyBuckets && micros >= limit; limit *= 10) bucket++;
+
+    StatementStats& stats = statementStats[kind];
+    stats.count.fetch_add(1, std::memory_order_relaxed);
+    stats.totalMicros.fetch_add(static_cast<uint64_t>(micros), std::memory_order_relaxed);
+    stats.buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+}
+
+// SHOW STATS: statements run since startup by kind, with their latencies
+void handleShowStats(std::ostream& out) {
+    std::vector<ResultColumn> columns = {{"statement", false, false}, {"count", true, false},
+                                         {"total_ms", false, false},  {"avg_us", true, false}};
+    for (const char* bucket : kLatencyBuckets) columns.push_back(ResultColumn{bucket, true, false});
+    ResultWriter result(outputMode, columns);
+    result.header();
+    size_t numRows = 0;
+    for (size_t kind = 0; kind < kNumStatementKinds; kind++) {
+        const StatementStats& stats = statementStats[kind];
+        uint64_t count = stats.count.load(std::memory_order_relaxed);
+        if (count == 0) continue;
+        uint64_t micros = stats.totalMicros.load(std::memory_order_relaxed);
+        char ms[32];
+        int length = std::snprintf(ms, sizeof(ms), "%.3f", micros / 1000.0);
+        result.value(kStatementKinds[kind]);
+        result.value(static_cast<int64_t>(count));
+        result.value(ms, length);
+        result.value(static_cast<int64_t>(micros / count));
+        for (const auto& bucket : stats.buckets) {
+            result.value(static_cast<int64_t>(bucket.load(std::memory_order_relaxed)));
+        }
+        result.endRow();
+        numRows++;
+    }
+    result.finish(numRows, out);
+}
+
+// .timer [on|off]: print the time each statement of this session takes
+void handleTimer(const std::string& command, std::ostream& out) {
+    std::istringstream ss(command);
+    std::string word, setting;
+    ss >> word >> setting;
+    setting = toUpper(setting);
+    if (setting.empty()) {
+        out << "Timer is " << (statementTimer ? "on" : "off") << ".\n";
+    } else if (setting == "ON" || setting == "OFF") {
+        statementTimer = setting == "ON";
+        out << "Timer " << (statementTimer ? "on" : "off") << ".\n";
+    } else {
+        out << "Error: Expected .timer on or .timer off\n";
+    }
+}
+
+// ---- Statement Execution ----
+// Whether a statement may run given the transactions open, or false after
+// reporting why not. Inside a transaction only reads and row writes run;
+// statements that replace or write out whole tables wait for every
+// transaction to finish.
+bool transactionAllows(const std::string& upperCmd, std::ostream& out) {
+    static const char* inside[] = {"SELECT", "INSERT INTO", "UPDATE", "DELETE FROM", "EXPLAIN ", "SHOW ",
+                                   "HELP", "BEGIN", "COMMIT", "ROLLBACK"};
+    static const char* outside[] = {"SAVE", "LOAD", "CHECKPOINT", "COPY"};
+    std::string verb = upperCmd.substr(0, upperCmd.find(' '));
+    if (activeTransaction) {
+        for (const char* prefix : inside) {
+            if (upperCmd.find(prefix) == 0) return true;
+        }
+        out << "Error: " << verb << " cannot run inside a transaction.\n";
+        return false;
+    }
+    for (const char* prefix : outside) {
+        if (upperCmd.find(prefix) == 0 && transactionsOpen()) {
+            out << "Error: " << verb << " cannot run while transactions are open.\n";
+            return false;
+        }
+    }
+    return true;
+}
+
+// Run INSERT, UPDATE or DELETE in the session's transaction, logged when it
+// commits, or, while other sessions have transactions open, as a
+// transaction of its own. Holds the catalog shared and the table's lock.
+void writeInTransaction(const Statement& stmt, const std::string& upperCmd, std::ostream& out) {
+    std::ostringstream reply;
+    bool changed = false;
+    if (activeTransaction) {
+        writingTransaction = activeTransaction.get();
+        executeWrite(stmt, upperCmd, changed, reply);
+        writingTransaction = nullptr;
+        if (changed) activeTransaction->log.push_back(stmt.text);
+        out << reply.str();
+        return;
+    }
+
+    Transaction txn;
+    startTransaction(txn, false);
+    writingTransaction = &txn;
+    executeWrite(stmt, upperCmd, changed, reply);
+    writingTransaction = nullptr;
+    try {
+        if (changed) wal.append(stmt.text);
+    } catch (...) {
+        finishTransaction(txn, false, nullptr);
+        finishWrites(txn, false, 0);
+        throw;
+    }
+    uint64_t stamp = 0;
+    uint64_t oldest = finishTransaction(txn, false, changed ? &stamp : nullptr);
+    finishWrites(txn, changed, stamp);
+    for (const auto& written : txn.tables) {
+        auto it = database.find(written.first);
+        if (it != database.end()) collectTable(it->second, oldest);
+    }
+    out << reply.str();
+}
+
+// Run a statement whose locks are held. A change is written to the log
+// before its reply; under --sync group, executeStatement then waits for the
+// sync, so nothing is acknowledged that recovery would lose.
+void dispatch(const Statement& stmt, const std::string& upperCmd, std::ostream& out) {
+    const std::string& command = stmt.text;
+    std::ostringstream reply;
+    bool changed = false;
+
+    if (!transactionAllows(upperCmd, out)) return;
+    bool rowWrite = upperCmd.find("INSERT INTO") == 0 || upperCmd.find("UPDATE") == 0 ||
+                    upperCmd.find("DELETE FROM") == 0;
+    if (rowWrite && (activeTransaction || transactionsOpen())) {
+        writeInTransaction(stmt, upperCmd, out);
+    } else if (executeWrite(stmt, upperCmd, changed, reply)) {
+        if (changed) wal.append(command);
+        out << reply.str();
+    } else if (upperCmd == "HELP") {
+        handleHelp(out);
+    } else if (upperCmd == "BEGIN" || upperCmd == "BEGIN TRANSACTION") {
+        handleBegin(out);
+    } else if (upperCmd == "COMMIT") {
+        handleCommit(out);
+    } else if (upperCmd == "ROLLBACK") {
+        handleRollback(out);
+    } else if (upperCmd.find("SELECT") == 0) {
+        handleSelect(stmt, out);
+    } else if (upperCmd.find("SAVE") == 0) {
+        handleSave(command, out);
+    } else if (upperCmd.find("LOAD") == 0) {
+        // The log only applies to the snapshot it follows
+        if (handleLoad(command, out) && wal.isOpen()) checkpoint();
+    } else if (upperCmd.find("COPY") == 0) {
+        // The copied file may change, so it is not replayed from the log
+        if (handleCopy(command, out) && wal.isOpen()) checkpoint();
+    } else if (upperCmd == "CHECKPOINT") {
+        handleCheckpoint(out);
+    } else if (upperCmd == "SHOW MEMORY") {
+        handleShowMemory(out);
+    } else if (upperCmd == "SHOW SAVE STATUS") {
+        handleShowSaveStatus(out);
+    } else if (upperCmd == "SHOW BUFFER POOL") {
+        handleShowBufferPool(out);
+    } else if (upperCmd.find("EXPLAIN ") == 0) {
+        handleExplain(command, out);
+    } else if (upperCmd == "VACUUM" || upperCmd.find("VACUUM ") == 0) {
+        handleVacuum(command, out);
+    } else if (upperCmd.find("SET ") == 0) {
+        // Runs under the exclusive catalog lock, so no scan is using the pool
+        handleSet(command, out);
+    } else {
+        out << "Unknown command. Type HELP for available commands.\n";
+    }
+}
+
+// Word `position` of a statement, counting from 0, or the word after the
+// first `after` keyword when `position` is npos
+std::string statementWord(const std::string& command, size_t position,
+                          const std::string& after) {
+    std::istringstream ss(command);
+    std::string word;
+    for (size_t i = 0; ss >> word; i++) {
+        if (position == std::string::npos ? toUpper(word) == after : i == position) {
+            if (position == std::string::npos) ss >> word;
+            return word;
+        }
+    }
+    return "";
+}
+
+// Planner of a statement that can be planned and prepared, or nullptr
+Planner statementPlanner(const std::string& upperCmd) {
+    if (upperCmd.find("SELECT") == 0) return planSelect;
+    if (upperCmd.find("INSERT INTO") == 0) return planInsert;
+    if (upperCmd.find("UPDATE") == 0) return planUpdate;
+    if (upperCmd.find("DELETE FROM") == 0) return planDelete;
+    return nullptr;
+}
+
+// PREPARE name AS statement, with ? for each parameter
+void handlePrepare(const std::string& command, std::ostream& out) {
+    std::istringstream ss(command);
+    std::string word, name, as, text;
+    ss >> word >> name >> as;
+    std::getline(ss, text);
+    text = trim(text);
+    if (name.empty() || toUpper(as) != "AS" || text.empty()) {
+        out << "Error: Invalid PREPARE syntax. Expected: PREPARE name AS statement\n";
+        return;
+    }
+
+    Planner planner = statementPlanner(toUpper(text));
+    if (!planner) {
+        out << "Error: Only SELECT, INSERT, UPDATE and DELETE statements can be prepared.\n";
+        return;
+    }
+
+    // Placeholder i is argument params[i], or the constant literal i
+    PreparedStatement prepared;
+    std::vector<size_t> parameters;
+    normalizeStatement(text, prepared.key, prepared.constants, &parameters);
+    prepared.params.assign(prepared.constants.size(), -1);
+    for (size_t i = 0; i < parameters.size(); i++) prepared.params[parameters[i]] = static_cast<int>(i);
+    prepared.numArgs = parameters.size();
+
+    // Planned now so that errors show up here, and the plan is cached
+    Statement stmt(text);
+    stmt.key = prepared.key;
+    stmt.literals = prepared.constants;
+    std::vector<std::string> args;
+    {
+        SharedLock catalog(catalogLock);
+        if (!statementPlan(stmt, planner, args, out)) return;
+    }
+    preparedStatements[name] = prepared;
+    out << "Statement '" << name << "' prepared.\n";
+}
+
+// EXECUTE name[(arg, ...)]: the prepared statement with its arguments bound,
+// or false after reporting why there is none
+bool bindPrepared(const std::string& command, Statement& stmt, std::ostream& out) {
+    std::string rest = trim(command.substr(7));
+    size_t open = rest.find('(');
+    std::string name = trim(rest.substr(0, open));
+    std::vector<std::string> args;
+    if (open != std::string::npos) {
+        if (rest.back() != ')') {
+            out << "Error: Invalid EXECUTE syntax. Expected: EXECUTE name(arg, ...)\n";
+            return false;
+        }
+        // Arguments are split at commas outside quotes
+        std::string list = rest.substr(open + 1, rest.size() - open - 2);
+        char quote = 0;
+        size_t start = 0;
+        for (size_t i = 0; i <= list.size(); i++) {
+            if (i == list.size() || (list[i] == ',' && !quote)) {
+                args.push_back(trim(list.substr(start, i - start)));
+                start = i + 1;
+            } else if (quote) {
+                if (list[i] == quote) quote = 0;
+            } else if (isQuote(RowFormat::TUPLES, list[i])) {
+                quote = list[i];
+            }
+        }
+        if (args.size() == 1 && args[0].empty()) args.clear();
+    }
+
+    auto it = preparedStatements.find(name);
+    if (it == preparedStatements.end()) {
+        out << "Error: Prepared statement '" << name << "' not found.\n";
+        return false;
+    }
+    const PreparedStatement& prepared = it->second;
+    if (args.size() != prepared.numArgs) {
+        out << "Error: Statement '" << name << "' expects " << prepared.numArgs
+            << " argument(s), but got " << args.size() << ".\n";
+        return false;
+    }
+
+    stmt.key = prepared.key;
+    stmt.literals = prepared.constants;
+    for (size_t i = 0; i < prepared.params.size(); i++) {
+        if (prepared.params[i] >= 0) stmt.literals[i] = args[prepared.params[i]];
+    }
+    stmt.text = bindStatement(stmt.key, stmt.literals);
+    return true;
+}
+
+// DEALLOCATE name
+void handleDeallocate(const std::string& command, std::ostream& out) {
+    std::string name = trim(command.substr(10));
+    if (preparedStatements.erase(name) == 0) {
+        out << "Error: Prepared statement '" << name << "' not found.\n";
+        return;
+    }
+    out << "Statement '" << name << "' deallocated.\n";
+}
+
+// Run a statement under the locks it needs. Statements on a single table
+// share the catalog and lock that table, shared for SELECT and exclusive for
+// writes, so sessions on different tables never wait for each other and
+// readers never wait for readers. A reader holds its lock to the end, so
+// writers to its table wait for it, unless it scans in a snapshot, which
+// reads a view of the table instead (see readTable). The tables they read
+// are pinned in the buffer pool. BEGIN, COMMIT and ROLLBACK share the
+// catalog and lock only the tables the transaction wrote, in name order, so
+// they wait for no statement on any other table. Everything else locks the
+// whole catalog.
+void runStatement(const Statement& stmt, std::ostream& out) {
+    const std::string& command = stmt.text;
+    std::string upperCmd = toUpper(command);
+    bool ending = (upperCmd == "COMMIT" || upperCmd == "ROLLBACK") && activeTransaction;
+    if (ending || upperCmd == "BEGIN" || upperCmd == "BEGIN TRANSACTION") {
+        SharedLock catalog(catalogLock);
+        std::vector<std::string> written = writtenTables();
+        {
+            std::vector<std::unique_lock<SharedMutex>> tables;
+            for (const std::string& name : written) {
+                auto it = database.find(name);
+                if (it != database.end()) tables.emplace_back(*it->second.lock);
+            }
+            dispatch(stmt, upperCmd, out);
+        }
+        if (ending) collectOthers(written);
+        return;
+    }
+
+    bool select = upperCmd.find("SELECT") == 0;
+    std::string tableName;
+    if (select) {
+        tableName = statementWord(command, std::string::npos);
+    } else if (upperCmd.find("INSERT INTO") == 0 || upperCmd.find("DELETE FROM") == 0) {
+        tableName = statementWord(command, 2);
+    } else if (upperCmd.find("UPDATE") == 0 || upperCmd.find("VACUUM ") == 0 ||
+               (upperCmd.find("COPY") == 0 && !wal.isOpen())) {
+        tableName = statementWord(command, 1);
+    }
+
+    if (!tableName.empty()) {
+        SharedLock catalog(catalogLock);
+        auto it = database.find(tableName);
+        if (it == database.end()) {
+            dispatch(stmt, upperCmd, out); // Reports the missing table
+        } else if (select) {
+            // A join also reads its second table. Both are locked in name
+            // order, so two joins never wait for each other.
+            auto joined = database.find(statementWord(command, std::string::npos, "JOIN"));
+            if (joined == database.end() || joined == it) {
+                ReadLock table(it->second);
+                PinGuard pin(it->second);
+                dispatch(stmt, upperCmd, out);
+            } else {
+                bool fromFirst = it->first < joined->first;
+                ReadLock first((fromFirst ? it : joined)->second);
+                ReadLock second((fromFirst ? joined : it)->second);
+                PinGuard pinFirst(it->second);
+                PinGuard pinSecond(joined->second);
+                dispatch(stmt, upperCmd, out);
+            }
+        } else {
+            std::lock_guard<SharedMutex> table(*it->second.lock);
+            PinGuard pin(it->second);
+            dispatch(stmt, upperCmd, out);
+        }
+        return;
+    }
+
+    std::lock_guard<SharedMutex> catalog(catalogLock);
+    dispatch(stmt, upperCmd, out);
+}
+
+// EXPLAIN ANALYZE statement: run a SELECT, UPDATE or DELETE as usual, under
+// its locks and logged if it changes anything, and list the steps it ran in
+// place of its reply. The total also covers parsing and waiting for locks.
+void handleExplainAnalyze(const std::string& command, std::ostream& out) {
+    std::string text = trim(command.substr(16));
+    std::string upperText = toUpper(text);
+    if (upperText.find("SELECT") != 0 && upperText.find("UPDATE") != 0 && upperText.find("DELETE") != 0) {
+        out << "Error: Only SELECT, UPDATE and DELETE statements can be explained.\n";
+        return;
+    }
+
+    Profile profile;
+    std::ostringstream reply;
+    ProfileStep total;
+    total.name = "Total";
+    auto start = std::chrono::steady_clock::now();
+    {
+        ProfileScope scope(profile);
+        runStatement(text, reply);
+    }
+    total.ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+    if (reply.str().compare(0, 6, "Error:") == 0) {
+        out << reply.str();
+        return;
+    }
+    // Rows in are those the scans and lookups looked at; rows out, those
+    // the last step produced
+    for (const auto& step : profile.steps) {
+        if (step.access) total.rowsIn += step.rowsIn;
+        total.bytesRead += step.bytesRead;
+    }
+    if (!profile.steps.empty()) total.rowsOut = profile.steps.back().rowsOut;
+    total.detail = std::to_string(profile.allocations.allocations) + " heap allocation(s), " +
+                   std::to_string(profile.allocations.bytes) + " byte(s)";
+    writeSteps(profile.steps, &total, out);
+}
+
+// Run one statement, writing its reply to `out`; returns false for EXIT
+bool executeStatement(const std::string& command, std::ostream& out) {
+    std::string upperCmd = toUpper(command);
+    if (upperCmd == "EXIT") return false;
+
+    // Session state only, so no locks beyond what planning needs
+    if (upperCmd == ".MODE" || upperCmd.find(".MODE ") == 0) {
+        handleMode(command, out);
+        return true;
+    } else if (upperCmd == ".TIMER" || upperCmd.find(".TIMER ") == 0) {
+        handleTimer(command, out);
+        return true;
+    } else if (upperCmd == "SHOW STATS") {
+        handleShowStats(out);
+        return true;
+    } else if (upperCmd.find("PREPARE ") == 0) {
+        handlePrepare(command, out);
+        return true;
+    } else if (upperCmd.find("DEALLOCATE ") == 0) {
+        handleDeallocate(command, out);
+        return true;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    if (upperCmd.find("EXECUTE ") == 0) {
+        Statement stmt;
+        if (!bindPrepared(command, stmt, out)) return true;
+        runStatement(stmt, out);
+        upperCmd = toUpper(stmt.text);
+    } else if (upperCmd.find("EXPLAIN ANALYZE ") == 0) {
+        handleExplainAnalyze(command, out);
+    } else {
+        runStatement(command, out);
+    }
+    wal.awaitAppended(); // The reply is sent only once its record is on disk
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    recordStatement(upperCmd, ms);
+    if (statementTimer) {
+        char line[48];
+        int length = std::snprintf(line, sizeof(line), "Time: %.3f ms\n", ms);
+        out.write(line, length);
+    }
+    return true;
+}
+
+// ---- Server ----
+// Clients send newline-terminated statements and get each reply back
+// followed by a NUL byte. Every connection is served by its own thread.
+#ifdef CRT_HAVE_SOCKETS
+std::atomic<bool> serverStopping(false);
+
+// A Unix-domain socket if `address` contains '/', otherwise a TCP port on
+// the loopback interface
+bool socketAddress(const std::string& address, sockaddr_storage& storage, socklen_t& length) {
+    std::memset(&storage, 0, sizeof(storage));
+    if (address.find('/') != std::string::npos) {
+        sockaddr_un& unixAddr = reinterpret_cast<sockaddr_un&>(storage);
+        if (address.size() >= sizeof(unixAddr.sun_path)) return false;
+        unixAddr.sun_family = AF_UNIX;
+        std::memcpy(unixAddr.sun_path, address.c_str(), address.size() + 1);
+        length = sizeof(unixAddr);
+        return true;
+    }
+
+    int64_t port;
+    if (!parseNumber(address, port) || port == 0 || port > 65535) return false;
+    sockaddr_in& inetAddr = reinterpret_cast<sockaddr_in&>(storage);
+    inetAddr.sin_family = AF_INET;
+    inetAddr.sin_port = htons(static_cast<uint16_t>(port));
+    inetAddr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    length = sizeof(inetAddr);
+    return true;
+}
+
+int openListener(const std::string& address) {
+    sockaddr_storage storage;
+    socklen_t length;
+    if (!socketAddress(address, storage, length)) {
+        throw std::runtime_error("invalid address '" + address + "'");
+    }
+
+    int fd = socket(storage.ss_family, SOCK_STREAM, 0);
+    if (fd < 0) throw std::runtime_error("could not create socket");
+    if (storage.ss_family == AF_UNIX) {
+        unlink(address.c_str());
+    } else {
+        int reuse = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    }
+    if (bind(fd, reinterpret_cast<sockaddr*>(&storage), length) != 0 || listen(fd, 128) != 0) {
+        ::close(fd);
+        throw std::runtime_error("could not listen on '" + address + "'");
+    }
+    return fd;
+}
+
+int connectSocket(const std::string& address) {
+    sockaddr_storage storage;
+    socklen_t length;
+    if (!socketAddress(address, storage, length)) return -1;
+    int fd = socket(storage.ss_family, SOCK_STREAM, 0);
+    if (fd >= 0 && connect(fd, reinterpret_cast<sockaddr*>(&storage), length) != 0) {
+        ::close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+bool sendAll(int fd, const char* data, size_t size) {
+    while (size > 0) {
+        ssize_t sent = send(fd, data, size, 0);
+        if (sent <= 0) return false;
+        data += sent;
+        size -= sent;
+    }
+    return true;
+}
+
+void serveSession(int fd) {
+    std::string pending;
+    char buffer[64 * 1024];
+    bool open = true;
+
+    while (open) {
+        ssize_t received = recv(fd, buffer, sizeof(buffer), 0);
+        if (received <= 0) break;
+        pending.append(buffer, received);
+
+        size_t start = 0, newline;
+        while (open && (newline = pending.find('\n', start)) != std::string::npos) {
+            std::string command = trim(pending.substr(start, newline - start));
+            start = newline + 1;
+            if (command.empty()) continue;
+
+            std::ostringstream out;
+            try {
+                open = executeStatement(command, out);
+            } catch (const std::exception& e) {
+                out << "Error: " << e.what() << "\n";
+            }
+            if (!open) out << "Goodbye!\n";
+            std::string reply = out.str();
+            reply.push_back('\0');
+            if (!sendAll(fd, reply.data(), reply.size())) open = false;
+        }
+        pending.erase(0, start);
+    }
+
+    // A transaction left open by the client is rolled back
+    if (activeTransaction) {
+        std::ostream quiet(nullptr);
+        executeStatement("ROLLBACK", quiet);
+    }
+}
+
+// Accept clients until serverStopping is set, then close every session and
+// wait for them to finish
+void runServer(int listenFd) {
+    std::signal(SIGPIPE, SIG_IGN);
+    std::mutex sessionsMutex;
+    std::condition_variable sessionsDone;
+    std::vector<int> sessions;
+
+    while (!serverStopping) {
+        pollfd waiting = {listenFd, POLLIN, 0};
+        if (poll(&waiting, 1, 200) <= 0) continue;
+        int fd = accept(listenFd, nullptr, nullptr);
+        if (fd < 0) continue;
+
+        std::lock_guard<std::mutex> guard(sessionsMutex);
+        sessions.push_back(fd);
+        std::thread([fd, &sessionsMutex, &sessionsDone, &sessions]() {
+            serveSession(fd);
+            std::lock_guard<std::mutex> guard(sessionsMutex);
+            sessions.erase(std::find(sessions.begin(), sessions.end(), fd));
+            ::close(fd);
+            sessionsDone.notify_all();
+        }).detach();
+    }
+
+    std::unique_lock<std::mutex> guard(sessionsMutex);
+    for (int fd : sessions) shutdown(fd, SHUT_RDWR);
+    sessionsDone.wait(guard, [&] { return sessions.empty(); });
+    ::close(listenFd);
 }
+#endif
 
 // ---- Main Loop ----
-int main() {
+#ifndef CRT_NO_MAIN
+void printUsage() {
+    std::cout << "Usage: CRT [--wal name] [--sync statement|group|delayed|off] [--group-ms N] [--listen address]\n";
+    std::cout << "  --wal name        keep name.db and a write-ahead log name.wal; recover on start\n";
+    std::cout << "  --sync            when the log is synced to disk (default: statement)\n";
+    std::cout << "  --group-ms N      sync interval for --sync delayed (default: 10)\n";
+    std::cout << "  --listen address  serve clients on a TCP port of 127.0.0.1 or a Unix socket path\n";
+}
+
+#ifdef CRT_HAVE_SOCKETS
+void stopServer(int) {
+    serverStopping = true;
+}
+#endif
+
+int main(int argc, char** argv) {
+    std::string walName, listenAddress;
+    SyncPolicy policy = SyncPolicy::STATEMENT;
+    int groupMs = 10;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        std::string value = i + 1 < argc ? argv[i + 1] : "";
+        if (arg == "--wal" && !value.empty()) {
+            walName = value;
+        } else if (arg == "--sync" &&
+                   (value == "statement" || value == "group" || value == "delayed" || value == "off")) {
+            policy = value == "statement" ? SyncPolicy::STATEMENT
+                   : value == "group"     ? SyncPolicy::GROUP
+                   : value == "delayed"   ? SyncPolicy::DELAYED
+                                          : SyncPolicy::OFF;
+        } else if (arg == "--group-ms" && isNumber(value) && value.size() < 7 && std::stoi(value) > 0) {
+            groupMs = std::stoi(value);
+#ifdef CRT_HAVE_SOCKETS
+        } else if (arg == "--listen" && !value.empty()) {
+            listenAddress = value;
+#endif
+        } else {
+            printUsage();
+            return 1;
+        }
+        i++;
+    }
+
     std::cout << "Mini Database Engine v2.0\n";
+    if (!walName.empty()) {
+        try {
+            recoverDatabase(walName, policy, groupMs, std::cout);
+        } catch (const std::exception& e) {
+            std::cout << "Error recovering '" << walName << "': " << e.what() << "\n";
+            return 1;
+        }
+    }
+
+#ifdef CRT_HAVE_SOCKETS
+    if (!listenAddress.empty()) {
+        try {
+            int listenFd = openListener(listenAddress);
+            std::signal(SIGINT, stopServer);
+            std::signal(SIGTERM, stopServer);
+            std::cout << "Listening on '" << listenAddress << "'. Press Ctrl+C to stop.\n" << std::flush;
+            runServer(listenFd);
+        } catch (const std::exception& e) {
+            std::cout << "Error: " << e.what() << "\n";
+            return 1;
+        }
+        wal.close();
+        std::cout << "Server stopped.\n";
+        return 0;
+    }
+#endif
+
     std::cout << "Type HELP for available commands or EXIT to quit\n";
     std::string command;
 
     while (true) {
         std::cout << "db> ";
-        std::getline(std::cin, command);
+        if (!std::getline(std::cin, command)) break;
         
         if (command.empty()) continue;
         
-        std::string upperCmd = toUpper(command);
-        
+        std::ostringstream reply;
+        bool open = true;
         try {
-            if (upperCmd == "EXIT") {
-                break;
-            } else if (upperCmd == "HELP") {
-                handleHelp();
-            } else if (upperCmd.find("CREATE TABLE") == 0) {
-                handleCreate(command);
-            } else if (upperCmd.find("INSERT INTO") == 0) {
-                handleInsert(command);
-            } else if (upperCmd.find("SELECT") == 0) {
-                handleSelect(command);
-            } else if (upperCmd.find("UPDATE") == 0) {
-                handleUpdate(command);
-            } else if (upperCmd.find("DELETE FROM") == 0) {
-                handleDelete(command);
-            } else if (upperCmd.find("SAVE") == 0) {
-                handleSave(command);
-            } else if (upperCmd.find("LOAD") == 0) {
-                handleLoad(command);
-            } else {
-                std::cout << "Unknown command. Type HELP for available commands.\n";
-            }
+            open = executeStatement(command, reply);
         } catch (const std::exception& e) {
-            std::cout << "Error: " << e.what() << "\n";
+            reply << "Error: " << e.what() << "\n";
         }
+        writeOutput(reply.str());
+        if (!open) break;
     }
     
+    wal.close();
     std::cout << "Goodbye!\n";
     return 0;
 }
+#endif // CRT_NO_MAIN
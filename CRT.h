@@ -0,0 +1,3949 @@
+// Engine declarations shared by the shell in CRT.cpp and the programs in
+// bench/, which link against the engine rather than compiling it in.
+#ifndef CRT_H
+#define CRT_H
+
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <cctype>
+#include <regex>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <memory>
+#include <climits>
+#include <cstdio>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <exception>
+#include <chrono>
+#include <list>
+#include <cstdlib>
+#include <new>
+#include <type_traits>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define CRT_X86_KERNELS 1
+#include <immintrin.h>
+#endif
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+#if defined(__unix__) || defined(__APPLE__)
+#define CRT_HAVE_MMAP 1
+#define CRT_HAVE_FSYNC 1
+#define CRT_HAVE_SOCKETS 1
+#define CRT_HAVE_WRITE 1
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <csignal>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#endif
+
+// ---- Allocation Counters ----
+// The engine counts its own allocations where it makes them: column and
+// arena growth, and the selections and result buffers below, which use
+// CountedAllocator. They are counted per thread, and only by threads that
+// point allocationCounter somewhere: the one running an EXPLAIN ANALYZE, and
+// pool workers while they run its tasks. Other threads pay one thread-local
+// test per allocation of those buffers, and other allocations none.
+struct AllocationCount {
+    uint64_t allocations = 0;
+    uint64_t bytes = 0;
+
+    void add(const AllocationCount& other) {
+        allocations += other.allocations;
+        bytes += other.bytes;
+    }
+};
+
+extern thread_local AllocationCount* allocationCounter;
+
+inline void countAllocation(size_t size) {
+    AllocationCount* counter = allocationCounter;
+    if (!counter) return;
+    counter->allocations++;
+    counter->bytes += size;
+}
+
+template <typename T>
+struct CountedAllocator {
+    typedef T value_type;
+
+    CountedAllocator() {}
+    template <typename U>
+    CountedAllocator(const CountedAllocator<U>&) {}
+
+    T* allocate(size_t n) {
+        countAllocation(n * sizeof(T));
+        return std::allocator<T>().allocate(n);
+    }
+    void deallocate(T* p, size_t n) { std::allocator<T>().deallocate(p, n); }
+};
+
+template <typename T, typename U>
+bool operator==(const CountedAllocator<T>&, const CountedAllocator<U>&) { return true; }
+template <typename T, typename U>
+bool operator!=(const CountedAllocator<T>&, const CountedAllocator<U>&) { return false; }
+
+// ---- Data Structures ----
+// One bit per slot, 64 slots per word; bits past the last slot are zero.
+typedef std::vector<uint64_t, CountedAllocator<uint64_t>> Bitmap;
+
+// Slots of selected rows, such as those a lookup finds
+typedef std::vector<size_t, CountedAllocator<size_t>> SlotList;
+
+struct Column {
+    std::string name;
+    std::string type; // "INT" or "TEXT"
+};
+
+// Arrays that a background save reads while their table goes on changing.
+// The save reads each array a chunk at a time. Before an array changes or
+// frees a chunk the save has not read, it leaves a copy of the chunk here,
+// so the save sees the arrays as its statement left them and copies only
+// what changes before it gets there. Arrays move their buffers only under
+// `mutex`, which the save holds while it reads them.
+class ChunkCapture {
+public:
+    static const size_t kChunk = 16 * 1024; // Elements per chunk
+
+    ChunkCapture() : reading(true), keptBytes(0) {}
+    ChunkCapture(const ChunkCapture&) = delete;
+    ChunkCapture& operator=(const ChunkCapture&) = delete;
+
+    std::mutex mutex;
+
+    // Register an array of `size` elements of `width` bytes at `values`;
+    // returns its ID. Runs before the save reads anything.
+    size_t add(const void* values, size_t size, size_t width) {
+        Array array;
+        array.values = static_cast<const char*>(values);
+        array.size = size;
+        array.width = width;
+        array.state.assign((size + kChunk - 1) / kChunk, UNREAD);
+        arrays.push_back(std::move(array));
+        return arrays.size() - 1;
+    }
+
+    // Elements of an array as the statement left them
+    size_t size(size_t id) const { return arrays[id].size; }
+
+    // Bytes of chunks kept for changes
+    uint64_t kept() const { return keptBytes; }
+
+    // Whether the save still reads the arrays
+    bool open() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return reading;
+    }
+
+    // Keep the chunks of elements [first, last) of an array that the save
+    // has not read, before they change; false once the save is finished
+    bool keep(size_t id, size_t first, size_t last) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!reading) return false;
+        keepChunks(arrays[id], first, last);
+        return true;
+    }
+
+    // Keep every chunk of an array the save has not read, before its buffer
+    // is freed
+    void release(size_t id) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!reading) return;
+        keepChunks(arrays[id], 0, SIZE_MAX);
+        arrays[id].values = nullptr;
+    }
+
+    // Move the buffer of an array: `move` moves it and returns where the
+    // values are now. False once the save is finished.
+    template <typename Fn>
+    bool move(size_t id, Fn fn) {
+        std::lock_guard<std::mutex> lock(mutex);
+        const void* values = fn();
+        if (!reading) return false;
+        arrays[id].values = static_cast<const char*>(values);
+        return true;
+    }
+
+    // Copy elements [first, last) of an array as the statement left them to
+    // `out`. Chunks copied whole are done with unless `again` is set, so
+    // they are no longer kept. Call under `mutex`.
+    void read(size_t id, size_t first, size_t last, void* out, bool again = false) {
+        Array& array = arrays[id];
+        char* to = static_cast<char*>(out);
+        for (size_t chunk = first / kChunk; first < last; chunk++) {
+            size_t begin = chunk * kChunk;
+            size_t end = std::min(array.size, begin + kChunk);
+            size_t stop = std::min(last, end);
+            size_t bytes = (stop - first) * array.width;
+            if (array.state[chunk] == KEPT) {
+                std::memcpy(to, array.chunks[chunk].data() + (first - begin) * array.width, bytes);
+            } else {
+                std::memcpy(to, array.values + first * array.width, bytes);
+            }
+            if (!again && first == begin && stop == end) {
+                array.state[chunk] = READ;
+                array.chunks.erase(chunk);
+            }
+            to += bytes;
+            first = stop;
+        }
+    }
+
+    // The save is done with an array
+    void done(size_t id) {
+        std::lock_guard<std::mutex> lock(mutex);
+        Array& array = arrays[id];
+        array.state.assign(array.state.size(), READ);
+        std::unordered_map<size_t, std::string>().swap(array.chunks);
+    }
+
+    // Stop keeping chunks and drop those kept; the save is finished
+    void close() {
+        std::lock_guard<std::mutex> lock(mutex);
+        reading = false;
+        arrays.clear();
+    }
+
+private:
+    enum ChunkState : uint8_t { UNREAD, READ, KEPT };
+
+    struct Array {
+        const char* values = nullptr;  // The array's buffer, until it is freed
+        size_t size = 0;
+        size_t width = 0;
+        std::vector<uint8_t> state;    // Per chunk
+        std::unordered_map<size_t, std::string> chunks; // Copies of the kept chunks
+    };
+
+    bool reading;                      // Guarded by `mutex`
+    std::atomic<uint64_t> keptBytes;
+    std::vector<Array> arrays;
+
+    void keepChunks(Array& array, size_t first, size_t last) {
+        last = std::min(last, array.size);
+        for (size_t chunk = first / kChunk; chunk * kChunk < last; chunk++) {
+            if (array.state[chunk] != UNREAD) continue;
+            size_t begin = chunk * kChunk;
+            size_t end = std::min(array.size, begin + kChunk);
+            array.chunks[chunk].assign(array.values + begin * array.width, (end - begin) * array.width);
+            array.state[chunk] = KEPT;
+            keptBytes += (end - begin) * array.width;
+        }
+    }
+};
+
+// Where an array stands with the background save reading it, if any
+struct CaptureBinding {
+    std::shared_ptr<ChunkCapture> capture;
+    size_t id = 0;
+    size_t size = 0;           // Elements as of the save's statement
+    std::vector<bool> kept;    // Chunks already kept or read
+
+    void bind(const std::shared_ptr<ChunkCapture>& to, const void* values, size_t count, size_t width) {
+        capture = to;
+        id = capture->add(values, count, width);
+        size = count;
+        kept.assign((count + ChunkCapture::kChunk - 1) / ChunkCapture::kChunk, false);
+    }
+
+    // Keep what the save still needs of elements [first, last) before they
+    // change, once per chunk
+    void changing(size_t first, size_t last) {
+        last = std::min(last, size);
+        for (size_t chunk = first / ChunkCapture::kChunk; chunk * ChunkCapture::kChunk < last; chunk++) {
+            if (kept[chunk]) continue;
+            if (!capture->keep(id, chunk * ChunkCapture::kChunk, (chunk + 1) * ChunkCapture::kChunk)) {
+                clear();
+                return;
+            }
+            kept[chunk] = true;
+        }
+    }
+
+    void clear() {
+        capture.reset();
+        std::vector<bool>().swap(kept);
+        size = 0;
+    }
+};
+
+// Section of the buffer pool's data file that an array reads in place. The
+// mapping is private, so a write copies the page it lands on and never
+// reaches the file, and it is reserved past the section so the array can
+// grow in place. Chunks are marked written, under `mutex`, before they
+// change; only the pages of clean chunks are given back, since those read
+// back from the file as they were.
+class PagedSection {
+public:
+    static const size_t kChunk = ChunkCapture::kChunk; // Elements per chunk
+
+    PagedSection(const PagedSection&) = delete;
+    PagedSection& operator=(const PagedSection&) = delete;
+
+    ~PagedSection() {
+#ifdef CRT_HAVE_MMAP
+        munmap(base, reservedBytes);
+#endif
+    }
+
+    // Map `count` elements of `width` bytes at `offset` of the open file
+    // `fd`, with room for `capacity`; null where the section cannot be mapped
+    static std::unique_ptr<PagedSection> map(int fd, uint64_t offset, size_t count, size_t capacity,
+                                             size_t width) {
+#ifdef CRT_HAVE_MMAP
+        size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+        size_t fileBytes = count * width;
+        size_t reserved = (std::max(fileBytes, capacity * width) + page - 1) / page * page;
+        if (fd < 0 || offset % page != 0 || reserved == 0) return nullptr;
+        void* base = mmap(nullptr, reserved, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE,
+                          -1, 0);
+        if (base == MAP_FAILED) return nullptr;
+        size_t filePages = (fileBytes + page - 1) / page * page;
+        if (filePages && mmap(base, filePages, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd,
+                              static_cast<off_t>(offset)) == MAP_FAILED) {
+            munmap(base, reserved);
+            return nullptr;
+        }
+        if (filePages) madvise(base, filePages, MADV_RANDOM); // Scans read ahead by morsel
+        return std::unique_ptr<PagedSection>(
+            new PagedSection(static_cast<char*>(base), reserved, filePages, width));
+#else
+        (void)fd;
+        (void)offset;
+        (void)count;
+        (void)capacity;
+        (void)width;
+        return nullptr;
+#endif
+    }
+
+    char* data() const { return base; }
+    size_t capacity() const { return reservedBytes / width; }
+
+    // Bytes of the chunks written since the section was mapped
+    size_t writtenBytes() const { return written; }
+
+    // Mark the chunks of elements [first, last) written, before they change.
+    // Only writers to the array mark chunks, so the check before the lock
+    // sees what they left.
+    void write(size_t first, size_t last) {
+        size_t end = (last + kChunk - 1) / kChunk;
+        size_t chunk = first / kChunk;
+        while (chunk < end && chunk < dirty.size() && dirty[chunk]) chunk++;
+        if (chunk == end) return;
+        std::lock_guard<std::mutex> lock(mutex);
+        if (dirty.size() < end) dirty.resize(end, false);
+        for (; chunk < end; chunk++) {
+            if (dirty[chunk]) continue;
+            dirty[chunk] = true;
+            written += kChunk * width;
+        }
+    }
+
+    // Give back the pages of the clean chunks overlapping elements
+    // [first, last); returns their bytes
+    size_t drop(size_t first, size_t last) { return advise(first, last, true); }
+
+    // Ask the kernel to read elements [first, last) ahead
+    void willNeed(size_t first, size_t last) { advise(first, last, false); }
+
+private:
+    PagedSection(char* base, size_t reserved, size_t filePages, size_t width)
+        : base(base), reservedBytes(reserved), filePages(filePages), width(width), written(0) {}
+
+    char* base;
+    size_t reservedBytes;
+    size_t filePages;          // Bytes mapped from the file; the rest is anonymous
+    size_t width;
+    std::mutex mutex;          // Guards `dirty` against writers while chunks are given back
+    std::vector<bool> dirty;   // Per chunk
+    std::atomic<size_t> written;
+
+    size_t advise(size_t first, size_t last, bool drop) {
+#ifdef CRT_HAVE_MMAP
+        size_t chunkBytes = kChunk * width;
+        size_t begin = first / kChunk * chunkBytes;
+        size_t end = std::min(filePages, (last + kChunk - 1) / kChunk * chunkBytes);
+        if (begin >= end) return 0;
+        if (!drop) {
+            madvise(base + begin, end - begin, MADV_WILLNEED);
+            return end - begin;
+        }
+        size_t bytes = 0;
+        std::lock_guard<std::mutex> lock(mutex);
+        for (size_t at = begin; at < end; at += chunkBytes) {
+            size_t chunk = at / chunkBytes;
+            if (chunk < dirty.size() && dirty[chunk]) continue;
+            size_t length = std::min(chunkBytes, end - at);
+            madvise(base + at, length, MADV_DONTNEED);
+            bytes += length;
+        }
+        return bytes;
+#else
+        (void)first;
+        (void)last;
+        (void)drop;
+        return 0;
+#endif
+    }
+};
+
+// Buffers that snapshot views read after their arrays have let go of them.
+// While views of a table are open, an array that would free, move or
+// overwrite what they read leaves its buffer here and goes on with a copy,
+// so a view reads the arrays as they were when it was captured. The last
+// view to close frees them.
+class ViewBuffers {
+public:
+    ViewBuffers() {}
+    ViewBuffers(const ViewBuffers&) = delete;
+    ViewBuffers& operator=(const ViewBuffers&) = delete;
+    ~ViewBuffers() {
+        for (void* buffer : heap) std::free(buffer);
+    }
+
+    // Keep a heap buffer, or the section a paged array read in place
+    void keep(void* buffer, std::unique_ptr<PagedSection> section) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (section) {
+            sections.push_back(std::move(section));
+        } else {
+            heap.push_back(buffer);
+        }
+    }
+
+private:
+    std::mutex mutex; // Columns are compacted in parallel
+    std::vector<void*> heap;
+    std::vector<std::unique_ptr<PagedSection>> sections;
+};
+
+// Where an array stands with the snapshot views reading it, if any
+struct ViewBinding {
+    std::weak_ptr<ViewBuffers> views;
+    size_t size = 0; // Elements the views read, which must not change
+};
+
+// Elements of one array of the storage layer, contiguous like a vector and
+// grown with realloc like a TextArena, or read in place from a PagedSection.
+// Elements change only through set, truncate and the calls that grow or
+// free the array, so that an array a background save is reading keeps the
+// chunks those change first, a paged array marks them written, and an
+// array snapshot views read leaves them its buffer.
+template <typename T>
+class ColumnArray {
+    static_assert(std::is_trivially_copyable<T>::value, "ColumnArray holds plain values");
+
+public:
+    ColumnArray() {}
+    ColumnArray(const ColumnArray& other) { append(other.data(), other.size()); }
+    ColumnArray(ColumnArray&& other) noexcept { swap(other); }
+    ColumnArray& operator=(ColumnArray other) noexcept {
+        swap(other);
+        return *this;
+    }
+    ~ColumnArray() {
+        if (binding.capture) binding.capture->release(binding.id);
+        letGo(viewers());
+    }
+
+    const T* data() const { return values; }
+    size_t size() const { return used; }
+    size_t capacity() const { return allocated; }
+    bool empty() const { return used == 0; }
+    const T& operator[](size_t i) const { return values[i]; }
+    const T& back() const { return values[used - 1]; }
+    const T* begin() const { return values; }
+    const T* end() const { return values + used; }
+
+    bool operator==(const ColumnArray& other) const {
+        return used == other.used && std::equal(begin(), end(), other.begin());
+    }
+    bool operator!=(const ColumnArray& other) const { return !(*this == other); }
+
+    void set(size_t i, T value) {
+        if (binding.capture) binding.changing(i, i + 1);
+        if (i < viewing.size) leaveViews(i);
+        if (paged) paged->write(i, i + 1);
+        values[i] = value;
+    }
+
+    void push_back(T value) {
+        if (used == allocated) reserve(std::max<size_t>(16, allocated * 2));
+        if (paged) paged->write(used, used + 1);
+        values[used++] = value;
+    }
+
+    void append(const T* first, size_t count) {
+        if (used + count > allocated) reserve(std::max(used + count, allocated * 2));
+        if (paged) paged->write(used, used + count);
+        if (count) std::memcpy(values + used, first, count * sizeof(T));
+        used += count;
+    }
+
+    void append(size_t count, T value) {
+        if (used + count > allocated) reserve(std::max(used + count, allocated * 2));
+        if (paged) paged->write(used, used + count);
+        std::fill(values + used, values + used + count, value);
+        used += count;
+    }
+
+    // Drop the elements from `count` on
+    void truncate(size_t count) {
+        if (count >= used) return;
+        if (binding.capture) binding.changing(count, used);
+        if (count < viewing.size) leaveViews(count);
+        used = count;
+    }
+
+    void pop_back() { truncate(used - 1); }
+    void clear() { truncate(0); }
+
+    void resize(size_t count) {
+        if (count < used) {
+            truncate(count);
+        } else {
+            append(count - used, T());
+        }
+    }
+
+    void reserve(size_t count) {
+        if (count > allocated) reallocate(count);
+    }
+
+    // A paged array holds no capacity to give back until it is empty
+    void shrink_to_fit() {
+        if (used < allocated && (!paged || used == 0)) reallocate(used);
+    }
+
+    void swap(ColumnArray& other) noexcept {
+        std::swap(values, other.values);
+        std::swap(used, other.used);
+        std::swap(allocated, other.allocated);
+        std::swap(binding, other.binding);
+        std::swap(paged, other.paged);
+        std::swap(viewing, other.viewing);
+        std::swap(borrowed, other.borrowed);
+    }
+
+    // Have a background save read the array through `capture`
+    void capture(const std::shared_ptr<ChunkCapture>& capture) {
+        binding.bind(capture, values, used, sizeof(T));
+    }
+
+    // An array that reads this one's elements as they are now, for a
+    // snapshot view. Until the views in `views` close, those elements stay
+    // as they are, or their buffer goes to `views`.
+    ColumnArray view(const std::shared_ptr<ViewBuffers>& views) {
+        viewing.views = views;
+        viewing.size = used;
+        ColumnArray alias;
+        alias.values = values;
+        alias.used = used;
+        alias.allocated = used;
+        alias.borrowed = true;
+        return alias;
+    }
+
+    // Read `count` elements at `offset` of the open file `fd` in place,
+    // with room to double; false, leaving the array as it was, if the
+    // section cannot be mapped
+    bool map(int fd, uint64_t offset, size_t count) {
+        std::unique_ptr<PagedSection> section = PagedSection::map(fd, offset, count, 2 * count, sizeof(T));
+        if (!section) return false;
+        ColumnArray mapped;
+        mapped.values = reinterpret_cast<T*>(section->data());
+        mapped.used = count;
+        mapped.allocated = section->capacity();
+        mapped.paged = std::move(section);
+        swap(mapped);
+        return true;
+    }
+
+    bool isPaged() const { return paged != nullptr; }
+
+    // Bytes the array holds that cannot be given back: its buffer, or the
+    // chunks written since it was mapped
+    size_t heldBytes() const { return paged ? paged->writtenBytes() : allocated * sizeof(T); }
+
+    // Give back the clean pages of elements [first, last) of a paged array;
+    // returns their bytes
+    size_t drop(size_t first, size_t last) const { return paged ? paged->drop(first, last) : 0; }
+
+    void willNeed(size_t first, size_t last) const {
+        if (paged) paged->willNeed(first, last);
+    }
+
+private:
+    T* values = nullptr;
+    size_t used = 0;
+    size_t allocated = 0;
+    CaptureBinding binding;
+    std::unique_ptr<PagedSection> paged;
+    ViewBinding viewing;
+    bool borrowed = false; // A view's, reading another array's buffer
+
+    // The open views that read elements from `first` on, if any
+    std::shared_ptr<ViewBuffers> viewers(size_t first = 0) {
+        if (first >= viewing.size) return nullptr;
+        std::shared_ptr<ViewBuffers> views = viewing.views.lock();
+        if (!views) viewing = ViewBinding();
+        return views;
+    }
+
+    // Free the buffer, or leave it to the views reading it
+    void letGo(const std::shared_ptr<ViewBuffers>& views) {
+        if (borrowed) return;
+        if (views) {
+            views->keep(values, std::move(paged));
+        } else if (!paged) {
+            std::free(values);
+        }
+        paged.reset();
+    }
+
+    // Go on with a copy of the buffer before elements from `first` on,
+    // which open views read, change
+    void leaveViews(size_t first) {
+        if (viewers(first)) reallocate(paged ? used : allocated);
+    }
+
+    // A paged array is copied to the heap and unmapped once it outgrows
+    // its section or shrinks, and so is one that views read
+    void reallocate(size_t count) {
+        auto relocate = [&]() {
+            std::shared_ptr<ViewBuffers> views = viewers();
+            if (count == 0) {
+                letGo(views);
+                values = nullptr;
+            } else if (paged || views) {
+                countAllocation(count * sizeof(T));
+                T* moved = static_cast<T*>(std::malloc(count * sizeof(T)));
+                if (!moved) throw std::bad_alloc();
+                std::memcpy(moved, values, std::min(used, count) * sizeof(T));
+                letGo(views);
+                values = moved;
+            } else {
+                countAllocation(count * sizeof(T));
+                T* moved = static_cast<T*>(std::realloc(values, count * sizeof(T)));
+                if (!moved) throw std::bad_alloc();
+                values = moved;
+            }
+            viewing = ViewBinding();
+            allocated = count;
+            return values;
+        };
+        if (!binding.capture) {
+            relocate();
+        } else if (!binding.capture->move(binding.id, relocate)) {
+            binding.clear();
+        }
+    }
+};
+
+// Byte arena holding the TEXT values of one column, contiguous so a value is
+// an offset and a length. It grows with realloc, which moves large buffers
+// by remapping their pages rather than copying them, so growth never holds
+// two copies of the bytes, or is read in place from a PagedSection.
+// Clearing the column frees it in one call. Bytes are only appended, so a
+// background save reading the arena only needs its bytes kept when they
+// are rewritten or freed.
+class TextArena {
+public:
+    TextArena() {}
+    TextArena(const TextArena& other) { append(other.data(), other.size()); }
+    TextArena(TextArena&& other) noexcept { swap(other); }
+    TextArena& operator=(TextArena other) noexcept {
+        swap(other);
+        return *this;
+    }
+    ~TextArena() {
+        if (binding.capture) binding.capture->release(binding.id);
+        letGo(viewers());
+    }
+
+    const char* data() const { return buffer ? buffer : ""; }
+    size_t size() const { return used; }
+    size_t capacity() const { return allocated; }
+
+    void reserve(size_t bytes) {
+        if (bytes <= allocated) return;
+        countAllocation(bytes);
+        reallocate(bytes);
+    }
+
+    void append(const char* text, size_t length) {
+        if (used + length > allocated) reserve(std::max(used + length, allocated * 2));
+        if (paged) paged->write(used, used + length);
+        if (length) std::memcpy(buffer + used, text, length);
+        used += length;
+    }
+
+    void append(const std::string& text) { append(text.data(), text.size()); }
+
+    void assign(const char* text, size_t length) {
+        if (binding.capture) binding.changing(0, used);
+        if (viewers()) reallocate(0);
+        used = 0;
+        append(text, length);
+    }
+
+    // Give back the capacity past the bytes in use, which a paged arena
+    // does not hold
+    void shrinkToFit() {
+        if (used < allocated && (!paged || used == 0)) reallocate(used);
+    }
+
+    void swap(TextArena& other) noexcept {
+        std::swap(buffer, other.buffer);
+        std::swap(used, other.used);
+        std::swap(allocated, other.allocated);
+        std::swap(binding, other.binding);
+        std::swap(paged, other.paged);
+        std::swap(viewing, other.viewing);
+        std::swap(borrowed, other.borrowed);
+    }
+
+    // Have a background save read the arena through `capture`
+    void capture(const std::shared_ptr<ChunkCapture>& capture) {
+        binding.bind(capture, buffer, used, 1);
+    }
+
+    // An arena that reads this one's bytes as they are now, for a snapshot
+    // view, like ColumnArray::view
+    TextArena view(const std::shared_ptr<ViewBuffers>& views) {
+        viewing.views = views;
+        viewing.size = used;
+        TextArena alias;
+        alias.buffer = buffer;
+        alias.used = used;
+        alias.allocated = used;
+        alias.borrowed = true;
+        return alias;
+    }
+
+    // Read `bytes` at `offset` of the open file `fd` in place, with room to
+    // double; false, leaving the arena as it was, if they cannot be mapped
+    bool map(int fd, uint64_t offset, size_t bytes) {
+        std::unique_ptr<PagedSection> section = PagedSection::map(fd, offset, bytes, 2 * bytes, 1);
+        if (!section) return false;
+        TextArena mapped;
+        mapped.buffer = section->data();
+        mapped.used = bytes;
+        mapped.allocated = section->capacity();
+        mapped.paged = std::move(section);
+        swap(mapped);
+        return true;
+    }
+
+    bool isPaged() const { return paged != nullptr; }
+    size_t heldBytes() const { return paged ? paged->writtenBytes() : allocated; }
+    size_t drop(size_t first, size_t last) const { return paged ? paged->drop(first, last) : 0; }
+
+    void willNeed(size_t first, size_t last) const {
+        if (paged) paged->willNeed(first, last);
+    }
+
+private:
+    char* buffer = nullptr;
+    size_t used = 0;
+    size_t allocated = 0;
+    CaptureBinding binding;
+    std::unique_ptr<PagedSection> paged;
+    ViewBinding viewing;
+    bool borrowed = false; // A view's, reading another arena's buffer
+
+    // The open views that read the bytes, if any
+    std::shared_ptr<ViewBuffers> viewers() {
+        if (viewing.size == 0) return nullptr;
+        std::shared_ptr<ViewBuffers> views = viewing.views.lock();
+        if (!views) viewing = ViewBinding();
+        return views;
+    }
+
+    // Free the buffer, or leave it to the views reading it
+    void letGo(const std::shared_ptr<ViewBuffers>& views) {
+        if (borrowed) return;
+        if (views) {
+            views->keep(buffer, std::move(paged));
+        } else if (!paged) {
+            std::free(buffer);
+        }
+        paged.reset();
+    }
+
+    // Resize the buffer to `bytes`, freeing it at 0. A shrink that fails
+    // keeps the larger buffer. A paged arena is copied to the heap, and so
+    // is one that views read.
+    void reallocate(size_t bytes) {
+        auto relocate = [&]() {
+            std::shared_ptr<ViewBuffers> views = viewers();
+            if (bytes == 0) {
+                letGo(views);
+                buffer = nullptr;
+                allocated = 0;
+            } else if (paged || views) {
+                char* moved = static_cast<char*>(std::malloc(bytes));
+                if (!moved) throw std::bad_alloc();
+                std::memcpy(moved, buffer, std::min(used, bytes));
+                letGo(views);
+                buffer = moved;
+                allocated = bytes;
+            } else if (char* moved = static_cast<char*>(std::realloc(buffer, bytes))) {
+                buffer = moved;
+                allocated = bytes;
+            } else if (bytes > allocated) {
+                throw std::bad_alloc();
+            }
+            viewing = ViewBinding();
+            return buffer;
+        };
+        if (!binding.capture) {
+            relocate();
+        } else if (!binding.capture->move(binding.id, relocate)) {
+            binding.clear();
+        }
+    }
+};
+
+// Slots per zone: an INT column keeps the smallest and largest value of each
+// run of this many slots, so scans can skip zones that cannot match
+const size_t kZoneSlots = 16 * 1024;
+
+// Values of one column, stored contiguously by type. A row is a slot index
+// shared by every column of its table.
+//
+// A TEXT column starts dictionary encoded: each distinct value is stored once
+// as an entry, and slots hold the 16-bit code of their entry. Once a column
+// has more distinct values than codes it switches to plain storage, with an
+// offset and length per slot.
+struct ColumnData {
+    ColumnArray<int64_t> ints;      // INT: one value per slot
+    std::vector<int64_t> zoneMin;   // INT: lower bound of the values of each zone
+    std::vector<int64_t> zoneMax;   // INT: upper bound of the values of each zone
+    ColumnArray<uint64_t> offsets;  // TEXT: start of each value (each entry if encoded) in bytes
+    ColumnArray<uint32_t> lengths;  // TEXT: length of each value (each entry if encoded)
+    TextArena bytes;                // TEXT: value bytes, appended on insert/update
+    bool encoded = true;            // TEXT: slots hold entry codes
+    ColumnArray<uint16_t> codes;    // TEXT, encoded: entry of each slot
+    std::vector<uint32_t> lookup;   // TEXT, encoded: entry codes by hash, open addressing
+
+    // Bytes and length of the TEXT value at a slot
+    size_t entry(size_t slot) const { return encoded ? codes[slot] : slot; }
+    const char* textData(size_t slot) const { return bytes.data() + offsets[entry(slot)]; }
+    uint32_t textLength(size_t slot) const { return lengths[entry(slot)]; }
+};
+
+// In-memory B+-tree over (key, row ID) entries, used by ordered indexes.
+// Leaves are chained for range scans. Erase does not rebalance, so leaves may
+// run under-full after deletes until the index is rebuilt.
+class BPlusTree {
+public:
+    typedef std::pair<int64_t, int> Entry;
+
+    BPlusTree() : root(new Node(true)), entries(0) {}
+
+    size_t size() const { return entries; }
+
+    void clear() {
+        root.reset(new Node(true));
+        entries = 0;
+    }
+
+    // Heap bytes held by the nodes
+    size_t memoryBytes() const { return nodeBytes(root.get()); }
+
+    void insert(const Entry& entry) {
+        Split split = insertInto(root.get(), entry);
+        if (split.right) {
+            std::unique_ptr<Node> newRoot(new Node(false));
+            newRoot->keys.push_back(split.separator);
+            newRoot->children.push_back(std::move(root));
+            newRoot->children.push_back(std::move(split.right));
+            root = std::move(newRoot);
+        }
+    }
+
+    bool erase(const Entry& entry) {
+        Node* leaf = findLeaf(entry);
+        auto it = std::lower_bound(leaf->keys.begin(), leaf->keys.end(), entry);
+        if (it == leaf->keys.end() || *it != entry) return false;
+        leaf->keys.erase(it);
+        entries--;
+        return true;
+    }
+
+    // Call fn(id) for entries with lo <= key <= hi in key order; stops early
+    // when fn returns false
+    template <typename Fn>
+    void scan(int64_t lo, int64_t hi, Fn fn) const {
+        Entry start(lo, INT_MIN);
+        const Node* leaf = findLeaf(start);
+        auto it = std::lower_bound(leaf->keys.begin(), leaf->keys.end(), start);
+        while (leaf) {
+            for (; it != leaf->keys.end(); ++it) {
+                if (it->first > hi || !fn(it->second)) return;
+            }
+            leaf = leaf->next;
+            if (leaf) it = leaf->keys.begin();
+        }
+    }
+
+private:
+    static const size_t kMaxKeys = 64;
+
+    struct Node {
+        explicit Node(bool isLeaf) : leaf(isLeaf), next(nullptr) {}
+        bool leaf;
+        std::vector<Entry> keys;                     // Leaf entries, or separators
+        std::vector<std::unique_ptr<Node>> children; // Inner nodes: keys.size() + 1
+        Node* next;                                  // Next leaf in key order
+    };
+
+    struct Split {
+        Entry separator;
+        std::unique_ptr<Node> right; // Null when the node did not split
+    };
+
+    std::unique_ptr<Node> root;
+    size_t entries;
+
+    static size_t nodeBytes(const Node* node) {
+        size_t bytes = sizeof(Node) + node->keys.capacity() * sizeof(Entry) +
+                       node->children.capacity() * sizeof(std::unique_ptr<Node>);
+        for (const auto& child : node->children) bytes += nodeBytes(child.get());
+        return bytes;
+    }
+
+    // Child i of an inner node holds entries in [keys[i-1], keys[i])
+    Node* findLeaf(const Entry& entry) const {
+        Node* node = root.get();
+        while (!node->leaf) {
+            size_t i = std::upper_bound(node->keys.begin(), node->keys.end(), entry) - node->keys.begin();
+            node = node->children[i].get();
+        }
+        return node;
+    }
+
+    Split insertInto(Node* node, const Entry& entry) {
+        Split split;
+        if (node->leaf) {
+            auto it = std::lower_bound(node->keys.begin(), node->keys.end(), entry);
+            if (it != node->keys.end() && *it == entry) return split;
+            node->keys.insert(it, entry);
+            entries++;
+            if (node->keys.size() <= kMaxKeys) return split;
+
+            std::unique_ptr<Node> right(new Node(true));
+            size_t mid = node->keys.size() / 2;
+            right->keys.assign(node->keys.begin() + mid, node->keys.end());
+            node->keys.resize(mid);
+            right->next = node->next;
+            node->next = right.get();
+            split.separator = right->keys.front();
+            split.right = std::move(right);
+            return split;
+        }
+
+        size_t i = std::upper_bound(node->keys.begin(), node->keys.end(), entry) - node->keys.begin();
+        Split child = insertInto(node->children[i].get(), entry);
+        if (!child.right) return split;
+        node->keys.insert(node->keys.begin() + i, child.separator);
+        node->children.insert(node->children.begin() + i + 1, std::move(child.right));
+        if (node->keys.size() <= kMaxKeys) return split;
+
+        std::unique_ptr<Node> right(new Node(false));
+        size_t mid = node->keys.size() / 2;
+        split.separator = node->keys[mid];
+        right->keys.assign(node->keys.begin() + mid + 1, node->keys.end());
+        for (size_t c = mid + 1; c < node->children.size(); c++) {
+            right->children.push_back(std::move(node->children[c]));
+        }
+        node->keys.resize(mid);
+        node->children.resize(mid + 1);
+        split.right = std::move(right);
+        return split;
+    }
+};
+
+enum class IndexKind { HASH, BTREE };
+
+// Secondary index on one column, mapping index keys to row IDs
+struct Index {
+    std::string name;
+    int colIndex;
+    IndexKind kind;
+    std::unordered_map<int64_t, std::vector<int>> hash; // HASH: key -> ascending row IDs
+    BPlusTree tree;                                     // BTREE: (key, row ID) entries
+};
+
+// Reader-writer lock: many shared holders or one exclusive holder. Waiting
+// writers hold off new readers, so a stream of reads cannot starve a write.
+class SharedMutex {
+public:
+    SharedMutex() : readers(0), writersWaiting(0), writer(false) {}
+    SharedMutex(const SharedMutex&) = delete;
+    SharedMutex& operator=(const SharedMutex&) = delete;
+
+    void lock() {
+        std::unique_lock<std::mutex> guard(mutex);
+        writersWaiting++;
+        released.wait(guard, [&] { return !writer && readers == 0; });
+        writersWaiting--;
+        writer = true;
+    }
+
+    void unlock() {
+        std::lock_guard<std::mutex> guard(mutex);
+        writer = false;
+        released.notify_all();
+    }
+
+    void lock_shared() {
+        std::unique_lock<std::mutex> guard(mutex);
+        released.wait(guard, [&] { return !writer && writersWaiting == 0; });
+        readers++;
+    }
+
+    void unlock_shared() {
+        std::lock_guard<std::mutex> guard(mutex);
+        if (--readers == 0) released.notify_all();
+    }
+
+    // Lock without waiting; false if that would wait, or this thread holds it
+    bool try_lock() {
+        std::lock_guard<std::mutex> guard(mutex);
+        if (writer || readers > 0) return false;
+        writer = true;
+        return true;
+    }
+
+    bool try_lock_shared() {
+        std::lock_guard<std::mutex> guard(mutex);
+        if (writer || writersWaiting > 0) return false;
+        readers++;
+        return true;
+    }
+
+private:
+    std::mutex mutex;
+    std::condition_variable released;
+    size_t readers;
+    size_t writersWaiting;
+    bool writer;
+};
+
+// Scoped shared ownership of a SharedMutex
+class SharedLock {
+public:
+    explicit SharedLock(SharedMutex& m) : m(m) { m.lock_shared(); }
+    ~SharedLock() { m.unlock_shared(); }
+    SharedLock(const SharedLock&) = delete;
+    SharedLock& operator=(const SharedLock&) = delete;
+
+private:
+    SharedMutex& m;
+};
+
+// Version stamps are commit timestamps, or the marker of a transaction that
+// has not committed yet, which has the top bit set
+const uint64_t kUncommitted = uint64_t(1) << 63;
+const uint64_t kForever = UINT64_MAX;
+
+// Lifetime of a row version that open snapshots may not all see alike
+struct RowVersion {
+    uint64_t begin = 0;        // Stamp of the write that created it; 0 if older than every snapshot
+    uint64_t end = kForever;   // Stamp of the write that replaced or deleted it
+};
+
+extern std::atomic<uint64_t> changeClock;
+
+struct Table {
+    std::string name;
+    std::vector<Column> columns;
+    ColumnArray<int> ids;          // Row ID per slot, ascending up to the delta
+    std::vector<ColumnData> data;  // One entry per column
+    std::vector<Index> indexes;
+    Bitmap deleted;                // Tombstone bit per slot; slots past the end are live
+    size_t deletedRows = 0;
+    int next_id = 1; // For auto-incrementing row IDs
+    std::shared_ptr<SharedMutex> lock = std::make_shared<SharedMutex>(); // Held per statement
+
+    // Row versions. Slots written by transactions keep their stamps while an
+    // open snapshot may see them differently from the latest committed
+    // state; the tombstones give that state. Versions appended by UPDATE
+    // start the delta, whose row IDs are out of order and found by hash.
+    std::unordered_map<size_t, RowVersion> versions;
+    size_t deltaStart = SIZE_MAX;                   // First slot of the delta
+    std::unordered_multimap<int, size_t> deltaSlots; // Row ID -> delta slots holding it
+    uint64_t writer = 0;      // Marker of the transaction changing the table
+    uint64_t lastCommit = 0;  // Last commit that changed it while transactions were open
+    uint64_t collectedAt = 0; // Oldest snapshot when its versions were last collected
+    uint64_t changedAt = ++changeClock; // Stamp of the last statement that changed it
+    bool paged = false;       // Lives in the buffer pool's data file, and is read in when used
+    std::shared_ptr<ChunkCapture> capture; // Of the last background save to read it
+    std::weak_ptr<ViewBuffers> views;      // Of the snapshot views reading its arrays
+    std::shared_ptr<ViewBuffers> viewed;   // A view's: the buffers it reads, kept while it lives
+    bool view = false;        // A snapshot view, which scans rather than seeks (see captureView)
+
+    size_t rowCount() const { return ids.size(); } // Slots, deleted ones included
+    size_t liveRows() const { return ids.size() - deletedRows; }
+    bool isDeleted(size_t slot) const {
+        return slot / 64 < deleted.size() && ((deleted[slot / 64] >> (slot % 64)) & 1);
+    }
+    bool isInt(size_t col) const { return columns[col].type == "INT"; }
+    bool hasDelta() const { return deltaStart != SIZE_MAX; }
+    bool beingSaved() const { return capture && capture->open(); }
+    void markChanged() { changedAt = ++changeClock; }
+};
+
+// ---- Database ----
+extern std::unordered_map<std::string, Table> database;
+extern SharedMutex catalogLock;
+
+// ---- Utility Functions ----
+std::string toUpper(const std::string& s);
+std::string trim(const std::string& s);
+size_t findKeyword(const std::string& upper, const std::string& keyword, size_t from = 0);
+int columnIndex(const Table& table, const std::string& name);
+bool isNumber(const std::string& s);
+bool parseNumber(const char* s, size_t length, int64_t& out);
+bool parseNumber(const std::string& s, int64_t& out);
+bool validateDataType(const std::string& value, const std::string& type);
+
+// ---- Selection Bitmaps ----
+
+inline size_t bitmapWords(size_t numSlots) {
+    return (numSlots + 63) / 64;
+}
+
+inline size_t countBits(uint64_t word) {
+#ifdef _MSC_VER
+    return static_cast<size_t>(__popcnt64(word));
+#else
+    return static_cast<size_t>(__builtin_popcountll(word));
+#endif
+}
+
+inline size_t lowestBit(uint64_t word) {
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanForward64(&index, word);
+    return index;
+#else
+    return static_cast<size_t>(__builtin_ctzll(word));
+#endif
+}
+
+inline bool testBit(const Bitmap& bitmap, size_t slot) {
+    return (bitmap[slot / 64] >> (slot % 64)) & 1;
+}
+
+size_t countSelected(const Bitmap& bitmap);
+
+// Call fn(slot) for every set bit, in slot order
+template <typename Fn>
+void forEachSelected(const Bitmap& bitmap, Fn fn) {
+    for (size_t w = 0; w < bitmap.size(); w++) {
+        uint64_t word = bitmap[w];
+        while (word) {
+            fn(w * 64 + lowestBit(word));
+            word &= word - 1;
+        }
+    }
+}
+
+// ---- Result Output ----
+// A result set is formatted straight into one byte buffer, which reaches the
+// terminal in a single write(2) or a client in one send. The output mode is
+// chosen per session with .mode: an aligned table, CSV, TSV, or a binary row
+// format for programs.
+//
+// Binary results start with "CRTB" and a u64 payload length. The payload is
+// a u32 column count, then per column a type byte (0 INT, 1 TEXT) and a u32
+// length-prefixed name, then the values row by row. Each value is a tag byte
+// (0 NULL, 1 INT, 2 TEXT) followed by an i64, or by a u32 length and bytes.
+// Integers are in host byte order, as in snapshots.
+enum class OutputMode { TABLE, CSV, TSV, BINARY };
+
+extern thread_local OutputMode outputMode;
+
+struct ResultColumn {
+    std::string name;
+    bool isInt;
+    bool rowId;  // Leading ID column of SELECT *, tab-terminated in a table
+};
+
+const size_t kColumnWidth = 15;
+
+// Formats rows into a buffer. Parts of a result may be formatted by separate
+// writers, on separate threads, and appended in order.
+class ResultWriter {
+public:
+    ResultWriter(OutputMode mode, const std::vector<ResultColumn>& columns)
+        : mode(mode), columns(&columns), column(0), used(0) {}
+
+    void header() {
+        if (mode == OutputMode::BINARY) {
+            put("CRTB", 4);
+            putInt(static_cast<uint64_t>(0));  // Payload length, set by footer()
+            putInt(static_cast<uint32_t>(columns->size()));
+            for (const ResultColumn& col : *columns) {
+                put(col.isInt ? 0 : 1);
+                putInt(static_cast<uint32_t>(col.name.size()));
+                put(col.name.data(), col.name.size());
+            }
+            return;
+        }
+        for (const ResultColumn& col : *columns) text(col.name.data(), col.name.size());
+        endRow();
+        if (mode == OutputMode::TABLE) {
+            std::memset(reserve(80), '-', 80);
+            put('\n');
+        }
+    }
+
+    void value(int64_t number) {
+        if (mode == OutputMode::BINARY) {
+            put(1);
+            putInt(number);
+            return;
+        }
+        // Digits are written backwards from the end of `digits`
+        char digits[24];
+        char* end = digits + sizeof(digits);
+        char* p = end;
+        uint64_t magnitude = number < 0 ? 0 - static_cast<uint64_t>(number) : number;
+        do {
+            *--p = static_cast<char>('0' + magnitude % 10);
+            magnitude /= 10;
+        } while (magnitude);
+        if (number < 0) *--p = '-';
+        text(p, end - p);
+    }
+
+    void value(const char* s, size_t length) {
+        if (mode == OutputMode::BINARY) {
+            put(2);
+            putInt(static_cast<uint32_t>(length));
+            put(s, length);
+            return;
+        }
+        text(s, length);
+    }
+
+    void value(const std::string& s) { value(s.data(), s.size()); }
+
+    void null() {
+        if (mode == OutputMode::BINARY) {
+            put(0);
+            return;
+        }
+        text("NULL", 4);
+    }
+
+    void endRow() {
+        if (mode != OutputMode::BINARY) put('\n');
+        column = 0;
+    }
+
+    // Write this writer's header and rows, then the rows of `parts`, then
+    // the footer: the row count of a table, or nothing else for the other
+    // modes. The parts are written as they are, not copied together.
+    void finish(const std::vector<ResultWriter>& parts, size_t numRows, std::ostream& out) {
+        if (mode == OutputMode::BINARY) {
+            uint64_t length = used - 12;
+            for (const auto& part : parts) length += part.used;
+            std::memcpy(&bytes[4], &length, sizeof(length));
+        }
+        out.write(bytes.data(), used);
+        for (const auto& part : parts) out.write(part.bytes.data(), part.used);
+        if (mode == OutputMode::TABLE) out << numRows << " row(s) returned.\n";
+    }
+
+    void finish(size_t numRows, std::ostream& out) {
+        finish(std::vector<ResultWriter>(), numRows, out);
+    }
+
+private:
+    OutputMode mode;
+    const std::vector<ResultColumn>* columns;
+    size_t column;
+    std::vector<char, CountedAllocator<char>> bytes;  // Grown geometrically; the first `used` are output
+    size_t used;
+
+    // Room for `n` more bytes, to be filled by the caller
+    char* reserve(size_t n) {
+        if (used + n > bytes.size()) bytes.resize(std::max(bytes.size() * 2, used + n + 4096));
+        char* p = bytes.data() + used;
+        used += n;
+        return p;
+    }
+
+    void put(char c) { *reserve(1) = c; }
+    void put(const char* s, size_t length) { std::memcpy(reserve(length), s, length); }
+
+    template <typename T>
+    void putInt(T value) {
+        std::memcpy(reserve(sizeof(value)), &value, sizeof(value));
+    }
+
+    void text(const char* s, size_t length) {
+        bool rowId = (*columns)[column].rowId;
+        if (mode == OutputMode::TABLE) {
+            // The row ID ends in a tab; other values are padded to the column width
+            size_t width = rowId ? length + 1 : std::max(length, kColumnWidth);
+            char* p = reserve(width);
+            std::memcpy(p, s, length);
+            std::memset(p + length, rowId ? '\t' : ' ', width - length);
+        } else if (mode == OutputMode::CSV) {
+            // Quote fields holding a separator, quote or line break
+            if (column > 0) put(',');
+            if (std::find_if(s, s + length, [](char c) {
+                    return c == ',' || c == '"' || c == '\n' || c == '\r';
+                }) == s + length) {
+                put(s, length);
+            } else {
+                put('"');
+                for (size_t i = 0; i < length; i++) {
+                    if (s[i] == '"') put('"');
+                    put(s[i]);
+                }
+                put('"');
+            }
+        } else {
+            // TSV escapes tabs, line breaks and backslashes
+            if (column > 0) put('\t');
+            for (size_t i = 0; i < length; i++) {
+                char c = s[i];
+                if (c == '\t') put("\\t", 2);
+                else if (c == '\n') put("\\n", 2);
+                else if (c == '\r') put("\\r", 2);
+                else if (c == '\\') put("\\\\", 2);
+                else put(c);
+            }
+        }
+        column++;
+    }
+};
+
+void writeCell(ResultWriter& writer, const Table& table, int col, size_t slot);
+void writeOutput(const std::string& reply);
+
+// ---- Parallel Tasks ----
+// Work-stealing thread pool. Each worker owns a deque of tasks, takes from
+// its front and steals from the back of the others' when it runs dry.
+// parallelFor deals a job's tasks round-robin over the deques and then runs
+// tasks on the calling thread too until the job is done, so concurrent
+// callers share one pool. A caller that counts allocations has those of its
+// tasks counted too, on whichever thread runs them.
+class ThreadPool {
+public:
+    // `numThreads` counts the calling thread, so one less worker is started
+    explicit ThreadPool(size_t numThreads) : pending(0), nextQueue(0), stopping(false) {
+        size_t numWorkers = std::max<size_t>(numThreads, 1) - 1;
+        for (size_t i = 0; i < numWorkers; i++) queues.emplace_back(new Queue());
+        for (size_t i = 0; i < numWorkers; i++) workers.emplace_back(&ThreadPool::workerLoop, this, i);
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(idleMutex);
+            stopping = true;
+        }
+        idle.notify_all();
+        for (auto& worker : workers) worker.join();
+    }
+
+    size_t threads() const { return workers.size() + 1; }
+
+    // Run fn(i) for every i in [0, numTasks); rethrows the first exception
+    void parallelFor(size_t numTasks, const std::function<void(size_t)>& fn) {
+        if (workers.empty() || numTasks <= 1) {
+            for (size_t i = 0; i < numTasks; i++) fn(i);
+            return;
+        }
+
+        Job job;
+        job.fn = &fn;
+        job.remaining = numTasks;
+        job.counting = allocationCounter != nullptr;
+        size_t home = nextQueue++ % queues.size();
+        for (size_t i = 0; i < numTasks; i++) {
+            Queue& queue = *queues[(home + i) % queues.size()];
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            queue.tasks.push_back(Task{&job, i});
+        }
+        {
+            std::lock_guard<std::mutex> lock(idleMutex);
+            pending += numTasks;
+        }
+        idle.notify_all();
+
+        Task task;
+        while (job.remaining > 0 && popTask(home, task)) run(task);
+
+        // Workers finish the rest; the job outlives their last touch of it
+        std::unique_lock<std::mutex> lock(job.mutex);
+        job.done.wait(lock, [&] { return job.remaining == 0; });
+        if (job.counting) allocationCounter->add(job.allocations);
+        if (job.error) std::rethrow_exception(job.error);
+    }
+
+private:
+    struct Job {
+        const std::function<void(size_t)>* fn;
+        std::atomic<size_t> remaining;
+        std::mutex mutex;
+        std::condition_variable done;
+        std::exception_ptr error;
+        bool counting;                // Count the tasks' allocations into `allocations`
+        AllocationCount allocations;  // Guarded by `mutex`
+    };
+
+    struct Task {
+        Job* job;
+        size_t index;
+    };
+
+    struct Queue {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+
+    std::vector<std::unique_ptr<Queue>> queues; // One per worker
+    std::vector<std::thread> workers;
+    std::mutex idleMutex;
+    std::condition_variable idle;
+    std::atomic<size_t> pending;   // Tasks queued and not yet taken
+    std::atomic<size_t> nextQueue; // Spreads callers over the deques
+    bool stopping;
+
+    // The front of deque `home`, else the back of another one
+    bool popTask(size_t home, Task& task) {
+        for (size_t i = 0; i < queues.size(); i++) {
+            Queue& queue = *queues[(home + i) % queues.size()];
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            if (queue.tasks.empty()) continue;
+            if (i == 0) {
+                task = queue.tasks.front();
+                queue.tasks.pop_front();
+            } else {
+                task = queue.tasks.back();
+                queue.tasks.pop_back();
+            }
+            pending--;
+            return true;
+        }
+        return false;
+    }
+
+    void run(const Task& task) {
+        Job& job = *task.job;
+        AllocationCount counted;
+        AllocationCount* previous = allocationCounter;
+        allocationCounter = job.counting ? &counted : nullptr;
+        try {
+            (*job.fn)(task.index);
+        } catch (...) {
+            std::lock_guard<std::mutex> lock(job.mutex);
+            if (!job.error) job.error = std::current_exception();
+        }
+        allocationCounter = previous;
+        std::lock_guard<std::mutex> lock(job.mutex);
+        job.allocations.add(counted);
+        if (--job.remaining == 0) job.done.notify_all();
+    }
+
+    void workerLoop(size_t id) {
+        Task task;
+        while (true) {
+            if (popTask(id, task)) {
+                run(task);
+                continue;
+            }
+            std::unique_lock<std::mutex> lock(idleMutex);
+            idle.wait(lock, [&] { return stopping || pending > 0; });
+            if (stopping && pending == 0) return;
+        }
+    }
+};
+
+extern std::mutex poolMutex;
+extern std::unique_ptr<ThreadPool> pool;
+ThreadPool& threadPool();
+void setThreadCount(size_t numThreads);
+size_t workerCount();
+
+template <typename Fn>
+void parallelFor(size_t numTasks, Fn fn) {
+    threadPool().parallelFor(numTasks, std::function<void(size_t)>(fn));
+}
+
+// ---- Indexes ----
+int64_t hashText(const char* s, size_t length);
+
+// Spread a 64-bit key over the low bits used as a hash table position
+inline uint64_t mixKey(int64_t key) {
+    uint64_t hash = static_cast<uint64_t>(key) * 0x9E3779B97F4A7C15ULL;
+    return hash ^ (hash >> 32);
+}
+
+int64_t indexKey(const Table& table, size_t col, size_t slot);
+void indexAdd(Index& index, int64_t key, int id);
+void indexRemove(Index& index, int64_t key, int id);
+void rebuildIndex(const Table& table, Index& index);
+Index* findIndexByName(const std::string& name, Table** owner);
+
+// Call fn(slot) for each slot holding a row ID: the one found by binary
+// search before the delta, then any versions of it in the delta
+template <typename Fn>
+void forEachSlotOf(const Table& table, int id, Fn fn) {
+    auto sortedEnd = table.ids.begin() + std::min(table.deltaStart, table.ids.size());
+    auto it = std::lower_bound(table.ids.begin(), sortedEnd, id);
+    if (it != sortedEnd && *it == id) fn(static_cast<size_t>(it - table.ids.begin()));
+    auto range = table.deltaSlots.equal_range(id);
+    for (auto entry = range.first; entry != range.second; ++entry) fn(entry->second);
+}
+
+// ---- Column Storage ----
+const size_t kMaxDictionaryEntries = 65536;  // Codes are 16 bits
+const uint32_t kNoEntry = UINT32_MAX;
+
+uint32_t findEntry(const ColumnData& column, const char* text, size_t length);
+void rehashEntries(ColumnData& column, size_t size);
+void decodeText(ColumnData& column);
+bool encodeText(ColumnData& column, const char* text, size_t length, uint16_t& code);
+void appendText(ColumnData& column, const char* text, size_t length);
+void appendText(ColumnData& column, const std::string& value);
+std::string getText(const ColumnData& column, size_t slot);
+std::string getValue(const Table& table, size_t col, size_t slot);
+void reserveRows(Table& table, size_t numRows);
+void addToZones(ColumnData& column, size_t first);
+void rebuildZones(ColumnData& column);
+
+// Append a row ID for a new last slot, registering it if in the delta
+inline void pushId(Table& table, int id) {
+    if (table.hasDelta()) table.deltaSlots.emplace(id, table.ids.size());
+    table.ids.push_back(id);
+}
+
+void appendRow(Table& table, const std::vector<std::string>& values, int id);
+void setValue(Table& table, size_t col, size_t slot, const std::string& value, int64_t number,
+              bool newVersion = false);
+size_t liveTextBytes(const ColumnData& column);
+void compactText(ColumnData& column);
+size_t deleteRows(Table& table, const Bitmap& drop);
+bool needsCompaction(const Table& table);
+
+// Keep the elements of the slots compaction keeps: the live ones in place,
+// or those listed in `order`, in that order, when it is given
+template <typename T>
+void keepSlots(const Table& table, ColumnArray<T>& values, const std::vector<size_t>& order) {
+    if (!order.empty()) {
+        ColumnArray<T> kept;
+        kept.reserve(order.size());
+        for (size_t slot : order) kept.push_back(values[slot]);
+        values.swap(kept);
+        return;
+    }
+    size_t out = 0;
+    for (size_t slot = 0; slot < values.size(); slot++) {
+        if (!table.isDeleted(slot)) values.set(out++, values[slot]);
+    }
+    values.truncate(out);
+}
+
+size_t compactRows(Table& table);
+void clearRows(Table& table);
+
+// ---- Row Versions ----
+// While transactions are open, writes leave the rows they replace in place:
+// UPDATE appends a new version of each row and DELETE only stamps the end of
+// the version it removes. A reader inside a transaction sees the versions
+// its snapshot does; everyone else sees the tombstones, which always give
+// the latest committed state.
+struct Transaction {
+    uint64_t marker = 0;    // Stamp of its writes until it commits
+    uint64_t snapshot = 0;  // Sees the commits up to this stamp
+    std::vector<std::string> log; // Statements to write to the log on commit
+
+    // Slots written in one table. Rows it appended are the slots from
+    // firstSlot on, since no one else appends while it is the writer.
+    struct Writes {
+        size_t firstSlot = 0;
+        int firstId = 0;
+        std::vector<size_t> ended;
+    };
+    std::unordered_map<std::string, Writes> tables;
+};
+
+extern thread_local std::unique_ptr<Transaction> activeTransaction;
+extern thread_local Transaction* writingTransaction;
+
+inline bool isCommitted(uint64_t stamp) {
+    return !(stamp & kUncommitted);
+}
+
+inline bool sees(const Transaction& txn, uint64_t stamp) {
+    return stamp == txn.marker || (isCommitted(stamp) && stamp <= txn.snapshot);
+}
+
+inline bool sees(const Transaction& txn, const RowVersion& version) {
+    return sees(txn, version.begin) && !sees(txn, version.end);
+}
+
+bool isVisible(const Table& table, size_t slot);
+const Bitmap& hiddenSlots(const Table& table, Bitmap& scratch);
+
+inline bool isHidden(const Bitmap& hidden, size_t slot) {
+    return slot / 64 < hidden.size() && testBit(hidden, slot);
+}
+
+bool hasVisibleRows(const Table& table);
+void markDeleted(Table& table, size_t slot, bool dead);
+void stampCreated(Table& table, size_t first);
+void stampEnded(Table& table, size_t slot);
+size_t appendVersion(Table& table, size_t slot);
+bool claimTable(Table& table, std::ostream& out);
+void unlinkVersion(Table& table, size_t slot);
+void settleVersion(Table& table, size_t slot);
+void collectVersions(Table& table, uint64_t oldest);
+bool hasWrites(const Table& table, const Transaction::Writes& writes);
+void commitWrites(Table& table, const Transaction::Writes& writes, uint64_t stamp);
+void rollbackWrites(Table& table, const Transaction::Writes& writes);
+
+// ---- Bulk Loading ----
+// Multi-row INSERT and COPY split their input into chunks at row boundaries,
+// parse and type-check the chunks in parallel into per-column batches, and
+// append the batches in input order. A statement with any invalid row
+// appends nothing.
+enum class RowFormat {
+    CSV,    // One row per line, comma-separated
+    TUPLES  // (v1, v2), (v3, v4), ... as in INSERT ... VALUES
+};
+
+// Rows parsed from one chunk, laid out like the table's columns
+struct RowBatch {
+    std::vector<ColumnData> data;
+    size_t rows = 0;
+    std::string error;  // Set on the first invalid row, which is rows + 1
+};
+
+bool isQuote(RowFormat format, char c);
+void scanField(const char*& p, const char* end, RowFormat format, std::string& field);
+void parseRows(const Table& table, const char* p, const char* end, RowFormat format, RowBatch& batch);
+std::vector<const char*> splitRows(const char* begin, const char* end, RowFormat format, size_t parts);
+std::vector<RowBatch> parseBulk(const Table& table, const char* begin, const char* end,
+                                RowFormat format, std::string& error);
+bool appendCodes(ColumnData& column, const ColumnData& parsed);
+size_t appendBatches(Table& table, std::vector<RowBatch>&& batches);
+
+// ---- SQL Lexer ----
+// Tokens point into the statement text, so lexing copies nothing. Quoted
+// strings keep their quotes; anything else that is not punctuation, such as
+// a name, a number or a ?N placeholder, is a word.
+enum class TokenKind { WORD, STRING, OP, LPAREN, RPAREN, COMMA, END };
+
+struct Token {
+    TokenKind kind = TokenKind::END;
+    const char* text = nullptr;
+    size_t length = 0;
+
+    // A word equal to `keyword`, which is upper case, in any case
+    bool is(const char* keyword) const {
+        if (kind != TokenKind::WORD) return false;
+        for (size_t i = 0; i < length; i++) {
+            if (!keyword[i] || std::toupper(static_cast<unsigned char>(text[i])) != keyword[i]) return false;
+        }
+        return !keyword[length];
+    }
+
+    bool isOp(const char* op) const {
+        return kind == TokenKind::OP && std::strlen(op) == length && std::memcmp(text, op, length) == 0;
+    }
+
+    std::string str() const { return std::string(text, length); }
+};
+
+class Lexer {
+public:
+    Lexer(const char* begin, const char* end) : p(begin), end(end) {}
+
+    Token next() {
+        while (p < end && std::isspace(static_cast<unsigned char>(*p))) p++;
+        Token token;
+        token.text = p;
+        if (p == end) return token;
+
+        char c = *p;
+        if (c == '"' || c == '\'') {
+            // A doubled quote stands for the quote; unterminated runs to the end
+            token.kind = TokenKind::STRING;
+            for (p++; p < end; p++) {
+                if (*p != c) continue;
+                if (p + 1 < end && p[1] == c) {
+                    p++;
+                } else {
+                    p++;
+                    break;
+                }
+            }
+        } else if (c == '(' || c == ')' || c == ',') {
+            token.kind = c == '(' ? TokenKind::LPAREN : c == ')' ? TokenKind::RPAREN : TokenKind::COMMA;
+            p++;
+        } else if (isOpChar(c)) {
+            token.kind = TokenKind::OP;
+            while (p < end && isOpChar(*p)) p++;
+        } else {
+            token.kind = TokenKind::WORD;
+            while (p < end && !std::isspace(static_cast<unsigned char>(*p)) && !isOpChar(*p) &&
+                   *p != '(' && *p != ')' && *p != ',' && *p != '"' && *p != '\'') {
+                p++;
+            }
+        }
+        token.length = p - token.text;
+        return token;
+    }
+
+private:
+    const char* p;
+    const char* end;
+
+    static bool isOpChar(char c) { return c == '=' || c == '<' || c == '>' || c == '!'; }
+};
+
+// ---- WHERE Conditions ----
+enum class CompareOp { EQ, NE, GT, LT, GE, LE, BETWEEN, IN, LIKE, INVALID };
+
+// One comparison of a WHERE condition, compiled once per statement: the
+// column is resolved to an index and the literal is pre-parsed, so matching
+// a row is a single compare. `id` names the row ID unless the table has a
+// column of that name.
+struct Predicate {
+    bool matchAll = true;    // no condition given
+    bool matchNone = false;  // unparsable condition or unknown column
+    int colIndex = -1;
+    bool rowId = false;      // compares the row ID rather than a column
+    bool intColumn = false;
+    CompareOp op = CompareOp::INVALID;
+    std::string literal;     // Also the LIKE pattern
+    bool literalIsNumber = false;
+    int64_t number = 0;
+    int64_t upper = 0;       // BETWEEN: inclusive upper bound, `number` is the lower
+    std::vector<int64_t> numbers;    // IN: the numeric values, sorted
+    std::vector<std::string> texts;  // IN: every value, unquoted
+    // EQ, NE or IN on an encoded TEXT column: the dictionary codes of the
+    // values, looked up once when bound against the table
+    bool codesBound = false;
+    std::vector<uint16_t> codes;
+};
+
+CompareOp parseCompareOp(const std::string& op);
+std::string unquote(const std::string& literal);
+void bindPredicate(Predicate& pred, const std::vector<std::string>& literals, const Table* table = nullptr);
+bool matchLike(const char* text, size_t length, const std::string& pattern);
+bool evaluateCondition(const Table& table, size_t slot, const Predicate& pred);
+
+// A WHERE clause: comparisons combined by AND, OR and NOT. Binding the
+// literals folds comparisons that match everything or nothing into ALL and
+// NONE, so a single comparison keeps the predicate's index and scan paths.
+enum class ConditionKind { ALL, NONE, COMPARE, AND, OR, NOT };
+
+struct Condition {
+    ConditionKind kind = ConditionKind::ALL;
+    Predicate pred;                     // COMPARE
+    std::vector<std::string> literals;  // COMPARE: as written, until bound
+    std::vector<Condition> children;    // AND and OR: two or more; NOT: one
+};
+
+bool isVectorized(const Condition& cond);
+
+// Recursive descent over the tokens of a condition:
+//   or      := and (OR and)*
+//   and     := not (AND not)*
+//   not     := NOT not | '(' or ')' | compare
+//   compare := column [NOT] (op value | BETWEEN value AND value
+//                            | IN '(' value, ... ')' | LIKE value)
+// A column may be qualified by `table.`.
+class ConditionParser {
+public:
+    ConditionParser(const std::vector<Column>& columns, const std::string& text,
+                    const std::string& tableName)
+        : columns(columns), tableName(tableName), lexer(text.data(), text.data() + text.size()) {
+        token = lexer.next();
+    }
+
+    // False on a syntax error or an unknown column
+    bool parse(Condition& cond) {
+        return parseOr(cond) && token.kind == TokenKind::END;
+    }
+
+private:
+    const std::vector<Column>& columns;
+    const std::string& tableName;
+    Lexer lexer;
+    Token token;
+
+    void advance() { token = lexer.next(); }
+
+    bool parseOr(Condition& cond) {
+        return parseList(cond, ConditionKind::OR, "OR", &ConditionParser::parseAnd);
+    }
+
+    bool parseAnd(Condition& cond) {
+        return parseList(cond, ConditionKind::AND, "AND", &ConditionParser::parseNot);
+    }
+
+    bool parseList(Condition& cond, ConditionKind kind, const char* keyword,
+                   bool (ConditionParser::*parseOperand)(Condition&)) {
+        if (!(this->*parseOperand)(cond)) return false;
+        if (!token.is(keyword)) return true;
+
+        Condition list;
+        list.kind = kind;
+        list.children.push_back(std::move(cond));
+        while (token.is(keyword)) {
+            advance();
+            list.children.emplace_back();
+            if (!(this->*parseOperand)(list.children.back())) return false;
+        }
+        cond = std::move(list);
+        return true;
+    }
+
+    bool parseNot(Condition& cond) {
+        if (token.is("NOT")) {
+            advance();
+            cond.kind = ConditionKind::NOT;
+            cond.children.resize(1);
+            return parseNot(cond.children[0]);
+        }
+        if (token.kind == TokenKind::LPAREN) {
+            advance();
+            if (!parseOr(cond) || token.kind != TokenKind::RPAREN) return false;
+            advance();
+            return true;
+        }
+        return parseCompare(cond);
+    }
+
+    bool parseValue(Condition& cond) {
+        if (token.kind != TokenKind::WORD && token.kind != TokenKind::STRING) return false;
+        cond.literals.push_back(token.str());
+        advance();
+        return true;
+    }
+
+    bool parseCompare(Condition& cond) {
+        if (token.kind != TokenKind::WORD) return false;
+        std::string colName = token.str();
+        if (!tableName.empty() && colName.size() > tableName.size() &&
+            colName.compare(0, tableName.size(), tableName) == 0 && colName[tableName.size()] == '.') {
+            colName = colName.substr(tableName.size() + 1);
+        }
+        advance();
+
+        Predicate& pred = cond.pred;
+        cond.kind = ConditionKind::COMPARE;
+        for (size_t i = 0; i < columns.size(); i++) {
+            if (columns[i].name == colName) {
+                pred.colIndex = static_cast<int>(i);
+                break;
+            }
+        }
+        if (pred.colIndex == -1 && toUpper(colName) == "ID") pred.rowId = true;
+        if (pred.colIndex == -1 && !pred.rowId) return false;
+        pred.intColumn = pred.rowId || columns[pred.colIndex].type == "INT";
+
+        // NOT BETWEEN, NOT IN and NOT LIKE negate the comparison
+        bool negated = token.is("NOT");
+        if (negated) advance();
+
+        if (token.is("BETWEEN")) {
+            pred.op = CompareOp::BETWEEN;
+            advance();
+            if (!parseValue(cond) || !token.is("AND")) return false;
+            advance();
+            if (!parseValue(cond)) return false;
+        } else if (token.is("IN")) {
+            pred.op = CompareOp::IN;
+            advance();
+            if (token.kind != TokenKind::LPAREN) return false;
+            do {
+                advance();
+                if (!parseValue(cond)) return false;
+            } while (token.kind == TokenKind::COMMA);
+            if (token.kind != TokenKind::RPAREN) return false;
+            advance();
+        } else if (token.is("LIKE")) {
+            pred.op = CompareOp::LIKE;
+            advance();
+            if (!parseValue(cond)) return false;
+        } else if (token.kind == TokenKind::OP && !negated) {
+            pred.op = parseCompareOp(token.str());
+            if (pred.op == CompareOp::INVALID) return false;
+            advance();
+            if (!parseValue(cond)) return false;
+        } else {
+            return false;
+        }
+
+        if (negated) {
+            Condition inner = std::move(cond);
+            cond = Condition();
+            cond.kind = ConditionKind::NOT;
+            cond.children.push_back(std::move(inner));
+        }
+        return true;
+    }
+};
+
+Condition parseCondition(const std::vector<Column>& columns, const std::string& text,
+                         const std::string& tableName = "");
+
+// Bind each comparison's literals, mapped through `bind`, then fold away
+// whatever the bound literals decide. Given the table, TEXT values are also
+// looked up in its dictionaries.
+template <typename Bind>
+void bindCondition(Condition& cond, Bind bind, const Table* table = nullptr) {
+    switch (cond.kind) {
+        case ConditionKind::ALL:
+        case ConditionKind::NONE:
+            return;
+        case ConditionKind::COMPARE: {
+            std::vector<std::string> literals;
+            for (const auto& literal : cond.literals) literals.push_back(bind(literal));
+            bindPredicate(cond.pred, literals, table);
+            if (cond.pred.matchNone) cond.kind = ConditionKind::NONE;
+            else if (cond.pred.matchAll) cond.kind = ConditionKind::ALL;
+            return;
+        }
+        case ConditionKind::NOT:
+            bindCondition(cond.children[0], bind, table);
+            if (cond.children[0].kind == ConditionKind::ALL) cond.kind = ConditionKind::NONE;
+            else if (cond.children[0].kind == ConditionKind::NONE) cond.kind = ConditionKind::ALL;
+            else return;
+            cond.children.clear();
+            return;
+        case ConditionKind::AND:
+        case ConditionKind::OR: {
+            // ALL decides an OR and NONE an AND; the other drops out
+            ConditionKind decides = cond.kind == ConditionKind::OR ? ConditionKind::ALL : ConditionKind::NONE;
+            std::vector<Condition> children;
+            bool decided = false;
+            for (auto& child : cond.children) {
+                bindCondition(child, bind, table);
+                if (child.kind == decides) {
+                    decided = true;
+                    break;
+                }
+                if (child.kind != ConditionKind::ALL && child.kind != ConditionKind::NONE) {
+                    children.push_back(std::move(child));
+                }
+            }
+            if (decided) {
+                cond = Condition();
+                cond.kind = decides;
+            } else if (children.size() == 1) {
+                Condition only = std::move(children[0]);
+                cond = std::move(only);
+            } else if (children.empty()) {
+                cond = Condition();
+                cond.kind = decides == ConditionKind::ALL ? ConditionKind::NONE : ConditionKind::ALL;
+            } else {
+                // Vectorized comparisons first, to leave fewer rows for the rest
+                std::stable_partition(children.begin(), children.end(),
+                                      [](const Condition& child) { return isVectorized(child); });
+                cond.children = std::move(children);
+            }
+            return;
+        }
+    }
+}
+
+Condition compileCondition(const std::vector<Column>& columns, const std::string& text,
+                           const std::string& tableName = "");
+Condition compileCondition(const Table& table, const std::string& text);
+bool evaluateCondition(const Table& table, size_t slot, const Condition& cond);
+
+// ---- Filter Kernels ----
+// Evaluate `value op literal` over a contiguous INT column into a selection
+// bitmap. The widest kernel the CPU supports is picked once at startup.
+typedef void (*FilterKernel)(const int64_t* values, size_t count, CompareOp op,
+                             int64_t literal, uint64_t* bitmap);
+
+inline bool compareInt(int64_t value, CompareOp op, int64_t literal) {
+    switch (op) {
+        case CompareOp::EQ: return value == literal;
+        case CompareOp::NE: return value != literal;
+        case CompareOp::GT: return value > literal;
+        case CompareOp::LT: return value < literal;
+        case CompareOp::GE: return value >= literal;
+        case CompareOp::LE: return value <= literal;
+        default: return false;
+    }
+}
+
+void filterIntTail(const int64_t* values, size_t start, size_t count, CompareOp op,
+                   int64_t literal, uint64_t* bitmap);
+
+template <CompareOp Op>
+void filterIntScalarOp(const int64_t* values, size_t count, int64_t literal, uint64_t* bitmap) {
+    size_t words = count / 64;
+    for (size_t w = 0; w < words; w++) {
+        const int64_t* v = values + w * 64;
+        uint64_t bits = 0;
+        for (size_t j = 0; j < 64; j++) {
+            bits |= static_cast<uint64_t>(compareInt(v[j], Op, literal)) << j;
+        }
+        bitmap[w] = bits;
+    }
+    filterIntTail(values, words * 64, count, Op, literal, bitmap);
+}
+
+void filterIntScalar(const int64_t* values, size_t count, CompareOp op, int64_t literal,
+                     uint64_t* bitmap);
+#ifdef CRT_X86_KERNELS
+// The SIMD kernels only have "greater than" and "equal" compares: LT swaps
+// the operands, and GE/LE/NE invert LT/GT/EQ.
+inline bool invertsCompare(CompareOp op) {
+    return op == CompareOp::NE || op == CompareOp::GE || op == CompareOp::LE;
+}
+
+void filterIntAvx2(const int64_t* values, size_t count, CompareOp op, int64_t literal,
+                   uint64_t* bitmap);
+void filterIntSse42(const int64_t* values, size_t count, CompareOp op, int64_t literal,
+                    uint64_t* bitmap);
+#endif
+
+struct FilterKernelInfo {
+    FilterKernel kernel;
+    const char* name;
+};
+
+FilterKernelInfo selectFilterKernel();
+extern const FilterKernelInfo filterKernel;
+
+// Scans run in morsels of a fixed number of slots on the thread pool. The
+// size is a multiple of 64, so each morsel owns whole bitmap words and the
+// merged result is in slot order without further work. A morsel is one zone.
+const size_t kMorselSlots = kZoneSlots;
+
+inline size_t morselCount(size_t numSlots) {
+    return (numSlots + kMorselSlots - 1) / kMorselSlots;
+}
+
+bool comparesCodes(const Table& table, const Predicate& pred);
+void lookupCodes(const ColumnData& column, const Predicate& pred, std::vector<uint16_t>& codes);
+void bindCodes(const Table& table, Predicate& pred);
+bool isVectorized(const Table& table, const Condition& cond);
+
+// How the slots of a zone can match a condition, judged from bounds on their
+// values alone
+enum class ZoneMatch { NONE, SOME, ALL };
+
+inline ZoneMatch decideZone(bool none, bool all) {
+    return none ? ZoneMatch::NONE : all ? ZoneMatch::ALL : ZoneMatch::SOME;
+}
+
+ZoneMatch zoneMatch(const Table& table, const Predicate& pred, size_t begin, size_t end);
+ZoneMatch zoneMatch(const Table& table, const Condition& cond, size_t begin, size_t end);
+void filterCodes(const uint16_t* codes, size_t count, const std::vector<uint16_t>& wanted, bool invert,
+                 uint64_t* bitmap);
+void scanMorsel(const Table& table, const Predicate& pred, size_t begin, size_t end, uint64_t* words);
+void scanConditionMorsel(const Table& table, const Condition& cond, size_t begin, size_t end,
+                         uint64_t* words);
+void dropHidden(const Bitmap& hidden, size_t first, uint64_t* words, size_t numWords);
+Bitmap scanRows(const Table& table, const Condition& cond);
+size_t skippedMorsels(const Table& table, const Condition& cond, size_t numSlots, size_t& slots);
+SlotList scanFirstRows(const Table& table, const Condition& cond, size_t limit, size_t* scanned = nullptr);
+
+// ---- Statement Profiling ----
+// EXPLAIN ANALYZE runs a statement with a Profile installed on its thread.
+// Each operator adds a step with its row counts, time and an estimate of the
+// column bytes it read. Steps are recorded by the thread that starts the
+// operator, not by the workers that run its morsels.
+struct ProfileStep {
+    std::string name;
+    std::string detail;
+    bool access = false;  // Finds the rows of a table: a scan or lookup
+    size_t rowsIn = 0;
+    size_t rowsOut = 0;
+    double ms = 0;
+    uint64_t bytesRead = 0;
+};
+
+struct Profile {
+    std::vector<ProfileStep> steps;
+    AllocationCount allocations;  // Made by the statement, on any thread
+};
+
+extern thread_local Profile* activeProfile;
+
+// Installs a profile on this thread, and counts the engine's allocations into it,
+// while it lives
+class ProfileScope {
+public:
+    explicit ProfileScope(Profile& profile) {
+        activeProfile = &profile;
+        allocationCounter = &profile.allocations;
+    }
+    ~ProfileScope() {
+        allocationCounter = nullptr;
+        activeProfile = nullptr;
+    }
+    ProfileScope(const ProfileScope&) = delete;
+    ProfileScope& operator=(const ProfileScope&) = delete;
+};
+
+// Started with an operator; record() adds its step. Callers check
+// activeProfile first, so details are only built when profiling.
+class StepTimer {
+public:
+    StepTimer() {
+        if (activeProfile) start = std::chrono::steady_clock::now();
+    }
+
+    void record(const std::string& name, const std::string& detail, size_t rowsIn, size_t rowsOut,
+                uint64_t bytesRead, bool access = false) {
+        ProfileStep step;
+        step.name = name;
+        step.detail = detail;
+        step.access = access;
+        step.rowsIn = rowsIn;
+        step.rowsOut = rowsOut;
+        step.ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        step.bytesRead = bytesRead;
+        activeProfile->steps.push_back(step);
+    }
+
+private:
+    std::chrono::steady_clock::time_point start;
+};
+
+uint64_t columnWidth(const Table& table, int col);
+void conditionColumns(const Condition& cond, std::vector<int>& cols);
+uint64_t conditionWidth(const Table& table, const Condition& cond);
+const char* compareOpText(CompareOp op);
+std::string predicateText(const Table& table, const Predicate& pred);
+std::string conditionText(const Table& table, const Condition& cond, bool nested = false);
+void countComparisons(const Table& table, const Condition& cond, size_t& total, size_t& vectorized);
+std::string filterText(const Table& table, const Condition& cond);
+std::string outputDetail(size_t numColumns, OutputMode mode);
+
+// ---- Access Paths ----
+// Rows matched by a WHERE clause: a bitmap from a scan, or ascending slots
+// from an index lookup
+struct Selection {
+    bool sparse = false;
+    Bitmap bitmap;
+    SlotList slots;
+};
+
+size_t countSelected(const Selection& selection);
+
+template <typename Fn>
+void forEachSelected(const Selection& selection, Fn fn) {
+    if (!selection.sparse) {
+        forEachSelected(selection.bitmap, fn);
+        return;
+    }
+    for (size_t slot : selection.slots) fn(slot);
+}
+
+size_t morselCount(const Selection& selection);
+
+// Call fn(slot) for the selected slots of one morsel, in slot order. Every
+// slot of morsel i comes before those of morsel i + 1.
+template <typename Fn>
+void forEachSelectedIn(const Selection& selection, size_t morsel, Fn fn) {
+    size_t begin = morsel * kMorselSlots;
+    if (selection.sparse) {
+        size_t end = std::min(selection.slots.size(), begin + kMorselSlots);
+        for (size_t i = begin; i < end; i++) fn(selection.slots[i]);
+        return;
+    }
+    size_t endWord = std::min(selection.bitmap.size(), (begin + kMorselSlots) / 64);
+    for (size_t w = begin / 64; w < endWord; w++) {
+        uint64_t word = selection.bitmap[w];
+        while (word) {
+            fn(w * 64 + lowestBit(word));
+            word &= word - 1;
+        }
+    }
+}
+
+Bitmap toBitmap(const Selection& selection, size_t numSlots);
+void setBitRange(Bitmap& bitmap, size_t begin, size_t end);
+std::vector<size_t> deltaSlotsIn(const Table& table, int64_t lo, int64_t hi);
+bool seekBounds(const Predicate& pred, int64_t& lo, int64_t& hi);
+
+// Slots [begin, end) of the sorted row IDs, and delta slots, that a row ID
+// predicate covers
+struct RowIdRange {
+    size_t begin = 0;
+    size_t end = 0;
+    std::vector<size_t> delta;
+};
+
+RowIdRange rowIdRange(const Table& table, const Predicate& pred);
+bool sparseRowIds(const Table& table, const Predicate& pred, const RowIdRange& range);
+Selection lookupRowIds(const Table& table, const Predicate& pred);
+const Index* chooseIndex(const Table& table, const Predicate& pred);
+bool indexRange(const Table& table, const Index& index, const Predicate& pred, std::vector<int>* ids);
+bool lookupIndex(const Table& table, const Index& index, const Predicate& pred, Selection& selection);
+bool seekRows(const Table& table, const Predicate& pred, Selection& selection);
+
+// How selectRows finds the rows of a condition
+enum class AccessKind { FULL_SCAN, LIMITED_SCAN, ROW_ID_LOOKUP, INDEX_LOOKUP };
+
+struct AccessPath {
+    AccessKind kind = AccessKind::FULL_SCAN;
+    const Predicate* seek = nullptr;  // Comparison looked up by row ID or index
+    const Index* index = nullptr;
+    bool recheck = false;             // The rest of an AND is checked on the rows found
+    size_t limit = SIZE_MAX;          // LIMITED_SCAN: rows wanted
+    size_t examined = 0;              // Slots scanned or rows looked up
+    size_t skipped = 0;               // Scans: morsels decided by zone bounds
+};
+
+void setSeekPath(const Table& table, const Predicate& pred, AccessPath& path);
+bool seeks(const Table& table, const Condition& cond, bool sparse);
+AccessPath planAccess(const Table& table, const Condition& cond, size_t limit = SIZE_MAX);
+const char* accessName(AccessKind kind);
+std::string describeAccess(const Table& table, const Condition& cond, const AccessPath& path);
+Selection selectRows(const Table& table, const Condition& cond, size_t limit, AccessPath& path);
+Selection selectRows(const Table& table, const Condition& cond, size_t limit = SIZE_MAX);
+
+// ---- Aggregation ----
+// Aggregate queries split the morsels into a few contiguous runs per worker.
+// Each run has its own group table and accumulators, filled a batch of slots
+// at a time, and the runs are merged in order so groups come out in order of
+// first appearance.
+enum class AggregateOp { KEY, COUNT, SUM, MIN, MAX, AVG };
+
+struct Aggregate {
+    AggregateOp op = AggregateOp::COUNT;
+    int colIndex = -1;  // -1 for COUNT(*)
+    std::string label;  // Header text, as written
+};
+
+// Running state of one aggregate in one group
+struct Accumulator {
+    int64_t count = 0;
+    int64_t sum = 0;
+    int64_t min = INT64_MAX;
+    int64_t max = INT64_MIN;
+};
+
+const size_t kAggregateBatch = 1024;
+const uint32_t kNoGroup = UINT32_MAX;
+
+// Open-addressing hash table from a group column value to a dense group
+// number, with linear probing over a power-of-two array. INT keys are the
+// values themselves, and encoded TEXT keys their codes; other TEXT keys are
+// hashes confirmed against the first slot of the group. Without a group
+// column every row is in group 0.
+class GroupTable {
+public:
+    GroupTable(const Table& table, int col)
+        : table(&table), col(col), entries(64, Entry{0, kNoGroup}) {
+        if (col >= 0 && !table.isInt(col) && table.data[col].encoded) codes = table.data[col].codes.data();
+    }
+
+    bool grouped() const { return col >= 0; }
+    size_t size() const { return firstSlots.size(); }
+    size_t firstSlot(uint32_t group) const { return firstSlots[group]; }
+
+    // Group of the value at `slot`, added if new
+    uint32_t find(size_t slot) {
+        if (col < 0) {
+            if (firstSlots.empty()) firstSlots.push_back(slot);
+            return 0;
+        }
+        int64_t key = codes ? codes[slot] : indexKey(*table, col, slot);
+        size_t i = probeStart(key);
+        for (; entries[i].group != kNoGroup; i = (i + 1) & (entries.size() - 1)) {
+            if (entries[i].key == key && sameValue(firstSlots[entries[i].group], slot)) {
+                return entries[i].group;
+            }
+        }
+        uint32_t group = static_cast<uint32_t>(firstSlots.size());
+        entries[i] = Entry{key, group};
+        firstSlots.push_back(slot);
+        if (firstSlots.size() * 2 > entries.size()) grow();
+        return group;
+    }
+
+private:
+    struct Entry {
+        int64_t key;
+        uint32_t group;
+    };
+
+    const Table* table;
+    int col;
+    const uint16_t* codes = nullptr;  // Entry codes of an encoded TEXT group column
+    std::vector<Entry> entries;
+    std::vector<size_t> firstSlots;
+
+    size_t probeStart(int64_t key) const { return mixKey(key) & (entries.size() - 1); }
+
+    bool sameValue(size_t a, size_t b) const {
+        if (table->isInt(col) || codes) return true;
+        const ColumnData& column = table->data[col];
+        return column.textLength(a) == column.textLength(b) &&
+               std::memcmp(column.textData(a), column.textData(b), column.textLength(a)) == 0;
+    }
+
+    void grow() {
+        std::vector<Entry> old(entries.size() * 2, Entry{0, kNoGroup});
+        old.swap(entries);
+        for (const Entry& entry : old) {
+            if (entry.group == kNoGroup) continue;
+            size_t i = probeStart(entry.key);
+            while (entries[i].group != kNoGroup) i = (i + 1) & (entries.size() - 1);
+            entries[i] = entry;
+        }
+    }
+};
+
+bool parseAggregates(const Table& table, const std::string& list, int groupCol,
+                     std::vector<Aggregate>& aggregates, std::string& error);
+void mergeAccumulator(Accumulator& into, const Accumulator& from);
+void accumulateBatch(const Table& table, const std::vector<Aggregate>& aggregates,
+                     const size_t* slots, const uint32_t* groups, size_t n,
+                     Accumulator* accumulators);
+void aggregateMorsels(const Table& table, const Selection& selection, size_t begin, size_t end,
+                      const std::vector<Aggregate>& aggregates, GroupTable& groups,
+                      std::vector<Accumulator>& accumulators);
+void writeAggregate(ResultWriter& writer, const Table& table, const Aggregate& agg,
+                    size_t firstSlot, const Accumulator& acc);
+std::string aggregateDetail(const Table& table, const std::vector<Aggregate>& aggregates, int groupCol);
+void runAggregates(const Table& table, const Selection& selection,
+                   const std::vector<Aggregate>& aggregates, int groupCol, std::ostream& out);
+
+// ---- Sorting ----
+// ORDER BY sorts the selected slots by one column, ties in row order. With a
+// LIMIT only the first offset + limit rows are needed: each run of morsels
+// keeps them in a bounded heap, and the heaps are merged at the end.
+struct RowOrder {
+    bool ordered = false;
+    int colIndex = -1;  // -1 for the row ID
+    bool descending = false;
+    size_t offset = 0;
+    size_t limit = SIZE_MAX;
+
+    // Rows needed before OFFSET is applied
+    size_t needed() const { return limit > SIZE_MAX - offset ? SIZE_MAX : offset + limit; }
+};
+
+// Strict weak order of slots by the sort column or row ID, then by slot. A
+// row's slot says nothing of its ID once an UPDATE has given it a new version.
+struct SlotOrder {
+    const Table* table;
+    int col;
+    bool descending;
+
+    int compare(size_t a, size_t b) const {
+        if (col < 0) return (table->ids[a] > table->ids[b]) - (table->ids[a] < table->ids[b]);
+        const ColumnData& column = table->data[col];
+        if (table->isInt(col)) return (column.ints[a] > column.ints[b]) - (column.ints[a] < column.ints[b]);
+        uint32_t lengthA = column.textLength(a), lengthB = column.textLength(b);
+        int c = std::memcmp(column.textData(a), column.textData(b), std::min(lengthA, lengthB));
+        if (c != 0) return c;
+        return (lengthA > lengthB) - (lengthA < lengthB);
+    }
+
+    bool operator()(size_t a, size_t b) const {
+        int c = compare(a, b);
+        if (c != 0) return descending ? c > 0 : c < 0;
+        return a < b;
+    }
+};
+
+std::string orderDetail(const Table& table, const RowOrder& order);
+std::string limitDetail(const RowOrder& order);
+SlotList orderRows(const Table& table, const Selection& selection, const RowOrder& order);
+
+// ---- Joins ----
+// Equi-joins build a hash table on the side with fewer selected rows and
+// probe it with the other side's morsels in parallel. The table keeps its
+// entries grouped by bucket in one array, so a probe reads one contiguous run.
+struct JoinSide {
+    const Table* table = nullptr;
+    int keyCol = -1;  // -1 for the row ID
+    Selection selection;
+};
+
+typedef std::pair<size_t, size_t> JoinMatch;  // Slots in sides[0] and sides[1]
+typedef std::vector<JoinMatch, CountedAllocator<JoinMatch>> JoinMatches;
+
+int64_t joinKey(const Table& table, int col, size_t slot);
+bool sameJoinKey(const JoinSide& a, size_t slotA, const JoinSide& b, size_t slotB);
+
+class JoinTable {
+public:
+    explicit JoinTable(const JoinSide& side) {
+        size_t numRows = countSelected(side.selection);
+        size_t numBuckets = 1;
+        while (numBuckets < numRows) numBuckets *= 2;
+        mask = numBuckets - 1;
+
+        // Count each bucket, turn the counts into start offsets, then place
+        // the entries; each bucket keeps its slots in ascending order
+        std::vector<Entry> rows;
+        rows.reserve(numRows);
+        starts.assign(numBuckets + 1, 0);
+        forEachSelected(side.selection, [&](size_t slot) {
+            int64_t key = joinKey(*side.table, side.keyCol, slot);
+            rows.push_back(Entry{key, slot});
+            starts[(mixKey(key) & mask) + 1]++;
+        });
+        for (size_t b = 0; b < numBuckets; b++) starts[b + 1] += starts[b];
+        entries.resize(rows.size());
+        std::vector<size_t> next(starts.begin(), starts.end() - 1);
+        for (const Entry& row : rows) entries[next[mixKey(row.key) & mask]++] = row;
+    }
+
+    // Call fn(slot) for every build slot with this key, in slot order
+    template <typename Fn>
+    void forEachMatch(int64_t key, Fn fn) const {
+        size_t bucket = mixKey(key) & mask;
+        for (size_t i = starts[bucket]; i < starts[bucket + 1]; i++) {
+            if (entries[i].key == key) fn(entries[i].slot);
+        }
+    }
+
+private:
+    struct Entry {
+        int64_t key;
+        size_t slot;
+    };
+
+    uint64_t mask = 0;
+    std::vector<size_t> starts;  // Bucket b holds entries [starts[b], starts[b + 1])
+    std::vector<Entry> entries;
+};
+
+std::vector<JoinMatches> hashJoin(const JoinSide sides[2]);
+
+// ---- Query Plans ----
+// SELECT, INSERT, UPDATE and DELETE run from plans: the statement parsed
+// once, with its table and columns resolved and its literals left as
+// placeholders. A statement is normalized by replacing each number and
+// quoted string with ?N, so the same statement with other literals finds the
+// same plan in an LRU cache and skips parsing. PREPARE normalizes a
+// statement whose ? parameters EXECUTE supplies.
+enum class PlanKind { SELECT, INSERT, UPDATE, DELETE };
+
+// A literal of a plan: placeholder `param`, or text as written
+struct PlanLiteral {
+    int param = -1;
+    std::string text;
+};
+
+PlanLiteral planLiteral(const std::string& text);
+std::string bindStatement(const std::string& key, const std::vector<std::string>& literals);
+std::string bindLiteral(const PlanLiteral& literal, const std::vector<std::string>& args);
+Condition bindWhere(const Condition& where, const std::vector<std::string>& args, const Table& table);
+
+struct Plan {
+    PlanKind kind = PlanKind::SELECT;
+    std::string tableName;
+    uint64_t catalogVersion = 0;  // Catalog the columns were resolved against
+    Condition where;  // Literals unbound
+
+    // SELECT. A join is planned and run from the statement text every time.
+    bool join = false;
+    std::vector<int> projection;  // -1 for the row ID
+    std::vector<ResultColumn> columns;
+    std::vector<Aggregate> aggregates;  // Set for an aggregate query
+    int groupCol = -1;
+    RowOrder order;
+    bool limited = false;
+    PlanLiteral limit, offset;
+
+    // UPDATE: column and new value of each assignment
+    std::vector<std::pair<int, PlanLiteral>> assignments;
+
+    // INSERT: values row by row
+    size_t numRows = 0;
+    std::vector<PlanLiteral> values;
+};
+
+typedef std::shared_ptr<const Plan> PlanPtr;
+
+extern std::atomic<uint64_t> catalogVersion;
+
+// Statements longer than this are planned without the cache, so bulk
+// INSERTs neither pay for normalizing nor flush the cache
+const size_t kMaxPlanText = 4096;
+
+bool normalizeStatement(const std::string& text, std::string& key, std::vector<std::string>& literals,
+                        std::vector<size_t>* parameters = nullptr);
+
+// A statement to run: its text, and its normalized form when already known,
+// as for EXECUTE. Otherwise planning normalizes the text.
+struct Statement {
+    std::string text;  // As written; what the log records
+    std::string key;
+    std::vector<std::string> literals;
+
+    Statement() {}
+    Statement(const std::string& text) : text(text) {}
+    Statement(const char* text) : text(text) {}
+};
+
+// Plans by normalized statement text, least recently used first out. One
+// cache serves every session.
+class PlanCache {
+public:
+    explicit PlanCache(size_t capacity) : capacity(capacity) {}
+
+    PlanPtr find(const std::string& key) {
+        std::lock_guard<std::mutex> guard(mutex);
+        auto it = entries.find(key);
+        if (it == entries.end()) return nullptr;
+        order.splice(order.begin(), order, it->second);
+        return it->second->second;
+    }
+
+    void insert(const std::string& key, const PlanPtr& plan) {
+        std::lock_guard<std::mutex> guard(mutex);
+        auto it = entries.find(key);
+        if (it != entries.end()) {
+            it->second->second = plan;
+            order.splice(order.begin(), order, it->second);
+            return;
+        }
+        order.emplace_front(key, plan);
+        entries[key] = order.begin();
+        evict();
+    }
+
+    void setCapacity(size_t entries) {
+        std::lock_guard<std::mutex> guard(mutex);
+        capacity = entries;
+        evict();
+    }
+
+    size_t size() {
+        std::lock_guard<std::mutex> guard(mutex);
+        return entries.size();
+    }
+
+private:
+    typedef std::list<std::pair<std::string, PlanPtr>> Order;
+
+    std::mutex mutex;
+    size_t capacity;
+    Order order;  // Most recently used first
+    std::unordered_map<std::string, Order::iterator> entries;
+
+    void evict() {
+        while (entries.size() > capacity) {
+            entries.erase(order.back().first);
+            order.pop_back();
+        }
+    }
+};
+
+extern PlanCache planCache;
+
+typedef std::shared_ptr<Plan> (*Planner)(const std::string& text, std::ostream& out);
+PlanPtr statementPlan(const Statement& stmt, Planner planner, std::vector<std::string>& args,
+                      std::ostream& out);
+
+// A statement prepared in this session. Placeholder i of `key` is argument
+// params[i] of EXECUTE, or the constant constants[i] when params[i] is -1.
+struct PreparedStatement {
+    std::string key;
+    std::vector<std::string> constants;
+    std::vector<int> params;
+    size_t numArgs = 0;
+};
+
+extern thread_local std::unordered_map<std::string, PreparedStatement> preparedStatements;
+
+// ---- Snapshot Files ----
+// SAVE writes a versioned snapshot: a header page, one page-aligned section
+// per array of the storage layer, and a directory that describes the tables,
+// columns and indexes and where each section starts. LOAD maps the file and
+// bulk-copies every section into its column vector. Values are stored in
+// native byte order.
+//
+//   header     magic, version, directory offset and size, log sequence
+//   sections   row IDs (int32), INT values and their zone bounds (int64),
+//              and per TEXT column
+//              either lengths (uint32) and bytes in slot order, or its
+//              dictionary entries' lengths and bytes with the codes (uint16)
+//              in slot order or as runs of equal codes
+//   directory  per table: name, next_id, row count, ID section, columns with
+//              their encoding and sections, index definitions
+//
+// An incremental save appends sections and a new directory to a file and
+// rewrites the header last, so sections of unchanged tables stay in place
+// and older sections and directories are left unreferenced.
+//
+// Version 1 files, which only have plain TEXT columns, and version 2 files,
+// which have no zone bounds, still load.
+typedef std::unordered_map<std::string, Table> TableMap;
+
+const char kSnapshotMagic[8] = {'C', 'R', 'T', 'S', 'N', 'A', 'P', '\0'};
+const uint32_t kSnapshotVersion = 3;
+
+// How a TEXT column is stored in a snapshot
+enum class TextEncoding { PLAIN, DICTIONARY, DICTIONARY_RUNS };
+const uint64_t kSnapshotAlign = 4096;
+
+struct SnapshotHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t align;
+    uint64_t directoryOffset;
+    uint64_t directorySize;
+    uint64_t fileSize;
+    uint64_t logSequence; // Write-ahead log generation this snapshot includes
+};
+
+// Buffered output that tracks the file offset. Small writes are gathered into
+// a large buffer; writes at least as large as the buffer bypass it.
+class SnapshotWriter {
+public:
+    // `start` is the offset `out` is positioned at; bytes written so far are
+    // added to `progress` when one is given
+    explicit SnapshotWriter(std::ostream& out, uint64_t start = 0, std::atomic<uint64_t>* progress = nullptr)
+        : out(out), pos(start), progress(progress) {
+        buffer.reserve(kBufferSize);
+    }
+
+    uint64_t offset() const { return pos; }
+
+    void write(const void* data, size_t size) {
+        const char* bytes = static_cast<const char*>(data);
+        if (buffer.size() + size > kBufferSize) flush();
+        if (size >= kBufferSize) {
+            out.write(bytes, size);
+            if (progress) *progress += size;
+        } else {
+            buffer.insert(buffer.end(), bytes, bytes + size);
+        }
+        pos += size;
+    }
+
+    // Pad with zeros up to the next section boundary
+    void align() {
+        static const char zeros[kSnapshotAlign] = {};
+        uint64_t padding = (kSnapshotAlign - pos % kSnapshotAlign) % kSnapshotAlign;
+        write(zeros, padding);
+    }
+
+    void flush() {
+        out.write(buffer.data(), buffer.size());
+        if (progress) *progress += buffer.size();
+        buffer.clear();
+        if (!out) throw std::runtime_error("write failed");
+    }
+
+private:
+    static const size_t kBufferSize = 1 << 20;
+
+    std::ostream& out;
+    std::vector<char> buffer;
+    uint64_t pos;
+    std::atomic<uint64_t>* progress;
+};
+
+// Read-only view of a whole file: mapped where the platform supports it,
+// otherwise read into memory in one call. A file opened for paging keeps
+// its descriptor, and readSection maps arrays from it in place.
+class MappedFile {
+public:
+    MappedFile() : base(nullptr), length(0), fd(-1) {}
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    ~MappedFile() {
+#ifdef CRT_HAVE_MMAP
+        if (base && base != copy.data()) munmap(const_cast<char*>(base), length);
+        if (fd >= 0) ::close(fd);
+#endif
+    }
+
+    bool open(const std::string& filename, bool paging = false) {
+#ifdef CRT_HAVE_MMAP
+        int opened = ::open(filename.c_str(), O_RDONLY);
+        if (opened < 0) return false;
+        struct stat info;
+        if (fstat(opened, &info) == 0 && info.st_size > 0) {
+            void* mapped = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, opened, 0);
+            if (mapped != MAP_FAILED) {
+                madvise(mapped, info.st_size, MADV_SEQUENTIAL);
+                base = static_cast<const char*>(mapped);
+                length = info.st_size;
+            }
+        }
+        if (paging && base) {
+            fd = opened;
+        } else {
+            ::close(opened);
+        }
+        if (base) return true;
+#else
+        (void)paging;
+#endif
+        std::ifstream file(filename, std::ios::binary | std::ios::ate);
+        if (!file) return false;
+        copy.resize(static_cast<size_t>(file.tellg()));
+        file.seekg(0);
+        file.read(copy.data(), copy.size());
+        base = copy.data();
+        length = copy.size();
+        return static_cast<bool>(file);
+    }
+
+    const char* data() const { return base; }
+    size_t size() const { return length; }
+    int descriptor() const { return fd; } // -1 unless opened for paging
+
+    // Ask the kernel to start reading a range that is about to be copied
+    void willNeed(uint64_t offset, uint64_t size) const {
+#ifdef CRT_HAVE_MMAP
+        if (!base || base == copy.data() || offset >= length) return;
+        uint64_t start = offset - offset % kSnapshotAlign;
+        madvise(const_cast<char*>(base) + start, std::min<uint64_t>(size + offset - start, length - start),
+                MADV_WILLNEED);
+#else
+        (void)offset;
+        (void)size;
+#endif
+    }
+
+private:
+    const char* base;
+    size_t length;
+    int fd;
+    std::vector<char> copy; // Fallback when the file is not mapped
+};
+
+// Stream over a mapped file, for the legacy reader
+struct MemoryBuffer : std::streambuf {
+    MemoryBuffer(const char* data, size_t size) {
+        char* begin = const_cast<char*>(data);
+        setg(begin, begin, begin + size);
+    }
+};
+
+void putU64(std::string& out, uint64_t value);
+void putString(std::string& out, const std::string& value);
+
+// Bounds-checked reader over a snapshot directory
+class DirectoryReader {
+public:
+    DirectoryReader(const char* data, size_t size) : data(data), size(size), pos(0) {}
+
+    uint64_t u64() {
+        uint64_t value;
+        std::memcpy(&value, take(sizeof(value)), sizeof(value));
+        return value;
+    }
+
+    std::string str() {
+        uint64_t length = u64();
+        const char* bytes = take(length);
+        return std::string(bytes, length);
+    }
+
+    size_t position() const { return pos; }
+
+private:
+    const char* data;
+    size_t size;
+    size_t pos;
+
+    const char* take(uint64_t count) {
+        if (count > size - pos) throw std::runtime_error("corrupt snapshot directory");
+        const char* at = data + pos;
+        pos += count;
+        return at;
+    }
+};
+
+uint64_t writeSection(SnapshotWriter& writer, const void* data, size_t size);
+void addArrays(const Table& table, ChunkCapture& capture);
+
+// Elements [first, last) of a captured array, copied under the capture's lock
+template <typename T>
+void readCaptured(ChunkCapture& capture, size_t id, size_t first, size_t last, std::vector<T>& out,
+                  bool again = false) {
+    out.resize(last - first);
+    std::lock_guard<std::mutex> lock(capture.mutex);
+    capture.read(id, first, last, out.data(), again);
+}
+
+// Write a captured array as its own section, a chunk at a time; returns its
+// offset
+template <typename T>
+uint64_t writeCaptured(SnapshotWriter& writer, ChunkCapture& capture, size_t id) {
+    size_t count = capture.size(id);
+    if (count) writer.align();
+    uint64_t offset = writer.offset();
+    std::vector<T> chunk;
+    for (size_t first = 0; first < count; first += ChunkCapture::kChunk) {
+        readCaptured(capture, id, first, std::min(count, first + ChunkCapture::kChunk), chunk);
+        writer.write(chunk.data(), chunk.size() * sizeof(T));
+    }
+    return offset;
+}
+
+void writeTextColumn(SnapshotWriter& writer, std::string& directory, ChunkCapture& capture, size_t id,
+                     bool encoded);
+void compactTables(TableMap& tables);
+std::string writeTable(SnapshotWriter& writer, const Table& table, ChunkCapture* capture = nullptr);
+SnapshotHeader writeDirectory(SnapshotWriter& writer, uint64_t numTables, const std::string& entries,
+                              uint64_t logSequence);
+void writeHeader(std::ostream& file, const SnapshotHeader& header);
+void saveSnapshot(const TableMap& tables, const std::string& filename, uint64_t logSequence = 0);
+const char* sectionAt(const MappedFile& file, uint64_t offset, uint64_t count, size_t width);
+
+// Copy `count` elements of a mapped section into a vector
+template <typename T>
+void readSection(const MappedFile& file, uint64_t offset, size_t count, std::vector<T>& out) {
+    const char* section = sectionAt(file, offset, count, sizeof(T));
+    out.resize(count);
+    if (count) std::memcpy(out.data(), section, count * sizeof(T));
+}
+
+// Into an array, mapped in place when the file is opened for paging
+template <typename T>
+void readSection(const MappedFile& file, uint64_t offset, size_t count, ColumnArray<T>& out) {
+    const char* section = sectionAt(file, offset, count, sizeof(T));
+    if (count && out.map(file.descriptor(), offset, count)) return;
+    out.clear();
+    out.append(reinterpret_cast<const T*>(section), count);
+}
+
+bool isSnapshot(const MappedFile& file);
+void readTextColumn(const MappedFile& file, DirectoryReader& dir, ColumnData& data, size_t numRows,
+                    uint32_t version);
+void skipTextColumn(DirectoryReader& dir, uint32_t version);
+Table readTable(const MappedFile& file, DirectoryReader& dir, uint32_t version, bool rows = true);
+SnapshotHeader readHeader(const MappedFile& file);
+uint64_t loadSnapshot(const MappedFile& file, TableMap& tables);
+
+// ---- Write-Ahead Log ----
+// Statements that changed the database are appended to the log before they
+// are acknowledged. Replaying them in order over the snapshot they were logged
+// against rebuilds the same state, row IDs included. The log starts with a
+// header naming its sequence; a checkpoint writes a snapshot tagged with the
+// next sequence and then resets the log to it, so a log older than the
+// snapshot is known to be already included.
+//
+//   header   magic, sequence
+//   records  payload length (uint32), checksum (uint32), statement text
+//
+// Sync policies: STATEMENT syncs every record before returning. GROUP has a
+// background thread sync whatever was appended since its last sync, and a
+// statement waits for the sync that covers its record once it has released
+// its locks, so statements finishing together share one sync. DELAYED
+// acknowledges without waiting and syncs every `groupMs` milliseconds (a
+// crash loses at most that window), and OFF leaves it to the OS.
+enum class SyncPolicy { STATEMENT, GROUP, DELAYED, OFF };
+
+const char kLogMagic[8] = {'C', 'R', 'T', 'W', 'A', 'L', '\0', '\0'};
+
+struct LogHeader {
+    char magic[8];
+    uint64_t sequence;
+};
+
+void syncFile(std::FILE* file);
+void syncPath(const std::string& path);
+uint32_t logChecksum(const std::string& payload);
+extern thread_local uint64_t appendedRecord;
+
+class WriteAheadLog {
+public:
+    WriteAheadLog() : file(nullptr), policy(SyncPolicy::STATEMENT), groupMs(10),
+                      logSequence(0), appended(0), synced(0), stopping(false) {}
+    WriteAheadLog(const WriteAheadLog&) = delete;
+    WriteAheadLog& operator=(const WriteAheadLog&) = delete;
+    ~WriteAheadLog() { close(); }
+
+    bool isOpen() const { return file != nullptr; }
+    const std::string& path() const { return logPath; }
+    uint64_t sequence() const { return logSequence; }
+
+    // Open the log at `path` for a database restored from a snapshot tagged
+    // `snapshotSequence`, and return the statements still to replay. A torn
+    // record at the tail is cut off; a log the snapshot already includes is
+    // reset.
+    std::vector<std::string> open(const std::string& path, uint64_t snapshotSequence,
+                                  SyncPolicy syncPolicy, int groupMillis) {
+        close();
+        logPath = path;
+        policy = syncPolicy;
+        groupMs = groupMillis;
+
+        std::vector<std::string> statements;
+        std::string bytes;
+        std::ifstream in(path, std::ios::binary);
+        if (in) bytes.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+
+        LogHeader header;
+        if (bytes.size() < sizeof(header)) {
+            reset(snapshotSequence);
+            return statements;
+        }
+        std::memcpy(&header, bytes.data(), sizeof(header));
+        if (std::memcmp(header.magic, kLogMagic, sizeof(kLogMagic)) != 0) {
+            throw std::runtime_error("'" + path + "' is not a write-ahead log");
+        }
+        if (header.sequence > snapshotSequence) {
+            throw std::runtime_error("log '" + path + "' is newer than its snapshot");
+        }
+        if (header.sequence < snapshotSequence) {
+            reset(snapshotSequence);
+            return statements;
+        }
+
+        size_t pos = sizeof(header);
+        while (bytes.size() - pos >= 2 * sizeof(uint32_t)) {
+            uint32_t length, checksum;
+            std::memcpy(&length, bytes.data() + pos, sizeof(length));
+            std::memcpy(&checksum, bytes.data() + pos + sizeof(length), sizeof(checksum));
+            size_t start = pos + 2 * sizeof(uint32_t);
+            if (length > bytes.size() - start) break;
+            std::string statement = bytes.substr(start, length);
+            if (logChecksum(statement) != checksum) break;
+            statements.push_back(statement);
+            pos = start + length;
+        }
+
+        if (pos < bytes.size()) {
+            // Rewrite the valid prefix so new records follow a clean tail
+            std::FILE* out = std::fopen(path.c_str(), "wb");
+            if (!out) throw std::runtime_error("could not open log '" + path + "'");
+            std::fwrite(bytes.data(), 1, pos, out);
+            syncFile(out);
+            std::fclose(out);
+        }
+
+        logSequence = header.sequence;
+        openForAppend();
+        return statements;
+    }
+
+    void append(const std::string& statement) {
+        if (!file) return;
+        uint32_t header[2] = {static_cast<uint32_t>(statement.size()), logChecksum(statement)};
+
+        std::lock_guard<std::mutex> lock(mutex);
+        if (std::fwrite(header, sizeof(header), 1, file) != 1 ||
+            std::fwrite(statement.data(), 1, statement.size(), file) != statement.size()) {
+            throw std::runtime_error("could not append to log '" + logPath + "'");
+        }
+        appendedRecord = ++appended;
+        if (policy == SyncPolicy::STATEMENT) {
+            syncFile(file);
+            synced = appended;
+        } else if (policy == SyncPolicy::GROUP) {
+            wake.notify_one();
+        }
+    }
+
+    // Under GROUP, wait until the last record this thread appended is synced.
+    // Called once the statement's locks are released, so that statements on
+    // other sessions can append and share the sync.
+    void awaitAppended() {
+        if (policy != SyncPolicy::GROUP || !appendedRecord) return;
+        std::unique_lock<std::mutex> lock(mutex);
+        durable.wait(lock, [this] { return synced >= appendedRecord; });
+        appendedRecord = 0;
+    }
+
+    // Truncate to an empty log with the given sequence
+    void reset(uint64_t sequence) {
+        stopFlusher();
+        if (file) std::fclose(file);
+        file = nullptr;
+
+        std::FILE* out = std::fopen(logPath.c_str(), "wb");
+        if (!out) throw std::runtime_error("could not open log '" + logPath + "'");
+        LogHeader header;
+        std::memcpy(header.magic, kLogMagic, sizeof(header.magic));
+        header.sequence = sequence;
+        std::fwrite(&header, sizeof(header), 1, out);
+        syncFile(out);
+        std::fclose(out);
+
+        logSequence = sequence;
+        openForAppend();
+    }
+
+    void close() {
+        stopFlusher();
+        if (!file) return;
+        syncFile(file);
+        std::fclose(file);
+        file = nullptr;
+    }
+
+private:
+    std::string logPath;
+    std::FILE* file;
+    SyncPolicy policy;
+    int groupMs;
+    uint64_t logSequence;
+
+    std::mutex mutex;                 // Guards `file` and the counts against the flusher
+    std::condition_variable wake;     // The flusher: records to sync, or stop
+    std::condition_variable durable;  // Statements waiting for their records
+    std::thread flusher;
+    uint64_t appended;                // Records appended since the log was opened
+    uint64_t synced;                  // Of those, records known to be on disk
+    bool stopping;
+
+    void openForAppend() {
+        file = std::fopen(logPath.c_str(), "ab");
+        if (!file) throw std::runtime_error("could not open log '" + logPath + "'");
+        if (policy == SyncPolicy::GROUP || policy == SyncPolicy::DELAYED) {
+            stopping = false;
+            flusher = std::thread(&WriteAheadLog::flushLoop, this);
+        }
+    }
+
+    // One sync covers every record appended before it: under GROUP as soon
+    // as there is one, and the records appended while it runs go in the
+    // next; under DELAYED once per window
+    void flushLoop() {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true) {
+            if (policy == SyncPolicy::GROUP) {
+                wake.wait(lock, [this] { return stopping || appended > synced; });
+            } else {
+                wake.wait_for(lock, std::chrono::milliseconds(groupMs));
+            }
+            if (appended > synced) {
+                std::fflush(file);
+                uint64_t covered = appended;
+#ifdef CRT_HAVE_FSYNC
+                int fd = fileno(file);
+                lock.unlock();
+                fsync(fd);
+                lock.lock();
+#endif
+                synced = covered;
+                durable.notify_all();
+            }
+            if (stopping) break;
+        }
+    }
+
+    // Stop the flusher after a last sync of what is appended
+    void stopFlusher() {
+        if (!flusher.joinable()) return;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_one();
+        flusher.join();
+    }
+};
+
+extern WriteAheadLog wal;
+extern std::string walSnapshotPath;
+
+// ---- Saved Files ----
+// What a snapshot file holds, as the save that wrote it or the buffer pool
+// reading from it knows it, and writing one that reuses sections of another.
+
+// A table as a save left it in a file
+struct SavedTable {
+    uint64_t changedAt = 0; // Stamp of the table when saved
+    std::string entry;      // Its directory entry
+    uint64_t offset = 0;    // Where its sections start
+    uint64_t bytes = 0;     // and their size
+};
+
+struct SavedFile {
+    std::string filename;
+    uint64_t fileSize = 0;
+    uint64_t directoryOffset = 0;
+    std::unordered_map<std::string, SavedTable> tables;
+};
+
+SavedFile writeSavedFile(const SavedFile& base, const std::vector<std::string>& kept,
+                         const std::vector<const Table*>& changed,
+                         const std::vector<std::shared_ptr<ChunkCapture>>& captures,
+                         const std::vector<SavedTable>& reread, const MappedFile* source, bool append,
+                         std::atomic<uint64_t>* progress = nullptr, std::atomic<size_t>* tablesWritten = nullptr);
+
+// ---- Buffer Pool ----
+size_t heldBytes(const Table& table);
+uint64_t sectionsStart(const std::string& entry);
+SavedFile readPagedTables(const MappedFile& file, const std::string& filename, TableMap& tables);
+
+// What to do with the pages some rows of a paged table are on
+enum class PageAction { COUNT, READ_AHEAD, DROP };
+
+// Pages of a paged array that elements [first, last) are on; returns their
+// bytes, or for DROP the bytes given back
+template <typename Array>
+size_t arrayPages(const Array& array, size_t first, size_t last, size_t width, PageAction action) {
+    last = std::min(last, array.size());
+    if (!array.isPaged() || first >= last) return 0;
+    if (action == PageAction::DROP) return array.drop(first, last);
+    if (action == PageAction::READ_AHEAD) array.willNeed(first, last);
+    return (last - first) * width;
+}
+
+size_t columnPages(const Table& table, int col, size_t first, size_t last, PageAction action);
+size_t morselPages(const Table& table, size_t morsel, PageAction action);
+
+// A paged table, as the pool sees it
+struct Frame {
+    Table* table = nullptr;
+    bool resident = false;   // Read in: its sections mapped and its indexes built
+    bool busy = false;       // Being read in or evicted outside the pool's lock
+    bool referenced = false; // Pinned since the clock last passed it
+    int pins = 0;
+    size_t bytes = 0;        // Held while resident that cannot be given back by the page
+    std::vector<size_t> morselBytes; // Per morsel: bytes of its pages read since last given back, or 0
+    size_t pagedBytes = 0;   // Their sum
+    uint64_t loads = 0;
+    uint64_t evictions = 0;
+    uint64_t morselReads = 0;
+    uint64_t morselDrops = 0;
+};
+
+class BufferPool {
+public:
+    BufferPool() : budget(size_t(1) << 30), residentBytes(0), hand(0), writing(false) {}
+
+    // Make the data file `saved` the home of every table: tables not yet
+    // paged are resident. Runs under the exclusive catalog lock.
+    void attach(const SavedFile& saved, std::shared_ptr<MappedFile> file = nullptr) {
+        std::unique_lock<std::mutex> lock(mutex);
+        if (!file) file = mapFile(saved.filename);
+        data = saved;
+        source = file;
+        for (auto& tablePair : database) {
+            Table& table = tablePair.second;
+            if (frameOf.count(&table)) continue;
+            Frame frame;
+            frame.table = &table;
+            frame.resident = !table.paged;
+            frame.bytes = frame.resident ? heldBytes(table) : 0;
+            residentBytes += frame.bytes;
+            table.paged = true;
+            frameOf[&table] = frames.size();
+            frames.push_back(frame);
+        }
+        evictOver(lock);
+    }
+
+    // Forget the paged tables, which LOAD has replaced
+    void detach() {
+        std::lock_guard<std::mutex> lock(mutex);
+        frames.clear();
+        frameOf.clear();
+        readOrder.clear();
+        data = SavedFile();
+        source.reset();
+        residentBytes = 0;
+        hand = 0;
+    }
+
+    bool isDataFile(const std::string& filename) {
+        std::lock_guard<std::mutex> lock(mutex);
+        return source && data.filename == filename;
+    }
+
+    SavedFile dataFile() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return data;
+    }
+
+    std::shared_ptr<MappedFile> mapping() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return source;
+    }
+
+    // Keep a table resident until unpinned, reading it in first if need be.
+    // A table just read in is not marked referenced, so one used only once
+    // goes before those used again. Another statement pinning a table being
+    // read in waits for it.
+    void pin(Table& table) {
+        if (!table.paged) return;
+        std::unique_lock<std::mutex> lock(mutex);
+        size_t i = frameOf.at(&table);
+        idle.wait(lock, [&] { return !frames[i].busy; });
+        frames[i].pins++;
+        if (frames[i].resident) {
+            frames[i].referenced = true;
+        } else {
+            readIn(lock, i);
+        }
+        evictOver(lock);
+    }
+
+    // Pin a table only if it is resident; false if it is not
+    bool pinResident(Table& table) {
+        if (!table.paged) return true;
+        std::lock_guard<std::mutex> lock(mutex);
+        Frame& frame = frames[frameOf.at(&table)];
+        if (!frame.resident || frame.busy) return false;
+        frame.pins++;
+        return true;
+    }
+
+    void unpin(Table& table) {
+        if (!table.paged) return;
+        std::unique_lock<std::mutex> lock(mutex);
+        Frame& frame = frames[frameOf.at(&table)];
+        frame.pins--;
+        residentBytes -= frame.bytes;
+        frame.bytes = heldBytes(table);
+        residentBytes += frame.bytes;
+        evictOver(lock);
+    }
+
+    // A scan is about to read a morsel of a pinned table: count the pages
+    // its rows are on as held, and ask the kernel to read them and the next
+    // morsel's ahead. Read-ahead follows the scan, and only morsels not read
+    // since they were last given back are asked for.
+    void touch(const Table& table, size_t morsel) {
+        if (!table.paged) return;
+        std::unique_lock<std::mutex> lock(mutex);
+        size_t i = frameOf.at(&table);
+        Frame& frame = frames[i];
+        if (!frame.resident) return;
+        if (frame.morselBytes.size() < morsel + 2) frame.morselBytes.resize(morsel + 2, 0);
+        bool readCurrent = frame.morselBytes[morsel] == 0;
+        bool readNext = frame.morselBytes[morsel + 1] == 0;
+        if (!readCurrent && !readNext) return;
+        if (readCurrent) {
+            size_t bytes = morselPages(table, morsel, PageAction::COUNT);
+            frame.morselBytes[morsel] = bytes;
+            frame.pagedBytes += bytes;
+            residentBytes += bytes;
+            if (bytes) {
+                frame.morselReads++;
+                readOrder.push_back(std::make_pair(i, morsel));
+            }
+        }
+        lock.unlock();
+        if (readCurrent) morselPages(table, morsel, PageAction::READ_AHEAD);
+        if (readNext) morselPages(table, morsel + 1, PageAction::READ_AHEAD);
+        lock.lock();
+        evictOver(lock);
+    }
+
+    bool isResident(const Table& table) {
+        if (!table.paged) return true;
+        std::lock_guard<std::mutex> lock(mutex);
+        return frames[frameOf.at(&table)].resident;
+    }
+
+    // Whether a table changed since the data file last got it
+    bool isDirty(const Table& table) {
+        std::lock_guard<std::mutex> lock(mutex);
+        return changedSinceSaved(table);
+    }
+
+    void setBudget(size_t bytes) {
+        std::unique_lock<std::mutex> lock(mutex);
+        budget = bytes;
+        evictOver(lock);
+    }
+
+    size_t getBudget() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return budget;
+    }
+
+    // Bytes held by the resident tables
+    size_t heldTotal() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return residentBytes;
+    }
+
+    // The paged tables; runs under the exclusive catalog lock
+    std::vector<Frame> frameList() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return frames;
+    }
+
+private:
+    std::mutex mutex; // Guards everything below; reads and write-backs happen outside it
+    std::condition_variable idle; // A frame stopped being busy
+    size_t budget;
+    size_t residentBytes;
+    std::vector<Frame> frames;                       // In clock order
+    std::unordered_map<const Table*, size_t> frameOf; // Table -> its frame
+    std::deque<std::pair<size_t, size_t>> readOrder; // Frame and morsel of the pages counted, oldest first
+    size_t hand;
+    bool writing; // A write-back is under way
+    SavedFile data;
+    std::shared_ptr<MappedFile> source;
+
+    bool changedSinceSaved(const Table& table) const {
+        auto saved = data.tables.find(table.name);
+        return saved == data.tables.end() || saved->second.changedAt != table.changedAt;
+    }
+
+    static std::shared_ptr<MappedFile> mapFile(const std::string& filename) {
+        std::shared_ptr<MappedFile> file(new MappedFile());
+        if (!file->open(filename, true)) {
+            throw std::runtime_error("could not open file '" + filename + "' for reading");
+        }
+        return file;
+    }
+
+    // Read in frame i's table, pinned by this thread, outside the pool's
+    // lock: map its sections and rebuild its indexes, reading their columns
+    // ahead. The pages the rebuild read are given back; scans read the rest
+    // of the rows as they touch them.
+    void readIn(std::unique_lock<std::mutex>& lock, size_t i) {
+        Table& table = *frames[i].table;
+        frames[i].busy = true;
+        SavedTable saved = data.tables.at(table.name);
+        std::shared_ptr<MappedFile> file = source;
+        lock.unlock();
+        try {
+            DirectoryReader dir(saved.entry.data(), saved.entry.size());
+            Table loaded = readTable(*file, dir, kSnapshotVersion);
+            table.ids = std::move(loaded.ids);
+            table.data = std::move(loaded.data);
+            for (auto& index : table.indexes) {
+                columnPages(table, index.colIndex, 0, table.rowCount(), PageAction::READ_AHEAD);
+                rebuildIndex(table, index);
+            }
+            for (size_t morsel = 0; morsel < morselCount(table.rowCount()); morsel++) {
+                morselPages(table, morsel, PageAction::DROP);
+            }
+        } catch (...) {
+            clearRows(table);
+            lock.lock();
+            frames[i].busy = false;
+            frames[i].pins--;
+            idle.notify_all();
+            throw;
+        }
+        lock.lock();
+        Frame& frame = frames[i];
+        frame.busy = false;
+        frame.resident = true;
+        frame.bytes = heldBytes(table);
+        frame.morselBytes.assign(morselCount(table.rowCount()), 0);
+        residentBytes += frame.bytes;
+        frame.loads++;
+        idle.notify_all();
+    }
+
+    // Write a changed table to the data file `base`: appended, with a
+    // directory that keeps the rest, unless more of the file would be left
+    // unreferenced than reused. Then the rest are read back from `file`
+    // and the data file is rewritten whole. Returns what it then holds.
+    static SavedFile writeBack(Table& table, const SavedFile& base, const MappedFile& file) {
+        compactRows(table); // Snapshots hold live rows only
+        std::vector<std::string> kept;
+        std::vector<SavedTable> reread;
+        uint64_t reused = 0;
+        for (const auto& saved : base.tables) {
+            if (saved.first == table.name) continue;
+            kept.push_back(saved.first);
+            reread.push_back(saved.second);
+            reused += saved.second.bytes;
+        }
+        if (base.fileSize - reused <= reused) return writeSavedFile(base, kept, {&table}, {}, {}, nullptr, true);
+        return writeSavedFile(base, {}, {&table}, {}, reread, &file, false);
+    }
+
+    // Evict frame i's table, whose lock this thread holds, outside the
+    // pool's lock: write it back if it changed, then drop its rows and
+    // indexes. A table whose write-back fails stays until a later pass.
+    void evict(std::unique_lock<std::mutex>& lock, size_t i, bool dirty) {
+        Table& table = *frames[i].table;
+        frames[i].busy = true;
+        if (dirty) writing = true;
+        SavedFile saved = data;
+        std::shared_ptr<MappedFile> file = source;
+        lock.unlock();
+        bool evicted = true;
+        try {
+            if (dirty) {
+                saved = writeBack(table, saved, *file);
+                file = mapFile(saved.filename);
+            }
+            clearRows(table);
+        } catch (const std::exception&) {
+            evicted = false;
+        }
+        lock.lock();
+        if (dirty) {
+            writing = false;
+            if (evicted) {
+                data = saved;
+                source = file;
+            }
+        }
+        Frame& frame = frames[i];
+        frame.busy = false;
+        if (evicted) {
+            residentBytes -= frame.bytes + frame.pagedBytes;
+            frame.bytes = 0;
+            frame.pagedBytes = 0;
+            std::vector<size_t>().swap(frame.morselBytes);
+            frame.resident = false;
+            frame.evictions++;
+        }
+        table.lock->unlock();
+        idle.notify_all();
+    }
+
+    // Bring the bytes held within the budget. First the pages of the
+    // morsels read longest ago are given back, pinned tables' included,
+    // then unpinned tables are evicted round the clock. Tables a statement
+    // holds the lock of stay, as do those with row versions or that a
+    // background save is reading, and a changed table while another is
+    // being written back.
+    void evictOver(std::unique_lock<std::mutex>& lock) {
+        for (size_t n = readOrder.size(); residentBytes > budget && n > 0; n--) {
+            std::pair<size_t, size_t> next = readOrder.front();
+            readOrder.pop_front();
+            Frame& frame = frames[next.first];
+            if (!frame.resident || next.second >= frame.morselBytes.size() || !frame.morselBytes[next.second]) {
+                continue; // Given back with its table
+            }
+            // A write could move the table's arrays meanwhile
+            if (frame.busy || !frame.table->lock->try_lock_shared()) {
+                readOrder.push_back(next);
+                continue;
+            }
+            morselPages(*frame.table, next.second, PageAction::DROP);
+            frame.table->lock->unlock_shared();
+            residentBytes -= frame.morselBytes[next.second];
+            frame.pagedBytes -= frame.morselBytes[next.second];
+            frame.morselBytes[next.second] = 0;
+            frame.morselDrops++;
+        }
+
+        for (size_t step = 0; residentBytes > budget && step < 2 * frames.size(); step++) {
+            size_t i = hand;
+            hand = (hand + 1) % frames.size();
+            Frame& frame = frames[i];
+            if (!frame.resident || frame.busy || frame.pins > 0) continue;
+            if (frame.referenced) {
+                frame.referenced = false;
+                continue;
+            }
+            Table& table = *frame.table;
+            if (!table.lock->try_lock()) continue;
+            bool dirty = changedSinceSaved(table);
+            if ((dirty && writing) || !table.versions.empty() || table.writer || table.hasDelta() ||
+                table.beingSaved()) {
+                table.lock->unlock();
+                continue;
+            }
+            evict(lock, i, dirty);
+        }
+    }
+};
+
+extern BufferPool bufferPool;
+
+// Pins a table for the rest of a scope
+class PinGuard {
+public:
+    explicit PinGuard(Table& table) : table(table) { bufferPool.pin(table); }
+    ~PinGuard() { bufferPool.unpin(table); }
+    PinGuard(const PinGuard&) = delete;
+    PinGuard& operator=(const PinGuard&) = delete;
+
+private:
+    Table& table;
+};
+
+// ---- Background Compaction ----
+// DELETE only marks rows deleted. A table whose deleted slots pass the
+// needsCompaction threshold is queued here, and a background thread compacts
+// it under the locks a write to the table takes.
+class Compactor {
+public:
+    Compactor() : stopping(false) {}
+    ~Compactor() { stop(); }
+
+    // Queue a table; the thread starts with the first one
+    void schedule(const std::string& tableName) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (std::find(pending.begin(), pending.end(), tableName) != pending.end()) return;
+        pending.push_back(tableName);
+        if (!worker.joinable()) worker = std::thread(&Compactor::run, this);
+        wake.notify_one();
+    }
+
+    // Finish the table being compacted and drop the rest of the queue
+    void stop() {
+        if (!worker.joinable()) return;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_one();
+        worker.join();
+    }
+
+private:
+    std::mutex mutex;            // Guards `pending` and `stopping`
+    std::condition_variable wake;
+    std::deque<std::string> pending;
+    std::thread worker;
+    bool stopping;
+
+    void run() {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true) {
+            wake.wait(lock, [&] { return stopping || !pending.empty(); });
+            if (stopping) return;
+            std::string tableName = pending.front();
+            pending.pop_front();
+            lock.unlock();
+            {
+                // The table may have been compacted, cleared or replaced since
+                SharedLock catalog(catalogLock);
+                auto it = database.find(tableName);
+                if (it != database.end()) {
+                    // A paged table that has been evicted has nothing to compact
+                    std::lock_guard<SharedMutex> table(*it->second.lock);
+                    if (bufferPool.pinResident(it->second)) {
+                        if (needsCompaction(it->second)) compactRows(it->second);
+                        bufferPool.unpin(it->second);
+                    }
+                }
+            }
+            lock.lock();
+        }
+    }
+};
+
+extern Compactor compactor;
+
+// ---- Background Saves ----
+// A save remembers the directory entry it wrote for each table and the
+// stamp the table had then. The next save to the same file writes only the
+// tables stamped since: it appends their sections and a directory that also
+// points at the sections of the rest. A file of which more is unreferenced
+// than reused is rewritten whole. SAVE ASYNC captures the tables to write under
+// the catalog lock, which copies no rows, and a background thread reads
+// them a chunk at a time while statements go on changing them; a chunk
+// changed before the thread reads it is copied first.
+
+// Tables a save writes, and those whose sections in the file it reuses
+struct SaveJob {
+    SavedFile base;                           // The file and, when appending, what it holds
+    bool incremental = false;                 // Append to the file rather than rewrite it
+    std::vector<const Table*> changed;        // Into the database, or into `copies`
+    std::vector<std::string> kept;
+    std::vector<std::unique_ptr<Table>> copies; // SAVE ASYNC: definitions of the tables to write
+    std::vector<std::shared_ptr<ChunkCapture>> captures; // and their rows, as of the statement
+    std::vector<SavedTable> reread;           // Evicted paged tables, read back from `source`
+    std::shared_ptr<MappedFile> source;
+};
+
+// The running save, or the last one
+struct SaveStatus {
+    std::string filename;
+    std::string state;  // "running", "saved" or "failed"
+    bool incremental = false;
+    size_t tablesWritten = 0;
+    size_t tablesToWrite = 0;
+    size_t tablesKept = 0;
+    uint64_t bytesWritten = 0;
+    uint64_t bytesCopied = 0; // SAVE ASYNC: of chunks changed before it read them
+    double ms = 0;
+    std::string error;
+};
+
+std::unique_ptr<Table> copyDefinitions(const Table& table);
+std::shared_ptr<ChunkCapture> captureTable(Table& table);
+
+class Saver {
+public:
+    Saver() : bytesWritten(0), tablesWritten(0) {}
+    ~Saver() { wait(); } // A save started before exit still completes
+
+    bool running() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return current.state == "running";
+    }
+
+    // Wait for a background save to finish
+    void wait() {
+        if (worker.joinable()) worker.join();
+    }
+
+    // Plan a save of the database, compacting the tables it writes, which
+    // are captured for a background save. Paged tables that are not resident
+    // are read back while the save writes. Runs under the exclusive catalog
+    // lock with no save running.
+    SaveJob plan(const std::string& filename, bool background) {
+        SaveJob job;
+        if (bufferPool.isDataFile(filename)) {
+            job.base = bufferPool.dataFile();
+        } else if (last.filename == filename && fileUnchanged()) {
+            job.base = last;
+        }
+        job.base.filename = filename;
+        uint64_t reused = 0;
+        for (const auto& tablePair : database) {
+            auto saved = job.base.tables.find(tablePair.first);
+            if (saved != job.base.tables.end() && saved->second.changedAt == tablePair.second.changedAt) {
+                reused += saved->second.bytes;
+            }
+        }
+        job.incremental = job.base.fileSize && job.base.fileSize - reused <= reused;
+
+        std::shared_ptr<MappedFile> source = bufferPool.mapping();
+        SavedFile paged = source ? bufferPool.dataFile() : SavedFile();
+        for (auto& tablePair : database) {
+            Table& table = tablePair.second;
+            auto saved = job.incremental ? job.base.tables.find(table.name) : job.base.tables.end();
+            if (saved != job.base.tables.end() && saved->second.changedAt == table.changedAt) {
+                job.kept.push_back(table.name);
+            } else if (!bufferPool.isResident(table)) {
+                job.reread.push_back(paged.tables.at(table.name));
+                job.source = source;
+            } else {
+                compactRows(table); // Snapshots hold live rows only
+                if (background) {
+                    job.copies.push_back(copyDefinitions(table));
+                    job.captures.push_back(captureTable(table));
+                    job.changed.push_back(job.copies.back().get());
+                } else {
+                    job.changed.push_back(&table);
+                }
+            }
+        }
+        return job;
+    }
+
+    // Write a save on this thread; returns what the file holds, or throws
+    // if it fails
+    SavedFile save(const SaveJob& job) {
+        begin(job);
+        std::string error = write(job);
+        if (!error.empty()) throw std::runtime_error(error);
+        std::lock_guard<std::mutex> lock(mutex);
+        return last;
+    }
+
+    // Write a save on the background thread
+    void start(SaveJob job) {
+        wait();
+        begin(job);
+        worker = std::thread([this](const std::shared_ptr<SaveJob>& owned) { write(*owned); },
+                             std::make_shared<SaveJob>(std::move(job)));
+    }
+
+    SaveStatus status() {
+        std::lock_guard<std::mutex> lock(mutex);
+        SaveStatus status = current;
+        if (status.state == "running") {
+            status.tablesWritten = tablesWritten;
+            status.bytesWritten = bytesWritten;
+            status.ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - started)
+                            .count();
+        }
+        return status;
+    }
+
+private:
+    std::mutex mutex;     // Guards `current`, `started` and `last`
+    SaveStatus current;
+    std::chrono::steady_clock::time_point started;
+    std::atomic<uint64_t> bytesWritten;
+    std::atomic<size_t> tablesWritten;
+    SavedFile last;       // Changed only by the thread writing a save
+    std::thread worker;
+
+    // Whether the file saved last still holds what that save left in it
+    bool fileUnchanged() {
+        std::ifstream file(last.filename, std::ios::binary | std::ios::ate);
+        if (!file || static_cast<uint64_t>(file.tellg()) != last.fileSize) return false;
+        SnapshotHeader header;
+        file.seekg(0);
+        file.read(reinterpret_cast<char*>(&header), sizeof(header));
+        return file && std::memcmp(header.magic, kSnapshotMagic, sizeof(header.magic)) == 0 &&
+               header.fileSize == last.fileSize && header.directoryOffset == last.directoryOffset;
+    }
+
+    void begin(const SaveJob& job) {
+        std::lock_guard<std::mutex> lock(mutex);
+        current = SaveStatus();
+        current.filename = job.base.filename;
+        current.state = "running";
+        current.incremental = job.incremental;
+        current.tablesToWrite = job.changed.size() + job.reread.size();
+        current.tablesKept = job.kept.size();
+        started = std::chrono::steady_clock::now();
+        bytesWritten = 0;
+        tablesWritten = 0;
+    }
+
+    // Write a save, unless nothing changed since the last one to the file,
+    // and record the outcome; returns the error, if any
+    std::string write(const SaveJob& job) {
+        SavedFile saved;
+        std::string error;
+        try {
+            if (job.incremental && job.changed.empty() && job.reread.empty() &&
+                job.kept.size() == job.base.tables.size()) {
+                saved = job.base; // Nothing changed since
+            } else {
+                saved = writeSavedFile(job.base, job.kept, job.changed, job.captures, job.reread,
+                                       job.source.get(), job.incremental, &bytesWritten, &tablesWritten);
+            }
+        } catch (const std::exception& e) {
+            error = e.what(); // What the file holds is unknown, so the next save rewrites it
+        }
+        uint64_t copied = 0;
+        for (const auto& capture : job.captures) {
+            capture->close();
+            copied += capture->kept();
+        }
+
+        std::lock_guard<std::mutex> lock(mutex);
+        last = std::move(saved);
+        current.state = error.empty() ? "saved" : "failed";
+        current.tablesWritten = tablesWritten;
+        current.bytesWritten = bytesWritten;
+        current.bytesCopied = copied;
+        current.ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - started).count();
+        current.error = error;
+        return error;
+    }
+};
+
+extern Saver saver;
+
+// ---- Transactions ----
+extern std::mutex transactionMutex;
+extern uint64_t lastCommitStamp;
+extern uint64_t transactionCount;
+extern std::vector<uint64_t> openSnapshots;
+void startTransaction(Transaction& txn, bool explicitBegin);
+uint64_t finishTransaction(const Transaction& txn, bool explicitBegin, uint64_t* stamp);
+bool transactionsOpen();
+uint64_t oldestSnapshot();
+void collectTable(Table& table, uint64_t oldest);
+void finishWrites(const Transaction& txn, bool commit, uint64_t stamp);
+std::vector<std::string> writtenTables();
+void endSessionTransaction(bool commit);
+void collectOthers(const std::vector<std::string>& written);
+void handleBegin(std::ostream& out);
+void handleCommit(std::ostream& out);
+void handleRollback(std::ostream& out);
+
+// ---- Snapshot Reads ----
+// A SELECT in a snapshot that scans a table reads a view of it: its arrays
+// as they are, with the slots the snapshot does not see deleted, captured
+// under the table's shared lock. The statement then gives up the lock, so
+// writers to the table go on while it scans.
+std::unique_ptr<Table> captureView(Table& table);
+
+// Shared lock a SELECT holds on a table, which it trades for a view of the
+// table the first time it asks for one
+class ReadLock {
+public:
+    explicit ReadLock(Table& table) : table(table), locked(true), outer(innermost) {
+        table.lock->lock_shared();
+        innermost = this;
+    }
+    ~ReadLock() {
+        if (locked) table.lock->unlock_shared();
+        innermost = outer;
+    }
+    ReadLock(const ReadLock&) = delete;
+    ReadLock& operator=(const ReadLock&) = delete;
+
+    // The lock the running statement holds on a table, or nullptr
+    static ReadLock* held(const Table& table) {
+        for (ReadLock* lock = innermost; lock; lock = lock->outer) {
+            if (&lock->table == &table) return lock;
+        }
+        return nullptr;
+    }
+
+    bool viewed() const { return !locked; }
+
+    const Table& view() {
+        if (locked) {
+            snapshot = captureView(table);
+            table.lock->unlock_shared();
+            locked = false;
+        }
+        return *snapshot;
+    }
+
+private:
+    Table& table;
+    bool locked;
+    std::unique_ptr<Table> snapshot;
+    ReadLock* outer; // Taken before this one by the same statement
+    static thread_local ReadLock* innermost;
+};
+
+const Table& readTable(const Table& table, const Condition& cond, size_t limit = SIZE_MAX);
+
+// ---- Command Handlers ----
+bool handleCreate(const std::string& command, std::ostream& out);
+bool handleCreateIndex(const std::string& command, std::ostream& out);
+bool handleDropIndex(const std::string& command, std::ostream& out);
+std::shared_ptr<Plan> planInsert(const std::string& text, std::ostream& out);
+bool runInsert(const Plan& plan, const std::vector<std::string>& args, std::ostream& out);
+bool insertBulk(const std::string& command, std::ostream& out);
+bool handleInsert(const Statement& stmt, std::ostream& out);
+bool handleCopy(const std::string& command, std::ostream& out);
+int selectColumn(const Table& table, const std::string& name);
+
+// Column of a joined table, named `table.col` or just `col` when only one
+// of the tables has it
+struct JoinColumn {
+    int side = 0;
+    int col = -1;  // -1 for the row ID
+};
+
+bool resolveJoinColumn(const JoinSide sides[2], const std::string& name, JoinColumn& ref,
+                       std::string& error);
+
+// A join with its tables, keys, WHERE conditions and columns resolved
+struct JoinQuery {
+    JoinSide sides[2];
+    Condition where[2];  // Filters of each table before the join
+    std::vector<JoinColumn> projection;
+};
+
+std::string joinDetail(const JoinQuery& query, bool selected);
+bool parseJoin(const std::string& selectList, const std::string& source, JoinQuery& query,
+               std::ostream& out);
+void handleJoin(const std::string& selectList, const std::string& source, std::ostream& out);
+std::shared_ptr<Plan> planSelect(const std::string& text, std::ostream& out);
+bool bindOrder(const Plan& plan, const std::vector<std::string>& args, RowOrder& order);
+void runSelect(const Plan& plan, const std::vector<std::string>& args, std::ostream& out);
+void handleSelect(const Statement& stmt, std::ostream& out);
+std::shared_ptr<Plan> planDelete(const std::string& text, std::ostream& out);
+bool runDelete(const Plan& plan, const std::vector<std::string>& args, std::ostream& out);
+bool handleDelete(const Statement& stmt, std::ostream& out);
+std::shared_ptr<Plan> planUpdate(const std::string& text, std::ostream& out);
+std::string updateDetail(const Table& table, const Plan& plan);
+bool runUpdate(const Plan& plan, const std::vector<std::string>& args, std::ostream& out);
+bool handleUpdate(const Statement& stmt, std::ostream& out);
+void handleSave(const std::string& command, std::ostream& out);
+void loadLegacy(std::istream& file, const std::string& filename, TableMap& tables);
+bool loadDatabaseFile(const std::string& filename, TableMap& tables, uint64_t& logSequence);
+bool handleLoad(const std::string& command, std::ostream& out);
+bool executeWrite(const Statement& stmt, const std::string& upperCmd, bool& changed,
+                  std::ostream& out);
+void checkpoint();
+void handleCheckpoint(std::ostream& out);
+
+// Heap bytes held by a table, by what holds them. Vectors count their
+// capacity; hash index nodes are estimated from their entry counts.
+struct TableMemory {
+    size_t columns = 0;    // Row IDs, row versions and INT, zone, offset, length, code and lookup arrays
+    size_t text = 0;       // TEXT arenas
+    size_t liveText = 0;   // Bytes of current TEXT values of live rows
+    size_t indexes = 0;
+};
+
+TableMemory tableMemory(const Table& table);
+void handleShowMemory(std::ostream& out);
+void handleShowSaveStatus(std::ostream& out);
+void handleShowBufferPool(std::ostream& out);
+void handleVacuum(const std::string& command, std::ostream& out);
+void writeSteps(const std::vector<ProfileStep>& steps, const ProfileStep* total, std::ostream& out);
+void handleExplain(const std::string& command, std::ostream& out);
+void recoverDatabase(const std::string& name, SyncPolicy policy, int groupMs, std::ostream& out);
+void handleSet(const std::string& command, std::ostream& out);
+void handleMode(const std::string& command, std::ostream& out);
+void handleHelp(std::ostream& out);
+
+// ---- Statement Statistics ----
+// Counts and latency histograms per kind of statement, shared by all
+// sessions. Latency is from the start of a statement to its reply, waits
+// for locks included.
+const char* const kStatementKinds[] = {"SELECT", "INSERT", "UPDATE", "DELETE", "CREATE", "DROP",
+                                       "COPY",   "SAVE",   "LOAD",   "EXPLAIN", "OTHER"};
+const size_t kNumStatementKinds = sizeof(kStatementKinds) / sizeof(kStatementKinds[0]);
+
+// Bucket b holds latencies under 10^(b + 1) microseconds, the last the rest
+const char* const kLatencyBuckets[] = {"<10us", "<100us", "<1ms", "<10ms", "<100ms", "<1s", ">=1s"};
+const size_t kNumLatencyBuckets = sizeof(kLatencyBuckets) / sizeof(kLatencyBuckets[0]);
+
+struct StatementStats {
+    std::atomic<uint64_t> count;
+    std::atomic<uint64_t> totalMicros;
+    std::atomic<uint64_t> buckets[kNumLatencyBuckets];
+};
+
+extern StatementStats statementStats[kNumStatementKinds];
+extern thread_local bool statementTimer;
+void recordStatement(const std::string& upperCmd, double ms);
+void handleShowStats(std::ostream& out);
+void handleTimer(const std::string& command, std::ostream& out);
+
+// ---- Statement Execution ----
+bool transactionAllows(const std::string& upperCmd, std::ostream& out);
+void writeInTransaction(const Statement& stmt, const std::string& upperCmd, std::ostream& out);
+void dispatch(const Statement& stmt, const std::string& upperCmd, std::ostream& out);
+std::string statementWord(const std::string& command, size_t position,
+                          const std::string& after = "FROM");
+Planner statementPlanner(const std::string& upperCmd);
+void handlePrepare(const std::string& command, std::ostream& out);
+bool bindPrepared(const std::string& command, Statement& stmt, std::ostream& out);
+void handleDeallocate(const std::string& command, std::ostream& out);
+void runStatement(const Statement& stmt, std::ostream& out);
+void handleExplainAnalyze(const std::string& command, std::ostream& out);
+bool executeStatement(const std::string& command, std::ostream& out);
+
+// ---- Server ----
+#ifdef CRT_HAVE_SOCKETS
+extern std::atomic<bool> serverStopping;
+bool socketAddress(const std::string& address, sockaddr_storage& storage, socklen_t& length);
+int openListener(const std::string& address);
+int connectSocket(const std::string& address);
+bool sendAll(int fd, const char* data, size_t size);
+void serveSession(int fd);
+void runServer(int listenFd);
+#endif
+
+#endif // CRT_H
@@ -0,0 +1,74 @@
+// Aggregate benchmark: COUNT/SUM/MIN/MAX/AVG with and without GROUP BY over
+// a large table, timed through runAggregates so the numbers cover the group
+// table, the batch accumulation and the merge but not the scan.
+//
+// Build and run with: make bench
+
+#include "bench_util.h"
+
+#include <random>
+
+int main(int argc, char** argv) {
+    size_t numRows = argc > 1 ? std::stoul(argv[1]) : 10000000;
+
+    Table table;
+    table.name = "bench";
+    table.columns = {{"score", "INT"}, {"bucket", "INT"}, {"city", "TEXT"}};
+    table.data.resize(table.columns.size());
+    reserveRows(table, numRows);
+    std::mt19937_64 rng(7);
+    int64_t expectedSum = 0;
+    for (size_t i = 0; i < numRows; i++) {
+        int64_t score = rng() % 1000000;
+        expectedSum += score;
+        appendRow(table, {std::to_string(score), std::to_string(rng() % 100000),
+                          "city" + std::to_string(rng() % 50)},
+                  table.next_id++);
+    }
+
+    struct Query {
+        const char* list;
+        const char* group;
+    };
+    const Query queries[] = {
+        {"COUNT(*)", ""},
+        {"SUM(score), MIN(score), MAX(score), AVG(score)", ""},
+        {"city, COUNT(*), AVG(score)", "city"},
+        {"bucket, SUM(score)", "bucket"},
+    };
+
+    std::cout << "rows: " << numRows << ", threads: " << workerCount() << "\n";
+    std::cout << std::setw(50) << std::left << "select list" << std::setw(10) << "group by"
+              << "time (ms)\n";
+
+    Selection all = selectRows(table, compileCondition(table.columns, ""));
+    for (const Query& query : queries) {
+        int groupCol = columnIndex(table, query.group);
+        std::vector<Aggregate> aggregates;
+        std::string error;
+        if (!parseAggregates(table, query.list, groupCol, aggregates, error)) {
+            std::cout << "Error: " << error << "\n";
+            return 1;
+        }
+        std::ostringstream result;
+        double ms = timeMs([&] {
+            result.str("");
+            runAggregates(table, all, aggregates, groupCol, result);
+        });
+        std::cout << std::setw(50) << std::left << query.list << std::setw(10)
+                  << (query.group[0] ? query.group : "-") << std::fixed << std::setprecision(2)
+                  << ms << "\n";
+
+        if (groupCol < 0) {
+            std::string text = result.str();
+            std::string expected = std::to_string(aggregates[0].op == AggregateOp::COUNT
+                                                      ? static_cast<int64_t>(numRows)
+                                                      : expectedSum);
+            if (text.find("\n" + expected + " ") == std::string::npos) {
+                std::cout << "MISMATCH for '" << query.list << "'\n" << text;
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
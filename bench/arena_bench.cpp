@@ -0,0 +1,80 @@
+// TEXT storage benchmark: appending values to a TextArena against a
+// std::string buffer, then row-at-a-time and bulk INSERTs with the bytes
+// each table holds per byte of data. Arena contents are checked against the
+// string's.
+//
+// Build and run with: make bench
+
+#include "bench_util.h"
+
+int main(int argc, char** argv) {
+    size_t numValues = argc > 1 ? std::stoul(argv[1]) : 4000000;
+    size_t numRows = numValues / 20;
+
+    std::vector<std::string> values;
+    for (size_t i = 0; i < 1000; i++) values.push_back("value-" + std::to_string(i * 7919));
+
+    std::string string;
+    TextArena arena;
+    double stringMs = timeMs([&] {
+        std::string bytes;
+        for (size_t i = 0; i < numValues; i++) bytes.append(values[i % values.size()]);
+        string.swap(bytes);
+    });
+    double arenaMs = timeMs([&] {
+        TextArena bytes;
+        for (size_t i = 0; i < numValues; i++) bytes.append(values[i % values.size()]);
+        arena.swap(bytes);
+    });
+    if (arena.size() != string.size() || std::memcmp(arena.data(), string.data(), string.size()) != 0) {
+        std::cout << "MISMATCH between arena and string bytes\n";
+        return 1;
+    }
+
+    std::cout << "values: " << numValues << ", bytes: " << string.size() << "\n";
+    std::cout << std::setw(36) << std::left << "append" << "time (ms)\n";
+    std::cout << std::setw(36) << std::left << "std::string" << std::fixed << std::setprecision(2)
+              << stringMs << "\n";
+    std::cout << std::setw(36) << std::left << "TextArena" << arenaMs << "\n";
+
+    // Logical size: 8 bytes per INT and the row ID, plus the TEXT bytes
+    std::ostream quiet(nullptr);
+    executeStatement("CREATE TABLE single (n INT, label TEXT)", quiet);
+    executeStatement("CREATE TABLE bulk (n INT, label TEXT)", quiet);
+    std::string insert = "INSERT INTO bulk VALUES ";
+    size_t textBytes = 0;
+    for (size_t i = 0; i < numRows; i++) {
+        const std::string& label = values[i % values.size()];
+        textBytes += label.size();
+        if (i) insert += ", ";
+        insert += "(" + std::to_string(i) + ", \"" + label + "\")";
+    }
+    size_t logical = numRows * (sizeof(int64_t) + sizeof(int)) + textBytes;
+
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < numRows; i++) {
+        executeStatement("INSERT INTO single VALUES (" + std::to_string(i) + ", \"" +
+                             values[i % values.size()] + "\")", quiet);
+    }
+    double singleMs = elapsedMs(start);
+    start = std::chrono::steady_clock::now();
+    executeStatement(insert, quiet);
+    double bulkMs = elapsedMs(start);
+
+    std::cout << "rows: " << numRows << ", logical bytes: " << logical << "\n";
+    std::cout << std::setw(36) << std::left << "insert" << std::setw(14) << "time (ms)"
+              << "held / logical bytes\n";
+    const char* names[] = {"single", "bulk"};
+    double times[] = {singleMs, bulkMs};
+    for (int i = 0; i < 2; i++) {
+        const Table& table = database.find(names[i])->second;
+        if (table.rowCount() != numRows) {
+            std::cout << "MISMATCH: " << table.rowCount() << " rows in " << names[i] << "\n";
+            return 1;
+        }
+        TableMemory memory = tableMemory(table);
+        std::cout << std::setw(36) << std::left << (std::string(names[i]) + " INSERT") << std::setw(14)
+                  << times[i] << double(memory.columns + memory.text) / logical << "\n";
+    }
+    return 0;
+}
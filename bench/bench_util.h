@@ -0,0 +1,30 @@
+// Helpers shared by the benchmarks
+#ifndef CRT_BENCH_UTIL_H
+#define CRT_BENCH_UTIL_H
+
+#include "../CRT.h"
+
+inline double elapsedMs(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Best of a few runs, to keep one-off page faults out of the numbers
+template <typename Fn>
+double timeMs(Fn fn, int runs = 5) {
+    double best = 1e300;
+    for (int run = 0; run < runs; run++) {
+        auto start = std::chrono::steady_clock::now();
+        fn();
+        best = std::min(best, elapsedMs(start));
+    }
+    return best;
+}
+
+// Run one statement the way a session does and return its reply
+inline std::string run(const std::string& statement) {
+    std::ostringstream out;
+    executeStatement(statement, out);
+    return out.str();
+}
+
+#endif // CRT_BENCH_UTIL_H
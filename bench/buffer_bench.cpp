@@ -0,0 +1,203 @@
+// Buffer pool benchmark: a database of several tables runs a workload of
+// range sums and small updates in memory, then again loaded PAGED with a
+// pool that holds only a few of its tables. Most statements go to two hot
+// tables and the rest round the others, so tables are read in, evicted and
+// written back. Every reply must match the in-memory run, the data file
+// must stay within the bound its rewrites keep it to, and a scan must
+// stream through a table larger than a 1 MB pool, holding no more of its
+// pages than that. The paged database must load back the same after saves
+// to another file and to its data file.
+//
+// Build and run with: make bench
+
+#include "bench_util.h"
+
+#include <cstdio>
+
+// Sum of `score` in every table, in a fixed order
+static std::string sums(size_t numTables) {
+    std::string all;
+    for (size_t t = 0; t < numTables; t++) all += run("SELECT COUNT(*), SUM(score) FROM t" + std::to_string(t));
+    return all;
+}
+
+// The workload's statements: four in five go to t0 or t1, the rest round
+// the other tables; one in six is an UPDATE
+static std::vector<std::string> workload(size_t numTables, size_t numRows, size_t count) {
+    std::vector<std::string> statements;
+    for (size_t i = 0; i < count; i++) {
+        size_t t = i % 5 < 4 ? i % 2 : 2 + (i / 5) % (numTables - 2);
+        std::string name = "t" + std::to_string(t);
+        size_t lo = (i * 7919) % numRows;
+        if (i % 6 == 5) {
+            statements.push_back("UPDATE " + name + " SET score = " + std::to_string(i) + " WHERE key BETWEEN " +
+                                 std::to_string(lo) + " AND " + std::to_string(lo + 99));
+        } else {
+            statements.push_back("SELECT COUNT(*), SUM(score) FROM " + name + " WHERE key >= " +
+                                 std::to_string(lo) + " AND key < " + std::to_string(lo + numRows / 10));
+        }
+    }
+    return statements;
+}
+
+static uint64_t fileBytes(const std::string& file) {
+    std::ifstream in(file, std::ios::binary | std::ios::ate);
+    return in ? static_cast<uint64_t>(in.tellg()) : 0;
+}
+
+// Load `file` and check that its tables hold what `expected` says
+static bool loadsBack(const std::string& load, size_t numTables, const std::string& expected, const char* what) {
+    std::string reply = run(load);
+    if (reply.find("successfully") == std::string::npos || sums(numTables) != expected) {
+        std::cout << "MISMATCH: " << what << " did not load back: " << reply;
+        return false;
+    }
+    return true;
+}
+
+int main(int argc, char** argv) {
+    size_t numTables = argc > 1 ? std::stoul(argv[1]) : 8;
+    size_t numRows = argc > 2 ? std::stoul(argv[2]) : 300000;
+    size_t numStatements = argc > 3 ? std::stoul(argv[3]) : 400;
+    const std::string file = "buffer_bench.db";
+    const std::string other = "buffer_bench_other.db";
+
+    std::ostream quiet(nullptr);
+    executeStatement(".mode csv", quiet);
+    for (size_t t = 0; t < numTables; t++) {
+        std::string name = "t" + std::to_string(t);
+        executeStatement("CREATE TABLE " + name + " (key INT, score INT, name TEXT)", quiet);
+        for (size_t first = 0; first < numRows; first += 10000) {
+            std::string insert = "INSERT INTO " + name + " VALUES ";
+            for (size_t i = first; i < std::min(numRows, first + 10000); i++) {
+                if (i > first) insert += ", ";
+                insert += "(" + std::to_string(i) + ", " + std::to_string((i * 7919) % 1000) + ", \"name" +
+                          std::to_string(i) + "\")";
+            }
+            executeStatement(insert, quiet);
+        }
+        executeStatement("CREATE INDEX " + name + "_key ON " + name + "(key)", quiet);
+    }
+    run("SAVE " + file);
+    uint64_t savedBytes = fileBytes(file);
+
+    // A pool of three and a half tables: the hot two stay, the others take turns
+    size_t tableBytes = heldBytes(database.find("t0")->second);
+    size_t poolMb = std::max<size_t>(1, (7 * tableBytes / 2) >> 20);
+    std::vector<std::string> statements = workload(numTables, numRows, numStatements);
+
+    std::vector<std::string> expected;
+    auto start = std::chrono::steady_clock::now();
+    for (const auto& statement : statements) expected.push_back(run(statement));
+    double memoryMs = elapsedMs(start);
+    std::string expectedSums = sums(numTables);
+    const std::string scan = "SELECT COUNT(*), SUM(score) FROM t2 WHERE score >= 0";
+    std::string expectedScan = run(scan);
+
+    run("LOAD " + file);
+    run("SET buffer_pool = " + std::to_string(poolMb));
+    std::string reply = run("LOAD " + file + " PAGED");
+    if (reply.find("paged in") == std::string::npos) {
+        std::cout << "MISMATCH: LOAD PAGED replied " << reply;
+        return 1;
+    }
+    start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < statements.size(); i++) {
+        reply = run(statements[i]);
+        if (reply != expected[i]) {
+            std::cout << "MISMATCH: '" << statements[i] << "' replied " << reply << "in memory: " << expected[i];
+            return 1;
+        }
+    }
+    double pagedMs = elapsedMs(start);
+    uint64_t pagedBytes = fileBytes(file);
+
+    uint64_t loads = 0, evictions = 0, hotLoads = 0, morselReads = 0, morselDrops = 0;
+    for (const Frame& frame : bufferPool.frameList()) {
+        loads += frame.loads;
+        evictions += frame.evictions;
+        morselReads += frame.morselReads;
+        morselDrops += frame.morselDrops;
+        if (frame.table->name == "t0" || frame.table->name == "t1") hotLoads += frame.loads;
+    }
+
+    std::cout << "tables: " << numTables << ", rows per table: " << numRows << ", table bytes: " << tableBytes
+              << ", pool: " << poolMb << " MB, threads: " << workerCount() << "\n";
+    std::cout << std::setw(24) << std::left << "run" << std::setw(16) << "statements" << std::setw(16)
+              << "total (ms)" << std::setw(16) << "loads" << std::setw(16) << "hot loads" << std::setw(16)
+              << "evictions" << std::setw(16) << "morsel reads" << "morsel drops\n";
+    std::cout << std::setw(24) << std::left << "in memory" << std::setw(16) << statements.size()
+              << std::setw(16) << std::fixed << std::setprecision(2) << memoryMs << std::setw(16) << 0
+              << std::setw(16) << 0 << std::setw(16) << 0 << std::setw(16) << 0 << 0 << "\n";
+    std::cout << std::setw(24) << std::left << "paged" << std::setw(16) << statements.size() << std::setw(16)
+              << pagedMs << std::setw(16) << loads << std::setw(16) << hotLoads << std::setw(16) << evictions
+              << std::setw(16) << morselReads << morselDrops << "\n";
+    if (evictions == 0) {
+        std::cout << "MISMATCH: a pool of " << poolMb << " MB evicted nothing\n";
+        return 1;
+    }
+
+    // Write-backs append until more of the data file would be unreferenced
+    // than reused, and then rewrite it, so it stays within about twice the
+    // tables and one more written back
+    std::cout << "data file: " << savedBytes << " bytes saved, " << pagedBytes << " after the paged run\n";
+    if (pagedBytes > 3 * savedBytes) {
+        std::cout << "MISMATCH: write-backs grew the data file from " << savedBytes << " to " << pagedBytes
+                  << " bytes\n";
+        return 1;
+    }
+
+    // A scan of a table larger than the pool gives back the pages of the
+    // morsels behind it
+    run("SET buffer_pool = 1");
+    start = std::chrono::steady_clock::now();
+    reply = run(scan);
+    double scanMs = elapsedMs(start);
+    size_t heldPages = 0;
+    uint64_t scanReads = 0, scanDrops = 0;
+    for (const Frame& frame : bufferPool.frameList()) {
+        heldPages += frame.pagedBytes;
+        if (frame.table->name == "t2") {
+            scanReads = frame.morselReads;
+            scanDrops = frame.morselDrops;
+        }
+    }
+    std::cout << "scan of t2 in a 1 MB pool: " << scanMs << " ms, " << scanReads << " morsel reads, " << scanDrops
+              << " drops, " << heldPages << " bytes of pages held\n";
+    if (reply != expectedScan) {
+        std::cout << "MISMATCH: '" << scan << "' in a 1 MB pool replied " << reply << "in memory: " << expectedScan;
+        return 1;
+    }
+    if (heldPages > (size_t(1) << 20) || scanDrops == 0) {
+        std::cout << "MISMATCH: a scan in a 1 MB pool held " << heldPages << " bytes of pages\n";
+        return 1;
+    }
+    run("SET buffer_pool = " + std::to_string(poolMb));
+
+    // Evicted tables are read back from the data file by a save elsewhere;
+    // a save to the data file writes only the tables changed since, by the same rule
+    start = std::chrono::steady_clock::now();
+    run("SAVE ASYNC " + other);
+    saver.wait();
+    double otherMs = elapsedMs(start);
+    if (saver.status().state != "saved") {
+        std::cout << "MISMATCH: SAVE ASYNC to another file " << saver.status().state << ": "
+                  << saver.status().error << "\n";
+        return 1;
+    }
+    start = std::chrono::steady_clock::now();
+    run("SAVE " + file);
+    double dataMs = elapsedMs(start);
+    SaveStatus status = saver.status();
+    std::cout << "SAVE ASYNC elsewhere: " << otherMs << " ms; SAVE to the data file: " << dataMs << " ms, "
+              << status.tablesWritten << " table(s) written, " << status.tablesKept << " kept\n";
+
+    if (!loadsBack("LOAD " + other, numTables, expectedSums, "SAVE ASYNC elsewhere")) return 1;
+    if (!loadsBack("LOAD " + file, numTables, expectedSums, "SAVE to the data file")) return 1;
+    if (!loadsBack("LOAD " + file + " PAGED", numTables, expectedSums, "LOAD PAGED")) return 1;
+
+    run("LOAD " + other); // Releases the data file
+    std::remove(file.c_str());
+    std::remove(other.c_str());
+    return 0;
+}
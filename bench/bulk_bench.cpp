@@ -0,0 +1,72 @@
+// Bulk load benchmark: one INSERT per row against a multi-row INSERT and a
+// COPY from CSV, which parse their input in parallel chunks and append in
+// batches. Console output is discarded while timing.
+//
+// Build and run with: make bench
+
+#include "bench_util.h"
+
+static std::ostream quiet(nullptr);
+
+static void resetTable() {
+    database.clear();
+    handleCreate("CREATE TABLE bench (name TEXT, age INT, city TEXT)", quiet);
+}
+
+int main(int argc, char** argv) {
+    size_t numRows = argc > 1 ? std::stoul(argv[1]) : 2000000;
+    size_t numSingle = std::min<size_t>(numRows, 100000);
+    const std::string csvFile = "bulk_bench.csv";
+
+    std::string tuples, csv;
+    std::vector<std::string> inserts;
+    for (size_t i = 0; i < numRows; i++) {
+        std::string name = "user" + std::to_string(i);
+        std::string age = std::to_string(i % 100);
+        std::string city = "city" + std::to_string(i % 7);
+        std::string tuple = "(\"" + name + "\", " + age + ", \"" + city + "\")";
+        if (i < numSingle) inserts.push_back("INSERT INTO bench VALUES " + tuple);
+        tuples += (i ? ", " : "") + tuple;
+        csv += name + "," + age + "," + city + "\n";
+    }
+    std::ofstream(csvFile, std::ios::binary) << csv;
+    std::string multiInsert = "INSERT INTO bench VALUES " + tuples;
+
+    resetTable();
+    auto start = std::chrono::steady_clock::now();
+    for (const auto& insert : inserts) handleInsert(insert, quiet);
+    double singleMs = elapsedMs(start);
+    size_t singleRows = database["bench"].rowCount();
+
+    resetTable();
+    start = std::chrono::steady_clock::now();
+    handleInsert(multiInsert, quiet);
+    double multiMs = elapsedMs(start);
+    size_t multiRows = database["bench"].rowCount();
+
+    resetTable();
+    start = std::chrono::steady_clock::now();
+    handleCopy("COPY bench FROM '" + csvFile + "'", quiet);
+    double copyMs = elapsedMs(start);
+    size_t copyRows = database["bench"].rowCount();
+
+    std::remove(csvFile.c_str());
+
+    if (singleRows != numSingle || multiRows != numRows || copyRows != numRows ||
+        getValue(database["bench"], 0, numRows - 1) != "user" + std::to_string(numRows - 1)) {
+        std::cout << "MISMATCH: " << singleRows << ", " << multiRows << ", " << copyRows << " rows\n";
+        return 1;
+    }
+
+    std::cout << "threads: " << workerCount() << "\n";
+    std::cout << std::setw(20) << std::left << "method" << std::setw(12) << "rows"
+              << std::setw(14) << "time (ms)" << "rows/s\n";
+    std::cout << std::fixed;
+    std::cout << std::setw(20) << "INSERT per row" << std::setw(12) << numSingle << std::setw(14)
+              << std::setprecision(2) << singleMs << std::setprecision(0) << numSingle / (singleMs / 1000) << "\n";
+    std::cout << std::setw(20) << "multi-row INSERT" << std::setw(12) << numRows << std::setw(14)
+              << std::setprecision(2) << multiMs << std::setprecision(0) << numRows / (multiMs / 1000) << "\n";
+    std::cout << std::setw(20) << "COPY" << std::setw(12) << numRows << std::setw(14)
+              << std::setprecision(2) << copyMs << std::setprecision(0) << numRows / (copyMs / 1000) << "\n";
+    return 0;
+}
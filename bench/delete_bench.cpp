@@ -0,0 +1,80 @@
+// DELETE benchmark: single-row deletes through an index on a large table,
+// compacting the columns on every delete against marking rows deleted and
+// compacting once with VACUUM. The surviving rows of both tables are checked
+// against each other, along with an index lookup of every deleted key.
+//
+// Build and run with: make bench
+
+#include "bench_util.h"
+
+static void fill(Table& table, size_t numRows) {
+    table.name = "bench";
+    table.columns = {{"key", "INT"}, {"score", "INT"}, {"name", "TEXT"}};
+    table.data.resize(table.columns.size());
+    reserveRows(table, numRows);
+    for (size_t i = 0; i < numRows; i++) {
+        appendRow(table, {std::to_string(i), std::to_string(i % 1000), "name" + std::to_string(i)},
+                  table.next_id++);
+    }
+    Index index;
+    index.name = "bench_key";
+    index.colIndex = 0;
+    index.kind = IndexKind::HASH;
+    rebuildIndex(table, index);
+    table.indexes.push_back(std::move(index));
+}
+
+int main(int argc, char** argv) {
+    size_t numRows = argc > 1 ? std::stoul(argv[1]) : 2000000;
+    size_t numDeletes = 200;
+
+    Table eager, tombstoned;
+    fill(eager, numRows);
+    fill(tombstoned, numRows);
+
+    std::vector<Condition> deletes;
+    for (size_t i = 0; i < numDeletes; i++) {
+        deletes.push_back(compileCondition(eager.columns, "key = " + std::to_string((i * 7919) % numRows)));
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    for (const auto& cond : deletes) {
+        deleteRows(eager, toBitmap(selectRows(eager, cond), eager.rowCount()));
+        compactRows(eager);
+    }
+    double eagerMs = elapsedMs(start);
+
+    start = std::chrono::steady_clock::now();
+    for (const auto& cond : deletes) {
+        deleteRows(tombstoned, toBitmap(selectRows(tombstoned, cond), tombstoned.rowCount()));
+    }
+    double tombstoneMs = elapsedMs(start);
+
+    // Scans skip the deleted rows before and after compaction
+    Condition all = compileCondition(eager.columns, "");
+    Condition some = compileCondition(eager.columns, "score < 500");
+    size_t expected = countSelected(scanRows(eager, some));
+    bool same = countSelected(scanRows(tombstoned, all)) == numRows - numDeletes &&
+                countSelected(scanRows(tombstoned, some)) == expected;
+
+    start = std::chrono::steady_clock::now();
+    size_t vacuumed = compactRows(tombstoned);
+    double vacuumMs = elapsedMs(start);
+
+    same = same && vacuumed == numDeletes && tombstoned.ids == eager.ids &&
+           countSelected(scanRows(tombstoned, some)) == expected;
+    for (const auto& cond : deletes) same = same && countSelected(selectRows(tombstoned, cond)) == 0;
+    if (!same) {
+        std::cout << "MISMATCH between eager and tombstoned deletes\n";
+        return 1;
+    }
+
+    std::cout << "rows: " << numRows << ", deletes: " << numDeletes << ", threads: " << workerCount() << "\n";
+    std::cout << std::setw(36) << std::left << "delete" << "per delete (ms)\n";
+    std::cout << std::setw(36) << std::left << "compact every delete" << std::fixed << std::setprecision(4)
+              << eagerMs / numDeletes << "\n";
+    std::cout << std::setw(36) << std::left << "mark deleted" << tombstoneMs / numDeletes << "\n";
+    std::cout << std::setw(36) << std::left << "VACUUM afterwards (total ms)" << std::setprecision(2)
+              << vacuumMs << "\n";
+    return 0;
+}
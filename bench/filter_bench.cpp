@@ -0,0 +1,84 @@
+// INT filter kernel benchmark: the per-row predicate path against the scalar
+// and SIMD selection-bitmap kernels, sweeping selectivity from 0.1% to 100%.
+//
+// Build and run with: make bench
+
+#include "bench_util.h"
+
+#include <chrono>
+#include <random>
+
+int main(int argc, char** argv) {
+    size_t numRows = argc > 1 ? std::stoul(argv[1]) : 4000000;
+    const int64_t range = 1000000;
+
+    Table table;
+    table.name = "bench";
+    table.columns = {{"score", "INT"}};
+    table.data.resize(1);
+    std::mt19937_64 rng(42);
+    table.data[0].ints.reserve(numRows);
+    table.ids.reserve(numRows);
+    for (size_t i = 0; i < numRows; i++) {
+        table.data[0].ints.push_back(static_cast<int64_t>(rng() % range));
+        table.ids.push_back(table.next_id++);
+    }
+    const int64_t* values = table.data[0].ints.data();
+
+    std::vector<FilterKernelInfo> kernels = {{filterIntScalar, "scalar"}};
+#ifdef CRT_X86_KERNELS
+    if (__builtin_cpu_supports("sse4.2")) kernels.push_back({filterIntSse42, "sse4.2"});
+    if (__builtin_cpu_supports("avx2")) kernels.push_back({filterIntAvx2, "avx2"});
+#endif
+
+    // Every kernel must agree with the scalar one for every operator
+    const CompareOp ops[] = {CompareOp::EQ, CompareOp::NE, CompareOp::GT,
+                             CompareOp::LT, CompareOp::GE, CompareOp::LE};
+    size_t oddCount = numRows - 3; // exercise the partial last word
+    Bitmap expected(bitmapWords(oddCount)), actual(bitmapWords(oddCount));
+    for (CompareOp op : ops) {
+        filterIntScalar(values, oddCount, op, values[7], expected.data());
+        for (const auto& k : kernels) {
+            k.kernel(values, oddCount, op, values[7], actual.data());
+            if (actual != expected) {
+                std::cout << "MISMATCH: kernel " << k.name << "\n";
+                return 1;
+            }
+        }
+    }
+
+    std::cout << "rows: " << numRows << ", dispatched kernel: " << filterKernel.name << "\n";
+    std::cout << std::setw(14) << std::left << "selectivity" << std::setw(14) << "per-row (ms)";
+    for (const auto& k : kernels) std::cout << std::setw(14) << (std::string(k.name) + " (ms)");
+    std::cout << "matches\n";
+
+    const double selectivities[] = {0.001, 0.01, 0.1, 0.25, 0.5, 0.75, 1.0};
+    Bitmap bitmap(bitmapWords(numRows));
+    for (double selectivity : selectivities) {
+        std::string condition = "score < " + std::to_string(static_cast<int64_t>(selectivity * range));
+        Condition cond = compileCondition(table.columns, condition);
+        const Predicate& pred = cond.pred;
+
+        size_t perRowMatches = 0;
+        double perRowMs = timeMs([&]() {
+            perRowMatches = 0;
+            for (size_t slot = 0; slot < numRows; slot++) {
+                if (evaluateCondition(table, slot, pred)) perRowMatches++;
+            }
+        });
+
+        std::cout << std::setw(14) << std::left << (std::to_string(selectivity * 100).substr(0, 5) + "%")
+                  << std::setw(14) << std::fixed << std::setprecision(2) << perRowMs;
+        for (const auto& k : kernels) {
+            double ms = timeMs([&]() { k.kernel(values, numRows, pred.op, pred.number, bitmap.data()); });
+            if (countSelected(bitmap) != perRowMatches) {
+                std::cout << "\nMISMATCH: kernel " << k.name << " at " << condition << "\n";
+                return 1;
+            }
+            std::cout << std::setw(14) << ms;
+        }
+        std::cout << perRowMatches << "\n";
+    }
+
+    return 0;
+}
@@ -0,0 +1,72 @@
+// Hash join benchmark: a large fact table joined to a small dimension table
+// on an INT key and on a TEXT key, and two equal-sized tables on the row ID.
+// Match counts are checked against the counts implied by the data.
+//
+// Build and run with: make bench
+
+#include "bench_util.h"
+
+#include <random>
+
+static Table makeTable(const std::string& name, size_t numRows, size_t numKeys, uint64_t seed) {
+    Table table;
+    table.name = name;
+    table.columns = {{"key", "INT"}, {"label", "TEXT"}};
+    table.data.resize(table.columns.size());
+    reserveRows(table, numRows);
+    std::mt19937_64 rng(seed);
+    for (size_t i = 0; i < numRows; i++) {
+        size_t key = numKeys ? rng() % numKeys : i;
+        appendRow(table, {std::to_string(key), "label" + std::to_string(key)}, table.next_id++);
+    }
+    return table;
+}
+
+int main(int argc, char** argv) {
+    size_t numRows = argc > 1 ? std::stoul(argv[1]) : 2000000;
+    size_t numKeys = 20000;
+
+    Table facts = makeTable("facts", numRows, numKeys, 7);
+    Table dims = makeTable("dims", numKeys, 0, 11);
+    Table twins = makeTable("twins", numRows, 0, 13);
+
+    struct Case {
+        const char* name;
+        const Table* left;
+        int leftKey;
+        const Table* right;
+        int rightKey;
+    };
+    const Case cases[] = {
+        {"facts.key = dims.key", &facts, 0, &dims, 0},
+        {"facts.label = dims.label", &facts, 1, &dims, 1},
+        {"facts.id = twins.id", &facts, -1, &twins, -1},
+    };
+
+    std::cout << "rows: " << numRows << ", dimension rows: " << numKeys
+              << ", threads: " << workerCount() << "\n";
+    std::cout << std::setw(30) << std::left << "join" << std::setw(14) << "time (ms)" << "matches\n";
+
+    for (const Case& c : cases) {
+        JoinSide sides[2];
+        sides[0].table = c.left;
+        sides[0].keyCol = c.leftKey;
+        sides[0].selection = selectRows(*c.left, compileCondition(c.left->columns, ""));
+        sides[1].table = c.right;
+        sides[1].keyCol = c.rightKey;
+        sides[1].selection = selectRows(*c.right, compileCondition(c.right->columns, ""));
+
+        size_t numMatches = 0;
+        double ms = timeMs([&] {
+            numMatches = 0;
+            for (const auto& part : hashJoin(sides)) numMatches += part.size();
+        });
+        if (numMatches != numRows) {
+            std::cout << "MISMATCH for " << c.name << ": " << numMatches << " matches\n";
+            return 1;
+        }
+        std::cout << std::setw(30) << std::left << c.name << std::setw(14) << std::fixed
+                  << std::setprecision(2) << ms << numMatches << "\n";
+    }
+    return 0;
+}
@@ -0,0 +1,90 @@
+// Result output benchmark: SELECT * over a large table in each output mode,
+// against the per-value iostream formatting it replaced. Output goes to a
+// stream that only counts bytes, as a terminal or socket would take it. The
+// table mode is checked byte for byte against the iostream output.
+//
+// Build and run with: make bench
+
+#include "bench_util.h"
+
+#include <random>
+
+// Stream buffer that counts and drops what is written
+class CountingBuffer : public std::streambuf {
+public:
+    size_t count = 0;
+
+protected:
+    std::streamsize xsputn(const char*, std::streamsize n) override {
+        count += n;
+        return n;
+    }
+    int overflow(int c) override {
+        count++;
+        return c;
+    }
+};
+
+// The previous formatting: std::setw per value
+static void formatWithStreams(const Table& table, std::ostream& out) {
+    out << "ID\t";
+    for (auto& col : table.columns) out << std::setw(15) << std::left << col.name;
+    out << "\n" << std::string(80, '-') << "\n";
+    for (size_t slot = 0; slot < table.rowCount(); slot++) {
+        out << table.ids[slot] << "\t";
+        for (size_t col = 0; col < table.columns.size(); col++) {
+            out << std::setw(15) << std::left << getValue(table, col, slot);
+        }
+        out << "\n";
+    }
+    out << table.rowCount() << " row(s) returned.\n";
+}
+
+int main(int argc, char** argv) {
+    size_t numRows = argc > 1 ? std::stoul(argv[1]) : 1000000;
+
+    Table& table = database["bench"];
+    table.name = "bench";
+    table.columns = {{"score", "INT"}, {"city", "TEXT"}, {"visits", "INT"}};
+    table.data.resize(table.columns.size());
+    reserveRows(table, numRows);
+    std::mt19937_64 rng(7);
+    for (size_t i = 0; i < numRows; i++) {
+        appendRow(table, {std::to_string(rng() % 1000000), "city" + std::to_string(rng() % 50),
+                          std::to_string(rng() % 100)},
+                  table.next_id++);
+    }
+
+    std::cout << "rows: " << numRows << ", threads: " << workerCount() << "\n";
+    std::cout << std::setw(20) << std::left << "output" << std::setw(14) << "time (ms)" << "bytes\n";
+
+    std::ostringstream expected, actual;
+    formatWithStreams(table, expected);
+    handleSelect("SELECT * FROM bench", actual);
+    if (actual.str() != expected.str()) {
+        std::cout << "MISMATCH between table output and iostream output\n";
+        return 1;
+    }
+
+    CountingBuffer counter;
+    std::ostream out(&counter);
+    double ms = timeMs([&] {
+        counter.count = 0;
+        formatWithStreams(table, out);
+    }, 3);
+    std::cout << std::setw(20) << std::left << "iostream table" << std::setw(14) << std::fixed
+              << std::setprecision(2) << ms << counter.count << "\n";
+
+    const OutputMode modes[] = {OutputMode::TABLE, OutputMode::CSV, OutputMode::TSV, OutputMode::BINARY};
+    const char* names[] = {"table", "csv", "tsv", "binary"};
+    for (int i = 0; i < 4; i++) {
+        outputMode = modes[i];
+        ms = timeMs([&] {
+            counter.count = 0;
+            handleSelect("SELECT * FROM bench", out);
+        }, 3);
+        std::cout << std::setw(20) << std::left << names[i] << std::setw(14) << std::fixed
+                  << std::setprecision(2) << ms << counter.count << "\n";
+    }
+    return 0;
+}
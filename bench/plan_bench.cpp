@@ -0,0 +1,82 @@
+// Plan cache benchmark: point SELECTs and UPDATEs through an index, each
+// with a different literal, run with the plan cache off, with it on, and as
+// EXECUTE of a prepared statement. The replies of the three are checked
+// against each other.
+//
+// Build and run with: make bench
+
+#include "bench_util.h"
+
+// Run the statements, returning the time taken and the replies
+static double run(const std::vector<std::string>& statements, std::string& replies) {
+    std::ostringstream out;
+    auto start = std::chrono::steady_clock::now();
+    for (const auto& statement : statements) executeStatement(statement, out);
+    double ms = elapsedMs(start);
+    replies = out.str();
+    return ms;
+}
+
+int main(int argc, char** argv) {
+    size_t numRows = argc > 1 ? std::stoul(argv[1]) : 100000;
+    size_t numStatements = 50000;
+
+    std::ostream quiet(nullptr);
+    executeStatement("CREATE TABLE bench (key INT, name TEXT, score INT)", quiet);
+    std::string insert = "INSERT INTO bench VALUES ";
+    for (size_t i = 0; i < numRows; i++) {
+        if (i) insert += ", ";
+        insert += "(" + std::to_string(i) + ", \"name" + std::to_string(i) + "\", 0)";
+    }
+    executeStatement(insert, quiet);
+    executeStatement("CREATE INDEX bench_key ON bench(key)", quiet);
+    executeStatement("PREPARE point AS SELECT name, score FROM bench WHERE key = ?", quiet);
+    executeStatement("PREPARE bump AS UPDATE bench SET score = ? WHERE key = ?", quiet);
+
+    struct Case {
+        const char* name;
+        std::string (*statement)(size_t key);
+        std::string (*execute)(size_t key);
+    };
+    const Case cases[] = {
+        {"SELECT name, score ... WHERE key = N",
+         [](size_t key) { return "SELECT name, score FROM bench WHERE key = " + std::to_string(key); },
+         [](size_t key) { return "EXECUTE point(" + std::to_string(key) + ")"; }},
+        {"UPDATE bench SET score = M WHERE key = N",
+         [](size_t key) {
+             return "UPDATE bench SET score = " + std::to_string(key % 7) +
+                    " WHERE key = " + std::to_string(key);
+         },
+         [](size_t key) { return "EXECUTE bump(" + std::to_string(key % 7) + ", " + std::to_string(key) + ")"; }},
+    };
+
+    std::cout << "rows: " << numRows << ", statements: " << numStatements << "\n";
+    std::cout << std::setw(44) << std::left << "statement" << std::setw(16) << "uncached (us)"
+              << std::setw(14) << "cached (us)" << "execute (us)\n";
+
+    for (const auto& c : cases) {
+        std::vector<std::string> statements, executes;
+        for (size_t i = 0; i < numStatements; i++) {
+            size_t key = (i * 7919) % numRows;
+            statements.push_back(c.statement(key));
+            executes.push_back(c.execute(key));
+        }
+
+        std::string uncachedReplies, cachedReplies, executeReplies;
+        planCache.setCapacity(0);
+        double uncachedMs = run(statements, uncachedReplies);
+        planCache.setCapacity(1024);
+        double cachedMs = run(statements, cachedReplies);
+        double executeMs = run(executes, executeReplies);
+
+        if (cachedReplies != uncachedReplies || executeReplies != uncachedReplies) {
+            std::cout << "MISMATCH for " << c.name << "\n";
+            return 1;
+        }
+        double perStatement = 1000.0 / numStatements;
+        std::cout << std::setw(44) << std::left << c.name << std::setw(16) << std::fixed
+                  << std::setprecision(2) << uncachedMs * perStatement << std::setw(14)
+                  << cachedMs * perStatement << executeMs * perStatement << "\n";
+    }
+    return 0;
+}
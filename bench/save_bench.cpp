@@ -0,0 +1,122 @@
+// Save benchmark: a database of several tables is saved whole, then with
+// SAVE ASYNC while point lookups and updates keep running, then
+// incrementally after one table changes. Reports how long each save holds
+// up statements, the bytes it writes and the bytes SAVE ASYNC copied for
+// rows changed before it wrote them. Every file is loaded back and its
+// sums checked against the database as the save statement saw it.
+//
+// Build and run with: make bench
+
+#include "bench_util.h"
+
+#include <cstdio>
+
+// Sum of `column` in every table, in a fixed order
+static std::string sums(size_t numTables) {
+    std::string all;
+    for (size_t t = 0; t < numTables; t++) all += run("SELECT COUNT(*), SUM(score) FROM t" + std::to_string(t));
+    return all;
+}
+
+// Load `file` and check that its tables hold what `expected` says; the
+// database is left as loaded
+static bool loadsBack(const std::string& file, size_t numTables, const std::string& expected,
+                      const char* what) {
+    std::string reply = run("LOAD " + file);
+    if (reply.find("successfully") == std::string::npos || sums(numTables) != expected) {
+        std::cout << "MISMATCH: " << what << " did not load back: " << reply;
+        return false;
+    }
+    return true;
+}
+
+int main(int argc, char** argv) {
+    size_t numTables = argc > 1 ? std::stoul(argv[1]) : 8;
+    size_t numRows = argc > 2 ? std::stoul(argv[2]) : 500000;
+    const std::string file = "save_bench.db";
+
+    std::ostream quiet(nullptr);
+    executeStatement(".mode csv", quiet);
+    for (size_t t = 0; t < numTables; t++) {
+        std::string name = "t" + std::to_string(t);
+        executeStatement("CREATE TABLE " + name + " (key INT, score INT, name TEXT)", quiet);
+        for (size_t first = 0; first < numRows; first += 10000) {
+            std::string insert = "INSERT INTO " + name + " VALUES ";
+            for (size_t i = first; i < std::min(numRows, first + 10000); i++) {
+                if (i > first) insert += ", ";
+                insert += "(" + std::to_string(i) + ", " + std::to_string((i * 7919) % 1000) + ", \"name" +
+                          std::to_string(i) + "\")";
+            }
+            executeStatement(insert, quiet);
+        }
+        executeStatement("CREATE INDEX " + name + "_key ON " + name + "(key)", quiet);
+    }
+    std::string expected = sums(numTables);
+
+    std::cout << "tables: " << numTables << ", rows per table: " << numRows << ", threads: " << workerCount()
+              << "\n";
+    std::cout << std::setw(36) << std::left << "save" << std::setw(16) << "stall (ms)" << std::setw(16)
+              << "total (ms)" << std::setw(16) << "bytes" << std::setw(16) << "copied" << std::setw(16)
+              << "lookups during" << "updates during\n";
+    auto report = [&](const char* name, double stallMs, size_t lookups, size_t updates) {
+        SaveStatus status = saver.status();
+        std::cout << std::setw(36) << std::left << name << std::setw(16) << std::fixed << std::setprecision(2)
+                  << stallMs << std::setw(16) << status.ms << std::setw(16) << status.bytesWritten << std::setw(16)
+                  << status.bytesCopied << std::setw(16) << lookups << updates << "\n";
+    };
+
+    // A synchronous save holds every statement for the whole write
+    auto start = std::chrono::steady_clock::now();
+    run("SAVE " + file);
+    report("SAVE (full)", elapsedMs(start), 0, 0);
+    if (!loadsBack(file, numTables, expected, "SAVE")) return 1;
+
+    // A background save holds statements only while it captures the tables,
+    // which copies no rows; lookups and updates run until it is done, and
+    // the last table is emptied. The file is removed first, so it rewrites
+    // every table.
+    std::remove(file.c_str());
+    start = std::chrono::steady_clock::now();
+    run("SAVE ASYNC " + file);
+    double stallMs = elapsedMs(start);
+    run("DELETE FROM t" + std::to_string(numTables - 1));
+    size_t lookups = 0, updates = 0;
+    while (saver.running()) {
+        size_t lo = (lookups * 104729) % numRows;
+        std::string key = std::to_string(lo);
+        if (run("SELECT name FROM t0 WHERE key = " + key).find("name" + key) == std::string::npos) {
+            std::cout << "MISMATCH: lookup of " << key << " during SAVE ASYNC\n";
+            return 1;
+        }
+        if (lookups++ % 8 == 0) {
+            run("UPDATE t" + std::to_string(updates % numTables) + " SET score = 0 WHERE key BETWEEN " + key +
+                " AND " + std::to_string(lo + 99));
+            updates++;
+        }
+    }
+    report("SAVE ASYNC (full)", stallMs, lookups, updates);
+    if (saver.status().state != "saved" || !loadsBack(file, numTables, expected, "SAVE ASYNC")) return 1;
+
+    // Loading gave every table a new stamp, so this save rewrites them all;
+    // after one table changes, the next writes only that one
+    run("SAVE " + file);
+    std::string reply = run("UPDATE t1 SET score = 0 WHERE key < 1000");
+    if (reply.find("1000 row(s) updated") == std::string::npos) {
+        std::cout << "MISMATCH: UPDATE replied " << reply;
+        return 1;
+    }
+    expected = sums(numTables);
+    start = std::chrono::steady_clock::now();
+    run("SAVE " + file);
+    report("SAVE (1 table changed)", elapsedMs(start), 0, 0);
+    SaveStatus status = saver.status();
+    if (!status.incremental || status.tablesWritten != 1 || status.tablesKept != numTables - 1) {
+        std::cout << "MISMATCH: incremental SAVE wrote " << status.tablesWritten << " table(s), kept "
+                  << status.tablesKept << "\n";
+        return 1;
+    }
+    if (!loadsBack(file, numTables, expected, "incremental SAVE")) return 1;
+
+    std::remove(file.c_str());
+    return 0;
+}
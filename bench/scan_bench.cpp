@@ -0,0 +1,51 @@
+// Parallel scan benchmark: filtered scans split into morsels on the
+// work-stealing pool, at 1 thread and doubling up to the hardware count (at
+// least 8). Every run is checked against the single-threaded result.
+//
+// Build and run with: make bench
+
+#include "bench_util.h"
+
+#include <random>
+
+int main(int argc, char** argv) {
+    size_t numRows = argc > 1 ? std::stoul(argv[1]) : 4000000;
+
+    Table table;
+    table.name = "bench";
+    table.columns = {{"score", "INT"}, {"city", "TEXT"}};
+    table.data.resize(table.columns.size());
+    reserveRows(table, numRows);
+    std::mt19937_64 rng(7);
+    for (size_t i = 0; i < numRows; i++) {
+        appendRow(table, {std::to_string(rng() % 1000000), "city" + std::to_string(rng() % 50)},
+                  table.next_id++);
+    }
+
+    const char* conditions[] = {"score < 500000", "score BETWEEN 1000 AND 2000", "city = city7"};
+    unsigned hardware = std::max(8u, std::thread::hardware_concurrency());
+
+    std::cout << "rows: " << numRows << ", morsel: " << kMorselSlots << " slots\n";
+    std::cout << std::setw(30) << std::left << "condition" << std::setw(10) << "threads"
+              << std::setw(14) << "scan (ms)" << "matches\n";
+
+    for (const char* condition : conditions) {
+        Condition pred = compileCondition(table.columns, condition);
+        setThreadCount(1);
+        Bitmap expected = scanRows(table, pred);
+
+        for (unsigned threads = 1; threads <= hardware; threads *= 2) {
+            setThreadCount(threads);
+            Bitmap result;
+            double ms = timeMs([&] { result = scanRows(table, pred); });
+            if (result != expected) {
+                std::cout << "MISMATCH for '" << condition << "' at " << threads << " threads\n";
+                return 1;
+            }
+            std::cout << std::setw(30) << std::left << condition << std::setw(10) << threads
+                      << std::setw(14) << std::fixed << std::setprecision(2) << ms
+                      << countSelected(result) << "\n";
+        }
+    }
+    return 0;
+}
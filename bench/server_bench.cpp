@@ -0,0 +1,107 @@
+// Server load generator: QPS and p50/p99 latency at 1 to 64 connections.
+// Each client sends a mix of point SELECTs by row ID and INSERTs, one
+// statement at a time, waiting for each reply.
+//
+// Build and run with: make bench
+// Against a running server: bench/server_bench [address] [seconds per step]
+// (the server needs a table `bench (name TEXT, age INT)` or lets it be created)
+
+#include "bench_util.h"
+
+#include <random>
+
+// Send a statement and read its reply up to the terminating NUL byte
+static bool roundTrip(int fd, const std::string& statement, std::string& reply) {
+    std::string line = statement + "\n";
+    if (!sendAll(fd, line.data(), line.size())) return false;
+    reply.clear();
+    char buffer[4096];
+    while (true) {
+        ssize_t received = recv(fd, buffer, sizeof(buffer), 0);
+        if (received <= 0) return false;
+        reply.append(buffer, received);
+        if (reply.back() == '\0') return true;
+    }
+}
+
+static double percentile(std::vector<double>& sorted, double p) {
+    if (sorted.empty()) return 0;
+    return sorted[std::min(sorted.size() - 1, static_cast<size_t>(p * sorted.size()))];
+}
+
+int main(int argc, char** argv) {
+    std::string address = argc > 1 ? argv[1] : "";
+    double seconds = argc > 2 ? std::stod(argv[2]) : 0.5;
+    const int numRows = 100000;
+
+    // Without an address, serve an in-process database on a Unix socket
+    std::thread server;
+    if (address.empty()) {
+        address = "./server_bench.sock";
+        std::ostream quiet(nullptr);
+        handleCreate("CREATE TABLE bench (name TEXT, age INT)", quiet);
+        std::string insert = "INSERT INTO bench VALUES ";
+        for (int i = 0; i < numRows; i++) {
+            insert += (i ? ", (" : "(") + std::string("\"user") + std::to_string(i) + "\", " +
+                      std::to_string(i % 100) + ")";
+        }
+        handleInsert(insert, quiet);
+        int listenFd = openListener(address);
+        server = std::thread(runServer, listenFd);
+    }
+
+    std::cout << "address: " << address << ", " << seconds << " s per step, 90% SELECT / 10% INSERT\n";
+    std::cout << std::setw(14) << std::left << "connections" << std::setw(14) << "QPS"
+              << std::setw(14) << "p50 (us)" << "p99 (us)\n";
+
+    for (int connections = 1; connections <= 64; connections *= 2) {
+        std::vector<std::vector<double>> latencies(connections);
+        std::atomic<bool> failed(false);
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::duration<double>(seconds);
+
+        std::vector<std::thread> clients;
+        for (int c = 0; c < connections; c++) {
+            clients.emplace_back([&, c]() {
+                int fd = connectSocket(address);
+                if (fd < 0) {
+                    failed = true;
+                    return;
+                }
+                std::mt19937 rng(c);
+                std::string reply;
+                while (std::chrono::steady_clock::now() < deadline) {
+                    std::string statement = rng() % 10 == 0
+                        ? "INSERT INTO bench VALUES (\"client" + std::to_string(c) + "\", 42)"
+                        : "SELECT * FROM bench WHERE id = " + std::to_string(rng() % numRows + 1);
+                    auto start = std::chrono::steady_clock::now();
+                    if (!roundTrip(fd, statement, reply)) {
+                        failed = true;
+                        break;
+                    }
+                    latencies[c].push_back(std::chrono::duration<double, std::micro>(
+                        std::chrono::steady_clock::now() - start).count());
+                }
+                ::close(fd);
+            });
+        }
+        for (auto& client : clients) client.join();
+        if (failed) {
+            std::cout << "client failed at " << connections << " connection(s)\n";
+            return 1;
+        }
+
+        std::vector<double> all;
+        for (const auto& l : latencies) all.insert(all.end(), l.begin(), l.end());
+        std::sort(all.begin(), all.end());
+        std::cout << std::setw(14) << connections << std::fixed << std::setprecision(0)
+                  << std::setw(14) << all.size() / seconds << std::setprecision(1)
+                  << std::setw(14) << percentile(all, 0.5) << percentile(all, 0.99) << "\n";
+    }
+
+    if (server.joinable()) {
+        serverStopping = true;
+        server.join();
+        unlink(address.c_str());
+    }
+    return 0;
+}
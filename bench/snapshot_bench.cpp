@@ -0,0 +1,132 @@
+// SAVE/LOAD benchmark: the legacy per-value stream format against the
+// page-aligned snapshot format, which is written in large buffered chunks and
+// loaded by mapping the file and bulk-copying each column section.
+//
+// Build and run with: make bench
+
+#include "bench_util.h"
+
+#include <chrono>
+#include <cstdio>
+
+// The writer as it was before snapshots: several small writes per value, with
+// a size_t length prefix on every one
+static void legacySave(const TableMap& tables, const std::string& filename) {
+    std::ofstream file(filename, std::ios::binary);
+    size_t numTables = tables.size();
+    file.write(reinterpret_cast<const char*>(&numTables), sizeof(numTables));
+
+    for (const auto& tablePair : tables) {
+        const Table& table = tablePair.second;
+        size_t nameLength = table.name.length();
+        file.write(reinterpret_cast<const char*>(&nameLength), sizeof(nameLength));
+        file.write(table.name.c_str(), nameLength);
+        file.write(reinterpret_cast<const char*>(&table.next_id), sizeof(table.next_id));
+
+        size_t numColumns = table.columns.size();
+        file.write(reinterpret_cast<const char*>(&numColumns), sizeof(numColumns));
+        for (const auto& column : table.columns) {
+            for (const std::string* field : {&column.name, &column.type}) {
+                size_t length = field->length();
+                file.write(reinterpret_cast<const char*>(&length), sizeof(length));
+                file.write(field->c_str(), length);
+            }
+        }
+
+        size_t numRows = table.rowCount();
+        file.write(reinterpret_cast<const char*>(&numRows), sizeof(numRows));
+        for (size_t slot = 0; slot < numRows; slot++) {
+            file.write(reinterpret_cast<const char*>(&table.ids[slot]), sizeof(table.ids[slot]));
+            file.write(reinterpret_cast<const char*>(&numColumns), sizeof(numColumns));
+            for (size_t col = 0; col < numColumns; col++) {
+                std::string value = getValue(table, col, slot);
+                size_t valueLength = value.length();
+                file.write(reinterpret_cast<const char*>(&valueLength), sizeof(valueLength));
+                file.write(value.c_str(), valueLength);
+            }
+        }
+    }
+
+    size_t numIndexes = 0;
+    file.write(reinterpret_cast<const char*>(&numIndexes), sizeof(numIndexes));
+}
+
+static bool sameTables(const TableMap& a, const TableMap& b) {
+    if (a.size() != b.size()) return false;
+    for (const auto& tablePair : a) {
+        auto it = b.find(tablePair.first);
+        if (it == b.end()) return false;
+        const Table& x = tablePair.second;
+        const Table& y = it->second;
+        if (x.ids != y.ids || x.next_id != y.next_id || x.columns.size() != y.columns.size()) return false;
+        for (size_t col = 0; col < x.columns.size(); col++) {
+            for (size_t slot = 0; slot < x.rowCount(); slot++) {
+                if (getValue(x, col, slot) != getValue(y, col, slot)) return false;
+            }
+        }
+    }
+    return true;
+}
+
+int main(int argc, char** argv) {
+    size_t numRows = argc > 1 ? std::stoul(argv[1]) : 1000000;
+    const std::string legacyFile = "snapshot_bench_legacy.db";
+    const std::string snapshotFile = "snapshot_bench.db";
+
+    TableMap tables;
+    Table& table = tables["bench"];
+    table.name = "bench";
+    table.columns = {{"name", "TEXT"}, {"age", "INT"}, {"city", "TEXT"}, {"score", "INT"}};
+    table.data.resize(table.columns.size());
+    reserveRows(table, numRows);
+    for (size_t i = 0; i < numRows; i++) {
+        appendRow(table, {"user" + std::to_string(i), std::to_string(i % 100),
+                          "city" + std::to_string(i % 7), std::to_string(i * 7919 % 1000003)},
+                  table.next_id++);
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    legacySave(tables, legacyFile);
+    double legacySaveMs = elapsedMs(start);
+
+    start = std::chrono::steady_clock::now();
+    TableMap legacyLoaded;
+    {
+        std::ifstream file(legacyFile, std::ios::binary);
+        loadLegacy(file, legacyFile, legacyLoaded);
+    }
+    double legacyLoadMs = elapsedMs(start);
+
+    start = std::chrono::steady_clock::now();
+    saveSnapshot(tables, snapshotFile);
+    double snapshotSaveMs = elapsedMs(start);
+
+    start = std::chrono::steady_clock::now();
+    TableMap snapshotLoaded;
+    {
+        MappedFile file;
+        if (!file.open(snapshotFile)) {
+            std::cout << "could not open " << snapshotFile << "\n";
+            return 1;
+        }
+        loadSnapshot(file, snapshotLoaded);
+    }
+    double snapshotLoadMs = elapsedMs(start);
+
+    bool ok = sameTables(tables, legacyLoaded) && sameTables(tables, snapshotLoaded);
+    std::remove(legacyFile.c_str());
+    std::remove(snapshotFile.c_str());
+    if (!ok) {
+        std::cout << "MISMATCH after reload\n";
+        return 1;
+    }
+
+    std::cout << "rows: " << numRows << "\n";
+    std::cout << std::setw(12) << std::left << "format"
+              << std::setw(14) << "save (ms)" << "load (ms)\n";
+    std::cout << std::setw(12) << std::left << "legacy" << std::fixed << std::setprecision(2)
+              << std::setw(14) << legacySaveMs << legacyLoadMs << "\n";
+    std::cout << std::setw(12) << std::left << "snapshot"
+              << std::setw(14) << snapshotSaveMs << snapshotLoadMs << "\n";
+    return 0;
+}
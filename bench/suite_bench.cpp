@@ -0,0 +1,162 @@
+// Workload suite: bulk INSERT, point lookups through an index, a range
+// filter, a full scan, UPDATE and DELETE with WHERE, and SAVE and LOAD, run
+// through executeStatement at each table size. Every reply is checked, and
+// the timings are printed as one JSON document for tracking regressions.
+//
+// Build and run with: make bench (10K and 100K rows), or make bench-large for
+// 10K, 1M and 10M rows. Sizes can be given on the command line:
+// bench/suite_bench 10000 1000000
+
+#include "bench_util.h"
+
+#include <cstdio>
+
+// Counts the lines written through it and drops the bytes
+class LineCounter : public std::streambuf {
+public:
+    size_t lines = 0;
+
+protected:
+    int overflow(int c) override {
+        if (c == '\n') lines++;
+        return c;
+    }
+    std::streamsize xsputn(const char* s, std::streamsize n) override {
+        lines += std::count(s, s + n, '\n');
+        return n;
+    }
+};
+
+struct Result {
+    const char* workload;
+    size_t rows;
+    size_t ops;
+    double ms;
+};
+
+// Run the workloads on a table of `numRows` rows; false after reporting a
+// reply that was not the expected one
+static bool runSuite(size_t numRows, std::vector<Result>& results) {
+    const std::string name = "suite_" + std::to_string(numRows);
+    const std::string file = "suite_bench";
+    const size_t chunkRows = 10000;
+    const size_t span = std::max<size_t>(numRows / 100, 1);
+
+    // key is the row number; score is a permutation of the row numbers, since
+    // 7919 is prime and shares no factor with the sizes used here
+    std::ostream quiet(nullptr);
+    executeStatement("CREATE TABLE " + name + " (key INT, score INT, name TEXT)", quiet);
+    double insertMs = 0;
+    for (size_t first = 0; first < numRows; first += chunkRows) {
+        std::string insert = "INSERT INTO " + name + " VALUES ";
+        for (size_t i = first; i < std::min(numRows, first + chunkRows); i++) {
+            if (i > first) insert += ", ";
+            insert += "(" + std::to_string(i) + ", " + std::to_string((i * 7919) % numRows) + ", \"name" +
+                      std::to_string(i) + "\")";
+        }
+        auto start = std::chrono::steady_clock::now();
+        executeStatement(insert, quiet);
+        insertMs += elapsedMs(start);
+    }
+    results.push_back({"bulk_insert", numRows, numRows, insertMs});
+    if (database.find(name)->second.liveRows() != numRows) {
+        std::cout << "MISMATCH: bulk_insert left " << database.find(name)->second.liveRows() << " rows\n";
+        return false;
+    }
+
+    executeStatement("CREATE INDEX " + name + "_key ON " + name + "(key) USING BTREE", quiet);
+    size_t lookups = std::min<size_t>(numRows, 10000);
+    std::vector<std::string> statements;
+    for (size_t i = 0; i < lookups; i++) {
+        statements.push_back("SELECT name FROM " + name + " WHERE key = " + std::to_string((i * 104729) % numRows));
+    }
+    size_t found = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (const auto& statement : statements) found += run(statement).size() > sizeof("name\n");
+    results.push_back({"point_lookup", numRows, lookups, elapsedMs(start)});
+    if (found != lookups) {
+        std::cout << "MISMATCH: point_lookup found " << found << " of " << lookups << " keys\n";
+        return false;
+    }
+
+    const size_t ranges = 20;
+    std::string expected = "COUNT(*)\n" + std::to_string(span) + "\n";
+    bool same = true;
+    start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < ranges; i++) {
+        size_t lo = (i * numRows) / ranges;
+        same = same && run("SELECT COUNT(*) FROM " + name + " WHERE score BETWEEN " + std::to_string(lo) +
+                           " AND " + std::to_string(lo + span - 1)) == expected;
+    }
+    results.push_back({"range_filter", numRows, ranges, elapsedMs(start)});
+    if (!same) {
+        std::cout << "MISMATCH: range_filter counts\n";
+        return false;
+    }
+
+    LineCounter counter;
+    std::ostream scanOut(&counter);
+    start = std::chrono::steady_clock::now();
+    executeStatement("SELECT * FROM " + name, scanOut);
+    results.push_back({"full_scan", numRows, 1, elapsedMs(start)});
+    if (counter.lines != numRows + 1) {
+        std::cout << "MISMATCH: full_scan wrote " << counter.lines << " lines\n";
+        return false;
+    }
+
+    std::string reply;
+    start = std::chrono::steady_clock::now();
+    reply = run("UPDATE " + name + " SET name = \"updated\" WHERE key < " + std::to_string(span));
+    results.push_back({"update_where", numRows, 1, elapsedMs(start)});
+    if (reply != std::to_string(span) + " row(s) updated in '" + name + "'.\n") {
+        std::cout << "MISMATCH: update_where replied " << reply;
+        return false;
+    }
+
+    start = std::chrono::steady_clock::now();
+    reply = run("DELETE FROM " + name + " WHERE key >= " + std::to_string(numRows - span));
+    results.push_back({"delete_where", numRows, 1, elapsedMs(start)});
+    if (reply != std::to_string(span) + " row(s) deleted from '" + name + "'.\n") {
+        std::cout << "MISMATCH: delete_where replied " << reply;
+        return false;
+    }
+
+    start = std::chrono::steady_clock::now();
+    executeStatement("SAVE " + file, quiet);
+    results.push_back({"save", numRows, 1, elapsedMs(start)});
+    start = std::chrono::steady_clock::now();
+    executeStatement("LOAD " + file, quiet);
+    results.push_back({"load", numRows, 1, elapsedMs(start)});
+    std::remove((file + ".db").c_str());
+    auto it = database.find(name);
+    if (it == database.end() || it->second.liveRows() != numRows - span) {
+        std::cout << "MISMATCH: LOAD did not restore '" << name << "'\n";
+        return false;
+    }
+
+    database.erase(name);
+    return true;
+}
+
+int main(int argc, char** argv) {
+    std::vector<size_t> sizes;
+    for (int i = 1; i < argc; i++) sizes.push_back(std::stoul(argv[i]));
+    if (sizes.empty()) sizes = {10000, 100000};
+
+    std::ostream quiet(nullptr);
+    executeStatement(".mode csv", quiet);
+    std::vector<Result> results;
+    for (size_t numRows : sizes) {
+        if (!runSuite(numRows, results)) return 1;
+    }
+
+    std::cout << "{\"threads\": " << workerCount() << ", \"results\": [\n" << std::fixed;
+    for (size_t i = 0; i < results.size(); i++) {
+        const Result& r = results[i];
+        std::cout << "  {\"workload\": \"" << r.workload << "\", \"rows\": " << r.rows << ", \"ops\": " << r.ops
+                  << ", \"ms\": " << std::setprecision(3) << r.ms << ", \"us_per_op\": " << r.ms * 1000.0 / r.ops
+                  << "}" << (i + 1 < results.size() ? "," : "") << "\n";
+    }
+    std::cout << "]}\n";
+    return 0;
+}
@@ -0,0 +1,74 @@
+// ORDER BY / LIMIT benchmark: "top 50 by score" through the bounded heap
+// against a full sort of the selection, and LIMIT without ORDER BY through
+// the early-stopping scan against a full scan. Results are checked against
+// each other.
+//
+// Build and run with: make bench
+
+#include "bench_util.h"
+
+#include <random>
+
+int main(int argc, char** argv) {
+    size_t numRows = argc > 1 ? std::stoul(argv[1]) : 2000000;
+
+    Table table;
+    table.name = "bench";
+    table.columns = {{"score", "INT"}, {"city", "TEXT"}};
+    table.data.resize(table.columns.size());
+    reserveRows(table, numRows);
+    std::mt19937_64 rng(7);
+    for (size_t i = 0; i < numRows; i++) {
+        appendRow(table, {std::to_string(rng() % 1000000), "city" + std::to_string(rng() % 50)},
+                  table.next_id++);
+    }
+
+    std::cout << "rows: " << numRows << ", threads: " << workerCount() << "\n";
+    std::cout << std::setw(44) << std::left << "query" << std::setw(14) << "full (ms)"
+              << "limited (ms)\n";
+
+    const int sortColumns[] = {0, 1};
+    Selection all = selectRows(table, compileCondition(table.columns, ""));
+    for (int col : sortColumns) {
+        RowOrder full;
+        full.ordered = true;
+        full.colIndex = col;
+        full.descending = true;
+        RowOrder top = full;
+        top.limit = 50;
+
+        SlotList sorted, best;
+        double fullMs = timeMs([&] { sorted = orderRows(table, all, full); });
+        double topMs = timeMs([&] { best = orderRows(table, all, top); });
+        sorted.resize(top.limit);
+        if (best != sorted) {
+            std::cout << "MISMATCH for top 50 by " << table.columns[col].name << "\n";
+            return 1;
+        }
+        std::cout << std::setw(44) << std::left
+                  << ("ORDER BY " + table.columns[col].name + " DESC LIMIT 50") << std::setw(14)
+                  << std::fixed << std::setprecision(2) << fullMs << topMs << "\n";
+    }
+
+    const char* conditions[] = {"score < 500000", "city = city7", "score BETWEEN 1000 AND 1100"};
+    for (const char* condition : conditions) {
+        Condition pred = compileCondition(table.columns, condition);
+        Bitmap bitmap;
+        SlotList first;
+        double fullMs = timeMs([&] { bitmap = scanRows(table, pred); });
+        double limitMs = timeMs([&] { first = scanFirstRows(table, pred, 100); });
+
+        SlotList expected;
+        forEachSelected(bitmap, [&](size_t slot) {
+            if (expected.size() < 100) expected.push_back(slot);
+        });
+        if (first != expected) {
+            std::cout << "MISMATCH for '" << condition << "' LIMIT 100\n";
+            return 1;
+        }
+        std::cout << std::setw(44) << std::left << (std::string(condition) + " LIMIT 100")
+                  << std::setw(14) << std::fixed << std::setprecision(2) << fullMs << limitMs
+                  << "\n";
+    }
+    return 0;
+}
@@ -0,0 +1,234 @@
+// Transaction benchmark: transfers run as transactions, each reading two
+// account balances, moving half of one to the other and appending a ledger
+// row. They run alone, then alongside a session that keeps one snapshot
+// open and scans the accounts over and over, then alongside autocommit
+// scans. The snapshot's sums and counts must never change, and autocommit
+// scans must only ever see whole transfers. Transfers must go on committing
+// through one long scan in a snapshot, which reads a view of the accounts
+// rather than holding their lock. ORDER BY id must still follow the row IDs
+// while updated rows are in new slots, and once their versions are
+// collected the rows must be back in their old places.
+//
+// Build and run with: make bench
+
+#include "bench_util.h"
+
+#include <random>
+
+// Values of the first row of a CSV reply
+static std::vector<int64_t> firstRow(const std::string& reply) {
+    std::vector<int64_t> values;
+    size_t start = reply.find('\n') + 1;
+    std::istringstream row(reply.substr(start, reply.find('\n', start) - start));
+    std::string field;
+    while (std::getline(row, field, ',')) values.push_back(std::atoll(field.c_str()));
+    return values;
+}
+
+typedef std::chrono::steady_clock::time_point TimePoint;
+
+// Run `count` transfers, noting when each commits in `commits` if given;
+// false after reporting a failed statement
+static bool transfer(size_t numAccounts, size_t count, uint64_t seed, std::vector<TimePoint>* commits = nullptr) {
+    std::mt19937_64 rng(seed);
+    run(".mode csv");
+    for (size_t i = 0; i < count; i++) {
+        std::string from = std::to_string(rng() % numAccounts + 1);
+        std::string to = std::to_string(rng() % numAccounts + 1);
+        if (from == to) continue;
+        std::vector<std::string> replies;
+        replies.push_back(run("BEGIN"));
+        int64_t fromBalance = firstRow(run("SELECT balance FROM accounts WHERE id = " + from))[0];
+        int64_t toBalance = firstRow(run("SELECT balance FROM accounts WHERE id = " + to))[0];
+        int64_t amount = fromBalance / 2;
+        replies.push_back(run("UPDATE accounts SET balance = " + std::to_string(fromBalance - amount) +
+                              " WHERE id = " + from));
+        replies.push_back(run("UPDATE accounts SET balance = " + std::to_string(toBalance + amount) +
+                              " WHERE id = " + to));
+        replies.push_back(run("INSERT INTO ledger VALUES (" + from + ", " + to + ", " +
+                              std::to_string(amount) + ")"));
+        replies.push_back(run("COMMIT"));
+        if (commits) commits->push_back(std::chrono::steady_clock::now());
+        for (const auto& reply : replies) {
+            if (reply.compare(0, 6, "Error:") == 0) {
+                std::cout << "MISMATCH: transfer failed: " << reply;
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+// First values of every row of a CSV reply, joined by commas
+static std::string firstColumn(const std::string& reply) {
+    std::string values;
+    std::istringstream rows(reply.substr(reply.find('\n') + 1));
+    std::string row;
+    while (std::getline(rows, row)) {
+        if (row.find("row(s)") != std::string::npos) break;
+        values += (values.empty() ? "" : ",") + row.substr(0, row.find(','));
+    }
+    return values;
+}
+
+struct ScanResult {
+    size_t scans = 0;
+    double ms = 0;
+    bool same = true;
+};
+
+// Scan the accounts until `done` is set. A snapshot must see the same sum,
+// account count and ledger count every time; autocommit scans, the same sum.
+static ScanResult scanWhile(const std::atomic<bool>& done, bool snapshot, int64_t total) {
+    ScanResult result;
+    run(".mode csv");
+    if (snapshot) run("BEGIN");
+    std::vector<int64_t> first;
+    while (!done) {
+        auto start = std::chrono::steady_clock::now();
+        std::vector<int64_t> seen = firstRow(run("SELECT SUM(balance), COUNT(*) FROM accounts"));
+        seen.push_back(firstRow(run("SELECT COUNT(*) FROM ledger"))[0]);
+        result.ms += elapsedMs(start);
+        result.scans++;
+        if (first.empty()) first = seen;
+        result.same = result.same && seen[0] == total && (!snapshot || seen == first);
+    }
+    if (snapshot) run("COMMIT");
+    return result;
+}
+
+int main(int argc, char** argv) {
+    size_t numAccounts = argc > 1 ? std::stoul(argv[1]) : 1000000;
+    size_t numTransfers = argc > 2 ? std::stoul(argv[2]) : 20000;
+    const int64_t balance = 1000;
+    const int64_t total = balance * static_cast<int64_t>(numAccounts);
+
+    std::ostream quiet(nullptr);
+    executeStatement("CREATE TABLE accounts (owner INT, balance INT)", quiet);
+    executeStatement("CREATE TABLE ledger (source INT, target INT, amount INT)", quiet);
+    for (size_t first = 0; first < numAccounts; first += 10000) {
+        std::string insert = "INSERT INTO accounts VALUES ";
+        for (size_t i = first; i < std::min(numAccounts, first + 10000); i++) {
+            if (i > first) insert += ", ";
+            insert += "(" + std::to_string(i) + ", " + std::to_string(balance) + ")";
+        }
+        executeStatement(insert, quiet);
+    }
+
+    std::cout << "accounts: " << numAccounts << ", transfers per run: " << numTransfers
+              << ", threads: " << workerCount() << "\n";
+    std::cout << std::setw(36) << std::left << "run" << std::setw(18) << "transfers/s" << std::setw(10)
+              << "scans" << "ms per scan\n";
+
+    const char* names[] = {"transfers alone", "with a snapshot scanning", "with autocommit scans"};
+    double aloneRate = 0;
+    for (int mode = 0; mode < 3; mode++) {
+        std::atomic<bool> done(false);
+        ScanResult scans;
+        std::thread scanner;
+        if (mode > 0) scanner = std::thread([&] { scans = scanWhile(done, mode == 1, total); });
+
+        auto start = std::chrono::steady_clock::now();
+        bool ok = transfer(numAccounts, numTransfers, 7 + mode);
+        double ms = elapsedMs(start);
+        done = true;
+        if (scanner.joinable()) scanner.join();
+        if (!ok) return 1;
+        if (!scans.same) {
+            std::cout << "MISMATCH: " << names[mode] << " saw a partial or changed state\n";
+            return 1;
+        }
+        if (mode == 0) aloneRate = numTransfers * 1000.0 / ms;
+        std::cout << std::setw(36) << std::left << names[mode] << std::setw(18) << std::fixed
+                  << std::setprecision(0) << numTransfers * 1000.0 / ms << std::setw(10) << scans.scans
+                  << std::setprecision(2) << (scans.scans ? scans.ms / scans.scans : 0.0) << "\n";
+    }
+
+    // One long scan in a snapshot, while transfers run. Leaving out its
+    // first and last few ms, when the scheduler may not have let it start
+    // or finish, transfers must commit during it at a good part of their
+    // rate alone: one core shared with the scan gives them about half. A
+    // scan too short to tell is not checked.
+    {
+        std::atomic<bool> done(false);
+        TimePoint scanStart, scanEnd;
+        std::thread scanner([&] {
+            run(".mode csv");
+            run("BEGIN");
+            scanStart = std::chrono::steady_clock::now();
+            run("SELECT owner, SUM(balance) FROM accounts GROUP BY owner");
+            scanEnd = std::chrono::steady_clock::now();
+            run("COMMIT");
+            done = true;
+        });
+        std::vector<TimePoint> commits;
+        bool ok = true;
+        for (uint64_t seed = 100; ok && !done; seed++) ok = transfer(numAccounts, 100, seed, &commits);
+        scanner.join();
+        if (!ok) return 1;
+
+        const auto margin = std::chrono::milliseconds(20);
+        double middleMs = std::chrono::duration<double, std::milli>(scanEnd - scanStart - 2 * margin).count();
+        size_t during = 0;
+        for (TimePoint commit : commits) during += commit > scanStart + margin && commit < scanEnd - margin;
+        double rate = during * 1000.0 / middleMs;
+        std::cout << std::setw(36) << std::left << "during one long snapshot scan" << std::setw(18)
+                  << std::setprecision(0) << rate << std::setw(10) << 1 << std::setprecision(2)
+                  << middleMs + 2 * margin.count() << "\n";
+        if (middleMs >= 50 && rate * 4 < aloneRate) {
+            std::cout << "MISMATCH: transfers committed at " << rate << "/s during a snapshot scan, "
+                      << aloneRate << "/s alone\n";
+            return 1;
+        }
+    }
+
+    // Once the snapshot is gone its versions are collected
+    run(".mode csv");
+    std::vector<int64_t> last = firstRow(run("SELECT SUM(balance), COUNT(*) FROM accounts"));
+    if (last[0] != total || last[1] != static_cast<int64_t>(numAccounts) ||
+        !database.find("accounts")->second.versions.empty()) {
+        std::cout << "MISMATCH: accounts left with sum " << last[0] << ", " << last[1] << " row(s), "
+                  << database.find("accounts")->second.versions.size() << " version(s)\n";
+        return 1;
+    }
+
+    // Rows 1 and 2 get new versions at the end of the table, which stay
+    // there while a snapshot from before the update is open
+    std::atomic<int> step(0);
+    std::thread holder([&] {
+        run("BEGIN");
+        step = 1;
+        while (step != 2) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        run("COMMIT");
+    });
+    while (step != 1) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    run("BEGIN");
+    run("UPDATE accounts SET balance = 0 WHERE id <= 2");
+    run("COMMIT");
+    std::string n = std::to_string(numAccounts);
+    const std::pair<std::string, std::string> orders[] = {
+        {"SELECT id FROM accounts WHERE id <= 3 ORDER BY id", "1,2,3"},
+        {"SELECT id FROM accounts WHERE id <= 3 ORDER BY id DESC", "3,2,1"},
+        {"SELECT id FROM accounts ORDER BY id LIMIT 3", "1,2,3"},
+        {"SELECT id FROM accounts ORDER BY id DESC LIMIT 2", n + "," + std::to_string(numAccounts - 1)},
+        {"SELECT id FROM accounts WHERE id <= 3", "3,1,2"},
+    };
+    for (const auto& order : orders) {
+        std::string ids = firstColumn(run(order.first));
+        if (ids != order.second) {
+            std::cout << "MISMATCH: '" << order.first << "' returned IDs " << ids << ", not " << order.second
+                      << "\n";
+            return 1;
+        }
+    }
+
+    // Closing the snapshot moves them back, where replaying the log puts them
+    step = 2;
+    holder.join();
+    std::string ids = firstColumn(run("SELECT id FROM accounts WHERE id <= 3"));
+    if (ids != "1,2,3") {
+        std::cout << "MISMATCH: rows updated in a transaction were left in the order " << ids << "\n";
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,68 @@
+// Write-ahead log benchmark: INSERT statements per second through the log
+// under each sync policy, each statement appending its record and waiting
+// until it is durable. STATEMENT pays one sync per record. GROUP runs
+// several sessions, whose records share a sync when they are appended
+// while another runs. DELAYED and OFF acknowledge before the sync.
+//
+// Build and run with: make bench
+
+#include "bench_util.h"
+
+int main(int argc, char** argv) {
+    size_t numStatements = argc > 1 ? std::stoul(argv[1]) : 2000;
+    const std::string logFile = "wal_bench.wal";
+
+    struct Run {
+        const char* name;
+        SyncPolicy policy;
+        size_t sessions;
+        size_t statements;
+    } runs[] = {
+        {"statement", SyncPolicy::STATEMENT, 1, numStatements},
+        {"group", SyncPolicy::GROUP, 1, numStatements},
+        {"group", SyncPolicy::GROUP, 16, numStatements * 4},
+        {"delayed", SyncPolicy::DELAYED, 1, numStatements * 50},
+        {"off", SyncPolicy::OFF, 1, numStatements * 50},
+    };
+
+    std::cout << std::setw(12) << std::left << "sync" << std::setw(12) << "sessions" << std::setw(14)
+              << "statements" << std::setw(14) << "time (ms)" << "statements/s\n";
+
+    for (const Run& run : runs) {
+        std::remove(logFile.c_str());
+        WriteAheadLog log;
+        log.open(logFile, 0, run.policy, 10);
+
+        auto start = std::chrono::steady_clock::now();
+        std::vector<std::thread> sessions;
+        for (size_t s = 0; s < run.sessions; s++) {
+            sessions.emplace_back([&, s] {
+                for (size_t i = s; i < run.statements; i += run.sessions) {
+                    log.append("INSERT INTO bench VALUES (\"user" + std::to_string(i) + "\", " +
+                               std::to_string(i % 100) + ")");
+                    log.awaitAppended();
+                }
+            });
+        }
+        for (auto& session : sessions) session.join();
+        log.close();
+        double ms = elapsedMs(start);
+
+        // Every record must come back on reopen
+        size_t replayed = log.open(logFile, 0, SyncPolicy::OFF, 10).size();
+        log.close();
+        if (replayed != run.statements) {
+            std::cout << "MISMATCH for " << run.name << ": " << replayed << " of "
+                      << run.statements << " records\n";
+            return 1;
+        }
+
+        std::cout << std::setw(12) << std::left << run.name << std::setw(12) << run.sessions
+                  << std::setw(14) << run.statements
+                  << std::setw(14) << std::fixed << std::setprecision(2) << ms
+                  << std::setprecision(0) << run.statements / (ms / 1000) << "\n";
+    }
+
+    std::remove(logFile.c_str());
+    return 0;
+}
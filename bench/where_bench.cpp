@@ -0,0 +1,115 @@
+// WHERE predicate microbenchmark: per-row regex evaluation (the old
+// evaluateCondition) against the per-statement compiled Condition.
+//
+// Build and run with: make bench
+
+#include "bench_util.h"
+
+#include <chrono>
+
+struct LegacyRow {
+    std::vector<std::string> values;
+};
+
+// The evaluator as it was before predicates were compiled: a regex is built,
+// the column looked up by name and both sides parsed for every row.
+static bool legacyEvaluateCondition(const LegacyRow& row, const std::vector<Column>& columns,
+                                    const std::string& condition) {
+    if (condition.empty()) return true;
+
+    std::regex conditionRegex("(\\w+)\\s*([=<>!]+)\\s*([^\\s]+)");
+    std::smatch matches;
+
+    if (std::regex_search(condition, matches, conditionRegex) && matches.size() >= 4) {
+        std::string colName = matches[1].str();
+        std::string op = matches[2].str();
+        std::string value = matches[3].str();
+
+        if (value.front() == '"' && value.back() == '"') {
+            value = value.substr(1, value.length() - 2);
+        }
+
+        int colIndex = -1;
+        for (size_t i = 0; i < columns.size(); i++) {
+            if (columns[i].name == colName) {
+                colIndex = i;
+                break;
+            }
+        }
+
+        if (colIndex == -1) return false;
+
+        std::string rowValue = row.values[colIndex];
+
+        if (op == "=") {
+            return rowValue == value;
+        } else if (op == "!=") {
+            return rowValue != value;
+        } else if (op == ">") {
+            return isNumber(rowValue) && isNumber(value) && std::stoi(rowValue) > std::stoi(value);
+        } else if (op == "<") {
+            return isNumber(rowValue) && isNumber(value) && std::stoi(rowValue) < std::stoi(value);
+        } else if (op == ">=") {
+            return isNumber(rowValue) && isNumber(value) && std::stoi(rowValue) >= std::stoi(value);
+        } else if (op == "<=") {
+            return isNumber(rowValue) && isNumber(value) && std::stoi(rowValue) <= std::stoi(value);
+        }
+    }
+
+    return false;
+}
+
+int main(int argc, char** argv) {
+    size_t numRows = argc > 1 ? std::stoul(argv[1]) : 20000;
+
+    Table table;
+    table.name = "bench";
+    table.columns = {{"name", "TEXT"}, {"age", "INT"}, {"city", "TEXT"}};
+    table.data.resize(table.columns.size());
+    reserveRows(table, numRows);
+
+    // The legacy evaluator runs over string rows, as the table used to store them
+    std::vector<LegacyRow> legacyRows(numRows);
+    for (size_t i = 0; i < numRows; i++) {
+        legacyRows[i].values = {"user" + std::to_string(i), std::to_string(i % 100), "city" + std::to_string(i % 7)};
+        appendRow(table, legacyRows[i].values, table.next_id++);
+    }
+
+    const char* conditions[] = {"age > 50", "age <= 10", "city = \"city3\"", "name != user42"};
+
+    std::cout << "rows: " << numRows << "\n";
+    std::cout << std::setw(20) << std::left << "condition"
+              << std::setw(14) << "regex (ms)" << std::setw(14) << "compiled (ms)"
+              << std::setw(10) << "speedup" << "matches\n";
+
+    for (const char* condition : conditions) {
+        auto start = std::chrono::steady_clock::now();
+        size_t legacyMatches = 0;
+        for (const auto& row : legacyRows) {
+            if (legacyEvaluateCondition(row, table.columns, condition)) legacyMatches++;
+        }
+        double legacyMs = elapsedMs(start);
+
+        start = std::chrono::steady_clock::now();
+        size_t compiledMatches = 0;
+        Condition pred = compileCondition(table.columns, condition);
+        for (size_t slot = 0; slot < table.rowCount(); slot++) {
+            if (evaluateCondition(table, slot, pred)) compiledMatches++;
+        }
+        double compiledMs = elapsedMs(start);
+
+        if (legacyMatches != compiledMatches) {
+            std::cout << "MISMATCH for '" << condition << "': " << legacyMatches
+                      << " vs " << compiledMatches << "\n";
+            return 1;
+        }
+
+        std::cout << std::setw(20) << std::left << condition
+                  << std::setw(14) << std::fixed << std::setprecision(2) << legacyMs
+                  << std::setw(14) << compiledMs
+                  << std::setw(10) << std::setprecision(1) << legacyMs / compiledMs
+                  << compiledMatches << "\n";
+    }
+
+    return 0;
+}
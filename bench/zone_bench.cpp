@@ -0,0 +1,64 @@
+// Zone map benchmark: an append-mostly table whose `ts` column ascends with
+// a little jitter, as timestamps of rows appended over time do. Filters on
+// recent ranges of `ts` are timed with the zone bounds in place and with
+// them cleared, which makes every morsel undecided. Match counts are checked
+// against each other.
+//
+// Build and run with: make bench
+
+#include "bench_util.h"
+
+#include <random>
+
+int main(int argc, char** argv) {
+    size_t numRows = argc > 1 ? std::stoul(argv[1]) : 4000000;
+
+    Table tables[2];
+    for (int t = 0; t < 2; t++) {
+        Table& table = tables[t];
+        table.name = t == 0 ? "zoned" : "unzoned";
+        table.columns = {{"ts", "INT"}, {"value", "INT"}};
+        table.data.resize(table.columns.size());
+        reserveRows(table, numRows);
+        std::mt19937_64 rng(13);
+        for (size_t i = 0; i < numRows; i++) {
+            appendRow(table, {std::to_string(i * 10 + rng() % 50), std::to_string(rng() % 1000)},
+                      table.next_id++);
+        }
+    }
+    for (auto& column : tables[1].data) {
+        column.zoneMin.clear();
+        column.zoneMax.clear();
+    }
+
+    // Bounds near the end of the table, so most zones hold only older rows
+    int64_t last = static_cast<int64_t>(numRows) * 10;
+    std::vector<std::string> conditions = {
+        "ts > " + std::to_string(last - last / 100),
+        "ts BETWEEN " + std::to_string(last / 2) + " AND " + std::to_string(last / 2 + last / 1000),
+        "ts >= " + std::to_string(last - last / 20) + " AND value < 100",
+        "ts < 1000 OR ts > " + std::to_string(last - 1000),
+        "value < 100",
+    };
+
+    std::cout << "rows: " << numRows << ", morsels: " << morselCount(numRows)
+              << ", threads: " << workerCount() << "\n";
+    std::cout << std::setw(48) << std::left << "condition" << std::setw(14) << "skipped" << std::setw(14)
+              << "zoned (ms)" << std::setw(14) << "unzoned (ms)" << "matches\n";
+    for (const auto& condition : conditions) {
+        Condition cond = compileCondition(tables[0].columns, condition);
+        size_t slots;
+        size_t skipped = skippedMorsels(tables[0], cond, numRows, slots);
+        Bitmap zoned, unzoned;
+        double zonedMs = timeMs([&] { zoned = scanRows(tables[0], cond); });
+        double unzonedMs = timeMs([&] { unzoned = scanRows(tables[1], cond); });
+        if (zoned != unzoned) {
+            std::cout << "MISMATCH for '" << condition << "'\n";
+            return 1;
+        }
+        std::cout << std::setw(48) << std::left << condition << std::setw(14) << skipped << std::setw(14)
+                  << std::fixed << std::setprecision(2) << zonedMs << std::setw(14) << unzonedMs
+                  << countSelected(zoned) << "\n";
+    }
+    return 0;
+}